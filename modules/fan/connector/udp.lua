@@ -65,12 +65,17 @@ local function connect(host, port, path)
                 return
             end
 
-            local package = weak_apt._output_chain:pop()
-            if package then
-                local apt = package.apt
-                apt.output_chain_count = apt.output_chain_count - 1
-                apt:_send_package(package)
-            end
+            reliable_udp.send_batch(
+                weak_apt.conn,
+                function()
+                    local package = weak_apt._output_chain:pop()
+                    if package then
+                        local apt = package.apt
+                        apt.output_chain_count = apt.output_chain_count - 1
+                    end
+                    return package
+                end
+            )
         end
     }
 
@@ -163,25 +168,28 @@ local function bind(host, port, path)
                 end
             end
 
-            while true do
-                local package = obj._main_output_chain:pop()
-                if package then
-                    local apt = package.apt
-                    if not apt._suspended then
-                        apt.output_chain_count = apt.output_chain_count - 1
-
-                        apt:_send_package(package)
-                        break
-                    else
-                        if config.debug then
-                            print("archive package with disconnected client.")
+            reliable_udp.send_batch(
+                obj.serv,
+                function()
+                    while true do
+                        local package = obj._main_output_chain:pop()
+                        if package then
+                            local apt = package.apt
+                            if not apt._suspended then
+                                apt.output_chain_count = apt.output_chain_count - 1
+                                return package
+                            else
+                                if config.debug then
+                                    print("archive package with disconnected client.")
+                                end
+                                table.insert(apt._suspend_list, package)
+                            end
+                        else
+                            return nil
                         end
-                        table.insert(apt._suspend_list, package)
                     end
-                else
-                    break
                 end
-            end
+            )
         end,
         onread = function(conn, buf, from)
             local obj = weak_obj
@@ -3,6 +3,8 @@ local connector = require "fan.connector"
 local http = require "fan.http"
 local zlib = require "zlib"
 local config = require "config"
+local has_lfs, lfs = pcall(require, "lfs")
+local has_radix, radix = pcall(require, "fan.httpd.router")
 
 -- Router System
 local Router = {}
@@ -12,12 +14,20 @@ function Router.new()
     return setmetatable({
         routes = {},
         middlewares = {},
-        not_found_handler = nil
+        not_found_handler = nil,
+        tree = has_radix and radix.new() or nil
     }, Router)
 end
 
 function Router:add_route(method, path, handler)
     method = string.upper(method)
+
+    -- Routes go to the C segment trie; only shapes it cannot hold (a
+    -- parameter inside a segment, e.g. "/f/:name.json") stay Lua patterns.
+    if self.tree and self.tree:add(method, path, handler) ~= nil then
+        return
+    end
+
     if not self.routes[method] then
         self.routes[method] = {}
     end
@@ -51,6 +61,13 @@ function Router:use(middleware)
 end
 
 function Router:match(method, path)
+    if self.tree then
+        local handler, params = self.tree:match(method, path)
+        if handler then
+            return handler, params
+        end
+    end
+
     local routes = self.routes[string.upper(method)]
     if not routes then return nil, nil end
 
@@ -377,6 +394,188 @@ function context_mt:reply(code, message, body)
     self.apt:send(table.concat(t))
 end
 
+-- Static file replies
+local FILE_SEND_SLICE = 64 * 1024
+
+local FILE_STATUS_MESSAGES = {
+    [200] = "OK",
+    [206] = "Partial Content",
+    [304] = "Not Modified",
+    [416] = "Range Not Satisfiable"
+}
+
+local FILE_CONTENT_TYPES = {
+    html = "text/html; charset=utf-8",
+    htm = "text/html; charset=utf-8",
+    css = "text/css; charset=utf-8",
+    js = "application/javascript; charset=utf-8",
+    mjs = "application/javascript; charset=utf-8",
+    json = "application/json",
+    txt = "text/plain; charset=utf-8",
+    xml = "application/xml",
+    svg = "image/svg+xml",
+    png = "image/png",
+    jpg = "image/jpeg",
+    jpeg = "image/jpeg",
+    gif = "image/gif",
+    webp = "image/webp",
+    ico = "image/x-icon",
+    wasm = "application/wasm",
+    pdf = "application/pdf",
+    mp4 = "video/mp4",
+    woff = "font/woff",
+    woff2 = "font/woff2"
+}
+
+local HTTP_MONTHS = {
+    Jan = 1, Feb = 2, Mar = 3, Apr = 4, May = 5, Jun = 6,
+    Jul = 7, Aug = 8, Sep = 9, Oct = 10, Nov = 11, Dec = 12
+}
+
+local function http_date(t)
+    return os.date("!%a, %d %b %Y %H:%M:%S GMT", t)
+end
+
+-- IMF-fixdate to epoch seconds (UTC, without going through local time).
+local function parse_http_date(value)
+    local d, mon, y, h, mi, sec = value:match("^%a+, (%d%d) (%a%a%a) (%d%d%d%d) (%d%d):(%d%d):(%d%d) GMT$")
+    local m = HTTP_MONTHS[mon or ""]
+    if not m then
+        return nil
+    end
+    y = tonumber(y)
+    if m <= 2 then
+        y = y - 1
+    end
+    local floor = math.floor
+    local era = floor(y / 400)
+    local yoe = y - era * 400
+    local mp = (m + 9) % 12
+    local doy = floor((153 * mp + 2) / 5) + tonumber(d) - 1
+    local doe = yoe * 365 + floor(yoe / 4) - floor(yoe / 100) + doy
+    local days = era * 146097 + doe - 719468
+    return days * 86400 + tonumber(h) * 3600 + tonumber(mi) * 60 + tonumber(sec)
+end
+
+-- Single "bytes=" range against `size`: first, last (inclusive) when
+-- satisfiable, false when not, nil to ignore the header.
+local function parse_range(value, size)
+    local a, b = value:match("^bytes=%s*(%d*)%-(%d*)%s*$")
+    if not a or (a == "" and b == "") then
+        return nil
+    end
+    if a == "" then
+        local n = tonumber(b)
+        if n == 0 or size == 0 then
+            return false
+        end
+        return math.max(size - n, 0), size - 1
+    end
+    a = tonumber(a)
+    local last = b ~= "" and tonumber(b)
+    if last and last < a then
+        return nil
+    end
+    if a >= size then
+        return false
+    end
+    return a, math.min(last or size - 1, size - 1)
+end
+
+function context_mt:reply_file(code, path, opts)
+    -- Same contract as the core httpd: replying twice is a caller bug.
+    if self.apt.disconnected then
+        error("connection closed by peer")
+    elseif self.reply_status == ResponseState.STARTED then
+        error("reply has started already.")
+    elseif self.reply_status then
+        error("reply has completed already.")
+    end
+
+    -- Without lfs there is no mtime: no Last-Modified / If-Modified-Since.
+    local attr = has_lfs and lfs.attributes(path)
+    if has_lfs and not attr then
+        return nil, "No such file or directory"
+    elseif attr and attr.mode ~= "file" then
+        return nil, "not a regular file"
+    end
+    local f, err = io.open(path, "rb")
+    if not f then
+        return nil, err
+    end
+    local size = attr and attr.size or f:seek("end")
+    if not size then
+        f:close()
+        return nil, "not a regular file"
+    end
+
+    code = code or 200
+    opts = opts or {}
+    local status, first, length = code, 0, size
+
+    if code == 200 and (self.method == "GET" or self.method == "HEAD") then
+        local since = self.headers["if-modified-since"]
+        local since_time = type(since) == "string" and parse_http_date(since)
+        local range = opts.range
+        if range == nil then
+            range = self.headers["range"]
+        end
+
+        if since_time and attr and attr.modification <= since_time then
+            status, length = 304, 0
+        elseif type(range) == "string" then
+            local a, b = parse_range(range, size)
+            if a then
+                status, first, length = 206, a, b - a + 1
+                self:addheader("Content-Range", string.format("bytes %d-%d/%d", a, b, size))
+            elseif a == false then
+                status, length = 416, 0
+                self:addheader("Content-Range", string.format("bytes */%d", size))
+            end
+        end
+    end
+
+    self:transition_state(ResponseState.COMPLETED)
+    self:_ready_for_reply()
+    self._no_gzip = true
+
+    if attr then
+        self:addheader("Last-Modified", http_date(attr.modification))
+    end
+    self:addheader("Accept-Ranges", "bytes")
+    if status ~= 304 and status ~= 416 and not self._content_type_set then
+        local ext = path:match("%.([%w]+)$")
+        self:addheader("Content-Type", opts.content_type or
+            (ext and FILE_CONTENT_TYPES[ext:lower()]) or "application/octet-stream")
+    end
+
+    local t = {}
+    context_reply_fillheader(t, self, status, FILE_STATUS_MESSAGES[status] or "OK")
+    -- 304 has no body to delimit; 416 keeps Content-Length: 0 like evhttp.
+    if status ~= 304 and not self._content_length_set then
+        table.insert(t, string.format("Content-Length: %d\r\n", length))
+    end
+    table.insert(t, "\r\n")
+    self.apt:send(table.concat(t))
+
+    -- Read in slices rather than with one f:read("*a").
+    if self.method ~= "HEAD" and length > 0 then
+        f:seek("set", first)
+        local remaining = length
+        while remaining > 0 do
+            local data = f:read(math.min(FILE_SEND_SLICE, remaining))
+            if not data then
+                break
+            end
+            self.apt:send(data)
+            remaining = remaining - #data
+        end
+    end
+    f:close()
+
+    return status
+end
+
 function context_mt:addheader(k, v)
     local lk = k:lower()
     if lk == "content-type" then
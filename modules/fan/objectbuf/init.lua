@@ -28,6 +28,7 @@ end
 return {
     encode = encode,
     decode = decode,
+    schema = core.schema,
     sample = function(obj, optional_result_count)
         local count_map = {}
         local count_list = {}
@@ -25,6 +25,7 @@ local WAITING_COUNT = config.udp_waiting_count or 10
 local NONE_PAIRED_WAITING_COUNT = config.udp_none_paired_waiting_count or 1
 
 local UDP_WINDOW_SIZE = config.udp_window_size or 10
+local SEND_BATCH_SIZE = config.udp_send_batch_size or 32
 
 local session_cache = config.session_cache or {}
 
@@ -139,25 +140,29 @@ function apt_mt:send_package(package, package_parts_map)
     end
 end
 
-function apt_mt:_send_package(package)
+function apt_mt:_package_buf(package)
     if package.ack then
-        self:_send(package.head, "ack")
-    else
-        if self._output_package_parts_map[package.head] then
-            if not self._output_wait_ack[package.head] then
-                self._output_wait_count = self._output_wait_count + 1
-            end
-            self._output_wait_ack[package.head] = gettime()
-            if package.body then
-                self:_send(package.head .. package.body, "data")
-            else
-                local body = string.sub(package.buf, package.body_begin, package.body_end)
-                self:_send(package.head .. body, "data")
-            end
+        return package.head, "ack"
+    elseif self._output_package_parts_map[package.head] then
+        if not self._output_wait_ack[package.head] then
+            self._output_wait_count = self._output_wait_count + 1
+        end
+        self._output_wait_ack[package.head] = gettime()
+        if package.body then
+            return package.head .. package.body, "data"
+        else
+            return package.head .. string.sub(package.buf, package.body_begin, package.body_end), "data"
         end
     end
 end
 
+function apt_mt:_send_package(package)
+    local buf, kind = self:_package_buf(package)
+    if buf then
+        self:_send(buf, kind)
+    end
+end
+
 function apt_mt:send(buf)
     if not self.conn then
         return nil
@@ -452,7 +457,7 @@ function apt_mt:_onread(buf)
     end
 end
 
-function apt_mt:_send(buf, kind)
+function apt_mt:_sent(buf, kind)
     if config.debug then
         local output_index, count, package_index = string.unpack("<I4I2I2", buf)
         if output_index == WINDOW_CTRL then
@@ -463,18 +468,33 @@ function apt_mt:_send(buf, kind)
         end
     end
 
-    local result = self.conn:send(buf, self.dest)
-    if result < 0 then
-        self.conn:rebind()
-    end
-
     self.last_outgoing_time = gettime()
 
     self.outgoing_bytes_total = self.outgoing_bytes_total + #(buf)
 
     config.udp_send_total = config.udp_send_total + 1
     self.udp_send_total = self.udp_send_total + 1
+end
 
+-- put back a package taken by _package_buf that the socket did not accept,
+-- so it goes out first on the next onsendready instead of waiting for the
+-- retransmit timeout.
+function apt_mt:_requeue(package)
+    if not package.ack and self._output_wait_ack[package.head] then
+        self._output_wait_count = self._output_wait_count - 1
+        self._output_wait_ack[package.head] = nil
+    end
+    self._output_chain:inserthead(package)
+    self.output_chain_count = self.output_chain_count + 1
+end
+
+function apt_mt:_send(buf, kind)
+    local result = self.conn:send(buf, self.dest)
+    if result < 0 then
+        self.conn:rebind()
+    end
+
+    self:_sent(buf, kind)
     self:send_req()
 end
 
@@ -605,6 +625,58 @@ local function init_conn(t)
     setmetatable(t, apt_mt)
 end
 
+-- Drain up to SEND_BATCH_SIZE packages from `pop` into a single
+-- conn:send_batch call. `pop` returns the next package, or nil when
+-- nothing more may be sent right now.
+local function send_batch(conn, pop)
+    local bufs, dests, apts, kinds, packages = {}, {}, {}, {}, {}
+
+    while #bufs < SEND_BATCH_SIZE do
+        local package = pop()
+        if not package then
+            break
+        end
+
+        local apt = package.apt
+        local buf, kind = apt:_package_buf(package)
+        if buf then
+            local n = #bufs + 1
+            bufs[n] = buf
+            dests[n] = apt.dest
+            apts[n] = apt
+            kinds[n] = kind
+            packages[n] = package
+        end
+    end
+
+    if #bufs == 0 then
+        return 0
+    end
+
+    local sent, err, errno = conn:send_batch(bufs, dests)
+    if sent then
+        -- the socket buffer filled up: the rest go out first next time.
+        for i = #bufs, sent + 1, -1 do
+            apts[i]:_requeue(packages[i])
+        end
+    else
+        -- nothing went out. data packages are left to the retransmit
+        -- timeout rather than retried at once against a failing socket.
+        print("send_batch", err)
+        if errno then
+            conn:rebind()
+        end
+        sent = 0
+    end
+
+    for i = 1, sent do
+        apts[i]:_sent(bufs[i], kinds[i])
+    end
+    apts[#apts]:send_req()
+
+    return sent
+end
+
 local function new_chain()
     local chain = {_head = nil, _tail = nil, size = 0}
     setmetatable(chain, chain_mt)
@@ -616,6 +688,7 @@ return {
     apt_mt = apt_mt,
     chain_mt = chain_mt,
     new_chain = new_chain,
+    send_batch = send_batch,
     session_cache = session_cache,
     MTU = MTU,
     HEAD_SIZE = HEAD_SIZE,
@@ -625,6 +698,7 @@ return {
     WAITING_COUNT = WAITING_COUNT,
     NONE_PAIRED_WAITING_COUNT = NONE_PAIRED_WAITING_COUNT,
     UDP_WINDOW_SIZE = UDP_WINDOW_SIZE,
+    SEND_BATCH_SIZE = SEND_BATCH_SIZE,
     CHECK_TIMEOUT_DURATION = CHECK_TIMEOUT_DURATION,
     MAX_OUTPUT_INDEX = MAX_OUTPUT_INDEX,
     WINDOW_CTRL = WINDOW_CTRL,
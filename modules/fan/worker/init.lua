@@ -4,6 +4,14 @@ local config = require "config"
 local objectbuf = config.worker_using_cjson and require "cjson" or require "fan.objectbuf"
 local connector = require "fan.connector"
 local stream = require "fan.stream"
+local shmring = require "fan.shmring"
+local loadbalance_mt = require "fan.worker.loadbalance"
+
+-- bytes per direction per slave for the shared-memory transport.
+local RING_SIZE = config.worker_ring_size or 4 * 1024 * 1024
+
+-- upper bound on calls per message when map is not given a batch_size.
+local DEFAULT_BATCH_SIZE = 64
 
 local function maxn(t)
   local n = 0
@@ -16,98 +24,252 @@ local function maxn(t)
   return n
 end
 
-local loadbalance_mt = {}
-loadbalance_mt.__index = loadbalance_mt
+-- send on a shmring, waiting while it is full; false once the peer is gone.
+local function ring_send(ring, buf)
+  while true do
+    local ok = ring:send(buf)
+    if ok then
+      return true
+    elseif ok == nil then
+      return false
+    end
+    fan.sleep(0.001)
+  end
+end
+
+-- master side of a slave reached through shared memory.
+local shm_slave_mt = {}
+shm_slave_mt.__index = shm_slave_mt
 
-function loadbalance_mt.new(max_job_count)
-  local obj = {max_job_count = max_job_count, slaves = {}, yielding = {head = nil, tail = nil}}
-  setmetatable(obj, loadbalance_mt)
-  return obj
+function shm_slave_mt:send(buf)
+  return ring_send(self.tasks, buf)
 end
 
-function loadbalance_mt:_assign(slave)
-  if self.yielding.head then
-    local co = self.yielding.head.value
-    self.yielding.head = self.yielding.head.next
-    local st, msg = coroutine.resume(co, slave)
+local function attach_slave(obj, apt, max_job_count)
+  apt.task_map = {}
+  apt.task_index = 1
+  apt.jobcount = 0
+  apt.status = "running"
+  apt.max_job_count = max_job_count
+
+  table.insert(obj.slaves, apt)
+  obj.loadbalance:add(apt)
+end
+
+local function onresult(obj, apt, str)
+  local args = objectbuf.decode(str)
+
+  local results
+  if args.err then
+    -- the task ran but its results could not be sent back.
+    results = {false, args.err}
+  else
+    results = {true, table.unpack(args, 2, maxn(args))}
+  end
+
+  if apt.task_map[args[1]] then
+    local running = apt.task_map[args[1]]
+    apt.task_map[args[1]] = nil
+    local st, msg = coroutine.resume(running, table.unpack(results, 1, maxn(results)))
     if not st then
       print(msg)
     end
+  else
+    apt.task_map[args[1]] = results
   end
-end
 
-function loadbalance_mt:add(slave)
-  table.insert(self.slaves, slave)
-
-  self:_assign(slave)
+  obj.loadbalance:telldone(apt, args[1])
 end
 
-local function compare_slave_jobcount(a, b)
-  return a.max_job_count - a.jobcount > b.max_job_count - b.jobcount
+local function onslavedead(obj, apt)
+  obj.loadbalance:remove(apt)
+  for task_key, co in pairs(apt.task_map) do
+    if type(co) == "thread" and coroutine.status(co) == "suspended" then
+      apt.status = "dead"
+      assert(coroutine.resume(co, false, "slave dead."))
+    end
+  end
 end
 
-function loadbalance_mt:findbest()
-  table.sort(self.slaves, compare_slave_jobcount)
-  local slave = self.slaves[1]
-  if not slave or slave.jobcount >= self.max_job_count then
-    if not self.yielding.head then
-      self.yielding.head = {value = coroutine.running()}
-      self.yielding.tail = self.yielding.head
+-- runs one encoded task on the slave, returns the encoded results, or an
+-- error reply for the task when they are longer than max_len.
+local function run_task(funcmap, str, max_len)
+  local args = objectbuf.decode(str)
+
+  local task_key = args[1]
+  local func = funcmap[args[2]]
+
+  local ret = ""
+  if func then
+    local st, msg =
+      pcall(
+      function()
+        local results
+        if args.batch then
+          -- one {true, ...} or {false, err} per call of the batch, in order.
+          local out = {}
+          for i, call_args in ipairs(args.batch) do
+            out[i] = {pcall(func, table.unpack(call_args, 1, maxn(call_args)))}
+          end
+          results = {task_key, out}
+        else
+          results = {task_key, func(table.unpack(args, 3, maxn(args)))}
+        end
+        return objectbuf.encode(results)
+      end
+    )
+    if not st then
+      print(msg)
+    elseif max_len and #msg > max_len then
+      ret =
+        objectbuf.encode(
+        {task_key, err = string.format("results of %d bytes exceed ring capacity %d", #msg, max_len)}
+      )
     else
-      self.yielding.tail.next = {value = coroutine.running()}
-      self.yielding.tail = self.yielding.tail.next
+      ret = msg
     end
-    slave = coroutine.yield()
   end
 
-  slave.jobcount = slave.jobcount + 1
-  return slave
+  return ret
 end
 
-function loadbalance_mt:telldone(slave)
-  slave.jobcount = slave.jobcount - 1
-  self:_assign(slave)
+-- sends one task (or a batch of calls when batch is set) to the best slave
+-- and waits for its results.
+local function call(obj, k, batch, ...)
+  local slave = obj.loadbalance:findbest()
+
+  local task_key = string.format("%d", slave.task_index)
+  slave.task_index = slave.task_index + 1
+  local args = {task_key, k, ...}
+  args.batch = batch
+
+  obj.loadbalance:sent(slave, task_key)
+  local ok, sent =
+    pcall(
+    function()
+      local payload = objectbuf.encode(args)
+      if not slave.shm then
+        local output = stream.new()
+        output:AddString(payload)
+        payload = output:package()
+      end
+      return slave:send(payload)
+    end
+  )
+  if not ok then
+    -- e.g. a message larger than the ring; the slave never saw it,
+    -- so give its slot back before raising.
+    obj.loadbalance:telldone(slave, task_key)
+    error(sent, 0)
+  end
+  if not sent then
+    print("slave dead.")
+    slave.status = "dead"
+    obj.loadbalance:remove(slave)
+    return
+  end
+
+  -- slave resume maybe faster than master's salve:send resume
+  if slave.task_map[task_key] then
+    local args = slave.task_map[task_key]
+    slave.task_map[task_key] = nil
+    return table.unpack(args)
+  else
+    slave.task_map[task_key] = coroutine.running()
+    return coroutine.yield()
+  end
 end
 
-local master_mt = {}
-master_mt.__index = function(obj, k)
-  if obj.func_names[k] then
-    obj:wait_all_slaves()
+-- calls func_name once per entry of list (each an array of arguments),
+-- batch_size calls per message, batches spread over the slaves.
+-- returns one {true, ...} or {false, err} per entry, in list order.
+local function map(obj, func_name, list, opt)
+  if not obj.func_names[func_name] then
+    error("unknown worker function: " .. tostring(func_name))
+  end
+  local batch_size = opt and opt.batch_size
+  if batch_size ~= nil and (type(batch_size) ~= "number" or batch_size < 1 or batch_size % 1 ~= 0) then
+    error("batch_size must be an integer >= 1: " .. tostring(batch_size))
+  end
+  obj:wait_all_slaves()
 
-    return function(obj, ...)
-      local slave = obj.loadbalance:findbest()
+  local count = #list
+  local results = {}
+  if count == 0 then
+    return results
+  end
 
-      local task_key = string.format("%d", slave.task_index)
-      slave.task_index = slave.task_index + 1
-      local args = {task_key, k, ...}
+  if not batch_size then
+    -- enough batches to keep every slave busy.
+    batch_size = math.min(DEFAULT_BATCH_SIZE, math.ceil(count / math.max(#obj.slaves, 1)))
+  end
 
-      local output = stream.new()
-      output:AddString(objectbuf.encode(args))
+  local pending = 0
+  local waiting
+  for first = 1, count, batch_size do
+    local last = math.min(first + batch_size - 1, count)
+    local batch = {}
+    for i = first, last do
+      batch[i - first + 1] = list[i]
+    end
 
-      if not slave:send(output:package()) then
-        print("slave dead.")
-        slave.status = "dead"
-        return
-      end
+    pending = pending + 1
+    coroutine.wrap(
+      function()
+        -- a batch that raises still fills its range and counts down,
+        -- otherwise map would wait for it forever.
+        local ok, st, out = pcall(call, obj, func_name, batch)
+        if not ok then
+          st, out = false, st
+        end
+        for i = first, last do
+          if st and type(out) == "table" then
+            results[i] = out[i - first + 1]
+          else
+            results[i] = {false, st == false and out or "slave dead."}
+          end
+        end
 
-      -- slave resume maybe faster than master's salve:send resume
-      if slave.task_map[task_key] then
-        local args = slave.task_map[task_key]
-        slave.task_map[task_key] = nil
-        return table.unpack(args)
-      else
-        slave.task_map[task_key] = coroutine.running()
-        return coroutine.yield()
+        pending = pending - 1
+        if pending == 0 and waiting then
+          local st, msg = coroutine.resume(waiting)
+          if not st then
+            print(msg)
+          end
+        end
       end
+    )()
+  end
+
+  if pending > 0 then
+    waiting = coroutine.running()
+    coroutine.yield()
+  end
+
+  return results
+end
+
+local master_mt = {}
+master_mt.__index = function(obj, k)
+  if obj.func_names[k] then
+    obj:wait_all_slaves()
+
+    return function(obj, ...)
+      return call(obj, k, nil, ...)
     end
   end
 end
 
 local function new(funcmap, slavecount, max_job_count, url)
   local samehost = false
+  local rings
   if not url then
-    local fifoname = connector.tmpfifoname()
-    url = "fifo:" .. fifoname
+    if config.worker_transport == "fifo" then
+      local fifoname = connector.tmpfifoname()
+      url = "fifo:" .. fifoname
+    else
+      rings = {}
+    end
     samehost = true
   end
 
@@ -125,11 +287,24 @@ local function new(funcmap, slavecount, max_job_count, url)
   end
 
   for i = 1, slavecount do
+    if rings then
+      -- created before fork so both processes map the same pages.
+      rings[i] = {tasks = assert(shmring.new(RING_SIZE)), results = assert(shmring.new(RING_SIZE))}
+    end
+
     local pid = assert(fan.fork())
     master = pid > 0
 
     if not master then
       slave_index = i
+      if rings then
+        -- drop the earlier slaves' rings inherited from the master, so
+        -- their wakeup pipes see EOF when that slave or the master dies.
+        for k = 1, i - 1 do
+          rings[k].tasks:close()
+          rings[k].results:close()
+        end
+      end
       break
     else
       -- assert(fan.setpgid(pid, pid))
@@ -150,7 +325,7 @@ local function new(funcmap, slavecount, max_job_count, url)
     )
     local obj = {
       slave_pool = pool.new(),
-      loadbalance = loadbalance_mt.new(max_job_count),
+      loadbalance = loadbalance_mt.new(max_job_count, config.worker_balance),
       slave_pids = slave_pids,
       slaves = {},
       func_names = {}
@@ -161,6 +336,8 @@ local function new(funcmap, slavecount, max_job_count, url)
 
     setmetatable(obj, master_mt)
 
+    obj.map = map
+
     obj.terminate = function(self)
       for k, v in pairs(self.slave_pids) do
         fan.kill(v)
@@ -173,18 +350,30 @@ local function new(funcmap, slavecount, max_job_count, url)
         return
       end
 
+      if rings then
+        for i, pair in ipairs(rings) do
+          local apt = setmetatable({shm = true, tasks = pair.tasks}, shm_slave_mt)
+          pair.results:bind {
+            onread = function(str)
+              onresult(obj, apt, str)
+            end,
+            ondisconnected = function()
+              pair.tasks:close()
+              pair.results:close()
+              apt.status = "dead"
+              onslavedead(obj, apt)
+            end
+          }
+          attach_slave(obj, apt, max_job_count)
+        end
+        return
+      end
+
       obj.serv = connector.bind(url)
 
       obj.serv.onaccept = function(apt)
         -- print("onaccept", apt)
-        apt.task_map = {}
-        apt.task_index = 1
-        apt.jobcount = 0
-        apt.status = "running"
-        apt.max_job_count = max_job_count
-
-        table.insert(obj.slaves, apt)
-        obj.loadbalance:add(apt)
+        attach_slave(obj, apt, max_job_count)
 
         if #(obj.slaves) == #(slave_pids) then
           if obj._wait_all_slaves_running then
@@ -205,32 +394,14 @@ local function new(funcmap, slavecount, max_job_count, url)
           local str, expect = input:GetString()
           if str then
             last_expect = 1
-            local args = objectbuf.decode(str)
-
-            if apt.task_map[args[1]] then
-              local running = apt.task_map[args[1]]
-              apt.task_map[args[1]] = nil
-              local st, msg = coroutine.resume(running, true, table.unpack(args, 2, maxn(args)))
-              if not st then
-                print(msg)
-              end
-            else
-              apt.task_map[args[1]] = {true, table.unpack(args, 2, maxn(args))}
-            end
-
-            obj.loadbalance:telldone(apt)
+            onresult(obj, apt, str)
           else
             -- print(pid, "not enough, expect", expect)
             last_expect = expect
           end
         end
 
-        for task_key, co in pairs(apt.task_map) do
-          if coroutine.status(co) == "suspended" then
-            apt.status = "dead"
-            assert(coroutine.resume(co, false, "slave dead."))
-          end
-        end
+        onslavedead(obj, apt)
       end
 
       obj._wait_all_slaves_running = coroutine.running()
@@ -267,6 +438,22 @@ local function new(funcmap, slavecount, max_job_count, url)
 
     fan.loop(
       function()
+        if rings then
+          local pair = rings[slave_index]
+          pair.tasks:bind {
+            onread = function(str)
+              if not ring_send(pair.results, run_task(funcmap, str, pair.results:capacity())) then
+                fan.loopbreak()
+              end
+            end,
+            ondisconnected = function()
+              -- the master is gone.
+              fan.loopbreak()
+            end
+          }
+          return
+        end
+
         while true do
           while not cli do
             fan.sleep(0.1)
@@ -287,31 +474,8 @@ local function new(funcmap, slavecount, max_job_count, url)
               last_expect = 1
               -- print(pid, "onread slave", str)
 
-              local args = objectbuf.decode(str)
-
-              local task_key = args[1]
-              local func = funcmap[args[2]]
-
-              -- print(pid, "process", task_key, args[2], table.unpack(args, 3, maxn(args)))
-
-              local ret = ""
-              if func then
-                local st, msg =
-                  pcall(
-                  function()
-                    local results = {task_key, func(table.unpack(args, 3, maxn(args)))}
-                    return objectbuf.encode(results)
-                  end
-                )
-                if not st then
-                  print(msg)
-                else
-                  ret = msg
-                end
-              end
-
               local output = stream.new()
-              output:AddString(ret)
+              output:AddString(run_task(funcmap, str))
               cli:send(output:package())
             else
               -- print(pid, "not enough, expect", expect)
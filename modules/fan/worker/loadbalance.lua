@@ -0,0 +1,314 @@
+local fan = require "fan"
+
+local math = math
+local coroutine = coroutine
+local setmetatable = setmetatable
+
+-- weight of the newest latency sample in a slave's moving average.
+local EWMA_ALPHA = 0.2
+
+local function now()
+  local sec, usec = fan.gettime()
+  return sec + usec / 1000000
+end
+
+local loadbalance_mt = {}
+loadbalance_mt.__index = loadbalance_mt
+
+-- policy: "least" (default) picks the slave with the smallest expected wait,
+-- "roundrobin" rotates over slaves with a free slot, "p2c" compares two
+-- random slaves with a free slot and takes the better one.
+function loadbalance_mt.new(max_job_count, policy)
+  policy = policy or "least"
+  if policy ~= "least" and policy ~= "roundrobin" and policy ~= "p2c" then
+    error("unknown load balance policy: " .. tostring(policy))
+  end
+
+  local obj = {
+    max_job_count = max_job_count,
+    policy = policy,
+    slaves = {}, -- "least": binary min-heap on lb_key, lb_pos is the index.
+    free = {}, -- "p2c": slaves with a free slot, lb_pos is the index.
+    cursor = nil, -- "roundrobin": ring of slaves with a free slot.
+    latency = nil, -- average over all slaves, for slaves not sampled yet.
+    yielding = {head = nil, tail = nil}
+  }
+  setmetatable(obj, loadbalance_mt)
+  return obj
+end
+
+-- expected wait for one more task on this slave; full slaves sort last.
+function loadbalance_mt:_key(slave)
+  if slave.jobcount >= self.max_job_count then
+    return math.huge
+  end
+  return (slave.jobcount + 1) * (slave.lb_latency or self.latency or 1)
+end
+
+local function heap_less(a, b)
+  local ka, kb = a.lb_key, b.lb_key
+  return ka < kb or (ka == kb and a.lb_id < b.lb_id)
+end
+
+-- move slave to its place after its job count or latency changed.
+function loadbalance_mt:_heap_fix(slave)
+  local heap = self.slaves
+  local n = #heap
+  local pos = slave.lb_pos
+  local key = self:_key(slave)
+  slave.lb_key = key
+
+  while pos > 1 do
+    local parent = math.floor(pos / 2)
+    local p = heap[parent]
+    if not heap_less(slave, p) then
+      break
+    end
+    heap[pos] = p
+    p.lb_pos = pos
+    pos = parent
+  end
+
+  local child = pos * 2
+  while child <= n do
+    local c = heap[child]
+    local right = heap[child + 1]
+    if right and heap_less(right, c) then
+      child = child + 1
+      c = right
+    end
+    if not heap_less(c, slave) then
+      break
+    end
+    heap[pos] = c
+    c.lb_pos = pos
+    pos = child
+    child = pos * 2
+  end
+
+  heap[pos] = slave
+  slave.lb_pos = pos
+end
+
+function loadbalance_mt:_ring_insert(slave)
+  local cursor = self.cursor
+  if not cursor then
+    slave.lb_next = slave
+    slave.lb_prev = slave
+    self.cursor = slave
+  else
+    -- just behind the cursor, so it waits for a full turn.
+    local prev = cursor.lb_prev
+    slave.lb_next = cursor
+    slave.lb_prev = prev
+    prev.lb_next = slave
+    cursor.lb_prev = slave
+  end
+end
+
+function loadbalance_mt:_ring_remove(slave)
+  local next = slave.lb_next
+  if next == slave then
+    self.cursor = nil
+  else
+    local prev = slave.lb_prev
+    prev.lb_next = next
+    next.lb_prev = prev
+    if self.cursor == slave then
+      self.cursor = next
+    end
+  end
+  slave.lb_next = nil
+  slave.lb_prev = nil
+end
+
+function loadbalance_mt:_free_insert(slave)
+  local free = self.free
+  free[#free + 1] = slave
+  slave.lb_pos = #free
+end
+
+function loadbalance_mt:_free_remove(slave)
+  local free = self.free
+  local n = #free
+  local last = free[n]
+  free[slave.lb_pos] = last
+  last.lb_pos = slave.lb_pos
+  free[n] = nil
+  slave.lb_pos = nil
+end
+
+-- the slave with a free slot the policy prefers, or nil.
+function loadbalance_mt:_take()
+  local policy = self.policy
+  local slave
+  if policy == "least" then
+    slave = self.slaves[1]
+    if not slave or slave.lb_key == math.huge then
+      return nil
+    end
+  elseif policy == "roundrobin" then
+    slave = self.cursor
+    if not slave then
+      return nil
+    end
+    self.cursor = slave.lb_next
+  else
+    local free = self.free
+    local n = #free
+    if n == 0 then
+      return nil
+    end
+    slave = free[math.random(n)]
+    if n > 1 then
+      local other = free[math.random(n)]
+      if other ~= slave and self:_key(other) < self:_key(slave) then
+        slave = other
+      end
+    end
+  end
+
+  slave.jobcount = slave.jobcount + 1
+  if policy == "least" then
+    self:_heap_fix(slave)
+  elseif slave.jobcount >= self.max_job_count then
+    if policy == "roundrobin" then
+      self:_ring_remove(slave)
+    else
+      self:_free_remove(slave)
+    end
+  end
+  return slave
+end
+
+function loadbalance_mt:_give(slave)
+  local was_full = slave.jobcount >= self.max_job_count
+  slave.jobcount = slave.jobcount - 1
+  if slave.lb_dead then
+    return
+  end
+
+  if self.policy == "least" then
+    self:_heap_fix(slave)
+  elseif was_full and slave.jobcount < self.max_job_count then
+    if self.policy == "roundrobin" then
+      self:_ring_insert(slave)
+    else
+      self:_free_insert(slave)
+    end
+  end
+end
+
+-- hand free slots to coroutines waiting in findbest, in arrival order.
+function loadbalance_mt:_assign()
+  while self.yielding.head do
+    local slave = self:_take()
+    if not slave then
+      return
+    end
+    local co = self.yielding.head.value
+    self.yielding.head = self.yielding.head.next
+    if not self.yielding.head then
+      self.yielding.tail = nil
+    end
+    local st, msg = coroutine.resume(co, slave)
+    if not st then
+      print(msg)
+    end
+  end
+end
+
+function loadbalance_mt:add(slave)
+  self.count = (self.count or 0) + 1
+  slave.lb_id = self.count
+
+  if self.policy == "least" then
+    local heap = self.slaves
+    heap[#heap + 1] = slave
+    slave.lb_pos = #heap
+    self:_heap_fix(slave)
+  elseif slave.jobcount < self.max_job_count then
+    if self.policy == "roundrobin" then
+      self:_ring_insert(slave)
+    else
+      self:_free_insert(slave)
+    end
+  end
+
+  self:_assign()
+end
+
+-- stop scheduling onto a dead slave.
+function loadbalance_mt:remove(slave)
+  if slave.lb_dead or not slave.lb_id then
+    return
+  end
+  slave.lb_dead = true
+
+  if self.policy == "least" then
+    local heap = self.slaves
+    local last = heap[#heap]
+    heap[#heap] = nil
+    if last ~= slave then
+      heap[slave.lb_pos] = last
+      last.lb_pos = slave.lb_pos
+      self:_heap_fix(last)
+    end
+    slave.lb_pos = nil
+  elseif self.policy == "roundrobin" then
+    if slave.lb_next then
+      self:_ring_remove(slave)
+    end
+  elseif slave.lb_pos then
+    self:_free_remove(slave)
+  end
+end
+
+function loadbalance_mt:findbest()
+  local slave = self:_take()
+  if not slave then
+    if not self.yielding.head then
+      self.yielding.head = {value = coroutine.running()}
+      self.yielding.tail = self.yielding.head
+    else
+      self.yielding.tail.next = {value = coroutine.running()}
+      self.yielding.tail = self.yielding.tail.next
+    end
+    -- _assign has already counted the job on the slave it passes.
+    slave = coroutine.yield()
+  end
+
+  return slave
+end
+
+-- task_key was just sent to slave. One task per slave is timed at a time,
+-- which is enough to follow its latency without a clock read per task.
+function loadbalance_mt:sent(slave, task_key)
+  if not slave.lb_probe then
+    slave.lb_probe = task_key
+    slave.lb_probe_depth = slave.jobcount
+    slave.lb_probe_time = now()
+  end
+end
+
+local function ewma(avg, sample)
+  if not avg then
+    return sample
+  end
+  return avg + EWMA_ALPHA * (sample - avg)
+end
+
+function loadbalance_mt:telldone(slave, task_key)
+  if task_key and slave.lb_probe == task_key then
+    -- the timed task queued behind the others in flight, count it per task.
+    local sample = (now() - slave.lb_probe_time) / slave.lb_probe_depth
+    slave.lb_probe = nil
+    slave.lb_latency = ewma(slave.lb_latency, sample)
+    self.latency = ewma(self.latency, sample)
+  end
+
+  self:_give(slave)
+  self:_assign()
+end
+
+return loadbalance_mt
@@ -18,10 +18,30 @@ static struct event signal_pipe;
 static int looping = 0;
 static int initialized = 0;
 
+// Task inbox: a mutex-protected FIFO plus a self-pipe registered on the
+// owning base. A poster only writes to the pipe when the queue goes from
+// empty to non-empty, so a burst of tasks costs a single wakeup.
+struct event_mgr_task {
+    event_mgr_task_fn fn;
+    void *arg;
+    struct event_mgr_task *next;
+};
+
+struct event_mgr_inbox {
+    pthread_mutex_t lock;
+    struct event_mgr_task *head;
+    struct event_mgr_task *tail;
+    evutil_socket_t fds[2];
+    struct event *ev;
+};
+
 // Worker pool for multi-threaded event processing
 struct event_worker {
     struct event_base *base;
     struct evdns_base *dnsbase;
+    struct event_mgr_inbox *inbox;
+    event_mgr_task_fn on_stop;
+    void *on_stop_arg;
     pthread_t thread;
     _Atomic int running;
     int id;
@@ -31,6 +51,106 @@ static struct event_worker workers[EVENT_MGR_MAX_WORKERS];
 static int num_workers = 0;
 static _Atomic unsigned int next_worker_idx = 0;
 
+static struct event_mgr_inbox *main_inbox = NULL;
+
+// Identity of the calling thread within the worker pool.
+static _Thread_local int current_worker = -1;
+static _Thread_local int worker_local = 0;
+
+static void inbox_cb(evutil_socket_t fd, short what, void *arg) {
+    struct event_mgr_inbox *inbox = (struct event_mgr_inbox *)arg;
+
+    // Drain the wakeup bytes before taking the queue: a post that lands
+    // after the swap below sees an empty queue and writes a fresh byte.
+    char drain[64];
+    while (read(fd, drain, sizeof(drain)) > 0) {
+    }
+
+    pthread_mutex_lock(&inbox->lock);
+    struct event_mgr_task *task = inbox->head;
+    inbox->head = NULL;
+    inbox->tail = NULL;
+    pthread_mutex_unlock(&inbox->lock);
+
+    while (task) {
+        struct event_mgr_task *next = task->next;
+        task->fn(task->arg);
+        free(task);
+        task = next;
+    }
+}
+
+static struct event_mgr_inbox *inbox_new(struct event_base *owner) {
+    struct event_mgr_inbox *inbox = calloc(1, sizeof(struct event_mgr_inbox));
+    if (!inbox) return NULL;
+
+    if (pipe(inbox->fds) != 0) {
+        free(inbox);
+        return NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        evutil_make_socket_nonblocking(inbox->fds[i]);
+        evutil_make_socket_closeonexec(inbox->fds[i]);
+    }
+
+    pthread_mutex_init(&inbox->lock, NULL);
+    inbox->ev = event_new(owner, inbox->fds[0], EV_READ | EV_PERSIST, inbox_cb, inbox);
+    if (!inbox->ev || event_add(inbox->ev, NULL) != 0) {
+        if (inbox->ev) event_free(inbox->ev);
+        close(inbox->fds[0]);
+        close(inbox->fds[1]);
+        pthread_mutex_destroy(&inbox->lock);
+        free(inbox);
+        return NULL;
+    }
+    return inbox;
+}
+
+// Tasks still queued here never ran; their args are the poster's to lose.
+static void inbox_free(struct event_mgr_inbox *inbox) {
+    if (!inbox) return;
+
+    event_free(inbox->ev);
+    close(inbox->fds[0]);
+    close(inbox->fds[1]);
+
+    struct event_mgr_task *task = inbox->head;
+    while (task) {
+        struct event_mgr_task *next = task->next;
+        free(task);
+        task = next;
+    }
+    pthread_mutex_destroy(&inbox->lock);
+    free(inbox);
+}
+
+static int inbox_post(struct event_mgr_inbox *inbox, event_mgr_task_fn fn, void *arg) {
+    struct event_mgr_task *task = malloc(sizeof(struct event_mgr_task));
+    if (!task) return -1;
+    task->fn = fn;
+    task->arg = arg;
+    task->next = NULL;
+
+    pthread_mutex_lock(&inbox->lock);
+    int was_empty = (inbox->head == NULL);
+    if (inbox->tail) {
+        inbox->tail->next = task;
+    } else {
+        inbox->head = task;
+    }
+    inbox->tail = task;
+    pthread_mutex_unlock(&inbox->lock);
+
+    if (was_empty) {
+        char c = 0;
+        ssize_t rc;
+        do {
+            rc = write(inbox->fds[1], &c, 1);
+        } while (rc < 0 && errno == EINTR);
+    }
+    return 0;
+}
+
 static void *worker_thread_func(void *arg) {
     struct event_worker *w = (struct event_worker *)arg;
     // Block SIGPIPE on worker threads
@@ -39,7 +159,16 @@ static void *worker_thread_func(void *arg) {
     sigaddset(&set, SIGPIPE);
     pthread_sigmask(SIG_BLOCK, &set, NULL);
 
+    current_worker = w->id;
+
     event_base_loop(w->base, EVLOOP_NO_EXIT_ON_EMPTY);
+
+    // The base is still alive here, so whatever runs on this thread (e.g. a
+    // per-worker Lua state) can tear down its events in place.
+    if (w->on_stop) {
+        w->on_stop(w->on_stop_arg);
+        w->on_stop = NULL;
+    }
     w->running = 0;
     return NULL;
 }
@@ -59,6 +188,10 @@ int event_mgr_workers_init(int count) {
         if (!workers[i].dnsbase) return -1;
         evdns_base_set_option(workers[i].dnsbase, "randomize-case:", "0");
 
+        // Registered before the thread starts looping on the base.
+        workers[i].inbox = inbox_new(workers[i].base);
+        if (!workers[i].inbox) return -1;
+
         workers[i].running = 1;
         int rc = pthread_create(&workers[i].thread, NULL, worker_thread_func, &workers[i]);
         if (rc != 0) return -1;
@@ -90,6 +223,10 @@ void event_mgr_workers_shutdown(void) {
             evdns_base_free(workers[i].dnsbase, 1);
             workers[i].dnsbase = NULL;
         }
+        if (workers[i].inbox) {
+            inbox_free(workers[i].inbox);
+            workers[i].inbox = NULL;
+        }
         if (workers[i].base) {
             event_base_free(workers[i].base);
             workers[i].base = NULL;
@@ -101,10 +238,19 @@ void event_mgr_workers_shutdown(void) {
 // Stop worker threads but keep their event_bases alive, so that Lua __gc
 // finalisers running afterwards can still bufferevent_free() into them.
 // The matching event_base_free() happens later via event_mgr_workers_free_bases.
+static void worker_loopbreak_task(void *arg) {
+    event_base_loopbreak((struct event_base *)arg);
+}
+
 void event_mgr_workers_stop_threads(void) {
     for (int i = 0; i < num_workers; i++) {
         if (workers[i].running && workers[i].base) {
-            event_base_loopbreak(workers[i].base);
+            // Break from the worker's own thread: without libevent threading
+            // support a cross-thread loopbreak would not wake its dispatch.
+            if (!workers[i].inbox ||
+                inbox_post(workers[i].inbox, worker_loopbreak_task, workers[i].base) != 0) {
+                event_base_loopbreak(workers[i].base);
+            }
         }
     }
     for (int i = 0; i < num_workers; i++) {
@@ -122,6 +268,10 @@ void event_mgr_workers_free_bases(void) {
             evdns_base_free(workers[i].dnsbase, 1);
             workers[i].dnsbase = NULL;
         }
+        if (workers[i].inbox) {
+            inbox_free(workers[i].inbox);
+            workers[i].inbox = NULL;
+        }
         if (workers[i].base) {
             event_base_free(workers[i].base);
             workers[i].base = NULL;
@@ -154,7 +304,43 @@ int event_mgr_worker_count(void) {
     return num_workers;
 }
 
+int event_mgr_post(int worker_id, event_mgr_task_fn fn, void *arg) {
+    if (!fn) return -1;
+
+    struct event_mgr_inbox *inbox;
+    if (worker_id < 0) {
+        inbox = main_inbox;
+    } else if (worker_id < num_workers && workers[worker_id].running) {
+        inbox = workers[worker_id].inbox;
+    } else {
+        return -1;
+    }
+
+    if (!inbox) return -1;
+    return inbox_post(inbox, fn, arg);
+}
+
+int event_mgr_current_worker(void) {
+    return current_worker;
+}
+
+void event_mgr_worker_make_local(void) {
+    if (current_worker >= 0) {
+        worker_local = 1;
+    }
+}
+
+void event_mgr_worker_on_stop(int worker_id, event_mgr_task_fn fn, void *arg) {
+    if (worker_id < 0 || worker_id >= num_workers) return;
+    workers[worker_id].on_stop_arg = arg;
+    workers[worker_id].on_stop = fn;
+}
+
 struct event_base *event_mgr_base() {
+    if (worker_local && current_worker >= 0 && current_worker < num_workers) {
+        return workers[current_worker].base;
+    }
+
     if (!base) {
         base = event_base_new();
     }
@@ -169,6 +355,9 @@ struct event_base *event_mgr_base_current() {
 }
 
 struct evdns_base *event_mgr_dnsbase() {
+    if (worker_local && current_worker >= 0 && current_worker < num_workers) {
+        return workers[current_worker].dnsbase;
+    }
     return dnsbase;
 }
 
@@ -265,6 +454,14 @@ static void cleanup_dnsbase() {
 // drives multi_done → progress callbacks that touch Lua via clientp.
 extern void cleanup_http_curl(void);
 
+// Only safe once no worker thread can post any more (threads joined).
+static void cleanup_main_inbox() {
+    if (main_inbox) {
+        inbox_free(main_inbox);
+        main_inbox = NULL;
+    }
+}
+
 static void cleanup_eventbase() {
     if (base) {
         event_base_free(base);
@@ -285,6 +482,7 @@ static void full_cleanup() {
     cleanup_openssl();
     cleanup_dnsbase();
     event_mgr_workers_shutdown();
+    cleanup_main_inbox();
     cleanup_eventbase();
     reset_state();
 }
@@ -318,6 +516,10 @@ int event_mgr_init() {
 
         event_assign(&signal_pipe, event_mgr_base_current(), SIGPIPE, EV_SIGNAL | EV_PERSIST, signal_cb, &signal_pipe);
         event_add(&signal_pipe, NULL);
+
+        if (!main_inbox) {
+            main_inbox = inbox_new(event_mgr_base_current());
+        }
         return 0;
     }
 
@@ -357,6 +559,7 @@ int event_mgr_loop() {
         cleanup_openssl();
         cleanup_dnsbase();
         event_mgr_workers_stop_threads();
+        cleanup_main_inbox();
 
         looping = 0;
         initialized = 0;
@@ -388,6 +591,7 @@ int event_mgr_loop_later_cleanup() {
         cleanup_openssl();
         cleanup_dnsbase();
         event_mgr_workers_stop_threads();
+        cleanup_main_inbox();
 
         looping = 0;
         initialized = 0;
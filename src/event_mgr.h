@@ -33,4 +33,25 @@ struct evdns_base *event_mgr_worker_dnsbase(int worker_id);
 int event_mgr_next_worker(void);
 int event_mgr_worker_count(void);
 
+// Cross-thread task posting. `fn(arg)` runs on the thread that owns the
+// target base: worker_id >= 0 for a worker, -1 for the main loop. Tasks are
+// queued under a mutex and the owner is woken through a pipe, so this works
+// whether or not libevent threading support is enabled. Returns -1 if the
+// target inbox does not exist or its worker has stopped (the task is not
+// queued and `arg` is not freed).
+typedef void (*event_mgr_task_fn)(void *arg);
+int event_mgr_post(int worker_id, event_mgr_task_fn fn, void *arg);
+
+// Worker index of the calling thread, or -1 on any non-worker thread.
+int event_mgr_current_worker(void);
+
+// Make event_mgr_base()/event_mgr_dnsbase() on the calling worker thread
+// resolve to that worker's own bases, so code running there (e.g. a
+// per-worker Lua state) keeps all of its events on its own loop.
+void event_mgr_worker_make_local(void);
+
+// Run `fn(arg)` on worker `worker_id`'s thread right after its loop exits,
+// while its event_base is still alive.
+void event_mgr_worker_on_stop(int worker_id, event_mgr_task_fn fn, void *arg);
+
 #endif
@@ -55,6 +55,16 @@ extern void decrRef(lua_State *L);
 #define decrRef(L) (void)0;
 #endif
 
+/* Response bodies are collected in fixed-size chunks, so growing the body
+   never reallocs or copies what was already received. */
+#define BODY_CHUNK_SIZE (16 * 1024)
+
+typedef struct _BodyChunk {
+    struct _BodyChunk *next;
+    size_t len;
+    char data[BODY_CHUNK_SIZE];
+} BodyChunk;
+
 /* Information associated with a specific easy handle */
 typedef struct _ConnInfo {
     CURL *easy;
@@ -63,12 +73,29 @@ typedef struct _ConnInfo {
 
     struct curl_slist *outputHeaders;
 
-    BYTEARRAY input;
+    BodyChunk *body_head;
+    BodyChunk *body_tail;
+    size_t body_size;
+    curl_off_t max_body_size; // 0 = unlimited
+    int body_too_large;
+    int body_stream; // hand the body to Lua as a fan.stream
+
+    int output_fd;            // output_file, -1 when the body is collected
+    int output_started;       // response code checked on the first write
+    int output_skip;          // non-2xx: collect the body instead of writing it
+    int output_errno;
+    curl_off_t output_offset; // existing bytes kept by a resumed download
+    curl_off_t output_written;
+
+    double progress_interval; // seconds between onprogress calls, 0 = every call
+    double progress_last;
+    curl_off_t progress_dlnow;
 
     lua_State *mainthread;
     lua_State *L;
 
     int completed; // set to 1 after http_getpost_complete, prevents double-process
+    CURLcode result; // transfer result from CURLMSG_DONE
 
     int verbose;
 
@@ -87,10 +114,34 @@ typedef struct _ConnInfo {
 
     struct curl_slist *resolve;
 
-    struct _ConnInfo *next; // linked list for in-flight tracking
+    int dirty;     // CONN_DIRTY_* option groups this request changed
+    int cookiejar; // cookies go to a real file, flush before reuse
+
+    struct _ConnInfo *next; // linked list for in-flight tracking, or idle pool
     struct _ConnInfo *prev;
 } ConnInfo;
 
+/* Option groups a request may move away from the pooled handle's baseline.
+   conn_release() restores only the groups that were touched, so a recycled
+   handle needs neither curl_easy_reset() nor the invariant options again. */
+#define CONN_DIRTY_METHOD (1 << 0)
+#define CONN_DIRTY_BODY (1 << 1)
+#define CONN_DIRTY_VERBOSE (1 << 2)
+#define CONN_DIRTY_DNS (1 << 3)
+#define CONN_DIRTY_PROGRESS (1 << 4)
+#define CONN_DIRTY_TIMEOUT (1 << 5)
+#define CONN_DIRTY_SSL (1 << 6)
+#define CONN_DIRTY_CA (1 << 7)
+#define CONN_DIRTY_HEADERS (1 << 8)
+#define CONN_DIRTY_PROXY (1 << 9)
+#define CONN_DIRTY_RESOLVE (1 << 10)
+#define CONN_DIRTY_REUSE (1 << 11)
+#define CONN_DIRTY_HTTP2 (1 << 12)
+#define CONN_DIRTY_MAXSIZE (1 << 13)
+#define CONN_DIRTY_RANGE (1 << 14)
+
+#define CONN_POOL_DEFAULT 32
+
 /* Doubly-linked list head for all in-flight connections.
    Used by cleanup_http_curl() to decrRef for requests that never completed. */
 static ConnInfo *inflight_head = NULL;
@@ -117,6 +168,13 @@ static void inflight_remove(ConnInfo *conn) {
     conn->next = NULL;
 }
 
+/* Finished ConnInfo/CURL pairs kept for the next request, linked via next. */
+static ConnInfo *pool_head = NULL;
+static int pool_idle = 0;
+static int pool_max_idle = CONN_POOL_DEFAULT;
+static unsigned long pool_hits = 0;
+static unsigned long pool_misses = 0;
+
 typedef struct {
     struct event *resume_timer;
     lua_State *L;
@@ -135,6 +193,10 @@ typedef struct _SockInfo {
 
 static CURLSH *share_handle = NULL;
 
+/* HTTP/2 multiplexing limits for the multi handle, see http.multiplex(). */
+static long multiplex_max_streams = 0;
+static long multiplex_max_host_connections = 0;
+
 #define CURL_TIMEOUT_DEFAULT 60
 
 enum { HTTP_GET, HTTP_POST, HTTP_PUT, HTTP_HEAD, HTTP_DELETE, HTTP_UPDATE };
@@ -166,6 +228,306 @@ static const char *mcode_or_die(const char *where, CURLMcode code) {
 
 static void resume_cb(int fd, short kind, void *userp);
 
+static void multi_apply_limits(void) {
+    if (!multi) {
+        return;
+    }
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, multiplex_max_host_connections);
+#if LIBCURL_VERSION_NUM >= 0x074300
+    // Always set, so a later 0 undoes an earlier limit: curl maps values
+    // below 1 to its default of 100.
+    curl_multi_setopt(multi, CURLMOPT_MAX_CONCURRENT_STREAMS, multiplex_max_streams);
+#endif
+}
+
+static size_t filldata(char *ptr, size_t size, size_t nmemb, ConnInfo *conn);
+static size_t fillheader(void *ptr, size_t size, size_t nmemb, void *userdata);
+
+/* Options every request shares; set once when the handle is created. */
+static void conn_setup_easy(ConnInfo *conn) {
+    curl_easy_setopt(conn->easy, CURLOPT_WRITEFUNCTION, filldata);
+    curl_easy_setopt(conn->easy, CURLOPT_WRITEDATA, conn);
+
+    curl_easy_setopt(conn->easy, CURLOPT_HEADERFUNCTION, fillheader);
+    curl_easy_setopt(conn->easy, CURLOPT_HEADERDATA, conn);
+    curl_easy_setopt(conn->easy, CURLOPT_NOSIGNAL, 1);
+
+    curl_easy_setopt(conn->easy, CURLOPT_ERRORBUFFER, conn->error);
+    curl_easy_setopt(conn->easy, CURLOPT_PRIVATE, conn);
+
+    curl_easy_setopt(conn->easy, CURLOPT_LOW_SPEED_LIMIT, 1);
+    curl_easy_setopt(conn->easy, CURLOPT_LOW_SPEED_TIME, CURL_TIMEOUT_DEFAULT);
+
+    if (share_handle) {
+        curl_easy_setopt(conn->easy, CURLOPT_SHARE, share_handle);
+    }
+}
+
+static ConnInfo *conn_acquire(void) {
+    ConnInfo *conn = pool_head;
+    if (conn) {
+        pool_head = conn->next;
+        conn->next = NULL;
+        pool_idle--;
+        pool_hits++;
+        return conn;
+    }
+
+    pool_misses++;
+    conn = calloc(1, sizeof(ConnInfo));
+    if (!conn) {
+        return NULL;
+    }
+    conn->easy = curl_easy_init();
+    if (!conn->easy) {
+        free(conn);
+        return NULL;
+    }
+    conn->output_fd = -1;
+    conn_setup_easy(conn);
+    return conn;
+}
+
+static void body_free(ConnInfo *conn);
+
+static void conn_free(ConnInfo *conn) {
+    body_free(conn);
+    if (conn->output_fd >= 0) {
+        close(conn->output_fd);
+    }
+    if (conn->outputHeaders) {
+        curl_slist_free_all(conn->outputHeaders);
+    }
+    if (conn->resolve) {
+        curl_slist_free_all(conn->resolve);
+    }
+    if (conn->easy) {
+        curl_easy_cleanup(conn->easy);
+    }
+    free(conn);
+}
+
+/* Return a handle that is no longer attached to the multi handle. */
+static void conn_release(ConnInfo *conn) {
+    if (pool_idle >= pool_max_idle) {
+        conn_free(conn); // curl_easy_cleanup also writes the cookie jar
+        return;
+    }
+
+    CURL *easy = conn->easy;
+    int dirty = conn->dirty;
+
+    /* Cookies are not shared between handles: write them out as cleanup
+       would, then drop them so the next request starts from the jar file. */
+    if (conn->cookiejar) {
+        curl_easy_setopt(easy, CURLOPT_COOKIELIST, "FLUSH");
+    }
+    curl_easy_setopt(easy, CURLOPT_COOKIEFILE, NULL);
+
+#if TARGET_OS_IPHONE || defined(ANDROID) || defined(__ANDROID__)
+    // There is no CAINFO to fall back to here, only the build default.
+    if (dirty & CONN_DIRTY_CA) {
+        curl_easy_reset(easy);
+        conn_setup_easy(conn);
+        dirty = 0;
+    }
+#endif
+
+    // POSTFIELDS switches the method to POST, so restore it afterwards.
+    if (dirty & CONN_DIRTY_BODY) {
+        curl_easy_setopt(easy, CURLOPT_POSTFIELDS, NULL);
+        curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE, -1L);
+        curl_easy_setopt(easy, CURLOPT_READFUNCTION, NULL);
+        curl_easy_setopt(easy, CURLOPT_READDATA, stdin);
+        dirty |= CONN_DIRTY_METHOD;
+    }
+    if (dirty & CONN_DIRTY_METHOD) {
+        curl_easy_setopt(easy, CURLOPT_CUSTOMREQUEST, NULL);
+        curl_easy_setopt(easy, CURLOPT_NOBODY, 0L);
+        curl_easy_setopt(easy, CURLOPT_POST, 0L);
+    }
+    if (dirty & CONN_DIRTY_VERBOSE) {
+        curl_easy_setopt(easy, CURLOPT_VERBOSE, 0L);
+        curl_easy_setopt(easy, CURLOPT_DEBUGFUNCTION, NULL);
+        curl_easy_setopt(easy, CURLOPT_DEBUGDATA, NULL);
+    }
+    if (dirty & CONN_DIRTY_DNS) {
+        curl_easy_setopt(easy, CURLOPT_DNS_SERVERS, NULL);
+    }
+    if (dirty & CONN_DIRTY_PROGRESS) {
+        curl_easy_setopt(easy, CURLOPT_NOPROGRESS, 1L);
+        curl_easy_setopt(easy, CURLOPT_PROGRESSFUNCTION, NULL);
+        curl_easy_setopt(easy, CURLOPT_PROGRESSDATA, NULL);
+    }
+    if (dirty & CONN_DIRTY_TIMEOUT) {
+        curl_easy_setopt(easy, CURLOPT_LOW_SPEED_TIME, CURL_TIMEOUT_DEFAULT);
+        curl_easy_setopt(easy, CURLOPT_TIMEOUT, 0L);
+    }
+    if (dirty & CONN_DIRTY_SSL) {
+        curl_easy_setopt(easy, CURLOPT_SSL_VERIFYPEER, 1L);
+        curl_easy_setopt(easy, CURLOPT_SSL_VERIFYHOST, 2L);
+        curl_easy_setopt(easy, CURLOPT_SSLCERT, NULL);
+        curl_easy_setopt(easy, CURLOPT_SSLCERTTYPE, NULL);
+        curl_easy_setopt(easy, CURLOPT_SSLKEY, NULL);
+        curl_easy_setopt(easy, CURLOPT_SSLKEYPASSWD, NULL);
+        curl_easy_setopt(easy, CURLOPT_SSLKEYTYPE, NULL);
+    }
+    if (dirty & CONN_DIRTY_HEADERS) {
+        curl_easy_setopt(easy, CURLOPT_HTTPHEADER, NULL);
+    }
+    if (dirty & CONN_DIRTY_PROXY) {
+        curl_easy_setopt(easy, CURLOPT_PROXYTYPE, (long)CURLPROXY_HTTP);
+        curl_easy_setopt(easy, CURLOPT_PROXY, NULL);
+        curl_easy_setopt(easy, CURLOPT_PROXYPORT, 0L);
+        curl_easy_setopt(easy, CURLOPT_PROXYUSERNAME, NULL);
+        curl_easy_setopt(easy, CURLOPT_PROXYPASSWORD, NULL);
+        curl_easy_setopt(easy, CURLOPT_NOPROXY, NULL);
+        curl_easy_setopt(easy, CURLOPT_HTTPPROXYTUNNEL, 0L);
+#ifdef CURLHEADER_SEPARATE
+        curl_easy_setopt(easy, CURLOPT_HEADEROPT, CURLHEADER_UNIFIED);
+#endif
+    }
+    if (dirty & CONN_DIRTY_RESOLVE) {
+        curl_easy_setopt(easy, CURLOPT_RESOLVE, NULL);
+    }
+    if (dirty & CONN_DIRTY_REUSE) {
+        curl_easy_setopt(easy, CURLOPT_FORBID_REUSE, 0L);
+    }
+    if (dirty & CONN_DIRTY_HTTP2) {
+        curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_NONE);
+        curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 0L);
+    }
+    if (dirty & CONN_DIRTY_MAXSIZE) {
+        curl_easy_setopt(easy, CURLOPT_MAXFILESIZE_LARGE, (curl_off_t)0);
+    }
+    if (dirty & CONN_DIRTY_RANGE) {
+        curl_easy_setopt(easy, CURLOPT_RANGE, NULL);
+    }
+
+    if (conn->outputHeaders) {
+        curl_slist_free_all(conn->outputHeaders);
+    }
+    if (conn->resolve) {
+        curl_slist_free_all(conn->resolve);
+    }
+    body_free(conn);
+    if (conn->output_fd >= 0) {
+        close(conn->output_fd);
+    }
+
+    memset(conn, 0, sizeof(ConnInfo));
+    conn->easy = easy;
+    conn->output_fd = -1;
+
+    conn->next = pool_head;
+    pool_head = conn;
+    pool_idle++;
+}
+
+/* Free idle handles beyond pool_max_idle. */
+static void conn_pool_trim(void) {
+    while (pool_idle > pool_max_idle) {
+        ConnInfo *conn = pool_head;
+        pool_head = conn->next;
+        pool_idle--;
+        conn_free(conn);
+    }
+}
+
+static int body_append(ConnInfo *conn, const char *data, size_t len) {
+    while (len > 0) {
+        BodyChunk *chunk = conn->body_tail;
+        if (!chunk || chunk->len == BODY_CHUNK_SIZE) {
+            chunk = malloc(sizeof(BodyChunk));
+            if (!chunk) {
+                return 0;
+            }
+            chunk->next = NULL;
+            chunk->len = 0;
+            if (conn->body_tail) {
+                conn->body_tail->next = chunk;
+            } else {
+                conn->body_head = chunk;
+            }
+            conn->body_tail = chunk;
+        }
+
+        size_t n = BODY_CHUNK_SIZE - chunk->len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(chunk->data + chunk->len, data, n);
+        chunk->len += n;
+        conn->body_size += n;
+        data += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static void body_free(ConnInfo *conn) {
+    BodyChunk *chunk = conn->body_head;
+    while (chunk) {
+        BodyChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    conn->body_head = NULL;
+    conn->body_tail = NULL;
+    conn->body_size = 0;
+}
+
+/* Join the chunks into one exactly sized buffer, freeing each chunk once
+   copied, so the peak stays near one body plus one chunk. */
+static char *body_join(ConnInfo *conn) {
+    char *buf = malloc(conn->body_size);
+    if (!buf) {
+        return NULL;
+    }
+
+    size_t offset = 0;
+    BodyChunk *chunk = conn->body_head;
+    while (chunk) {
+        BodyChunk *next = chunk->next;
+        memcpy(buf + offset, chunk->data, chunk->len);
+        offset += chunk->len;
+        free(chunk);
+        chunk = next;
+    }
+    conn->body_head = NULL;
+    conn->body_tail = NULL;
+    conn->body_size = 0;
+    return buf;
+}
+
+extern void luafan_stream_push_buffer(lua_State *L, uint8_t *buf, size_t len);
+
+/* Push the response body (string, fan.stream or nil) and release it. */
+static void body_push(lua_State *L, ConnInfo *conn) {
+    size_t size = conn->body_size;
+    if (size == 0) {
+        lua_pushnil(L);
+    } else if (conn->body_stream) {
+        char *buf = body_join(conn);
+        if (buf) {
+            luafan_stream_push_buffer(L, (uint8_t *)buf, size);
+        } else {
+            lua_pushnil(L);
+        }
+    } else if (conn->body_head == conn->body_tail) {
+        lua_pushlstring(L, conn->body_head->data, size);
+    } else {
+        char *buf = body_join(conn);
+        if (buf) {
+            lua_pushlstring(L, buf, size);
+            free(buf);
+        } else {
+            lua_pushnil(L);
+        }
+    }
+    body_free(conn);
+}
+
 static void http_getpost_complete(ConnInfo *conn) {
     if (conn->completed) {
         fprintf(stderr, "[http] WARNING: http_getpost_complete called twice on same conn\n");
@@ -194,10 +556,19 @@ static void http_getpost_complete(ConnInfo *conn) {
     lua_rawgeti(L, LUA_REGISTRYINDEX, conn->retref);
     luaL_unref(L, LUA_REGISTRYINDEX, conn->retref);
 
-    if (*conn->error != 0) {
+    if (conn->body_too_large || conn->result == CURLE_FILESIZE_EXCEEDED) {
+        lua_pushliteral(L, "response body exceeds max_body_size");
+        lua_setfield(L, -2, "error");
+    } else if (conn->output_errno) {
+        lua_pushfstring(L, "output_file: %s", strerror(conn->output_errno));
+        lua_setfield(L, -2, "error");
+    } else if (*conn->error != 0) {
         lua_pushstring(L, conn->error);
         lua_setfield(L, -2, "error");
         // LOGE("%s", conn->error);
+    } else if (conn->result != CURLE_OK) {
+        lua_pushstring(L, curl_easy_strerror(conn->result));
+        lua_setfield(L, -2, "error");
     }
 
     struct curl_slist *cookies = NULL;
@@ -221,6 +592,23 @@ static void http_getpost_complete(ConnInfo *conn) {
     long responseCode = -1;
     curl_easy_getinfo(conn->easy, CURLINFO_RESPONSE_CODE, &responseCode);
 
+    if (conn->output_fd >= 0) {
+        // a 2xx without body still replaces what a previous download left
+        if (!conn->output_started && conn->result == CURLE_OK && responseCode >= 200 && responseCode < 300 &&
+            responseCode != 206) {
+            if (ftruncate(conn->output_fd, 0) != 0) {
+                LOGE("http output_file truncate failed: %s", strerror(errno));
+            }
+        }
+        close(conn->output_fd);
+        conn->output_fd = -1;
+
+        if (conn->output_offset > 0) {
+            lua_pushnumber(L, (lua_Number)conn->output_offset);
+            lua_setfield(L, -2, "resumed_from");
+        }
+    }
+
     double dns_time = 0;
     if (curl_easy_getinfo(conn->easy, CURLINFO_NAMELOOKUP_TIME, &dns_time) == CURLE_OK) {
         lua_pushnumber(L, dns_time);
@@ -257,21 +645,42 @@ static void http_getpost_complete(ConnInfo *conn) {
         lua_setfield(L, -2, "total_time");
     }
 
-    bytearray_read_ready(&conn->input);
+    long num_connects = 0;
+    if (curl_easy_getinfo(conn->easy, CURLINFO_NUM_CONNECTS, &num_connects) == CURLE_OK) {
+        lua_pushinteger(L, num_connects);
+        lua_setfield(L, -2, "num_connects");
+    }
 
-    if (conn->input.total > 0) {
-        lua_pushlstring(L, (const char *)conn->input.buffer, conn->input.total);
-    } else {
-        //        lua_pushliteral(L, "");
-        lua_pushnil(L);
+    long http_version = 0;
+    if (curl_easy_getinfo(conn->easy, CURLINFO_HTTP_VERSION, &http_version) == CURLE_OK) {
+        switch (http_version) {
+            case CURL_HTTP_VERSION_1_0:
+                lua_pushnumber(L, 1.0);
+                break;
+            case CURL_HTTP_VERSION_1_1:
+                lua_pushnumber(L, 1.1);
+                break;
+            case CURL_HTTP_VERSION_2_0:
+                lua_pushnumber(L, 2);
+                break;
+#ifdef CURL_HTTP_VERSION_3
+            case CURL_HTTP_VERSION_3:
+                lua_pushnumber(L, 3);
+                break;
+#endif
+            default:
+                lua_pushnil(L);
+                break;
+        }
+        lua_setfield(L, -2, "http_version");
     }
+
+    body_push(L, conn);
     lua_setfield(L, -2, "body");
 
     lua_pushinteger(L, responseCode);
     lua_setfield(L, -2, "responseCode");
 
-    bytearray_dealloc(&conn->input);
-
     if (conn->onprogressref != LUA_NOREF) {
         luaL_unref(L, LUA_REGISTRYINDEX, conn->onprogressref);
         conn->onprogressref = LUA_NOREF;
@@ -337,19 +746,13 @@ static void timer_check_multi_info_cb(int fd, short kind, void *userp) {
             //            printf("DONE: %s => (%d) %s\n", eff_url, msg->data.result,
             //            conn->error);
 
+            conn->result = msg->data.result;
             http_getpost_complete(conn);
 
             curl_multi_remove_handle(multi, easy);
             //            free(conn->url);
 
-            if (conn->outputHeaders) {
-                curl_slist_free_all(conn->outputHeaders);
-            }
-            if (conn->resolve) {
-                curl_slist_free_all(conn->resolve);
-            }
-            curl_easy_cleanup(easy);
-            free(conn);
+            conn_release(conn);
         }
     }
 }
@@ -458,12 +861,69 @@ static int sock_cb(CURL *e, curl_socket_t s, int what, void *cbp, void *sockp) {
 
 static size_t filldata(char *ptr, size_t size, size_t nmemb, ConnInfo *conn) {
     if (conn->completed) return 0;
-    int i = 0;
+    size_t len = size * nmemb;
     //    fprintf(MSG_OUT, "filldata %zu %zu\n", size, nmemb);
-    for (; i < size; i++) {
-        bytearray_writebuffer(&conn->input, ptr + i * nmemb, nmemb);
+    if (conn->max_body_size > 0 && (curl_off_t)(conn->body_size + len) > conn->max_body_size) {
+        conn->body_too_large = 1;
+        return 0; // aborts the transfer with CURLE_WRITE_ERROR
     }
-    return size * nmemb;
+    if (!body_append(conn, ptr, len)) {
+        return 0;
+    }
+    return len;
+}
+
+/* output_file: write the body straight to the fd. The first write decides
+   where it goes: a 206 continues after the kept bytes, any other 2xx starts
+   the file over, and error responses are collected as a normal body. */
+static size_t writefile(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    ConnInfo *conn = (ConnInfo *)userdata;
+    if (conn->completed) return 0;
+    size_t len = size * nmemb;
+
+    if (!conn->output_started) {
+        conn->output_started = 1;
+        long code = 0;
+        curl_easy_getinfo(conn->easy, CURLINFO_RESPONSE_CODE, &code);
+        if (code < 200 || code >= 300) {
+            conn->output_skip = 1;
+        } else if (code == 206 && conn->output_offset > 0) {
+            if (lseek(conn->output_fd, conn->output_offset, SEEK_SET) < 0) {
+                conn->output_errno = errno;
+                return 0;
+            }
+        } else {
+            conn->output_offset = 0;
+            if (ftruncate(conn->output_fd, 0) != 0 || lseek(conn->output_fd, 0, SEEK_SET) < 0) {
+                conn->output_errno = errno;
+                return 0;
+            }
+        }
+    }
+
+    if (conn->output_skip) {
+        return filldata(ptr, size, nmemb, conn);
+    }
+
+    if (conn->max_body_size > 0 && conn->output_written + (curl_off_t)len > conn->max_body_size) {
+        conn->body_too_large = 1;
+        return 0;
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(conn->output_fd, ptr + done, len - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            conn->output_errno = errno;
+            return 0;
+        }
+        done += n;
+    }
+    conn->output_written += len;
+    return len;
 }
 
 static size_t fillheader(void *ptr, size_t size, size_t nmemb, void *userdata) {
@@ -581,6 +1041,27 @@ static size_t fillheader(void *ptr, size_t size, size_t nmemb, void *userdata) {
 static int onprogress(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow) {
     ConnInfo *conn = (ConnInfo *)clientp;
     if (conn->completed) return 1; // abort
+
+    if (conn->progress_interval > 0) {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        double now = tv.tv_sec + tv.tv_usec / 1000000.0;
+        int finished = dltotal > 0 && dlnow >= dltotal && (curl_off_t)dlnow != conn->progress_dlnow;
+        if (!finished && now - conn->progress_last < conn->progress_interval) {
+            return 0;
+        }
+        conn->progress_last = now;
+        conn->progress_dlnow = (curl_off_t)dlnow;
+    }
+
+    // report a resumed download against the whole file
+    if (conn->output_offset > 0) {
+        if (dltotal > 0) {
+            dltotal += conn->output_offset;
+        }
+        dlnow += conn->output_offset;
+    }
+
     lua_State *L = conn->mainthread;
 
     lua_lock(L);
@@ -788,7 +1269,12 @@ int debug_callback(CURL *curl_handle, curl_infotype infotype, char *buf, size_t
 }
 
 static int http_getpost(lua_State *L, int method) {
-    ConnInfo *conn = calloc(1, sizeof(ConnInfo));
+    ConnInfo *conn = conn_acquire();
+
+    if (!conn) {
+        luaL_error(L, "curl_easy_init() failed");
+        return 0;  // unreachable, luaL_error longjmps
+    }
 
     conn->onheaderref = LUA_NOREF;
     conn->onprogressref = LUA_NOREF;
@@ -796,20 +1282,10 @@ static int http_getpost(lua_State *L, int method) {
     conn->onwriteref = LUA_NOREF;
     conn->coref = LUA_NOREF;
     conn->bodyref = LUA_NOREF;
+    conn->output_fd = -1;
 
     int oncompleteref = LUA_NOREF;
 
-    bytearray_alloc(&conn->input, 1024);
-
-    conn->easy = curl_easy_init();
-
-    if (!conn->easy) {
-        bytearray_dealloc(&conn->input);
-        free(conn);
-        luaL_error(L, "curl_easy_init() failed");
-        return 0;  // unreachable, luaL_error longjmps
-    }
-
     //    printf("lua_gettop(L)=%d\n", lua_gettop(L));
 
     lua_newtable(L); // response
@@ -821,21 +1297,14 @@ static int http_getpost(lua_State *L, int method) {
 
     conn->retref = luaL_ref(L, LUA_REGISTRYINDEX);
 
-    curl_easy_setopt(conn->easy, CURLOPT_WRITEFUNCTION, filldata);
-    curl_easy_setopt(conn->easy, CURLOPT_WRITEDATA, conn);
-
-    curl_easy_setopt(conn->easy, CURLOPT_HEADERFUNCTION, fillheader);
-    curl_easy_setopt(conn->easy, CURLOPT_HEADERDATA, conn);
-    curl_easy_setopt(conn->easy, CURLOPT_NOSIGNAL, 1);
-
-    curl_easy_setopt(conn->easy, CURLOPT_ERRORBUFFER, conn->error);
-    curl_easy_setopt(conn->easy, CURLOPT_PRIVATE, conn);
-
     const char *err = NULL;
 
+    if (method != HTTP_GET) {
+        conn->dirty |= CONN_DIRTY_METHOD;
+    }
+
     switch (method) {
         case HTTP_GET:
-            curl_easy_setopt(conn->easy, CURLOPT_POST, 0);
             break;
         case HTTP_POST:
             curl_easy_setopt(conn->easy, CURLOPT_POST, 1);
@@ -886,6 +1355,7 @@ static int http_getpost(lua_State *L, int method) {
             curl_easy_setopt(conn->easy, CURLOPT_VERBOSE, 1);
             curl_easy_setopt(conn->easy, CURLOPT_DEBUGFUNCTION, debug_callback);
             curl_easy_setopt(conn->easy, CURLOPT_DEBUGDATA, conn);
+            conn->dirty |= CONN_DIRTY_VERBOSE;
         }
 
         lua_pushliteral(L, "dns_servers");
@@ -895,12 +1365,14 @@ static int http_getpost(lua_State *L, int method) {
                 LOGD("using dns_servers: %s", lua_tostring(L, -1));
             }
             curl_easy_setopt(conn->easy, CURLOPT_DNS_SERVERS, lua_tostring(L, -1));
+            conn->dirty |= CONN_DIRTY_DNS;
         } else if (!lua_isnil(L, -1)) {
             LOGE("invalid dns_servers type in table parameter");
         }
         else {
             if (dns_servers) {
                 curl_easy_setopt(conn->easy, CURLOPT_DNS_SERVERS, dns_servers);
+                conn->dirty |= CONN_DIRTY_DNS;
             }
         }
         lua_pop(L, 1);
@@ -911,6 +1383,7 @@ static int http_getpost(lua_State *L, int method) {
             curl_easy_setopt(conn->easy, CURLOPT_PROGRESSFUNCTION, onprogress);
             curl_easy_setopt(conn->easy, CURLOPT_PROGRESSDATA, conn);
             curl_easy_setopt(conn->easy, CURLOPT_NOPROGRESS, 0);
+            conn->dirty |= CONN_DIRTY_PROGRESS;
         } else if (lua_isnil(L, -1)) {
             conn->onprogressref = LUA_NOREF;
             lua_pop(L, 1);
@@ -919,13 +1392,12 @@ static int http_getpost(lua_State *L, int method) {
             lua_pop(L, 1);
         }
 
-        curl_easy_setopt(conn->easy, CURLOPT_LOW_SPEED_LIMIT, 1);
-
         lua_getfield(L, 1, "timeout");
         if (lua_isnumber(L, -1)) {
             curl_easy_setopt(conn->easy, CURLOPT_LOW_SPEED_TIME, lua_tointeger(L, -1));
+            conn->dirty |= CONN_DIRTY_TIMEOUT;
         } else if (lua_isnil(L, -1)) {
-            curl_easy_setopt(conn->easy, CURLOPT_LOW_SPEED_TIME, CURL_TIMEOUT_DEFAULT);
+            // default set by conn_setup_easy()
         } else {
             LOGE("invalid timeout type in table parameter");
         }
@@ -934,6 +1406,7 @@ static int http_getpost(lua_State *L, int method) {
         lua_getfield(L, 1, "conntimeout");
         if (lua_isnumber(L, -1)) {
             curl_easy_setopt(conn->easy, CURLOPT_TIMEOUT, lua_tointeger(L, -1));
+            conn->dirty |= CONN_DIRTY_TIMEOUT;
         } else if (lua_isnil(L, -1)) {
             //            curl_easy_setopt(conn->easy, CURLOPT_TIMEOUT,
             //            CURL_TIMEOUT_DEFAULT);
@@ -944,9 +1417,10 @@ static int http_getpost(lua_State *L, int method) {
 
         lua_getfield(L, 1, "ssl_verifypeer");
         if (lua_isnumber(L, -1)) {
-            curl_easy_setopt(conn->easy, CURLOPT_SSL_VERIFYPEER, lua_tonumber(L, -1));
+            curl_easy_setopt(conn->easy, CURLOPT_SSL_VERIFYPEER, (long)lua_tonumber(L, -1));
+            conn->dirty |= CONN_DIRTY_SSL;
         } else if (lua_isnil(L, -1)) {
-            curl_easy_setopt(conn->easy, CURLOPT_SSL_VERIFYPEER, 1);
+            // verify by default
         } else {
             LOGE("invalid ssl_verifypeer type in table parameter");
         }
@@ -954,9 +1428,10 @@ static int http_getpost(lua_State *L, int method) {
 
         lua_getfield(L, 1, "ssl_verifyhost");
         if (lua_isnumber(L, -1)) {
-            curl_easy_setopt(conn->easy, CURLOPT_SSL_VERIFYHOST, lua_tonumber(L, -1));
+            curl_easy_setopt(conn->easy, CURLOPT_SSL_VERIFYHOST, (long)lua_tonumber(L, -1));
+            conn->dirty |= CONN_DIRTY_SSL;
         } else if (lua_isnil(L, -1)) {
-            curl_easy_setopt(conn->easy, CURLOPT_SSL_VERIFYHOST, 2);
+            // verify by default
         } else {
             LOGE("invalid ssl_verifyhost type in table parameter");
         }
@@ -965,6 +1440,7 @@ static int http_getpost(lua_State *L, int method) {
         lua_getfield(L, 1, "sslcert");
         if (lua_isstring(L, -1)) {
             curl_easy_setopt(conn->easy, CURLOPT_SSLCERT, lua_tostring(L, -1));
+            conn->dirty |= CONN_DIRTY_SSL;
         } else if (!lua_isnil(L, -1)) {
             LOGE("invalid sslcert type in table parameter");
         }
@@ -973,6 +1449,7 @@ static int http_getpost(lua_State *L, int method) {
         lua_getfield(L, 1, "sslcertpasswd");
         if (lua_isstring(L, -1)) {
             curl_easy_setopt(conn->easy, CURLOPT_SSLCERTPASSWD, lua_tostring(L, -1));
+            conn->dirty |= CONN_DIRTY_SSL;
         } else if (!lua_isnil(L, -1)) {
             LOGE("invalid sslcertpasswd type in table parameter");
         }
@@ -981,6 +1458,7 @@ static int http_getpost(lua_State *L, int method) {
         lua_getfield(L, 1, "sslcerttype");
         if (lua_isstring(L, -1)) {
             curl_easy_setopt(conn->easy, CURLOPT_SSLCERTTYPE, lua_tostring(L, -1));
+            conn->dirty |= CONN_DIRTY_SSL;
         } else if (!lua_isnil(L, -1)) {
             LOGE("invalid sslcerttype type in table parameter");
         }
@@ -989,6 +1467,7 @@ static int http_getpost(lua_State *L, int method) {
         lua_getfield(L, 1, "sslkey");
         if (lua_isstring(L, -1)) {
             curl_easy_setopt(conn->easy, CURLOPT_SSLKEY, lua_tostring(L, -1));
+            conn->dirty |= CONN_DIRTY_SSL;
         } else if (!lua_isnil(L, -1)) {
             LOGE("invalid sslkey type in table parameter");
         }
@@ -997,6 +1476,7 @@ static int http_getpost(lua_State *L, int method) {
         lua_getfield(L, 1, "sslkeypasswd");
         if (lua_isstring(L, -1)) {
             curl_easy_setopt(conn->easy, CURLOPT_SSLKEYPASSWD, lua_tostring(L, -1));
+            conn->dirty |= CONN_DIRTY_SSL;
         } else if (!lua_isnil(L, -1)) {
             LOGE("invalid sslkeypasswd type in table parameter");
         }
@@ -1005,6 +1485,7 @@ static int http_getpost(lua_State *L, int method) {
         lua_getfield(L, 1, "sslkeytype");
         if (lua_isstring(L, -1)) {
             curl_easy_setopt(conn->easy, CURLOPT_SSLKEYTYPE, lua_tostring(L, -1));
+            conn->dirty |= CONN_DIRTY_SSL;
         } else if (!lua_isnil(L, -1)) {
             LOGE("invalid sslkeytype type in table parameter");
         }
@@ -1014,12 +1495,14 @@ static int http_getpost(lua_State *L, int method) {
         lua_gettable(L, 1);
         if (lua_isstring(L, -1)) {
             curl_easy_setopt(conn->easy, CURLOPT_CAINFO, lua_tostring(L, -1));
+            conn->dirty |= CONN_DIRTY_CA;
         } else if (!lua_isnil(L, -1)) {
             LOGE("invalid cainfo type in table parameter");
         } else {
             lua_getfield(L, LUA_REGISTRYINDEX, KEY_CAINFO);
             if (lua_isstring(L, -1)) {
                 curl_easy_setopt(conn->easy, CURLOPT_CAINFO, lua_tostring(L, -1));
+                conn->dirty |= CONN_DIRTY_CA;
             } else {
 #if TARGET_OS_IPHONE || defined(ANDROID) || defined(__ANDROID__)
 #else
@@ -1095,6 +1578,7 @@ static int http_getpost(lua_State *L, int method) {
             if (headers) {
                 curl_easy_setopt(conn->easy, CURLOPT_HTTPHEADER, headers);
                 conn->outputHeaders = headers;
+                conn->dirty |= CONN_DIRTY_HEADERS;
             }
         } else if (lua_isnil(L, -1)) {
             lua_pop(L, 1);
@@ -1104,6 +1588,7 @@ static int http_getpost(lua_State *L, int method) {
         }
 
         if (proxyType != INT16_MAX) {
+            conn->dirty |= CONN_DIRTY_PROXY;
             curl_easy_setopt(conn->easy, CURLOPT_PROXYTYPE, proxyType);
             if (proxyHost) {
                 curl_easy_setopt(conn->easy, CURLOPT_PROXY, proxyHost);
@@ -1125,6 +1610,7 @@ static int http_getpost(lua_State *L, int method) {
         lua_gettable(L, 1);
         if (lua_isnumber(L, -1)) {
             curl_easy_setopt(conn->easy, CURLOPT_HTTPPROXYTUNNEL, lua_tointeger(L, -1));
+            conn->dirty |= CONN_DIRTY_PROXY;
         } else if (!lua_isnil(L, -1)) {
             err = "invalid proxytunnel type in table parameter";
             goto ERROR;
@@ -1156,6 +1642,7 @@ static int http_getpost(lua_State *L, int method) {
 
         if (proxy && proxyport > 0) {
             LOGD("set proxy %s:%d", proxy, proxyport);
+            conn->dirty |= CONN_DIRTY_PROXY;
             curl_easy_setopt(conn->easy, CURLOPT_PROXYTYPE, CURLPROXY_HTTP);
             curl_easy_setopt(conn->easy, CURLOPT_PROXY, proxy);
             curl_easy_setopt(conn->easy, CURLOPT_PROXYPORT, proxyport);
@@ -1170,6 +1657,7 @@ static int http_getpost(lua_State *L, int method) {
             conn->onreadref = luaL_ref(L, LUA_REGISTRYINDEX);
             curl_easy_setopt(conn->easy, CURLOPT_READFUNCTION, onread);
             curl_easy_setopt(conn->easy, CURLOPT_READDATA, conn);
+            conn->dirty |= CONN_DIRTY_BODY;
         } else if (lua_isnil(L, -1)) {
             conn->onreadref = LUA_NOREF;
             lua_pop(L, 1);
@@ -1185,12 +1673,14 @@ static int http_getpost(lua_State *L, int method) {
 
                 curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDSIZE, len);
                 curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDS, data);
+                conn->dirty |= CONN_DIRTY_BODY;
             } else if (lua_isnil(L, -1)) {
                 // No body provided — for POST/PUT methods, set empty body to prevent
                 // curl from using fread() which blocks the event loop.
                 if (method == HTTP_POST || method == HTTP_PUT || method == HTTP_UPDATE) {
                     curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDSIZE, 0);
                     curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDS, "");
+                    conn->dirty |= CONN_DIRTY_BODY;
                 }
             } else {
                 err = "invalid body type in table parameter";
@@ -1245,11 +1735,84 @@ static int http_getpost(lua_State *L, int method) {
             struct curl_slist *host = curl_slist_append(NULL, resolve);
             curl_easy_setopt(conn->easy, CURLOPT_RESOLVE, host);
             conn->resolve = host;
+            conn->dirty |= CONN_DIRTY_RESOLVE;
         }
 
         lua_getfield(L, 1, "forbid_reuse");
         if (lua_isnumber(L, -1)) {
             curl_easy_setopt(conn->easy, CURLOPT_FORBID_REUSE, lua_tointeger(L, -1));
+            conn->dirty |= CONN_DIRTY_REUSE;
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, 1, "max_body_size");
+        if (lua_isnumber(L, -1)) {
+            conn->max_body_size = (curl_off_t)lua_tonumber(L, -1);
+            // rejects a larger Content-Length before any body is read
+            curl_easy_setopt(conn->easy, CURLOPT_MAXFILESIZE_LARGE, conn->max_body_size);
+            conn->dirty |= CONN_DIRTY_MAXSIZE;
+        } else if (!lua_isnil(L, -1)) {
+            err = "invalid max_body_size type in table parameter";
+            goto ERROR;
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, 1, "body_stream");
+        conn->body_stream = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+
+        lua_getfield(L, 1, "output_file");
+        if (lua_isstring(L, -1)) {
+            if (conn->onwriteref != LUA_NOREF) {
+                err = "output_file can not be used with onreceive";
+                goto ERROR;
+            }
+            conn->output_fd = open(lua_tostring(L, -1), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            if (conn->output_fd < 0) {
+                err = "can not open output_file";
+                goto ERROR;
+            }
+            curl_easy_setopt(conn->easy, CURLOPT_WRITEFUNCTION, writefile);
+            conn->progress_interval = 0.5;
+
+            lua_getfield(L, 1, "resume");
+            struct stat st;
+            if (lua_toboolean(L, -1) && fstat(conn->output_fd, &st) == 0 && st.st_size > 0) {
+                char range[32];
+                conn->output_offset = st.st_size;
+                snprintf(range, sizeof(range), "%" PRId64 "-", (int64_t)st.st_size);
+                curl_easy_setopt(conn->easy, CURLOPT_RANGE, range);
+                conn->dirty |= CONN_DIRTY_RANGE;
+            }
+            lua_pop(L, 1);
+        } else if (!lua_isnil(L, -1)) {
+            err = "invalid output_file type in table parameter";
+            goto ERROR;
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, 1, "progress_interval");
+        if (lua_isnumber(L, -1)) {
+            conn->progress_interval = lua_tonumber(L, -1);
+        }
+        lua_pop(L, 1);
+
+        /* HTTP/2: true negotiates h2 over TLS (ALPN), "prior_knowledge" speaks
+           h2c on cleartext. PIPEWAIT makes a request queue for a stream on a
+           connection that is still being set up instead of opening another. */
+        lua_getfield(L, 1, "http2");
+        if (lua_type(L, -1) == LUA_TSTRING && strcmp(lua_tostring(L, -1), "prior_knowledge") == 0) {
+            curl_easy_setopt(conn->easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE);
+            curl_easy_setopt(conn->easy, CURLOPT_PIPEWAIT, 1L);
+            conn->dirty |= CONN_DIRTY_HTTP2;
+        } else if (lua_toboolean(L, -1)) {
+            if (lua_type(L, -1) != LUA_TBOOLEAN) {
+                err = "invalid http2 value in table parameter";
+                goto ERROR;
+            }
+            curl_easy_setopt(conn->easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+            curl_easy_setopt(conn->easy, CURLOPT_PIPEWAIT, 1L);
+            conn->dirty |= CONN_DIRTY_HTTP2;
         }
         lua_pop(L, 1);
 
@@ -1258,6 +1821,7 @@ static int http_getpost(lua_State *L, int method) {
         if (lua_isstring(L, -1)) {
             curl_easy_setopt(conn->easy, CURLOPT_COOKIEJAR, lua_tostring(L, -1));
             curl_easy_setopt(conn->easy, CURLOPT_COOKIEFILE, lua_tostring(L, -1));
+            conn->cookiejar = 1;
         } else if (!lua_isnil(L, -1)) {
             err = "invalid cookiejar type in table parameter";
             goto ERROR;
@@ -1266,6 +1830,7 @@ static int http_getpost(lua_State *L, int method) {
             if (lua_isstring(L, -1)) {
                 curl_easy_setopt(conn->easy, CURLOPT_COOKIEJAR, lua_tostring(L, -1));
                 curl_easy_setopt(conn->easy, CURLOPT_COOKIEFILE, lua_tostring(L, -1));
+                conn->cookiejar = 1;
             } else {
                 curl_easy_setopt(conn->easy, CURLOPT_COOKIEJAR, "/dev/null");
                 curl_easy_setopt(conn->easy, CURLOPT_COOKIEFILE, "/dev/null");
@@ -1300,10 +1865,8 @@ static int http_getpost(lua_State *L, int method) {
         curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, NULL);
         curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, multi_timer_cb);
         curl_multi_setopt(multi, CURLMOPT_TIMERDATA, NULL);
-    }
-
-    if (share_handle) {
-        curl_easy_setopt(conn->easy, CURLOPT_SHARE, share_handle);
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+        multi_apply_limits();
     }
 
     CURLMcode rc = curl_multi_add_handle(multi, conn->easy);
@@ -1324,11 +1887,10 @@ static int http_getpost(lua_State *L, int method) {
     }
 
 ERROR:
-    if (conn->easy) {
-        curl_easy_cleanup(conn->easy);
-    }
 
-    bytearray_dealloc(&conn->input);
+    if (conn->bodyref != LUA_NOREF) {
+        luaL_unref(L, LUA_REGISTRYINDEX, conn->bodyref);
+    }
 
     if (conn->onprogressref != LUA_NOREF) {
         luaL_unref(L, LUA_REGISTRYINDEX, conn->onprogressref);
@@ -1357,7 +1919,7 @@ ERROR:
     luaL_unref(L, LUA_REGISTRYINDEX, conn->headerref);
     luaL_unref(L, LUA_REGISTRYINDEX, conn->retref);
 
-    free(conn);
+    conn_release(conn);
 
     if (err) {
         lua_unlock(L);
@@ -1454,6 +2016,68 @@ LUA_API int http_capath(lua_State *L) {
     return 0;
 }
 
+/* http.multiplex{max_concurrent_streams=, max_host_connections=} sets the
+   streams per h2 connection (0 = curl's default of 100) and connections per
+   host (0 = unlimited) on the shared multi handle; transfers over the limits
+   wait in the queue. The host limit is multi-handle wide, so it throttles
+   HTTP/1.1 requests too. */
+LUA_API int http_multiplex(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    lua_getfield(L, 1, "max_concurrent_streams");
+    if (lua_isnumber(L, -1)) {
+        multiplex_max_streams = (long)lua_tointeger(L, -1);
+    }
+    lua_pop(L, 1);
+
+    lua_getfield(L, 1, "max_host_connections");
+    if (lua_isnumber(L, -1)) {
+        multiplex_max_host_connections = (long)lua_tointeger(L, -1);
+    }
+    lua_pop(L, 1);
+
+    multi_apply_limits();
+    return 0;
+}
+
+/* http.pool{max_idle=} sets how many finished handles are kept for reuse;
+   0 disables the pool. */
+LUA_API int http_pool(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    lua_getfield(L, 1, "max_idle");
+    if (lua_isnumber(L, -1)) {
+        int max_idle = (int)lua_tointeger(L, -1);
+        pool_max_idle = max_idle > 0 ? max_idle : 0;
+        conn_pool_trim();
+    }
+    lua_pop(L, 1);
+
+    return 0;
+}
+
+LUA_API int http_pool_stats(lua_State *L) {
+    lua_newtable(L);
+
+    lua_pushinteger(L, pool_idle);
+    lua_setfield(L, -2, "idle");
+
+    lua_pushinteger(L, pool_max_idle);
+    lua_setfield(L, -2, "max_idle");
+
+    lua_pushnumber(L, (lua_Number)pool_hits);
+    lua_setfield(L, -2, "hits");
+
+    lua_pushnumber(L, (lua_Number)pool_misses);
+    lua_setfield(L, -2, "misses");
+
+    unsigned long total = pool_hits + pool_misses;
+    lua_pushnumber(L, total > 0 ? (lua_Number)pool_hits / total : 0);
+    lua_setfield(L, -2, "hit_rate");
+
+    return 1;
+}
+
 LUA_API int http_escape(lua_State *L) {
     size_t size = 0;
     const char *str = luaL_checklstring(L, 1, &size);
@@ -1489,6 +2113,9 @@ static const luaL_Reg httplib[] = {{"get", http_get},
                                    {"cookiejar", http_cookiejar},
                                    {"cainfo", http_cainfo},
                                    {"capath", http_capath},
+                                   {"multiplex", http_multiplex},
+                                   {"pool", http_pool},
+                                   {"pool_stats", http_pool_stats},
                                    {"escape", http_escape},
                                    {"unescape", http_unescape},
                                    {NULL, NULL}};
@@ -1640,7 +2267,6 @@ void cleanup_http_curl(void) {
                 lua_unlock(L);
             }
 
-            bytearray_dealloc(&conn->input);
             DecrNetworkActivity();
 
             if (mainthread) {
@@ -1648,18 +2274,18 @@ void cleanup_http_curl(void) {
             }
         }
 
-        if (conn->outputHeaders) {
-            curl_slist_free_all(conn->outputHeaders);
-        }
-        if (conn->resolve) {
-            curl_slist_free_all(conn->resolve);
-        }
         if (conn->easy) {
             curl_multi_remove_handle(multi, conn->easy);
-            curl_easy_cleanup(conn->easy);
         }
-        free(conn);
+        conn_free(conn);
+    }
+
+    while (pool_head) {
+        ConnInfo *conn = pool_head;
+        pool_head = conn->next;
+        conn_free(conn);
     }
+    pool_idle = 0;
 
     if (multi) {
         // curl_multi_cleanup invokes socket/timer callbacks to detach pending
@@ -79,6 +79,15 @@ void newtable_from_req(lua_State *L, struct evhttp_request *req) {
     request->frame_queue_len = 0;
     request->owns_request = 0;
     request->ws_cleaning_up = 0;
+    request->ws_deflate = NULL;
+    request->ws_send_fragmented = 0;
+    request->ws_recv_opcode = WS_OPCODE_CONTINUATION;
+    request->ws_recv_fragments = NULL;
+    request->remote = NULL;
+    request->metrics_started = 0;
+    request->metrics_route = 0;
+    request->metrics_code = 0;
+    request->metrics_bytes = 0;
     lua_rawseti(L, -2, 1);
 
     lua_pushvalue(L, -1);
@@ -135,28 +144,20 @@ void set_connection_header(struct evhttp_request *req, LuaServer *server) {
 // Main request dispatch
 // ============================================================
 
-static void httpd_handler_cgi_bin(struct evhttp_request *req, LuaServer *server) {
+// Run onService for `req`. With `remote` set, `req` is a main-thread copy
+// of a request parsed on a reuseport worker, and replies travel back there.
+void httpd_dispatch(LuaServer *server, struct evhttp_request *req, httpd_worker_req_t *remote) {
     metrics_update_connection();
 
-    const char* method = NULL;
-    enum evhttp_cmd_type cmd = evhttp_request_get_command(req);
-    const MethodMap *method_map;
-    for (method_map = methodMap; method_map->name; method_map++) {
-        if (cmd == method_map->cmd) {
-            method = method_map->name;
-            break;
-        }
-    }
-
-    metrics_update_request_start(method);
+    uint64_t started = metrics_update_request_start(evhttp_request_get_command(req),
+                                                    evbuffer_get_length(evhttp_request_get_input_buffer(req)));
 
     lua_State *mainthread = server->mainthread;
     lua_lock(mainthread);
     fan_cb_setup_t cbs = fan_cb_setup(mainthread, server->onServiceRef);
     if (!cbs.co) {
         lua_unlock(mainthread);
-        evhttp_send_error(req, 500, "Internal Server Error");
-        return;
+        goto fail;
     }
 
     if (!lua_isfunction(cbs.co, -1)) {
@@ -165,8 +166,7 @@ static void httpd_handler_cgi_bin(struct evhttp_request *req, LuaServer *server)
         lua_pop(cbs.co, 1);
         lua_unlock(mainthread);
         FAN_CB_CLEANUP(mainthread, cbs);
-        evhttp_send_error(req, 500, "Internal Server Error");
-        return;
+        goto fail;
     }
 
     newtable_from_req(cbs.co, req);
@@ -176,6 +176,13 @@ static void httpd_handler_cgi_bin(struct evhttp_request *req, LuaServer *server)
 
     lua_rawgeti(cbs.co, -1, 1);
     Request *request = (Request *)lua_touserdata(cbs.co, -1);
+    request->metrics_started = started;
+    if (remote) {
+        // The copy and the worker's request are released by __gc at the latest.
+        request->remote = remote;
+        luaL_getmetatable(cbs.co, LUA_EVHTTP_REMOTE_REQUEST_TYPE);
+        lua_setmetatable(cbs.co, -2);
+    }
     lua_pop(cbs.co, 1);
 
     lua_pushvalue(cbs.co, -1);
@@ -186,6 +193,21 @@ static void httpd_handler_cgi_bin(struct evhttp_request *req, LuaServer *server)
         httpd_release_conn_guard(request);
     }
     FAN_CB_CLEANUP(mainthread, cbs);
+    return;
+
+fail:
+    metrics_update_request_end(started, 0, 500, 0);
+    if (remote) {
+        Request detached = {.req = req, .remote = remote};
+        httpd_remote_post(&detached, HTTPD_REMOTE_REPLY, 500, "Internal Server Error", NULL);
+        evhttp_request_free(req);
+    } else {
+        evhttp_send_error(req, 500, "Internal Server Error");
+    }
+}
+
+static void httpd_handler_cgi_bin(struct evhttp_request *req, LuaServer *server) {
+    httpd_dispatch(server, req, NULL);
 }
 
 // ============================================================
@@ -195,6 +217,8 @@ static void httpd_handler_cgi_bin(struct evhttp_request *req, LuaServer *server)
 static const struct luaL_Reg evhttp_request_lib[] = {
     {"read", lua_evhttp_request_read},
     {"available", lua_evhttp_request_available},
+    {"body_chunks", lua_evhttp_request_body_chunks},
+    {"body_to_file", lua_evhttp_request_body_to_file},
 
     {"addheader", lua_evhttp_request_reply_addheader},
 
@@ -202,6 +226,8 @@ static const struct luaL_Reg evhttp_request_lib[] = {
     {"reply_start", lua_evhttp_request_reply_start},
     {"reply_chunk", lua_evhttp_request_reply_chunk},
     {"reply_end", lua_evhttp_request_reply_end},
+    {"reply_file", lua_evhttp_request_reply_file},
+    {"set_metrics_route", lua_evhttp_request_set_metrics_route},
 
     {"is_websocket_upgrade", lua_evhttp_request_is_websocket_upgrade},
     {"websocket_accept", lua_evhttp_request_websocket_accept},
@@ -222,6 +248,9 @@ LUA_API int lua_evhttp_server_gc(lua_State *L) {
     LuaServer *server = (LuaServer *)luaL_checkudata(L, 1, LUA_EVHTTP_SERVER_TYPE);
     CLEAR_REF(L, server->onServiceRef)
 
+    httpd_workers_close(server);
+    httpd_file_cache_clear();
+
     if (server->httpd) {
         if (server->boundsocket) {
             evhttp_del_accept_socket(server->httpd, server->boundsocket);
@@ -325,17 +354,21 @@ LUA_API int lua_evhttp_request_lookup(lua_State *L) {
         request_push_body(L, 1);
         return 1;
     } else if (strcmp(p, "remoteip") == 0) {
-        char *address = NULL;
-        ev_uint16_t port = 0;
-        evhttp_connection_get_peer(req->evcon, &address, &port);
+        char *address = req->remote_host;
+        ev_uint16_t port = req->remote_port;
+        if (req->evcon) {
+            evhttp_connection_get_peer(req->evcon, &address, &port);
+        }
 
         lua_pushstring(L, address);
 
         return 1;
     } else if (strcmp(p, "remoteport") == 0) {
-        char *address = NULL;
-        ev_uint16_t port = 0;
-        evhttp_connection_get_peer(req->evcon, &address, &port);
+        char *address = req->remote_host;
+        ev_uint16_t port = req->remote_port;
+        if (req->evcon) {
+            evhttp_connection_get_peer(req->evcon, &address, &port);
+        }
 
         lua_pushinteger(L, port);
 
@@ -396,6 +429,14 @@ static int validate_httpd_config(LuaServer *server) {
 // ============================================================
 
 void httpd_server_rebind(lua_State *L, LuaServer *server) {
+    if (server->reuseport_shards > 0) {
+        httpd_workers_close(server);
+        if (httpd_workers_open(server) != 0) {
+            server->port = 0;
+        }
+        return;
+    }
+
     struct evhttp_bound_socket *boundsocket = evhttp_bind_socket_with_handle(server->httpd, server->host, server->port);
 
     server->boundsocket = boundsocket;
@@ -453,7 +494,24 @@ LUA_API int utd_bind(lua_State *L) {
         return luaL_error(L, "Invalid server configuration parameters");
     }
 
-    struct evhttp *httpd = evhttp_new(event_mgr_base());
+    SET_INT_FROM_TABLE(L, server->reuseport_shards, 1, "reuseport_shards")
+    if (server->reuseport_shards > 0) {
+        lua_getfield(L, 1, "cert");
+        int has_cert = !lua_isnil(L, -1);
+        lua_pop(L, 1);
+        if (has_cert) {
+            return luaL_error(L, "cert is not supported with reuseport_shards");
+        }
+        if (server->reuseport_shards > EVENT_MGR_MAX_WORKERS) {
+            server->reuseport_shards = EVENT_MGR_MAX_WORKERS;
+        }
+        if (event_mgr_worker_count() == 0 && event_mgr_workers_init(server->reuseport_shards) != 0) {
+            return luaL_error(L, "failed to start %d workers", server->reuseport_shards);
+        }
+    }
+
+    // With reuseport_shards every worker runs its own evhttp instead.
+    struct evhttp *httpd = server->reuseport_shards > 0 ? NULL : evhttp_new(event_mgr_base());
 
 #if FAN_HAS_OPENSSL
     server->ctx = NULL;
@@ -465,7 +523,7 @@ LUA_API int utd_bind(lua_State *L) {
     lua_getfield(L, 1, "key");
     const char *key = lua_tostring(L, -1);
 
-    if (cert && key) {
+    if (httpd && cert && key) {
 #if OPENSSL_VERSION_NUMBER < 0x1010000fL
         SSL_CTX *ctx = SSL_CTX_new(SSLv23_server_method());
 #else
@@ -507,7 +565,11 @@ LUA_API int utd_bind(lua_State *L) {
 
     httpd_server_rebind(L, server);
 
-    if (!server->boundsocket) {
+    if (server->reuseport_shards > 0) {
+        if (!server->workers) {
+            return 0;
+        }
+    } else if (!server->boundsocket) {
 #if FAN_HAS_OPENSSL
         if (server->ctx) {
             SSL_CTX_free(server->ctx);
@@ -521,10 +583,13 @@ LUA_API int utd_bind(lua_State *L) {
 
     SET_FUNC_REF_FROM_TABLE(L, server->onServiceRef, 1, "onService")
 
-    evhttp_set_timeout(httpd, server->keep_alive_timeout + 30);
-    evhttp_set_cb(httpd, "/smoketest", smoke_request_cb, NULL);
-    evhttp_set_cb(httpd, "/metrics", metrics_request_cb, NULL);
-    evhttp_set_gencb(httpd, (void (*)(struct evhttp_request *, void *))httpd_handler_cgi_bin, server);
+    if (httpd) {
+        evhttp_set_timeout(httpd, server->keep_alive_timeout + 30);
+        evhttp_set_max_body_size(httpd, server->max_body_size);
+        evhttp_set_cb(httpd, "/smoketest", smoke_request_cb, NULL);
+        evhttp_set_cb(httpd, "/metrics", metrics_request_cb, NULL);
+        evhttp_set_gencb(httpd, (void (*)(struct evhttp_request *, void *))httpd_handler_cgi_bin, server);
+    }
 
     metrics_init();
 
@@ -558,7 +623,11 @@ LUA_API int lua_evhttp_server_rebind(lua_State *L) {
 // Lua module registration
 // ============================================================
 
-static const luaL_Reg utdlib[] = {{"bind", utd_bind}, {NULL, NULL}};
+static const luaL_Reg utdlib[] = {
+    {"bind", utd_bind},
+    {"websocket_broadcast", lua_evhttp_websocket_broadcast},
+    {NULL, NULL}
+};
 
 LUA_API int luaopen_fan_httpd_core(lua_State *L) {
     luaL_newmetatable(L, LUA_EVHTTP_REQUEST_TYPE);
@@ -568,6 +637,11 @@ LUA_API int luaopen_fan_httpd_core(lua_State *L) {
     lua_rawset(L, -3);
     lua_pop(L, 1);
 
+    luaL_newmetatable(L, LUA_EVHTTP_REMOTE_REQUEST_TYPE);
+    lua_pushcfunction(L, &lua_evhttp_remote_request_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+
     luaL_newmetatable(L, LUA_EVHTTP_SERVER_TYPE);
 
     lua_pushstring(L, "__gc");
@@ -0,0 +1,407 @@
+// httpd_file.c — req:reply_file(): static files sent from evbuffer file segments
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "httpd_internal.h"
+#include <strings.h>
+#include <pthread.h>
+
+// Open files are cached per thread in a small direct-mapped table keyed by
+// path, so a hot asset costs no open()/fstat() per request: the cached fd
+// is dup()ed into the response and evhttp hands it to sendfile. An entry is
+// trusted for HTTPD_FILE_CACHE_VALID seconds, then checked with stat() and
+// reopened if the file was replaced or modified. An entry whose file is
+// gone is dropped; a thread's entries are closed when it exits, and the
+// calling thread's when a server is closed.
+
+#define HTTPD_FILE_CACHE_SLOTS 256
+#define HTTPD_FILE_CACHE_VALID 1
+
+typedef struct {
+    char *path;  // NULL for an empty slot
+    int fd;
+    off_t size;
+    time_t mtime;
+    dev_t dev;
+    ino_t ino;
+    time_t checked;
+} httpd_file_entry_t;
+
+// Allocated on a thread's first reply_file; the key's destructor closes the
+// entries when that thread exits.
+static _Thread_local httpd_file_entry_t *file_cache = NULL;
+static pthread_key_t file_cache_key;
+static pthread_once_t file_cache_once = PTHREAD_ONCE_INIT;
+
+static const struct {
+    const char *ext;
+    const char *type;
+} httpd_mime_types[] = {
+    {"html", "text/html; charset=utf-8"},
+    {"htm", "text/html; charset=utf-8"},
+    {"css", "text/css; charset=utf-8"},
+    {"js", "application/javascript; charset=utf-8"},
+    {"mjs", "application/javascript; charset=utf-8"},
+    {"json", "application/json"},
+    {"txt", "text/plain; charset=utf-8"},
+    {"xml", "application/xml"},
+    {"svg", "image/svg+xml"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"webp", "image/webp"},
+    {"ico", "image/x-icon"},
+    {"wasm", "application/wasm"},
+    {"pdf", "application/pdf"},
+    {"mp4", "video/mp4"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {NULL, NULL},
+};
+
+static const char *httpd_file_content_type(const char *path) {
+    const char *dot = strrchr(path, '.');
+    const char *slash = strrchr(path, '/');
+    if (dot && (!slash || dot > slash)) {
+        for (int i = 0; httpd_mime_types[i].ext; i++) {
+            if (strcasecmp(dot + 1, httpd_mime_types[i].ext) == 0) {
+                return httpd_mime_types[i].type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+// ============================================================
+// File cache
+// ============================================================
+
+static uint32_t httpd_file_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    for (; *s; s++) {
+        h = (h ^ (unsigned char)*s) * 16777619u;
+    }
+    return h;
+}
+
+static void httpd_file_entry_clear(httpd_file_entry_t *entry) {
+    if (entry->path) {
+        close(entry->fd);
+        free(entry->path);
+        entry->path = NULL;
+    }
+}
+
+static void httpd_file_cache_free(void *arg) {
+    httpd_file_entry_t *cache = (httpd_file_entry_t *)arg;
+    for (int i = 0; i < HTTPD_FILE_CACHE_SLOTS; i++) {
+        httpd_file_entry_clear(&cache[i]);
+    }
+    free(cache);
+}
+
+static void httpd_file_cache_key_init(void) {
+    pthread_key_create(&file_cache_key, httpd_file_cache_free);
+}
+
+static httpd_file_entry_t *httpd_file_cache(void) {
+    if (!file_cache) {
+        pthread_once(&file_cache_once, httpd_file_cache_key_init);
+        file_cache = calloc(HTTPD_FILE_CACHE_SLOTS, sizeof(httpd_file_entry_t));
+        if (file_cache) {
+            pthread_setspecific(file_cache_key, file_cache);
+        }
+    }
+    return file_cache;
+}
+
+void httpd_file_cache_clear(void) {
+    if (file_cache) {
+        for (int i = 0; i < HTTPD_FILE_CACHE_SLOTS; i++) {
+            httpd_file_entry_clear(&file_cache[i]);
+        }
+    }
+}
+
+static int httpd_file_entry_current(const httpd_file_entry_t *entry, const struct stat *st) {
+    return st->st_dev == entry->dev && st->st_ino == entry->ino &&
+           st->st_size == entry->size && st->st_mtime == entry->mtime;
+}
+
+// Cache entry for `path` holding an open fd, or NULL with errno set.
+static httpd_file_entry_t *httpd_file_open(const char *path) {
+    httpd_file_entry_t *cache = httpd_file_cache();
+    if (!cache) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    httpd_file_entry_t *entry = &cache[httpd_file_hash(path) % HTTPD_FILE_CACHE_SLOTS];
+    time_t now = time(NULL);
+
+    if (entry->path && strcmp(entry->path, path) == 0) {
+        if (now - entry->checked < HTTPD_FILE_CACHE_VALID) {
+            return entry;
+        }
+        struct stat st;
+        if (stat(path, &st) == 0 && httpd_file_entry_current(entry, &st)) {
+            entry->checked = now;
+            return entry;
+        }
+        // Replaced or gone: do not keep a deleted file open.
+        httpd_file_entry_clear(entry);
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return NULL;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        errno = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+        return NULL;
+    }
+
+    char *owned = strdup(path);
+    if (!owned) {
+        close(fd);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    httpd_file_entry_clear(entry);
+    entry->path = owned;
+    entry->fd = fd;
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtime;
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->checked = now;
+    return entry;
+}
+
+// ============================================================
+// Conditional and range requests
+// ============================================================
+
+static void httpd_http_date(time_t t, char *out, size_t len) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(out, len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+static int httpd_parse_http_date(const char *value, time_t *out) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end || *end) {
+        return 0;
+    }
+    *out = timegm(&tm);
+    return 1;
+}
+
+static int httpd_parse_offset(const char **p, off_t *out) {
+    const char *s = *p;
+    if (!isdigit((unsigned char)*s)) return 0;
+    off_t value = 0;
+    for (; isdigit((unsigned char)*s); s++) {
+        if (value > (INT64_MAX - 9) / 10) return 0;
+        value = value * 10 + (*s - '0');
+    }
+    *p = s;
+    *out = value;
+    return 1;
+}
+
+// Resolve a single "bytes=" range against a file of `size` bytes into the
+// inclusive [*first, *last]. Returns 1 for a satisfiable range, -1 if it
+// cannot be satisfied, and 0 if the header is to be ignored (malformed or
+// asking for several ranges), in which case the whole file is sent.
+static int httpd_parse_range(const char *value, off_t size, off_t *first, off_t *last) {
+    if (strncasecmp(value, "bytes=", 6) != 0) return 0;
+    const char *p = value + 6;
+    while (*p == ' ') p++;
+
+    off_t a = 0, b = 0;
+    if (*p == '-') {
+        p++;
+        if (!httpd_parse_offset(&p, &b)) return 0;
+        while (*p == ' ') p++;
+        if (*p) return 0;
+        if (b == 0 || size == 0) return -1;
+        *first = b >= size ? 0 : size - b;
+        *last = size - 1;
+        return 1;
+    }
+
+    if (!httpd_parse_offset(&p, &a) || *p++ != '-') return 0;
+    int open_ended = !httpd_parse_offset(&p, &b);
+    while (*p == ' ') p++;
+    if (*p) return 0;
+    if (!open_ended && b < a) return 0;
+    if (a >= size) return -1;
+
+    *first = a;
+    *last = (open_ended || b >= size) ? size - 1 : b;
+    return 1;
+}
+
+// ============================================================
+// Lua API
+// ============================================================
+
+LUA_API int lua_evhttp_request_reply_file(lua_State *L) {
+    Request *request = request_from_table(L, 1);
+    if (!request->req) {
+        return luaL_error(L, "connection closed by peer");
+    }
+    switch (request->reply_status) {
+        case REPLY_STATUS_REPLYED:
+            return luaL_error(L, "reply has completed already.");
+        case REPLY_STATUS_REPLY_START:
+            return luaL_error(L, "reply has started already.");
+        default:
+            break;
+    }
+
+    int code = (int)luaL_optinteger(L, 2, 200);
+    const char *path = luaL_checkstring(L, 3);
+
+    const char *content_type = NULL;
+    const char *range = NULL;
+    int use_range = 1;
+    if (lua_istable(L, 4)) {
+        lua_getfield(L, 4, "content_type");
+        content_type = lua_tostring(L, -1);
+        lua_getfield(L, 4, "range");
+        if (lua_isboolean(L, -1)) {
+            use_range = lua_toboolean(L, -1);
+        } else {
+            range = lua_tostring(L, -1);
+        }
+        lua_pop(L, 2);
+    }
+
+    httpd_file_entry_t *entry = httpd_file_open(path);
+    if (!entry) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+
+    struct evhttp_request *req = request->req;
+    struct evkeyvalq *input = evhttp_request_get_input_headers(req);
+    struct evkeyvalq *output = evhttp_request_get_output_headers(req);
+    enum evhttp_cmd_type cmd = evhttp_request_get_command(req);
+    int is_head = cmd == EVHTTP_REQ_HEAD;
+
+    int status = code;
+    off_t first = 0;
+    off_t length = entry->size;
+    char header[128];
+
+    if (code == 200 && (cmd == EVHTTP_REQ_GET || is_head)) {
+        const char *since = evhttp_find_header(input, "If-Modified-Since");
+        time_t since_time;
+        if (!range && use_range) {
+            range = evhttp_find_header(input, "Range");
+        }
+
+        if (since && httpd_parse_http_date(since, &since_time) && entry->mtime <= since_time) {
+            status = 304;
+            length = 0;
+        } else if (range && use_range) {
+            off_t last = 0;
+            int rc = httpd_parse_range(range, entry->size, &first, &last);
+            if (rc > 0) {
+                status = 206;
+                length = last - first + 1;
+                snprintf(header, sizeof(header), "bytes %lld-%lld/%lld",
+                         (long long)first, (long long)last, (long long)entry->size);
+                evhttp_add_header(output, "Content-Range", header);
+            } else if (rc < 0) {
+                status = 416;
+                length = 0;
+                snprintf(header, sizeof(header), "bytes */%lld", (long long)entry->size);
+                evhttp_add_header(output, "Content-Range", header);
+            }
+        }
+    }
+
+    httpd_http_date(entry->mtime, header, sizeof(header));
+    evhttp_add_header(output, "Last-Modified", header);
+    evhttp_add_header(output, "Accept-Ranges", "bytes");
+    if (status != 304 && status != 416 && !evhttp_find_header(output, "Content-Type")) {
+        evhttp_add_header(output, "Content-Type", content_type ? content_type : httpd_file_content_type(path));
+    }
+
+    LuaServer *server = NULL;
+    lua_getfield(L, LUA_REGISTRYINDEX, "httpd_server");
+    if (!lua_isnil(L, -1)) {
+        server = (LuaServer *)lua_touserdata(L, -1);
+    }
+    lua_pop(L, 1);
+
+    if (server) {
+        set_connection_header(req, server);
+    } else {
+        evhttp_add_header(output, "Connection", "close");
+    }
+
+    struct evbuffer *buf = evbuffer_new();
+    if (!buf) {
+        return luaL_error(L, "Failed to create response buffer");
+    }
+
+    if (is_head && length > 0) {
+        // evhttp would write a body if we gave it one, so only announce it.
+        snprintf(header, sizeof(header), "%lld", (long long)length);
+        evhttp_add_header(output, "Content-Length", header);
+    } else if (length > 0) {
+        // Tagged as draining to a socket, the segment stays a sendfile()
+        // reference instead of being mapped; TLS has to read the bytes.
+#if FAN_HAS_OPENSSL
+        if (server && !server->ctx) {
+#else
+        if (server) {
+#endif
+            evbuffer_set_flags(buf, EVBUFFER_FLAG_DRAINS_TO_FD);
+        }
+        int fd = dup(entry->fd);
+        if (fd < 0 || evbuffer_add_file(buf, fd, first, length) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            evbuffer_free(buf);
+            lua_pushnil(L);
+            lua_pushstring(L, "failed to attach file to response");
+            return 2;
+        }
+    }
+
+    if (request->remote) {
+        httpd_remote_post(request, HTTPD_REMOTE_REPLY, status, NULL, buf);
+    } else {
+        evhttp_send_reply(req, status, NULL, buf);
+        evbuffer_free(buf);
+    }
+
+    request->reply_status = REPLY_STATUS_REPLYED;
+    httpd_release_conn_guard(request);
+
+    metrics_update_request_end(request->metrics_started, request->metrics_route, status, (size_t)length);
+
+    lua_pushinteger(L, status);
+    return 1;
+}
@@ -3,6 +3,7 @@
 
 #include "utlua.h"
 #include "platform.h"
+#include "websocket_deflate.h"
 #include <stdarg.h>
 #include <time.h>
 #include <arpa/inet.h>
@@ -36,6 +37,7 @@
 
 #define LUA_EVHTTP_REQUEST_TYPE "EVHTTP_REQUEST_TYPE"
 #define LUA_EVHTTP_SERVER_TYPE "EVHTTP_SERVER_TYPE"
+#define LUA_EVHTTP_REMOTE_REQUEST_TYPE "EVHTTP_REMOTE_REQUEST_TYPE"
 
 // ============================================================
 // Enumerations
@@ -84,6 +86,9 @@ typedef struct ws_frame_node {
     struct ws_frame_node *next;
 } ws_frame_node_t;
 
+typedef struct httpd_worker_group httpd_worker_group_t;
+typedef struct httpd_worker_req httpd_worker_req_t;
+
 typedef struct {
     lua_State *mainthread;
     struct evhttp *httpd;
@@ -98,6 +103,8 @@ typedef struct {
     int keep_alive_timeout;
     int max_keep_alive_requests;
     size_t max_body_size;
+    int reuseport_shards;                  // per-worker evhttp instances, 0 = main loop only
+    httpd_worker_group_t *workers;
 } LuaServer;
 
 typedef struct {
@@ -115,6 +122,15 @@ typedef struct {
     int frame_queue_len;
     int owns_request;
     volatile int ws_cleaning_up;
+    ws_deflate_t *ws_deflate;              // permessage-deflate, NULL if not negotiated
+    int ws_send_fragmented;                // inside an outgoing fragmented message
+    websocket_opcode_t ws_recv_opcode;     // opcode of the compressed message being joined
+    struct evbuffer *ws_recv_fragments;    // compressed fragments received so far
+    httpd_worker_req_t *remote;            // worker holding the real request, NULL once released
+    uint64_t metrics_started;              // dispatch time, for the latency histogram
+    int metrics_route;                     // route label id, see req:set_metrics_route()
+    int metrics_code;                      // status of a chunked reply
+    size_t metrics_bytes;                  // body bytes of a chunked reply
 } Request;
 
 typedef struct {
@@ -156,6 +172,7 @@ void httpd_log(log_level_t level, const char* format, ...);
 
 void httpd_release_conn_guard(Request *request);
 void newtable_from_req(lua_State *L, struct evhttp_request *req);
+void httpd_dispatch(LuaServer *server, struct evhttp_request *req, httpd_worker_req_t *remote);
 void set_connection_header(struct evhttp_request *req, LuaServer *server);
 
 // ============================================================
@@ -163,8 +180,9 @@ void set_connection_header(struct evhttp_request *req, LuaServer *server);
 // ============================================================
 
 void metrics_init(void);
-void metrics_update_request_start(const char *method);
-void metrics_update_request_end(int status_code, size_t bytes_sent);
+int metrics_route_id(const char *label);
+uint64_t metrics_update_request_start(enum evhttp_cmd_type cmd, size_t bytes_received);
+void metrics_update_request_end(uint64_t started_us, int route, int status_code, size_t bytes_sent);
 void metrics_update_connection(void);
 
 // Metrics endpoint callbacks
@@ -179,11 +197,47 @@ int request_push_body(lua_State *L, int idx);
 
 LUA_API int lua_evhttp_request_available(lua_State *L);
 LUA_API int lua_evhttp_request_read(lua_State *L);
+LUA_API int lua_evhttp_request_body_chunks(lua_State *L);
+LUA_API int lua_evhttp_request_body_to_file(lua_State *L);
 LUA_API int lua_evhttp_request_reply(lua_State *L);
 LUA_API int lua_evhttp_request_reply_addheader(lua_State *L);
 LUA_API int lua_evhttp_request_reply_start(lua_State *L);
 LUA_API int lua_evhttp_request_reply_chunk(lua_State *L);
 LUA_API int lua_evhttp_request_reply_end(lua_State *L);
+LUA_API int lua_evhttp_request_set_metrics_route(lua_State *L);
+
+// ============================================================
+// httpd_file.c exports
+// ============================================================
+
+LUA_API int lua_evhttp_request_reply_file(lua_State *L);
+// Close the calling thread's cached reply_file fds.
+void httpd_file_cache_clear(void);
+
+// ============================================================
+// httpd_workers.c exports
+// ============================================================
+
+typedef enum {
+    HTTPD_REMOTE_REPLY,
+    HTTPD_REMOTE_REPLY_START,
+    HTTPD_REMOTE_REPLY_CHUNK,
+    HTTPD_REMOTE_REPLY_END,
+    HTTPD_REMOTE_RELEASE
+} httpd_remote_op_t;
+
+// Open `server->reuseport_shards` SO_REUSEPORT listeners, each served by
+// its own evhttp on a worker base. Returns 0 and sets server->port.
+int httpd_workers_open(LuaServer *server);
+void httpd_workers_close(LuaServer *server);
+
+// Hand a reply step for a worker-parsed request back to its worker.
+// Takes ownership of `body` (may be NULL). REPLY and REPLY_END finish the
+// request and release it.
+void httpd_remote_post(Request *request, httpd_remote_op_t op, int code,
+                       const char *reason, struct evbuffer *body);
+
+LUA_API int lua_evhttp_remote_request_gc(lua_State *L);
 
 // ============================================================
 // httpd_websocket.c exports
@@ -202,5 +256,6 @@ LUA_API int lua_evhttp_request_websocket_pong(lua_State *L);
 LUA_API int lua_evhttp_request_websocket_close(lua_State *L);
 LUA_API int lua_evhttp_request_websocket_state(lua_State *L);
 LUA_API int lua_evhttp_request_websocket_receive(lua_State *L);
+LUA_API int lua_evhttp_websocket_broadcast(lua_State *L);
 
 #endif // HTTPD_INTERNAL_H
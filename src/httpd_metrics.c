@@ -1,86 +1,277 @@
 // httpd_metrics.c — Prometheus-style metrics collection and /metrics endpoint
 
 #include "httpd_internal.h"
+#include <pthread.h>
+#include <stdatomic.h>
 
 // ============================================================
-// Metrics structure and global instance
+// Metrics storage
 // ============================================================
 
+// Every thread that records metrics gets its own cache-line aligned shard,
+// so request accounting never shares a line with another thread; a scrape
+// adds the shards up. Counters are relaxed atomics: uncontended on their
+// owning thread, still exact for threads beyond METRICS_MAX_SHARDS, which
+// share the last shard.
+
+#define METRICS_MAX_SHARDS 8
+#define METRICS_MAX_ROUTES 64
+#define METRICS_ROUTE_LEN 128
+
+// Latency buckets are log-linear: two per power of two, with upper bounds
+// 64, 96, 128, 192, 256 ... microseconds, the last finite one about 25s.
+#define METRICS_BUCKET_MIN_SHIFT 6
+#define METRICS_BUCKETS 38
+
+enum {
+    METRIC_REQUESTS_TOTAL,
+    METRIC_REQUESTS_ENDED,
+    METRIC_BYTES_SENT,
+    METRIC_BYTES_RECEIVED,
+    METRIC_ERRORS,
+    METRIC_MEMORY_ALLOCATED,
+    METRIC_CONNECTIONS,
+    METRIC_KEEPALIVE_REUSED,
+    METRIC_REQUESTS_GET,
+    METRIC_REQUESTS_POST,
+    METRIC_REQUESTS_PUT,
+    METRIC_REQUESTS_DELETE,
+    METRIC_REQUESTS_OTHER,
+    METRIC_RESPONSES_2XX,
+    METRIC_RESPONSES_3XX,
+    METRIC_RESPONSES_4XX,
+    METRIC_RESPONSES_5XX,
+    METRIC_COUNTERS
+};
+
+// Status classes 1xx..5xx.
+#define METRICS_CLASSES 5
+
+typedef struct {
+    atomic_ulong buckets[METRICS_BUCKETS + 1];  // last one is +Inf
+    atomic_ulong sum_us;
+} metrics_histogram_t;
+
+typedef struct {
+    metrics_histogram_t classes[METRICS_CLASSES];
+} metrics_route_t;
+
 typedef struct {
-    unsigned long requests_total;
-    unsigned long requests_active;
-    unsigned long bytes_sent;
-    unsigned long bytes_received;
-    unsigned long errors_total;
-    unsigned long memory_allocated;
-    unsigned long connections_total;
-    unsigned long keepalive_reused;
-    time_t start_time;
-
-    unsigned long requests_get;
-    unsigned long requests_post;
-    unsigned long requests_put;
-    unsigned long requests_delete;
-    unsigned long requests_other;
-
-    unsigned long responses_2xx;
-    unsigned long responses_3xx;
-    unsigned long responses_4xx;
-    unsigned long responses_5xx;
-} httpd_metrics_t;
-
-static httpd_metrics_t g_metrics = {0};
+    _Alignas(64) atomic_ulong counters[METRIC_COUNTERS];
+    _Atomic(metrics_route_t *) routes[METRICS_MAX_ROUTES];  // allocated on first use
+} metrics_shard_t;
+
+static metrics_shard_t g_shards[METRICS_MAX_SHARDS];
+static atomic_int g_shard_count;
+static _Thread_local metrics_shard_t *tls_shard;
+
+// Route labels, already escaped for the exposition format. Entries are
+// immutable once published through g_route_count; id 0 collects requests
+// without a label (and labels beyond METRICS_MAX_ROUTES).
+static char g_route_labels[METRICS_MAX_ROUTES][METRICS_ROUTE_LEN] = {"*"};
+static uint32_t g_route_hashes[METRICS_MAX_ROUTES];
+static atomic_int g_route_count = 1;
+
+static pthread_mutex_t g_metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static time_t g_start_time;
+
+static metrics_shard_t *metrics_shard(void) {
+    metrics_shard_t *shard = tls_shard;
+    if (shard) {
+        return shard;
+    }
+
+    pthread_mutex_lock(&g_metrics_lock);
+    int count = atomic_load_explicit(&g_shard_count, memory_order_relaxed);
+    if (count < METRICS_MAX_SHARDS) {
+        shard = &g_shards[count];
+        atomic_store_explicit(&g_shard_count, count + 1, memory_order_release);
+    } else {
+        shard = &g_shards[METRICS_MAX_SHARDS - 1];
+    }
+    pthread_mutex_unlock(&g_metrics_lock);
+
+    tls_shard = shard;
+    return shard;
+}
+
+static inline void metrics_add(metrics_shard_t *shard, int counter, unsigned long value) {
+    atomic_fetch_add_explicit(&shard->counters[counter], value, memory_order_relaxed);
+}
+
+static metrics_route_t *metrics_shard_route(metrics_shard_t *shard, int route) {
+    metrics_route_t *entry = atomic_load_explicit(&shard->routes[route], memory_order_acquire);
+    if (entry) {
+        return entry;
+    }
+    entry = calloc(1, sizeof(metrics_route_t));
+    if (!entry) {
+        return NULL;
+    }
+    metrics_route_t *expected = NULL;
+    if (!atomic_compare_exchange_strong_explicit(&shard->routes[route], &expected, entry,
+                                                 memory_order_acq_rel, memory_order_acquire)) {
+        free(entry);
+        return expected;
+    }
+    return entry;
+}
+
+static int metrics_bucket(uint64_t us) {
+    if (us <= (1u << METRICS_BUCKET_MIN_SHIFT)) {
+        return 0;
+    }
+    // us lies in (2^k, 2^(k+1)]: the lower half of that octave ends at 1.5 * 2^k.
+    int k = 63 - __builtin_clzll(us - 1);
+    int bucket = 2 * (k - METRICS_BUCKET_MIN_SHIFT) + (us <= (3ull << (k - 1)) ? 1 : 2);
+    return bucket < METRICS_BUCKETS ? bucket : METRICS_BUCKETS;
+}
+
+static uint64_t metrics_bucket_bound(int bucket) {
+    uint64_t base = (bucket % 2) ? 96 : 64;
+    return base << (bucket / 2);
+}
+
+static uint64_t metrics_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t metrics_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    for (; *s; s++) {
+        h = (h ^ (unsigned char)*s) * 16777619u;
+    }
+    return h;
+}
 
 // ============================================================
 // Metrics update functions
 // ============================================================
 
 void metrics_init(void) {
-    memset(&g_metrics, 0, sizeof(g_metrics));
-    g_metrics.start_time = time(NULL);
+    pthread_mutex_lock(&g_metrics_lock);
+    if (!g_start_time) {
+        g_start_time = time(NULL);
+    }
+    pthread_mutex_unlock(&g_metrics_lock);
 }
 
-void metrics_update_request_start(const char* method) {
-    g_metrics.requests_total++;
-    g_metrics.requests_active++;
-
-    if (method) {
-        if (strcmp(method, "GET") == 0) {
-            g_metrics.requests_get++;
-        } else if (strcmp(method, "POST") == 0) {
-            g_metrics.requests_post++;
-        } else if (strcmp(method, "PUT") == 0) {
-            g_metrics.requests_put++;
-        } else if (strcmp(method, "DELETE") == 0) {
-            g_metrics.requests_delete++;
+// Route id for `label`, registering it on first use.
+int metrics_route_id(const char *label) {
+    char escaped[METRICS_ROUTE_LEN];
+    size_t n = 0;
+    for (const char *p = label; *p && n + 2 < sizeof(escaped); p++) {
+        if (*p == '\\' || *p == '"') {
+            escaped[n++] = '\\';
+            escaped[n++] = *p;
+        } else if (*p == '\n') {
+            escaped[n++] = '\\';
+            escaped[n++] = 'n';
         } else {
-            g_metrics.requests_other++;
+            escaped[n++] = *p;
+        }
+    }
+    escaped[n] = '\0';
+    uint32_t hash = metrics_hash(escaped);
+
+    int count = atomic_load_explicit(&g_route_count, memory_order_acquire);
+    for (int i = 0; i < count; i++) {
+        if (g_route_hashes[i] == hash && strcmp(g_route_labels[i], escaped) == 0) {
+            return i;
         }
     }
+
+    pthread_mutex_lock(&g_metrics_lock);
+    int id = 0;
+    count = atomic_load_explicit(&g_route_count, memory_order_relaxed);
+    for (int i = 0; i < count; i++) {
+        if (g_route_hashes[i] == hash && strcmp(g_route_labels[i], escaped) == 0) {
+            id = i;
+            break;
+        }
+    }
+    if (id == 0 && count < METRICS_MAX_ROUTES && strcmp(escaped, g_route_labels[0]) != 0) {
+        id = count;
+        memcpy(g_route_labels[id], escaped, n + 1);
+        g_route_hashes[id] = hash;
+        atomic_store_explicit(&g_route_count, count + 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&g_metrics_lock);
+    return id;
 }
 
-void metrics_update_request_end(int status_code, size_t bytes_sent) {
-    if (g_metrics.requests_active > 0) {
-        g_metrics.requests_active--;
+uint64_t metrics_update_request_start(enum evhttp_cmd_type cmd, size_t bytes_received) {
+    metrics_shard_t *shard = metrics_shard();
+    metrics_add(shard, METRIC_REQUESTS_TOTAL, 1);
+    metrics_add(shard, METRIC_BYTES_RECEIVED, bytes_received);
+
+    switch (cmd) {
+        case EVHTTP_REQ_GET:
+            metrics_add(shard, METRIC_REQUESTS_GET, 1);
+            break;
+        case EVHTTP_REQ_POST:
+            metrics_add(shard, METRIC_REQUESTS_POST, 1);
+            break;
+        case EVHTTP_REQ_PUT:
+            metrics_add(shard, METRIC_REQUESTS_PUT, 1);
+            break;
+        case EVHTTP_REQ_DELETE:
+            metrics_add(shard, METRIC_REQUESTS_DELETE, 1);
+            break;
+        default:
+            metrics_add(shard, METRIC_REQUESTS_OTHER, 1);
+            break;
     }
 
-    g_metrics.bytes_sent += bytes_sent;
+    return metrics_now_us();
+}
+
+void metrics_update_request_end(uint64_t started_us, int route, int status_code, size_t bytes_sent) {
+    metrics_shard_t *shard = metrics_shard();
+    metrics_add(shard, METRIC_REQUESTS_ENDED, 1);
+    metrics_add(shard, METRIC_BYTES_SENT, bytes_sent);
 
     if (status_code >= 200 && status_code < 300) {
-        g_metrics.responses_2xx++;
+        metrics_add(shard, METRIC_RESPONSES_2XX, 1);
     } else if (status_code >= 300 && status_code < 400) {
-        g_metrics.responses_3xx++;
+        metrics_add(shard, METRIC_RESPONSES_3XX, 1);
     } else if (status_code >= 400 && status_code < 500) {
-        g_metrics.responses_4xx++;
-        g_metrics.errors_total++;
+        metrics_add(shard, METRIC_RESPONSES_4XX, 1);
+        metrics_add(shard, METRIC_ERRORS, 1);
     } else if (status_code >= 500) {
-        g_metrics.responses_5xx++;
-        g_metrics.errors_total++;
+        metrics_add(shard, METRIC_RESPONSES_5XX, 1);
+        metrics_add(shard, METRIC_ERRORS, 1);
+    }
+
+    if (!started_us) {
+        return;
+    }
+    if (route < 0 || route >= METRICS_MAX_ROUTES) {
+        route = 0;
+    }
+    metrics_route_t *entry = metrics_shard_route(shard, route);
+    if (!entry) {
+        return;
+    }
+
+    int cls = status_code / 100 - 1;
+    if (cls < 0) {
+        cls = 0;
+    } else if (cls >= METRICS_CLASSES) {
+        cls = METRICS_CLASSES - 1;
     }
+
+    uint64_t now = metrics_now_us();
+    uint64_t elapsed = now > started_us ? now - started_us : 0;
+    metrics_histogram_t *hist = &entry->classes[cls];
+    atomic_fetch_add_explicit(&hist->buckets[metrics_bucket(elapsed)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum_us, elapsed, memory_order_relaxed);
 }
 
 void metrics_update_connection(void) {
-    g_metrics.connections_total++;
+    metrics_add(metrics_shard(), METRIC_CONNECTIONS, 1);
 }
 
 // ============================================================
@@ -96,6 +287,59 @@ void smoke_request_cb(struct evhttp_request *req, void *arg) {
 // Metrics endpoint
 // ============================================================
 
+static void metrics_add_histograms(struct evbuffer *buf, int shards) {
+    static const char *class_names[METRICS_CLASSES] = {"1xx", "2xx", "3xx", "4xx", "5xx"};
+    int routes = atomic_load_explicit(&g_route_count, memory_order_acquire);
+
+    evbuffer_add_printf(buf,
+        "\n# HELP httpd_request_duration_seconds Time from request dispatch to the end of the reply.\n"
+        "# TYPE httpd_request_duration_seconds histogram\n");
+
+    for (int r = 0; r < routes; r++) {
+        for (int c = 0; c < METRICS_CLASSES; c++) {
+            unsigned long buckets[METRICS_BUCKETS + 1] = {0};
+            unsigned long sum_us = 0;
+            int seen = 0;
+            for (int s = 0; s < shards; s++) {
+                metrics_route_t *entry = atomic_load_explicit(&g_shards[s].routes[r], memory_order_acquire);
+                if (!entry) {
+                    continue;
+                }
+                metrics_histogram_t *hist = &entry->classes[c];
+                for (int b = 0; b <= METRICS_BUCKETS; b++) {
+                    buckets[b] += atomic_load_explicit(&hist->buckets[b], memory_order_relaxed);
+                }
+                sum_us += atomic_load_explicit(&hist->sum_us, memory_order_relaxed);
+                seen = 1;
+            }
+
+            unsigned long total = 0;
+            for (int b = 0; b <= METRICS_BUCKETS; b++) {
+                total += buckets[b];
+            }
+            if (!seen || total == 0) {
+                continue;
+            }
+
+            const char *route = g_route_labels[r];
+            unsigned long cumulative = 0;
+            for (int b = 0; b < METRICS_BUCKETS; b++) {
+                cumulative += buckets[b];
+                evbuffer_add_printf(buf,
+                    "httpd_request_duration_seconds_bucket{route=\"%s\",code=\"%s\",le=\"%.6f\"} %lu\n",
+                    route, class_names[c], metrics_bucket_bound(b) / 1e6, cumulative);
+            }
+            evbuffer_add_printf(buf,
+                "httpd_request_duration_seconds_bucket{route=\"%s\",code=\"%s\",le=\"+Inf\"} %lu\n"
+                "httpd_request_duration_seconds_sum{route=\"%s\",code=\"%s\"} %.6f\n"
+                "httpd_request_duration_seconds_count{route=\"%s\",code=\"%s\"} %lu\n",
+                route, class_names[c], total,
+                route, class_names[c], sum_us / 1e6,
+                route, class_names[c], total);
+        }
+    }
+}
+
 void metrics_request_cb(struct evhttp_request *req, void *arg) {
     (void)arg;
     struct evbuffer *buf = evbuffer_new();
@@ -104,8 +348,19 @@ void metrics_request_cb(struct evhttp_request *req, void *arg) {
         return;
     }
 
+    unsigned long totals[METRIC_COUNTERS] = {0};
+    int shards = atomic_load_explicit(&g_shard_count, memory_order_acquire);
+    for (int s = 0; s < shards; s++) {
+        for (int i = 0; i < METRIC_COUNTERS; i++) {
+            totals[i] += atomic_load_explicit(&g_shards[s].counters[i], memory_order_relaxed);
+        }
+    }
+    unsigned long active = totals[METRIC_REQUESTS_TOTAL] > totals[METRIC_REQUESTS_ENDED]
+                               ? totals[METRIC_REQUESTS_TOTAL] - totals[METRIC_REQUESTS_ENDED]
+                               : 0;
+
     time_t now = time(NULL);
-    time_t uptime = now - g_metrics.start_time;
+    time_t uptime = g_start_time ? now - g_start_time : 0;
 
     evbuffer_add_printf(buf,
         "# HTTPD Server Metrics\n"
@@ -130,26 +385,28 @@ void metrics_request_cb(struct evhttp_request *req, void *arg) {
         "responses_4xx_total %lu\n"
         "responses_5xx_total %lu\n",
         (long)uptime,
-        g_metrics.requests_total,
-        g_metrics.requests_active,
-        g_metrics.bytes_sent,
-        g_metrics.bytes_received,
-        g_metrics.errors_total,
-        g_metrics.memory_allocated,
-        g_metrics.connections_total,
-        g_metrics.keepalive_reused,
-        g_metrics.requests_get,
-        g_metrics.requests_post,
-        g_metrics.requests_put,
-        g_metrics.requests_delete,
-        g_metrics.requests_other,
-        g_metrics.responses_2xx,
-        g_metrics.responses_3xx,
-        g_metrics.responses_4xx,
-        g_metrics.responses_5xx
+        totals[METRIC_REQUESTS_TOTAL],
+        active,
+        totals[METRIC_BYTES_SENT],
+        totals[METRIC_BYTES_RECEIVED],
+        totals[METRIC_ERRORS],
+        totals[METRIC_MEMORY_ALLOCATED],
+        totals[METRIC_CONNECTIONS],
+        totals[METRIC_KEEPALIVE_REUSED],
+        totals[METRIC_REQUESTS_GET],
+        totals[METRIC_REQUESTS_POST],
+        totals[METRIC_REQUESTS_PUT],
+        totals[METRIC_REQUESTS_DELETE],
+        totals[METRIC_REQUESTS_OTHER],
+        totals[METRIC_RESPONSES_2XX],
+        totals[METRIC_RESPONSES_3XX],
+        totals[METRIC_RESPONSES_4XX],
+        totals[METRIC_RESPONSES_5XX]
     );
 
-    evhttp_add_header(req->output_headers, "Content-Type", "text/plain; charset=utf-8");
+    metrics_add_histograms(buf, shards);
+
+    evhttp_add_header(req->output_headers, "Content-Type", "text/plain; version=0.0.4; charset=utf-8");
     evhttp_send_reply(req, 200, "OK", buf);
     evbuffer_free(buf);
 }
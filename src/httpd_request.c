@@ -41,24 +41,15 @@ int request_push_body(lua_State *L, int idx) {
             lua_pop(L, 1);
 
             if (len > 0 && len < body_limit) {
-                char *data = calloc(1, len + 1);
+                // One copy, straight from the evbuffer into the Lua string.
+                unsigned char *data = evbuffer_pullup(bodybuf, -1);
                 if (!data) {
-                    LOG_ERROR_FMT("Memory allocation failed for request body: %zu bytes", len + 1);
+                    LOG_ERROR_FMT("Memory allocation failed for request body: %zu bytes", len);
                     lua_pushnil(L);
                     return 1;
                 }
-
-                size_t total_read = 0;
-                char *ptrdata = data;
-                while (total_read < len) {
-                    int read = evbuffer_remove(bodybuf, ptrdata, len - total_read);
-                    if (read <= 0) break;
-                    ptrdata += read;
-                    total_read += read;
-                }
-
-                lua_pushlstring(L, data, total_read);
-                free(data);
+                lua_pushlstring(L, (const char *)data, len);
+                evbuffer_drain(bodybuf, len);
 
 #if (LUA_VERSION_NUM >= 502)
                 lua_pushvalue(L, -1);
@@ -94,6 +85,116 @@ LUA_API int lua_evhttp_request_available(lua_State *L) {
     return 1;
 }
 
+// Iterator step of req:body_chunks(); upvalues: request table, chunk
+// size, and whether a cached req.body has been handed out already.
+static int request_body_chunks_next(lua_State *L) {
+    if (lua_toboolean(L, lua_upvalueindex(3))) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    lua_rawgetp(L, lua_upvalueindex(1), "body");
+    if (lua_type(L, -1) == LUA_TSTRING) {
+        lua_pushboolean(L, 1);
+        lua_replace(L, lua_upvalueindex(3));
+        return 1;
+    }
+    lua_pop(L, 1);
+
+    struct evhttp_request *req = request_from_table(L, lua_upvalueindex(1))->req;
+    struct evbuffer *bodybuf = req ? evhttp_request_get_input_buffer(req) : NULL;
+    size_t len = bodybuf ? evbuffer_get_length(bodybuf) : 0;
+    if (len == 0) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    size_t chunk = (size_t)lua_tointeger(L, lua_upvalueindex(2));
+    if (chunk > len) {
+        chunk = len;
+    }
+    unsigned char *data = evbuffer_pullup(bodybuf, (ev_ssize_t)chunk);
+    if (!data) {
+        return luaL_error(L, "Failed to read request body");
+    }
+    lua_pushlstring(L, (const char *)data, chunk);
+    evbuffer_drain(bodybuf, chunk);
+    return 1;
+}
+
+LUA_API int lua_evhttp_request_body_chunks(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_Integer chunk = luaL_optinteger(L, 2, READ_BUFF_LEN);
+    if (chunk <= 0 || chunk > MAX_READ_BUFFER_SIZE) {
+        return luaL_error(L, "chunk size must be between 1 and %d", MAX_READ_BUFFER_SIZE);
+    }
+
+    lua_pushvalue(L, 1);
+    lua_pushinteger(L, chunk);
+    lua_pushboolean(L, 0);
+    lua_pushcclosure(L, request_body_chunks_next, 3);
+    return 1;
+}
+
+static int request_write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+LUA_API int lua_evhttp_request_body_to_file(lua_State *L) {
+    Request *request = request_from_table(L, 1);
+    const char *path = luaL_checkstring(L, 2);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+
+    size_t total = 0;
+    int failed = 0;
+
+    lua_rawgetp(L, 1, "body");
+    if (lua_type(L, -1) == LUA_TSTRING) {
+        const char *data = lua_tolstring(L, -1, &total);
+        failed = request_write_all(fd, data, total) != 0;
+    } else if (request->req) {
+        // Straight from the evbuffer chains to the file, no Lua strings.
+        struct evbuffer *bodybuf = evhttp_request_get_input_buffer(request->req);
+        while (bodybuf && evbuffer_get_length(bodybuf) > 0) {
+            int n = evbuffer_write(bodybuf, fd);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                failed = 1;
+                break;
+            }
+            total += (size_t)n;
+        }
+    }
+    lua_pop(L, 1);
+
+    if (close(fd) != 0) {
+        failed = 1;
+    }
+    if (failed) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+
+    lua_pushinteger(L, (lua_Integer)total);
+    return 1;
+}
+
 LUA_API int lua_evhttp_request_read(lua_State *L) {
     struct evhttp_request *req = request_from_table(L, 1)->req;
     if (!req) {
@@ -145,9 +246,15 @@ LUA_API int lua_evhttp_request_reply(lua_State *L) {
         case REPLY_STATUS_REPLYED:
             return luaL_error(L, "reply has completed already.");
         case REPLY_STATUS_REPLY_START:
-            evhttp_send_reply_end(request->req);
+            if (request->remote) {
+                httpd_remote_post(request, HTTPD_REMOTE_REPLY_END, 0, NULL, NULL);
+            } else {
+                evhttp_send_reply_end(request->req);
+            }
             request->reply_status = REPLY_STATUS_REPLYED;
             httpd_release_conn_guard(request);
+            metrics_update_request_end(request->metrics_started, request->metrics_route,
+                                       request->metrics_code, request->metrics_bytes);
             lua_settop(L, 1);
             return 1;
         default:
@@ -187,13 +294,17 @@ LUA_API int lua_evhttp_request_reply(lua_State *L) {
         }
     }
 
-    evhttp_send_reply(request->req, responseCode, responseMessage, buf);
-    evbuffer_free(buf);
+    if (request->remote) {
+        httpd_remote_post(request, HTTPD_REMOTE_REPLY, responseCode, responseMessage, buf);
+    } else {
+        evhttp_send_reply(request->req, responseCode, responseMessage, buf);
+        evbuffer_free(buf);
+    }
 
     request->reply_status = REPLY_STATUS_REPLYED;
     httpd_release_conn_guard(request);
 
-    metrics_update_request_end(responseCode, responseBuffLen);
+    metrics_update_request_end(request->metrics_started, request->metrics_route, responseCode, responseBuffLen);
 
     return 0;
 }
@@ -237,8 +348,13 @@ LUA_API int lua_evhttp_request_reply_start(lua_State *L) {
 
     int responseCode = (int)lua_tointeger(L, 2);
     const char *responseMessage = lua_tostring(L, 3);
-    evhttp_send_reply_start(request->req, responseCode, responseMessage);
+    if (request->remote) {
+        httpd_remote_post(request, HTTPD_REMOTE_REPLY_START, responseCode, responseMessage, NULL);
+    } else {
+        evhttp_send_reply_start(request->req, responseCode, responseMessage);
+    }
     request->reply_status = REPLY_STATUS_REPLY_START;
+    request->metrics_code = responseCode;
 
     lua_settop(L, 1);
     return 1;
@@ -259,13 +375,14 @@ LUA_API int lua_evhttp_request_reply_chunk(lua_State *L) {
             break;
     }
 
+    // The worker owning a remote request drops chunks once the peer is gone.
     struct evhttp_connection *evcon = evhttp_request_get_connection(request->req);
-    if (!evcon) {
+    if (!evcon && !request->remote) {
         request->reply_status = REPLY_STATUS_REPLYED;
         return luaL_error(L, "connection closed by peer");
     }
 
-    struct bufferevent *bev = evhttp_connection_get_bufferevent(evcon);
+    struct bufferevent *bev = evcon ? evhttp_connection_get_bufferevent(evcon) : NULL;
     if (bev) {
         evutil_socket_t fd = bufferevent_getfd(bev);
         if (fd >= 0) {
@@ -296,8 +413,13 @@ LUA_API int lua_evhttp_request_reply_chunk(lua_State *L) {
                 }
             }
         }
-        evhttp_send_reply_chunk(request->req, buf);
-        evbuffer_free(buf);
+        request->metrics_bytes += evbuffer_get_length(buf);
+        if (request->remote) {
+            httpd_remote_post(request, HTTPD_REMOTE_REPLY_CHUNK, 0, NULL, buf);
+        } else {
+            evhttp_send_reply_chunk(request->req, buf);
+            evbuffer_free(buf);
+        }
     }
 
     lua_settop(L, 1);
@@ -307,6 +429,10 @@ LUA_API int lua_evhttp_request_reply_chunk(lua_State *L) {
 LUA_API int lua_evhttp_request_reply_end(lua_State *L) {
     Request *request = request_from_table(L, 1);
     if (!request->req) {
+        if (request->reply_status == REPLY_STATUS_REPLY_START) {
+            metrics_update_request_end(request->metrics_started, request->metrics_route,
+                                       request->metrics_code, request->metrics_bytes);
+        }
         request->reply_status = REPLY_STATUS_REPLYED;
         lua_settop(L, 1);
         return 1;
@@ -321,12 +447,26 @@ LUA_API int lua_evhttp_request_reply_end(lua_State *L) {
     }
 
     struct evhttp_connection *evcon = evhttp_request_get_connection(request->req);
-    if (evcon) {
+    if (request->remote) {
+        httpd_remote_post(request, HTTPD_REMOTE_REPLY_END, 0, NULL, NULL);
+    } else if (evcon) {
         evhttp_send_reply_end(request->req);
     }
     request->reply_status = REPLY_STATUS_REPLYED;
     httpd_release_conn_guard(request);
+    metrics_update_request_end(request->metrics_started, request->metrics_route,
+                               request->metrics_code, request->metrics_bytes);
 
     lua_settop(L, 1);
     return 1;
 }
+
+// req:set_metrics_route(label) names the route this request is counted
+// under in the latency histogram, e.g. "/users/:id" rather than the path.
+LUA_API int lua_evhttp_request_set_metrics_route(lua_State *L) {
+    Request *request = request_from_table(L, 1);
+    const char *label = luaL_checkstring(L, 2);
+    request->metrics_route = metrics_route_id(label);
+    lua_settop(L, 1);
+    return 1;
+}
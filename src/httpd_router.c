@@ -0,0 +1,456 @@
+// httpd_router.c — fan.httpd.router: segment trie for request routing
+
+#include "utlua.h"
+#include <ctype.h>
+#include <strings.h>
+
+#define LUA_HTTPD_ROUTER_TYPE "HTTPD_ROUTER_TYPE"
+
+// Routes are split on '/' and stored one segment per level. Each node
+// holds its static children sorted for binary search, at most one ":param"
+// child and an optional "*name" route that takes the rest of the path, so
+// a lookup costs one comparison per segment instead of one pattern match
+// per registered route. Static children are tried before the parameter and
+// the wildcard, backtracking when a branch does not lead to a route.
+
+#define ROUTER_MAX_METHODS 16
+#define ROUTER_MAX_PARAMS 32
+#define ROUTER_METHOD_LEN 16
+
+typedef struct router_node_s router_node_t;
+
+typedef struct {
+    int handler_ref;  // LUA_NOREF when no route ends here
+    int nparams;
+    char **param_names;
+} router_leaf_t;
+
+typedef struct {
+    char *segment;
+    size_t len;
+    router_node_t *node;
+} router_edge_t;
+
+struct router_node_s {
+    router_edge_t *statics;
+    int nstatics;
+    int capstatics;
+    router_node_t *param;
+    router_leaf_t leaf;
+    router_leaf_t wildcard;
+};
+
+typedef struct {
+    char name[ROUTER_METHOD_LEN];
+    router_node_t *root;
+} router_method_t;
+
+typedef struct {
+    router_method_t methods[ROUTER_MAX_METHODS];
+    int nmethods;
+    int nroutes;
+} Router;
+
+typedef struct {
+    const char *ptr;
+    size_t len;
+} router_capture_t;
+
+// ============================================================
+// Trie
+// ============================================================
+
+static router_node_t *router_node_new(void) {
+    router_node_t *node = calloc(1, sizeof(router_node_t));
+    if (node) {
+        node->leaf.handler_ref = LUA_NOREF;
+        node->wildcard.handler_ref = LUA_NOREF;
+    }
+    return node;
+}
+
+static void router_leaf_clear(lua_State *L, router_leaf_t *leaf) {
+    if (leaf->handler_ref != LUA_NOREF) {
+        luaL_unref(L, LUA_REGISTRYINDEX, leaf->handler_ref);
+        leaf->handler_ref = LUA_NOREF;
+    }
+    for (int i = 0; i < leaf->nparams; i++) {
+        free(leaf->param_names[i]);
+    }
+    free(leaf->param_names);
+    leaf->param_names = NULL;
+    leaf->nparams = 0;
+}
+
+static void router_node_free(lua_State *L, router_node_t *node) {
+    if (!node) {
+        return;
+    }
+    for (int i = 0; i < node->nstatics; i++) {
+        free(node->statics[i].segment);
+        router_node_free(L, node->statics[i].node);
+    }
+    free(node->statics);
+    router_node_free(L, node->param);
+    router_leaf_clear(L, &node->leaf);
+    router_leaf_clear(L, &node->wildcard);
+    free(node);
+}
+
+static int router_segment_cmp(const char *a, size_t alen, const char *b, size_t blen) {
+    if (alen != blen) {
+        return alen < blen ? -1 : 1;
+    }
+    return memcmp(a, b, alen);
+}
+
+// Index of the static child for `seg`, or -(insertion point + 1).
+static int router_static_find(const router_node_t *node, const char *seg, size_t len) {
+    int lo = 0, hi = node->nstatics - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int c = router_segment_cmp(node->statics[mid].segment, node->statics[mid].len, seg, len);
+        if (c == 0) {
+            return mid;
+        } else if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return -(lo + 1);
+}
+
+static router_node_t *router_static_child(router_node_t *node, const char *seg, size_t len) {
+    int idx = router_static_find(node, seg, len);
+    if (idx >= 0) {
+        return node->statics[idx].node;
+    }
+    idx = -idx - 1;
+
+    if (node->nstatics == node->capstatics) {
+        int cap = node->capstatics ? node->capstatics * 2 : 4;
+        router_edge_t *statics = realloc(node->statics, cap * sizeof(router_edge_t));
+        if (!statics) {
+            return NULL;
+        }
+        node->statics = statics;
+        node->capstatics = cap;
+    }
+
+    router_edge_t edge;
+    edge.segment = malloc(len + 1);
+    edge.node = router_node_new();
+    if (!edge.segment || !edge.node) {
+        free(edge.segment);
+        free(edge.node);
+        return NULL;
+    }
+    memcpy(edge.segment, seg, len);
+    edge.segment[len] = '\0';
+    edge.len = len;
+
+    memmove(&node->statics[idx + 1], &node->statics[idx], (node->nstatics - idx) * sizeof(router_edge_t));
+    node->statics[idx] = edge;
+    node->nstatics++;
+    return edge.node;
+}
+
+static int router_is_name(const char *s, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (!isalnum((unsigned char)s[i]) && s[i] != '_') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static router_leaf_t *router_leaf_match(router_node_t *node, const char *p, const char *end,
+                                        router_capture_t *caps, int ncaps) {
+    const char *seg_end = memchr(p, '/', end - p);
+    if (!seg_end) {
+        seg_end = end;
+    }
+    size_t len = seg_end - p;
+
+    int idx = router_static_find(node, p, len);
+    if (idx >= 0) {
+        router_node_t *child = node->statics[idx].node;
+        router_leaf_t *leaf = NULL;
+        if (seg_end == end) {
+            leaf = child->leaf.handler_ref != LUA_NOREF ? &child->leaf : NULL;
+        } else {
+            leaf = router_leaf_match(child, seg_end + 1, end, caps, ncaps);
+        }
+        if (leaf) {
+            return leaf;
+        }
+    }
+
+    if (node->param && len > 0 && ncaps < ROUTER_MAX_PARAMS) {
+        router_node_t *child = node->param;
+        router_leaf_t *leaf = NULL;
+        caps[ncaps].ptr = p;
+        caps[ncaps].len = len;
+        if (seg_end == end) {
+            leaf = child->leaf.handler_ref != LUA_NOREF ? &child->leaf : NULL;
+        } else {
+            leaf = router_leaf_match(child, seg_end + 1, end, caps, ncaps + 1);
+        }
+        if (leaf) {
+            return leaf;
+        }
+    }
+
+    if (node->wildcard.handler_ref != LUA_NOREF && ncaps < ROUTER_MAX_PARAMS) {
+        caps[ncaps].ptr = p;
+        caps[ncaps].len = end - p;
+        return &node->wildcard;
+    }
+
+    return NULL;
+}
+
+// ============================================================
+// Lua API
+// ============================================================
+
+static router_method_t *router_method(Router *router, const char *method, int create) {
+    for (int i = 0; i < router->nmethods; i++) {
+        if (strcasecmp(router->methods[i].name, method) == 0) {
+            return &router->methods[i];
+        }
+    }
+    if (!create || router->nmethods == ROUTER_MAX_METHODS) {
+        return NULL;
+    }
+
+    router_method_t *entry = &router->methods[router->nmethods];
+    entry->root = router_node_new();
+    if (!entry->root) {
+        return NULL;
+    }
+    size_t i = 0;
+    for (; method[i]; i++) {
+        entry->name[i] = toupper((unsigned char)method[i]);
+    }
+    entry->name[i] = '\0';
+    router->nmethods++;
+    return entry;
+}
+
+// router:add(method, path, handler) -> true, or false when the route is
+// already registered (the first one is kept), or nil, err when the path
+// has a shape the trie cannot hold.
+LUA_API int lua_httpd_router_add(lua_State *L) {
+    Router *router = luaL_checkudata(L, 1, LUA_HTTPD_ROUTER_TYPE);
+    size_t method_len = 0;
+    const char *method = luaL_checklstring(L, 2, &method_len);
+    size_t path_len = 0;
+    const char *path = luaL_checklstring(L, 3, &path_len);
+    luaL_checkany(L, 4);
+
+    if (method_len == 0 || method_len >= ROUTER_METHOD_LEN) {
+        return luaL_error(L, "invalid method '%s'", method);
+    }
+    if (path_len == 0 || path[0] != '/') {
+        lua_pushnil(L);
+        lua_pushstring(L, "path must start with '/'");
+        return 2;
+    }
+
+    // Validate every segment before touching the trie.
+    const char *names[ROUTER_MAX_PARAMS];
+    size_t name_lens[ROUTER_MAX_PARAMS];
+    int nparams = 0;
+    int wildcard = 0;
+    const char *end = path + path_len;
+    for (const char *p = path + 1; p <= end;) {
+        const char *seg_end = memchr(p, '/', end - p);
+        if (!seg_end) {
+            seg_end = end;
+        }
+        size_t len = seg_end - p;
+
+        if (len > 0 && (p[0] == ':' || p[0] == '*')) {
+            const char *name = p + 1;
+            size_t name_len = len - 1;
+            if (p[0] == '*') {
+                if (seg_end != end) {
+                    lua_pushnil(L);
+                    lua_pushstring(L, "wildcard must be the last segment");
+                    return 2;
+                }
+                wildcard = 1;
+            }
+            if (wildcard && name_len == 0) {
+                name = "*";
+                name_len = 1;
+            } else if (!router_is_name(name, name_len)) {
+                lua_pushnil(L);
+                lua_pushfstring(L, "unsupported segment in '%s'", path);
+                return 2;
+            }
+            if (nparams == ROUTER_MAX_PARAMS) {
+                lua_pushnil(L);
+                lua_pushstring(L, "too many path parameters");
+                return 2;
+            }
+            names[nparams] = name;
+            name_lens[nparams] = name_len;
+            nparams++;
+        } else if (memchr(p, ':', len)) {
+            lua_pushnil(L);
+            lua_pushfstring(L, "unsupported segment in '%s'", path);
+            return 2;
+        }
+        p = seg_end + 1;
+    }
+
+    router_method_t *entry = router_method(router, method, 1);
+    if (!entry) {
+        return luaL_error(L, "too many methods");
+    }
+
+    router_node_t *node = entry->root;
+    for (const char *p = path + 1; p <= end;) {
+        const char *seg_end = memchr(p, '/', end - p);
+        if (!seg_end) {
+            seg_end = end;
+        }
+        size_t len = seg_end - p;
+
+        if (len > 0 && p[0] == '*') {
+            break;
+        } else if (len > 0 && p[0] == ':') {
+            if (!node->param) {
+                node->param = router_node_new();
+            }
+            node = node->param;
+        } else {
+            node = router_static_child(node, p, len);
+        }
+        if (!node) {
+            return luaL_error(L, "out of memory");
+        }
+        p = seg_end + 1;
+    }
+
+    router_leaf_t *leaf = wildcard ? &node->wildcard : &node->leaf;
+    if (leaf->handler_ref != LUA_NOREF) {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+
+    if (nparams > 0) {
+        leaf->param_names = calloc(nparams, sizeof(char *));
+        if (!leaf->param_names) {
+            return luaL_error(L, "out of memory");
+        }
+        for (int i = 0; i < nparams; i++) {
+            leaf->param_names[i] = strndup(names[i], name_lens[i]);
+            if (!leaf->param_names[i]) {
+                leaf->nparams = i;
+                router_leaf_clear(L, leaf);
+                return luaL_error(L, "out of memory");
+            }
+        }
+    }
+    leaf->nparams = nparams;
+
+    lua_pushvalue(L, 4);
+    leaf->handler_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    router->nroutes++;
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+// router:match(method, path) -> handler, params, or nil.
+LUA_API int lua_httpd_router_match(lua_State *L) {
+    Router *router = luaL_checkudata(L, 1, LUA_HTTPD_ROUTER_TYPE);
+    const char *method = luaL_checkstring(L, 2);
+    size_t path_len = 0;
+    const char *path = luaL_checklstring(L, 3, &path_len);
+
+    router_method_t *entry = router_method(router, method, 0);
+    if (!entry || path_len == 0 || path[0] != '/') {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    router_capture_t caps[ROUTER_MAX_PARAMS];
+    router_leaf_t *leaf = router_leaf_match(entry->root, path + 1, path + path_len, caps, 0);
+    if (!leaf) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, leaf->handler_ref);
+    lua_createtable(L, 0, leaf->nparams);
+    for (int i = 0; i < leaf->nparams; i++) {
+        lua_pushlstring(L, caps[i].ptr, caps[i].len);
+        lua_setfield(L, -2, leaf->param_names[i]);
+    }
+    return 2;
+}
+
+LUA_API int lua_httpd_router_count(lua_State *L) {
+    Router *router = luaL_checkudata(L, 1, LUA_HTTPD_ROUTER_TYPE);
+    lua_pushinteger(L, router->nroutes);
+    return 1;
+}
+
+LUA_API int lua_httpd_router_gc(lua_State *L) {
+    Router *router = luaL_checkudata(L, 1, LUA_HTTPD_ROUTER_TYPE);
+    for (int i = 0; i < router->nmethods; i++) {
+        router_node_free(L, router->methods[i].root);
+        router->methods[i].root = NULL;
+    }
+    router->nmethods = 0;
+    router->nroutes = 0;
+    return 0;
+}
+
+LUA_API int lua_httpd_router_new(lua_State *L) {
+    Router *router = lua_newuserdata(L, sizeof(Router));
+    memset(router, 0, sizeof(Router));
+    luaL_getmetatable(L, LUA_HTTPD_ROUTER_TYPE);
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+static const luaL_Reg routerlib[] = {
+    {"new", lua_httpd_router_new},
+    {NULL, NULL}
+};
+
+LUA_API int luaopen_fan_httpd_router(lua_State *L) {
+    luaL_newmetatable(L, LUA_HTTPD_ROUTER_TYPE);
+
+    lua_pushcfunction(L, &lua_httpd_router_add);
+    lua_setfield(L, -2, "add");
+
+    lua_pushcfunction(L, &lua_httpd_router_match);
+    lua_setfield(L, -2, "match");
+
+    lua_pushcfunction(L, &lua_httpd_router_count);
+    lua_setfield(L, -2, "count");
+
+    lua_pushstring(L, "__gc");
+    lua_pushcfunction(L, &lua_httpd_router_gc);
+    lua_rawset(L, -3);
+
+    lua_pushstring(L, "__index");
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -3);
+
+    lua_pop(L, 1);
+
+    lua_newtable(L);
+    luaL_register(L, NULL, routerlib);
+    return 1;
+}
@@ -1,6 +1,7 @@
 // httpd_websocket.c — WebSocket frame parsing, send/recv, accept, cleanup
 
 #include "httpd_internal.h"
+#include "websocket_mask.h"
 #include <openssl/sha.h>
 #include <openssl/evp.h>
 #include <openssl/bio.h>
@@ -60,13 +61,6 @@ static char* generate_websocket_accept_key(const char* client_key) {
 // Frame parsing and encoding
 // ============================================================
 
-static void websocket_mask_unmask(char *data, uint64_t len, uint32_t mask_key) {
-    uint8_t *mask_bytes = (uint8_t *)&mask_key;
-    for (uint64_t i = 0; i < len; i++) {
-        data[i] ^= mask_bytes[i % 4];
-    }
-}
-
 static int websocket_parse_frame(struct evbuffer *input, websocket_frame_t *frame) {
     size_t available = evbuffer_get_length(input);
     if (available < 2) {
@@ -124,7 +118,7 @@ static int websocket_parse_frame(struct evbuffer *input, websocket_frame_t *fram
         }
         evbuffer_remove(input, frame->payload, frame->payload_len);
         if (frame->masked) {
-            websocket_mask_unmask(frame->payload, frame->payload_len, frame->mask_key);
+            websocket_mask((uint8_t *)frame->payload, (size_t)frame->payload_len, frame->mask_key);
         }
     } else {
         frame->payload = NULL;
@@ -133,33 +127,64 @@ static int websocket_parse_frame(struct evbuffer *input, websocket_frame_t *fram
     return 1;
 }
 
-static struct evbuffer* websocket_create_frame(websocket_opcode_t opcode, const char *payload,
-                                             uint64_t payload_len, int fin) {
-    struct evbuffer *frame = evbuffer_new();
-    if (!frame) return NULL;
+// Encode a server (unmasked) frame header into `out`, which must hold at
+// least WS_MAX_FRAME_HEADER bytes. Returns the header length.
+#define WS_MAX_FRAME_HEADER 10
 
-    uint8_t first_byte = (fin ? 0x80 : 0x00) | (opcode & 0x0F);
-    evbuffer_add(frame, &first_byte, 1);
+static size_t websocket_frame_header(uint8_t *out, websocket_opcode_t opcode, uint64_t payload_len,
+                                     int fin, int rsv1) {
+    out[0] = (fin ? 0x80 : 0x00) | (rsv1 ? 0x40 : 0x00) | (opcode & 0x0F);
 
     if (payload_len < 126) {
-        uint8_t second_byte = (uint8_t)payload_len;
-        evbuffer_add(frame, &second_byte, 1);
+        out[1] = (uint8_t)payload_len;
+        return 2;
     } else if (payload_len <= 65535) {
-        uint8_t second_byte = 126;
-        evbuffer_add(frame, &second_byte, 1);
+        out[1] = 126;
         uint16_t len16 = htons((uint16_t)payload_len);
-        evbuffer_add(frame, &len16, 2);
+        memcpy(out + 2, &len16, 2);
+        return 4;
     } else {
-        uint8_t second_byte = 127;
-        evbuffer_add(frame, &second_byte, 1);
+        out[1] = 127;
         uint64_t len64 = htobe64(payload_len);
-        evbuffer_add(frame, &len64, 8);
+        memcpy(out + 2, &len64, 8);
+        return 10;
+    }
+}
+
+// `deflate` is the connection's permessage-deflate context, or NULL to
+// send the payload as-is. Only complete data messages are compressed.
+static struct evbuffer* websocket_create_frame(websocket_opcode_t opcode, const char *payload,
+                                             uint64_t payload_len, int fin, ws_deflate_t *deflate) {
+    char *compressed = NULL;
+    size_t compressed_len = 0;
+
+    if (deflate && fin && (opcode == WS_OPCODE_TEXT || opcode == WS_OPCODE_BINARY) &&
+        ws_deflate_wants(deflate, payload_len)) {
+        int rc = ws_deflate_compress(deflate, payload, payload_len, &compressed, &compressed_len);
+        if (rc < 0) {
+            return NULL;
+        }
+        if (rc > 0) {
+            payload = compressed;
+            payload_len = compressed_len;
+        }
+    }
+
+    struct evbuffer *frame = evbuffer_new();
+    if (!frame) {
+        free(compressed);
+        return NULL;
     }
 
+    uint8_t header[WS_MAX_FRAME_HEADER];
+    size_t header_len = websocket_frame_header(header, opcode, payload_len, fin, compressed != NULL);
+    evbuffer_add(frame, header, header_len);
+
     if (payload && payload_len > 0) {
         evbuffer_add(frame, payload, payload_len);
     }
 
+    free(compressed);
     return frame;
 }
 
@@ -288,6 +313,15 @@ void ws_connection_cleanup(Request *request) {
 
     ws_frame_queue_clear(request);
 
+    if (request->ws_deflate) {
+        ws_deflate_free(request->ws_deflate);
+        request->ws_deflate = NULL;
+    }
+    if (request->ws_recv_fragments) {
+        evbuffer_free(request->ws_recv_fragments);
+        request->ws_recv_fragments = NULL;
+    }
+
     if (request->ws_bev) {
         struct bufferevent *bev = request->ws_bev;
         request->ws_bev = NULL;
@@ -363,6 +397,81 @@ static void ws_resume_with_frame(Request *request, websocket_frame_t *frame) {
 // Bufferevent callbacks
 // ============================================================
 
+static void ws_fail(Request *request, const char *errmsg) {
+    request->ws_state = WS_STATE_CLOSED;
+    if (request->_ref_ != LUA_NOREF) {
+        ws_resume_with_error(request, errmsg);
+    } else {
+        ws_connection_cleanup(request);
+    }
+}
+
+// Replace a compressed payload with its inflated form.
+static int ws_frame_inflate(Request *request, websocket_frame_t *frame, const char *data, size_t len) {
+    char *plain = NULL;
+    size_t plain_len = 0;
+    if (ws_deflate_decompress(request->ws_deflate, data, len, &plain, &plain_len) < 0) {
+        return -1;
+    }
+    websocket_frame_free(frame);
+    frame->payload = plain;
+    frame->payload_len = plain_len;
+    frame->rsv1 = 0;
+    return 0;
+}
+
+// Handle RSV bits for permessage-deflate. Returns 1 when `frame` now holds
+// a complete message to dispatch, 0 when it was absorbed into a pending
+// compressed message, -1 on protocol or inflate errors.
+static int ws_frame_decompress(Request *request, websocket_frame_t *frame) {
+    int is_data = frame->opcode == WS_OPCODE_TEXT || frame->opcode == WS_OPCODE_BINARY;
+
+    if (frame->rsv2 || frame->rsv3) {
+        return -1;
+    }
+    if (frame->rsv1 && (!request->ws_deflate || !is_data)) {
+        return -1;
+    }
+
+    if (frame->opcode == WS_OPCODE_CONTINUATION && request->ws_recv_fragments) {
+        evbuffer_add(request->ws_recv_fragments, frame->payload, frame->payload_len);
+        websocket_frame_free(frame);
+        if (!frame->fin) {
+            return 0;
+        }
+
+        struct evbuffer *fragments = request->ws_recv_fragments;
+        request->ws_recv_fragments = NULL;
+        size_t len = evbuffer_get_length(fragments);
+        int rc = ws_frame_inflate(request, frame, (const char *)evbuffer_pullup(fragments, -1), len);
+        evbuffer_free(fragments);
+
+        frame->opcode = request->ws_recv_opcode;
+        return rc < 0 ? -1 : 1;
+    }
+
+    if (!frame->rsv1) {
+        return 1;
+    }
+
+    if (request->ws_recv_fragments) {
+        return -1;  // new data message before the previous one finished
+    }
+
+    if (!frame->fin) {
+        request->ws_recv_fragments = evbuffer_new();
+        if (!request->ws_recv_fragments) {
+            return -1;
+        }
+        request->ws_recv_opcode = frame->opcode;
+        evbuffer_add(request->ws_recv_fragments, frame->payload, frame->payload_len);
+        websocket_frame_free(frame);
+        return 0;
+    }
+
+    return ws_frame_inflate(request, frame, frame->payload, frame->payload_len) < 0 ? -1 : 1;
+}
+
 void ws_readcb(struct bufferevent *bev, void *ctx) {
     Request *request = (Request *)ctx;
     struct evbuffer *input = bufferevent_get_input(bev);
@@ -373,12 +482,15 @@ void ws_readcb(struct bufferevent *bev, void *ctx) {
         int rc = websocket_parse_frame(input, &frame);
         if (rc == 0) break;
         if (rc < 0) {
-            request->ws_state = WS_STATE_CLOSED;
-            if (request->_ref_ != LUA_NOREF) {
-                ws_resume_with_error(request, "frame parse error");
-            } else {
-                ws_connection_cleanup(request);
-            }
+            ws_fail(request, "frame parse error");
+            return;
+        }
+
+        rc = ws_frame_decompress(request, &frame);
+        if (rc == 0) continue;
+        if (rc < 0) {
+            websocket_frame_free(&frame);
+            ws_fail(request, "invalid compressed frame");
             return;
         }
 
@@ -386,7 +498,7 @@ void ws_readcb(struct bufferevent *bev, void *ctx) {
             case WS_OPCODE_PING:
                 if (request->ws_bev && request->ws_state == WS_STATE_OPEN) {
                     struct evbuffer *pong = websocket_create_frame(
-                        WS_OPCODE_PONG, frame.payload, frame.payload_len, 1);
+                        WS_OPCODE_PONG, frame.payload, frame.payload_len, 1, NULL);
                     if (pong) {
                         bufferevent_write_buffer(request->ws_bev, pong);
                         evbuffer_free(pong);
@@ -403,7 +515,7 @@ void ws_readcb(struct bufferevent *bev, void *ctx) {
                 request->ws_state = WS_STATE_CLOSED;
                 if (request->ws_bev) {
                     struct evbuffer *close_resp = websocket_create_frame(
-                        WS_OPCODE_CLOSE, frame.payload, frame.payload_len, 1);
+                        WS_OPCODE_CLOSE, frame.payload, frame.payload_len, 1, NULL);
                     if (close_resp) {
                         bufferevent_write_buffer(request->ws_bev, close_resp);
                         evbuffer_free(close_resp);
@@ -471,6 +583,58 @@ LUA_API int lua_evhttp_request_is_websocket_upgrade(lua_State *L) {
 // Lua API: WebSocket accept
 // ============================================================
 
+// websocket_accept options: `deflate = true` or a table of
+// ws_deflate_config_t overrides. Returns 1 if permessage-deflate is wanted.
+static int ws_deflate_config_from_lua(lua_State *L, int idx, ws_deflate_config_t *config) {
+    ws_deflate_config_init(config);
+    if (!lua_istable(L, idx)) {
+        return 0;
+    }
+
+    lua_getfield(L, idx, "deflate");
+    int top = lua_gettop(L);
+    int wanted = lua_toboolean(L, top);
+
+    if (lua_istable(L, top)) {
+        lua_getfield(L, top, "level");
+        if (lua_isnumber(L, -1)) {
+            config->level = (int)lua_tointeger(L, -1);
+            if (config->level < -1 || config->level > 9) config->level = -1;
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, top, "context_takeover");
+        if (!lua_isnil(L, -1)) config->context_takeover = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+
+        lua_getfield(L, top, "client_context_takeover");
+        if (!lua_isnil(L, -1)) config->client_context_takeover = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+
+        lua_getfield(L, top, "max_window_bits");
+        if (lua_isnumber(L, -1)) {
+            int bits = (int)lua_tointeger(L, -1);
+            config->max_window_bits = bits < 9 ? 9 : (bits > 15 ? 15 : bits);
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, top, "threshold");
+        if (lua_isnumber(L, -1) && lua_tointeger(L, -1) >= 0) {
+            config->threshold = (size_t)lua_tointeger(L, -1);
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, top, "max_message_size");
+        if (lua_isnumber(L, -1) && lua_tointeger(L, -1) > 0) {
+            config->max_message_size = (size_t)lua_tointeger(L, -1);
+        }
+        lua_pop(L, 1);
+    }
+
+    lua_pop(L, 1);
+    return wanted;
+}
+
 LUA_API int lua_evhttp_request_websocket_accept(lua_State *L) {
     Request *request = request_from_table(L, 1);
     struct evhttp_request *req = request->req;
@@ -482,6 +646,10 @@ LUA_API int lua_evhttp_request_websocket_accept(lua_State *L) {
         return luaL_error(L, "Response already started");
     }
 
+    if (request->remote) {
+        return luaL_error(L, "WebSocket is not supported with reuseport_shards");
+    }
+
     if (!is_websocket_upgrade_request(req)) {
         return luaL_error(L, "Not a valid WebSocket upgrade request");
     }
@@ -491,11 +659,30 @@ LUA_API int lua_evhttp_request_websocket_accept(lua_State *L) {
         return luaL_error(L, "Missing Sec-WebSocket-Key header");
     }
 
+    ws_deflate_config_t deflate_config;
+    int want_deflate = ws_deflate_config_from_lua(L, 2, &deflate_config);
+
     char *accept_key = generate_websocket_accept_key(ws_key);
     if (!accept_key) {
         return luaL_error(L, "Failed to generate WebSocket accept key");
     }
 
+    // Offers may be spread over several Sec-WebSocket-Extensions headers.
+    ws_deflate_params_t deflate_params;
+    char extensions[128];
+    int deflate_accepted = 0;
+    if (want_deflate) {
+        struct evkeyval *header;
+        TAILQ_FOREACH(header, req->input_headers, next) {
+            if (strcasecmp(header->key, "Sec-WebSocket-Extensions") == 0 &&
+                ws_deflate_negotiate(header->value, &deflate_config, &deflate_params,
+                                     extensions, sizeof(extensions))) {
+                deflate_accepted = 1;
+                break;
+            }
+        }
+    }
+
     evhttp_request_own(req);
     request->owns_request = 1;
 
@@ -509,8 +696,11 @@ LUA_API int lua_evhttp_request_websocket_accept(lua_State *L) {
         "HTTP/1.1 101 Switching Protocols\r\n"
         "Upgrade: websocket\r\n"
         "Connection: Upgrade\r\n"
-        "Sec-WebSocket-Accept: %s\r\n"
-        "\r\n", accept_key);
+        "Sec-WebSocket-Accept: %s\r\n", accept_key);
+    if (deflate_accepted) {
+        evbuffer_add_printf(response, "Sec-WebSocket-Extensions: %s\r\n", extensions);
+    }
+    evbuffer_add(response, "\r\n", 2);
 
     struct evhttp_connection *evcon = evhttp_request_get_connection(req);
     struct bufferevent *bev = evhttp_connection_get_bufferevent(evcon);
@@ -523,6 +713,9 @@ LUA_API int lua_evhttp_request_websocket_accept(lua_State *L) {
         request->ws_bev = bev;
         request->reply_status = REPLY_STATUS_REPLYED;
         request->mainthread = utlua_mainthread(L);
+        if (deflate_accepted) {
+            request->ws_deflate = ws_deflate_new(&deflate_config, &deflate_params);
+        }
 
         evhttp_connection_set_closecb(evcon, NULL, NULL);
 
@@ -538,6 +731,10 @@ LUA_API int lua_evhttp_request_websocket_accept(lua_State *L) {
     free(accept_key);
 
     lua_pushboolean(L, bev != NULL);
+    if (bev && request->ws_deflate) {
+        lua_pushstring(L, extensions);
+        return 2;
+    }
     return 1;
 }
 
@@ -565,10 +762,15 @@ LUA_API int lua_evhttp_request_websocket_send(lua_State *L) {
         return luaL_error(L, "Invalid WebSocket opcode: %d", opcode);
     }
 
-    struct evbuffer *frame = websocket_create_frame((websocket_opcode_t)opcode, data, data_len, fin);
+    // A message started uncompressed (fin=0) must finish uncompressed.
+    ws_deflate_t *deflate = request->ws_send_fragmented ? NULL : request->ws_deflate;
+    struct evbuffer *frame = websocket_create_frame((websocket_opcode_t)opcode, data, data_len, fin, deflate);
     if (!frame) {
         return luaL_error(L, "Failed to create WebSocket frame");
     }
+    if (opcode < WS_OPCODE_CLOSE) {
+        request->ws_send_fragmented = !fin;
+    }
 
     int result = bufferevent_write_buffer(request->ws_bev, frame);
     evbuffer_free(frame);
@@ -577,6 +779,183 @@ LUA_API int lua_evhttp_request_websocket_send(lua_State *L) {
     return 1;
 }
 
+// ============================================================
+// Lua API: WebSocket broadcast
+// ============================================================
+
+// One encoded frame shared by reference between many output buffers; the
+// last evbuffer to drain it frees it.
+typedef struct {
+    volatile int refs;
+    size_t len;
+    uint8_t data[];
+} ws_shared_frame_t;
+
+// Compressed frames for connections sharing a deflate key (see
+// ws_deflate_share_key); frame == NULL means compression was declined.
+#define WS_BROADCAST_DEFLATE_VARIANTS 4
+
+typedef struct {
+    int key;
+    ws_shared_frame_t *frame;
+} ws_broadcast_variant_t;
+
+static ws_shared_frame_t *ws_shared_frame_new(websocket_opcode_t opcode, const char *payload,
+                                              size_t payload_len, int rsv1) {
+    ws_shared_frame_t *shared = malloc(sizeof(ws_shared_frame_t) + WS_MAX_FRAME_HEADER + payload_len);
+    if (!shared) return NULL;
+
+    size_t header_len = websocket_frame_header(shared->data, opcode, payload_len, 1, rsv1);
+    if (payload_len > 0) {
+        memcpy(shared->data + header_len, payload, payload_len);
+    }
+    shared->len = header_len + payload_len;
+    shared->refs = 1;  // held by the broadcast call until it returns
+    return shared;
+}
+
+static void ws_shared_frame_unref(const void *data, size_t datalen, void *extra) {
+    (void)data; (void)datalen;
+    ws_shared_frame_t *shared = (ws_shared_frame_t *)extra;
+    if (shared && __sync_sub_and_fetch(&shared->refs, 1) == 0) {
+        free(shared);
+    }
+}
+
+static int ws_shared_frame_write(Request *request, ws_shared_frame_t *shared) {
+    struct evbuffer *output = bufferevent_get_output(request->ws_bev);
+    __sync_add_and_fetch(&shared->refs, 1);
+    if (evbuffer_add_reference(output, shared->data, shared->len, ws_shared_frame_unref, shared) != 0) {
+        __sync_sub_and_fetch(&shared->refs, 1);
+        return -1;
+    }
+    return 0;
+}
+
+// Compressed frame for `deflate`'s share key, building it on first use.
+// Returns NULL when the plain frame should be used instead, and sets
+// *unshared when this connection has to compress on its own.
+static ws_shared_frame_t *ws_broadcast_variant(ws_broadcast_variant_t *variants, int *nvariants,
+                                               ws_deflate_t *deflate, websocket_opcode_t opcode,
+                                               const char *payload, size_t payload_len, int *unshared) {
+    int key = ws_deflate_share_key(deflate);
+    *unshared = 0;
+    if (key < 0) {
+        *unshared = 1;
+        return NULL;
+    }
+
+    for (int i = 0; i < *nvariants; i++) {
+        if (variants[i].key == key) {
+            return variants[i].frame;
+        }
+    }
+    if (*nvariants == WS_BROADCAST_DEFLATE_VARIANTS) {
+        *unshared = 1;
+        return NULL;
+    }
+
+    char *compressed = NULL;
+    size_t compressed_len = 0;
+    ws_shared_frame_t *shared = NULL;
+    int rc = ws_deflate_compress(deflate, payload, payload_len, &compressed, &compressed_len);
+    if (rc < 0) {
+        *unshared = 1;
+        return NULL;
+    }
+    if (rc > 0) {
+        shared = ws_shared_frame_new(opcode, compressed, compressed_len, 1);
+        free(compressed);
+        if (!shared) {
+            *unshared = 1;
+            return NULL;
+        }
+    }
+
+    variants[*nvariants].key = key;
+    variants[*nvariants].frame = shared;
+    (*nvariants)++;
+    return shared;
+}
+
+// httpd.websocket_broadcast(requests, opcode, payload)
+// Encode one frame and queue it on every open WebSocket in `requests` by
+// reference. Connections with their own compression context still get a
+// per-connection frame. Returns the number of connections written to.
+LUA_API int lua_evhttp_websocket_broadcast(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    int opcode = (int)luaL_checkinteger(L, 2);
+    size_t payload_len = 0;
+    const char *payload = luaL_checklstring(L, 3, &payload_len);
+
+    if (opcode < 0 || opcode > 0xF) {
+        return luaL_error(L, "Invalid WebSocket opcode: %d", opcode);
+    }
+    if (opcode >= WS_OPCODE_CLOSE && payload_len > 125) {
+        return luaL_error(L, "Control frame payload too large (max 125 bytes)");
+    }
+
+    int is_data = opcode == WS_OPCODE_TEXT || opcode == WS_OPCODE_BINARY;
+    ws_shared_frame_t *plain = NULL;
+    ws_broadcast_variant_t variants[WS_BROADCAST_DEFLATE_VARIANTS];
+    int nvariants = 0;
+    int sent = 0;
+
+    int count = (int)lua_objlen(L, 1);
+    for (int i = 1; i <= count; i++) {
+        lua_rawgeti(L, 1, i);
+        Request *request = lua_istable(L, -1) ? request_from_table(L, -1) : NULL;
+        lua_pop(L, 1);
+
+        if (!request || !request->is_websocket || request->ws_state != WS_STATE_OPEN || !request->ws_bev) {
+            continue;
+        }
+        if (opcode < WS_OPCODE_CLOSE && request->ws_send_fragmented) {
+            continue;  // would land inside a fragmented message
+        }
+
+        ws_shared_frame_t *shared = NULL;
+        if (is_data && ws_deflate_wants(request->ws_deflate, payload_len)) {
+            int unshared = 0;
+            shared = ws_broadcast_variant(variants, &nvariants, request->ws_deflate,
+                                          (websocket_opcode_t)opcode, payload, payload_len, &unshared);
+            if (unshared) {
+                struct evbuffer *frame = websocket_create_frame((websocket_opcode_t)opcode, payload,
+                                                                payload_len, 1, request->ws_deflate);
+                if (frame) {
+                    if (bufferevent_write_buffer(request->ws_bev, frame) == 0) {
+                        sent++;
+                    }
+                    evbuffer_free(frame);
+                }
+                continue;
+            }
+        }
+
+        if (!shared) {
+            if (!plain) {
+                plain = ws_shared_frame_new((websocket_opcode_t)opcode, payload, payload_len, 0);
+                if (!plain) {
+                    break;
+                }
+            }
+            shared = plain;
+        }
+
+        if (ws_shared_frame_write(request, shared) == 0) {
+            sent++;
+        }
+    }
+
+    ws_shared_frame_unref(NULL, 0, plain);
+    for (int i = 0; i < nvariants; i++) {
+        ws_shared_frame_unref(NULL, 0, variants[i].frame);
+    }
+
+    lua_pushinteger(L, sent);
+    return 1;
+}
+
 // ============================================================
 // Lua API: WebSocket ping
 // ============================================================
@@ -599,7 +978,7 @@ LUA_API int lua_evhttp_request_websocket_ping(lua_State *L) {
         return luaL_error(L, "Ping payload too large (max 125 bytes)");
     }
 
-    struct evbuffer *frame = websocket_create_frame(WS_OPCODE_PING, payload, payload_len, 1);
+    struct evbuffer *frame = websocket_create_frame(WS_OPCODE_PING, payload, payload_len, 1, NULL);
     if (!frame) {
         return luaL_error(L, "Failed to create ping frame");
     }
@@ -633,7 +1012,7 @@ LUA_API int lua_evhttp_request_websocket_pong(lua_State *L) {
         return luaL_error(L, "Pong payload too large (max 125 bytes)");
     }
 
-    struct evbuffer *frame = websocket_create_frame(WS_OPCODE_PONG, payload, payload_len, 1);
+    struct evbuffer *frame = websocket_create_frame(WS_OPCODE_PONG, payload, payload_len, 1, NULL);
     if (!frame) {
         return luaL_error(L, "Failed to create pong frame");
     }
@@ -689,7 +1068,7 @@ LUA_API int lua_evhttp_request_websocket_close(lua_State *L) {
 
     struct evbuffer *frame = websocket_create_frame(WS_OPCODE_CLOSE,
                                                    close_payload_len > 0 ? close_payload : NULL,
-                                                   close_payload_len, 1);
+                                                   close_payload_len, 1, NULL);
     if (frame) {
         bufferevent_write_buffer(request->ws_bev, frame);
         evbuffer_free(frame);
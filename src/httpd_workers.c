@@ -0,0 +1,420 @@
+// httpd_workers.c — Per-worker evhttp instances behind SO_REUSEPORT listeners
+
+#include "httpd_internal.h"
+#include <stdatomic.h>
+
+// With `reuseport_shards = N` the server opens N listening sockets bound to
+// the same address with SO_REUSEPORT and runs one evhttp on each worker
+// base, so accepting, parsing and writing responses happen on the workers
+// in parallel. Only onService hops to the main state: the worker copies the
+// parsed request (method, uri, headers, body, peer) into a standalone
+// evhttp_request that the main thread owns, and every reply step is posted
+// back to the worker holding the connection.
+//
+// Worker-side fields of httpd_worker_req_t are only touched on that worker,
+// so its lifetime needs no locking: it is freed there once the connection
+// is done with it (answered or closed) and the main side has released it.
+// The group outlives the server userdata until every worker has freed its
+// evhttp and every request has been freed, hence the refcount.
+
+typedef struct {
+    httpd_worker_group_t *group;
+    int worker_id;
+    evutil_socket_t fd;
+    struct evhttp *httpd;
+} httpd_worker_slot_t;
+
+struct httpd_worker_group {
+    _Atomic int refs;
+    LuaServer *server;  // NULL once the server is closed (main thread only)
+    int keep_alive_timeout;
+    size_t max_body_size;
+    int count;
+    httpd_worker_slot_t slots[EVENT_MGR_MAX_WORKERS];
+};
+
+struct httpd_worker_req {
+    httpd_worker_group_t *group;
+    int worker_id;
+    struct evhttp_request *copy;  // handed to the main thread with the delivery
+    struct evhttp_request *req;   // worker only: NULL once answered or closed
+    int started;                  // worker only: chunked reply in progress
+    int released;                 // worker only: the main side is done with it
+};
+
+typedef struct {
+    httpd_worker_req_t *remote;
+    httpd_remote_op_t op;
+    int code;
+    char *reason;
+    struct evkeyvalq headers;
+    struct evbuffer *body;
+} httpd_remote_msg_t;
+
+static void httpd_worker_group_unref(httpd_worker_group_t *group) {
+    if (atomic_fetch_sub(&group->refs, 1) == 1) {
+        free(group);
+    }
+}
+
+// ============================================================
+// Worker side
+// ============================================================
+
+static void httpd_worker_req_maybe_free(httpd_worker_req_t *remote) {
+    if (remote->req || !remote->released) return;
+    httpd_worker_group_unref(remote->group);
+    free(remote);
+}
+
+// Stop watching the connection before the final reply hands it back to
+// evhttp, which may reuse it for the next keep-alive request.
+static void httpd_worker_req_detach(httpd_worker_req_t *remote) {
+    struct evhttp_connection *evcon = evhttp_request_get_connection(remote->req);
+    if (evcon) {
+        evhttp_connection_set_closecb(evcon, NULL, NULL);
+    }
+    remote->req = NULL;
+}
+
+static void httpd_worker_close_cb(struct evhttp_connection *evcon, void *arg) {
+    (void)evcon;
+    httpd_worker_req_t *remote = (httpd_worker_req_t *)arg;
+    remote->req = NULL;
+    httpd_worker_req_maybe_free(remote);
+}
+
+// Standalone copy of a parsed request, safe to hand to another thread.
+static struct evhttp_request *httpd_request_copy(struct evhttp_request *req) {
+    struct evhttp_request *copy = evhttp_request_new(NULL, NULL);
+    if (!copy) return NULL;
+
+    copy->kind = EVHTTP_REQUEST;
+    copy->type = req->type;
+    copy->major = req->major;
+    copy->minor = req->minor;
+    copy->remote_port = req->remote_port;
+    if (req->remote_host) {
+        copy->remote_host = strdup(req->remote_host);
+    }
+    if (req->uri) {
+        copy->uri = strdup(req->uri);
+        copy->uri_elems = copy->uri ? evhttp_uri_parse_with_flags(copy->uri, EVHTTP_URI_NONCONFORMANT) : NULL;
+        if (!copy->uri_elems) {
+            evhttp_request_free(copy);
+            return NULL;
+        }
+    }
+
+    struct evkeyval *header;
+    TAILQ_FOREACH(header, req->input_headers, next) {
+        evhttp_add_header(copy->input_headers, header->key, header->value);
+    }
+    evbuffer_add_buffer(copy->input_buffer, req->input_buffer);
+    return copy;
+}
+
+// Main thread: run onService for a request parsed on a worker.
+static void httpd_worker_deliver(void *arg) {
+    httpd_worker_req_t *remote = (httpd_worker_req_t *)arg;
+    struct evhttp_request *copy = remote->copy;
+    LuaServer *server = remote->group->server;
+    remote->copy = NULL;
+
+    if (server && server->onServiceRef != LUA_NOREF) {
+        httpd_dispatch(server, copy, remote);
+    } else {
+        Request detached = {.req = copy, .remote = remote};
+        httpd_remote_post(&detached, HTTPD_REMOTE_REPLY, 503, "Service Unavailable", NULL);
+        evhttp_request_free(copy);
+    }
+}
+
+// Worker thread: evhttp finished parsing a request on this worker.
+static void httpd_worker_request_cb(struct evhttp_request *req, void *arg) {
+    httpd_worker_slot_t *slot = (httpd_worker_slot_t *)arg;
+    httpd_worker_group_t *group = slot->group;
+
+    httpd_worker_req_t *remote = calloc(1, sizeof(httpd_worker_req_t));
+    struct evhttp_request *copy = remote ? httpd_request_copy(req) : NULL;
+    if (!copy) {
+        free(remote);
+        evhttp_send_error(req, 500, "Internal Server Error");
+        return;
+    }
+    remote->group = group;
+    remote->worker_id = slot->worker_id;
+    remote->copy = copy;
+    remote->req = req;
+
+    struct evhttp_connection *evcon = evhttp_request_get_connection(req);
+    if (evcon) {
+        evhttp_connection_set_closecb(evcon, httpd_worker_close_cb, remote);
+    }
+
+    atomic_fetch_add(&group->refs, 1);
+    if (event_mgr_post(-1, httpd_worker_deliver, remote) != 0) {
+        httpd_worker_req_detach(remote);
+        httpd_worker_group_unref(group);
+        evhttp_request_free(copy);
+        free(remote);
+        evhttp_send_error(req, 503, "Service Unavailable");
+    }
+}
+
+static void httpd_remote_msg_free(httpd_remote_msg_t *msg) {
+    evhttp_clear_headers(&msg->headers);
+    if (msg->body) {
+        evbuffer_free(msg->body);
+    }
+    free(msg->reason);
+    free(msg);
+}
+
+static void httpd_remote_apply_headers(struct evhttp_request *req, httpd_remote_msg_t *msg) {
+    struct evkeyval *header;
+    TAILQ_FOREACH(header, &msg->headers, next) {
+        evhttp_add_header(evhttp_request_get_output_headers(req), header->key, header->value);
+    }
+}
+
+// Worker thread: apply one reply step posted by the main thread.
+static void httpd_remote_task(void *arg) {
+    httpd_remote_msg_t *msg = (httpd_remote_msg_t *)arg;
+    httpd_worker_req_t *remote = msg->remote;
+    struct evhttp_request *req = remote->req;
+
+    if (req) {
+        switch (msg->op) {
+            case HTTPD_REMOTE_REPLY:
+                httpd_remote_apply_headers(req, msg);
+                httpd_worker_req_detach(remote);
+                evhttp_send_reply(req, msg->code, msg->reason, msg->body);
+                break;
+            case HTTPD_REMOTE_REPLY_START:
+                httpd_remote_apply_headers(req, msg);
+                evhttp_send_reply_start(req, msg->code, msg->reason);
+                remote->started = 1;
+                break;
+            case HTTPD_REMOTE_REPLY_CHUNK:
+                if (msg->body) {
+                    evhttp_send_reply_chunk(req, msg->body);
+                }
+                break;
+            case HTTPD_REMOTE_REPLY_END:
+                httpd_worker_req_detach(remote);
+                evhttp_send_reply_end(req);
+                break;
+            case HTTPD_REMOTE_RELEASE:
+                // Collected without finishing its reply: nobody can answer it now.
+                httpd_worker_req_detach(remote);
+                if (remote->started) {
+                    evhttp_send_reply_end(req);
+                } else {
+                    evhttp_send_error(req, 500, "Internal Server Error");
+                }
+                break;
+        }
+    }
+
+    if (msg->op == HTTPD_REMOTE_REPLY || msg->op == HTTPD_REMOTE_REPLY_END ||
+        msg->op == HTTPD_REMOTE_RELEASE) {
+        remote->released = 1;
+    }
+    httpd_worker_req_maybe_free(remote);
+    httpd_remote_msg_free(msg);
+}
+
+static void httpd_worker_listen_task(void *arg) {
+    httpd_worker_slot_t *slot = (httpd_worker_slot_t *)arg;
+    struct evhttp *httpd = evhttp_new(event_mgr_worker_base(slot->worker_id));
+
+    if (!httpd || !evhttp_accept_socket_with_handle(httpd, slot->fd)) {
+        LOGE("httpd reuseport: failed to listen on worker %d\n", slot->worker_id);
+        if (httpd) {
+            evhttp_free(httpd);
+        }
+        evutil_closesocket(slot->fd);
+        slot->fd = -1;
+        return;
+    }
+
+    evhttp_set_timeout(httpd, slot->group->keep_alive_timeout + 30);
+    evhttp_set_max_body_size(httpd, slot->group->max_body_size);
+    evhttp_set_cb(httpd, "/smoketest", smoke_request_cb, NULL);
+    evhttp_set_cb(httpd, "/metrics", metrics_request_cb, NULL);
+    evhttp_set_gencb(httpd, httpd_worker_request_cb, slot);
+    slot->httpd = httpd;
+}
+
+static void httpd_worker_release_task(void *arg) {
+    httpd_worker_slot_t *slot = (httpd_worker_slot_t *)arg;
+    if (slot->httpd) {
+        // Closes the listener and every connection, firing their closecbs.
+        evhttp_free(slot->httpd);
+        slot->httpd = NULL;
+    } else if (slot->fd >= 0) {
+        evutil_closesocket(slot->fd);
+    }
+    slot->fd = -1;
+    httpd_worker_group_unref(slot->group);
+}
+
+// ============================================================
+// Main side
+// ============================================================
+
+void httpd_remote_post(Request *request, httpd_remote_op_t op, int code,
+                       const char *reason, struct evbuffer *body) {
+    httpd_worker_req_t *remote = request->remote;
+    httpd_remote_msg_t *msg = remote ? calloc(1, sizeof(httpd_remote_msg_t)) : NULL;
+    if (!msg) {
+        if (body) {
+            evbuffer_free(body);
+        }
+        return;
+    }
+
+    msg->remote = remote;
+    msg->op = op;
+    msg->code = code;
+    msg->reason = reason ? strdup(reason) : NULL;
+    msg->body = body;
+    TAILQ_INIT(&msg->headers);
+
+    if ((op == HTTPD_REMOTE_REPLY || op == HTTPD_REMOTE_REPLY_START) && request->req) {
+        struct evkeyval *header;
+        TAILQ_FOREACH(header, evhttp_request_get_output_headers(request->req), next) {
+            evhttp_add_header(&msg->headers, header->key, header->value);
+        }
+    }
+
+    if (op == HTTPD_REMOTE_REPLY || op == HTTPD_REMOTE_REPLY_END || op == HTTPD_REMOTE_RELEASE) {
+        request->remote = NULL;
+    }
+
+    if (event_mgr_post(remote->worker_id, httpd_remote_task, msg) != 0) {
+        // Worker already stopped; its connections are gone with it.
+        httpd_remote_msg_free(msg);
+    }
+}
+
+LUA_API int lua_evhttp_remote_request_gc(lua_State *L) {
+    Request *request = (Request *)lua_touserdata(L, 1);
+    if (request->remote) {
+        httpd_remote_post(request, HTTPD_REMOTE_RELEASE, 0, NULL, NULL);
+    }
+    if (request->req) {
+        evhttp_request_free(request->req);
+        request->req = NULL;
+    }
+    return 0;
+}
+
+static evutil_socket_t httpd_reuseport_socket(const struct sockaddr *addr, ev_socklen_t addrlen) {
+    evutil_socket_t fd = socket(addr->sa_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (evutil_make_socket_nonblocking(fd) < 0 ||
+        evutil_make_socket_closeonexec(fd) < 0 ||
+        evutil_make_listen_socket_reuseable(fd) < 0 ||
+        evutil_make_listen_socket_reuseable_port(fd) < 0 ||
+        bind(fd, addr, addrlen) < 0 ||
+        listen(fd, 128) < 0) {
+        evutil_closesocket(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void httpd_workers_close(LuaServer *server) {
+    httpd_worker_group_t *group = server->workers;
+    if (!group) return;
+
+    server->workers = NULL;
+    group->server = NULL;
+
+    for (int i = 0; i < group->count; i++) {
+        httpd_worker_slot_t *slot = &group->slots[i];
+        if (event_mgr_post(slot->worker_id, httpd_worker_release_task, slot) != 0) {
+            // Worker already gone: its base is not dispatching, free in place.
+            httpd_worker_release_task(slot);
+        }
+    }
+
+    httpd_worker_group_unref(group);
+}
+
+int httpd_workers_open(LuaServer *server) {
+    char portbuf[6];
+    evutil_snprintf(portbuf, sizeof(portbuf), "%d", server->port);
+
+    struct evutil_addrinfo hints = {0};
+    struct evutil_addrinfo *answer = NULL;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags = EVUTIL_AI_PASSIVE | EVUTIL_AI_ADDRCONFIG;
+
+    if (evutil_getaddrinfo(server->host ? server->host : "0.0.0.0", portbuf, &hints, &answer) != 0 || !answer) {
+        return -1;
+    }
+
+    struct sockaddr_storage ss;
+    ev_socklen_t sslen = answer->ai_addrlen;
+    memcpy(&ss, answer->ai_addr, answer->ai_addrlen);
+    evutil_freeaddrinfo(answer);
+
+    int count = server->reuseport_shards;
+    if (count > event_mgr_worker_count()) {
+        count = event_mgr_worker_count();
+    }
+    if (count <= 0) {
+        return -1;
+    }
+
+    httpd_worker_group_t *group = calloc(1, sizeof(httpd_worker_group_t));
+    if (!group) return -1;
+    atomic_init(&group->refs, 1);
+    group->server = server;
+    group->keep_alive_timeout = server->keep_alive_timeout;
+    group->max_body_size = server->max_body_size;
+
+    for (int i = 0; i < count; i++) {
+        evutil_socket_t fd = httpd_reuseport_socket((struct sockaddr *)&ss, sslen);
+        if (fd < 0) {
+            break;
+        }
+
+        // port 0: every other socket must join the port the kernel picked
+        if (i == 0) {
+            int port = regress_get_socket_port(fd);
+            if (ss.ss_family == AF_INET6) {
+                ((struct sockaddr_in6 *)&ss)->sin6_port = htons(port);
+            } else {
+                ((struct sockaddr_in *)&ss)->sin_port = htons(port);
+            }
+        }
+
+        httpd_worker_slot_t *slot = &group->slots[i];
+        slot->group = group;
+        slot->worker_id = i;
+        slot->fd = fd;
+        group->count++;
+        atomic_fetch_add(&group->refs, 1);
+    }
+
+    server->workers = group;
+    if (group->count != count) {
+        httpd_workers_close(server);
+        return -1;
+    }
+
+    server->port = regress_get_socket_port(group->slots[0].fd);
+    for (int i = 0; i < group->count; i++) {
+        event_mgr_post(i, httpd_worker_listen_task, &group->slots[i]);
+    }
+    return 0;
+}
@@ -8,6 +8,24 @@
  *   encode / decode / array / object / null / enable_null
  *   is_present / is_nonempty_string / _version
  *
+ * C-only extensions:
+ *   enable_roundtrip(bool) -> numbers that are not integers below 1e14 are
+ *     written with the shortest of %.15g/%.16g/%.17g that reads back to the
+ *     same double (and Lua 5.3 integers exactly) instead of "%.14g".
+ *   encode_to(target, value [, chunk_size]) -> bytes written. Encodes straight
+ *     into target in pieces of at most chunk_size bytes (default 16KB), so a
+ *     huge document never exists as one Lua string. target is an httpd
+ *     request (after reply_start; call reply_end afterwards), a tcpd
+ *     connection, a fan.stream or a function(chunk). The writer must not yield;
+ *     on an encode error the chunks already written stay in target.
+ *   decoder([opts]) -> push parser for streamed input:
+ *     dec:feed(chunk) -> values, n   (or n when opts.onvalue is set)
+ *     dec:finish()    -> values, n   (ends the stream, flushes a trailing number)
+ *   Top-level values may follow each other (NDJSON). opts.depth = d walks the
+ *   containers above depth d and emits the values at depth d one by one, so a
+ *   huge array never exists as one table; opts.onvalue(value, key) receives
+ *   them instead of the returned list (key is the object key, nil in arrays).
+ *
  * Strict empty-table rule: bare {} must error (use json.array() or json.object()).
  * Decode attaches array/object metatables so re-encode is unambiguous.
  */
@@ -30,6 +48,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define JSON_SIMD_SSE2 1
+#endif
+
 #if LUA_VERSION_NUM < 502
 #ifndef lua_absindex
 #define lua_absindex(L, i)                                                     \
@@ -53,18 +76,41 @@
 #define JSON_OBJECT_MT_KEY "json.object_mt"
 #define JSON_NULL_KEY "json.null_sentinel"
 #define JSON_MOD_KEY "json.module"
+#define JSON_ROUNDTRIP_KEY "json.roundtrip"
+
+/* encode_to: default and smallest chunk handed to the target. */
+#define JSON_CHUNK_SIZE 16384
+#define JSON_CHUNK_MIN 64
+
+/* Integers below this print the same with "%.14g" and as plain digits. */
+#define JSON_EXACT_INT 100000000000000LL
 
 /* ---- growable string buffer ------------------------------------------------ */
 
+/* encode_to target: the buffer is handed to fn whenever it reaches limit. */
+typedef struct {
+    lua_State *L;
+    int fn;   /* writer (absolute index) */
+    int self; /* target passed before the chunk, 0 for a plain function */
+    size_t limit;
+    size_t written;
+} json_sink_t;
+
 typedef struct {
     char *data;
     size_t len;
     size_t cap;
+    int roundtrip;     /* encode option: shortest round-trip doubles */
+    json_sink_t *sink; /* encode_to only; NULL when building a string */
 } strbuf_t;
 
+static void sink_write(strbuf_t *b);
+
 static void strbuf_init(strbuf_t *b) {
     b->cap = 256;
     b->len = 0;
+    b->roundtrip = 0;
+    b->sink = NULL;
     b->data = (char *)malloc(b->cap);
     if (b->data)
         b->data[0] = '\0';
@@ -93,7 +139,25 @@ static int strbuf_reserve(strbuf_t *b, size_t need) {
     return 1;
 }
 
+/* With a sink the buffer never grows past limit: full chunks go out first. */
+static int strbuf_append_sink(strbuf_t *b, const char *s, size_t n) {
+    while (b->len + n > b->sink->limit) {
+        size_t room = b->sink->limit - b->len;
+        memcpy(b->data + b->len, s, room);
+        b->len += room;
+        s += room;
+        n -= room;
+        sink_write(b);
+    }
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+    b->data[b->len] = '\0';
+    return 1;
+}
+
 static int strbuf_append(strbuf_t *b, const char *s, size_t n) {
+    if (b->data && b->sink && b->len + n > b->sink->limit)
+        return strbuf_append_sink(b, s, n);
     if (!b->data || !strbuf_reserve(b, n))
         return 0;
     memcpy(b->data + b->len, s, n);
@@ -110,6 +174,49 @@ static int strbuf_append_str(strbuf_t *b, const char *s) {
     return strbuf_append(b, s, strlen(s));
 }
 
+/* ---- string scanning ------------------------------------------------------- */
+
+/* Length of the run at s that a JSON string holds verbatim: up to the first
+   '"', '\\' or control character (len if there is none). The decoder uses
+   it to skip to the next byte it has to look at, the encoder to copy runs
+   that need no escaping in one go. */
+static inline size_t scan_plain_scalar(const unsigned char *s, size_t len) {
+    size_t i = 0;
+    for (; i < len; i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\' || c < 0x20)
+            break;
+    }
+    return i;
+}
+
+#ifdef JSON_SIMD_SSE2
+/* x < 0x20 as unsigned bytes: min(x, 0x1f) == x. */
+static size_t scan_plain_sse2(const unsigned char *s, size_t len) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(0x1f);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)),
+                                 _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v));
+        int mask = _mm_movemask_epi8(m);
+        if (mask)
+            return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+    return i + scan_plain_scalar(s + i, len - i);
+}
+
+/* Keys and short values are the common case; the vector setup costs more
+   than it saves on them. */
+static inline size_t scan_plain(const unsigned char *s, size_t len) {
+    return len < 16 ? scan_plain_scalar(s, len) : scan_plain_sse2(s, len);
+}
+#else
+#define scan_plain scan_plain_scalar
+#endif
+
 /* ---- registry helpers ------------------------------------------------------ */
 
 static void push_array_mt(lua_State *L) {
@@ -217,6 +324,33 @@ static int encode_errorf(lua_State *L, strbuf_t *buf, const char *fmt, ...) {
     return encode_error(L, buf, msg);
 }
 
+/* Hand the buffered bytes to the encode_to target. Errors raised by the
+   writer propagate after the buffer is freed. */
+static void sink_write(strbuf_t *b) {
+    json_sink_t *k = b->sink;
+    lua_State *L = k->L;
+    if (b->len == 0)
+        return;
+    if (!lua_checkstack(L, 4))
+        encode_error(L, b, "stack overflow");
+    lua_pushvalue(L, k->fn);
+    if (k->self)
+        lua_pushvalue(L, k->self);
+    lua_pushlstring(L, b->data, b->len);
+    if (lua_pcall(L, k->self ? 2 : 1, 1, 0) != 0) {
+        strbuf_free(b);
+        lua_error(L);
+    }
+    /* tcpd send() answers -1 once the connection is gone */
+    int closed = lua_type(L, -1) == LUA_TNUMBER && lua_tonumber(L, -1) < 0;
+    lua_pop(L, 1);
+    if (closed)
+        encode_error(L, b, "encode_to: target closed");
+    k->written += b->len;
+    b->len = 0;
+    b->data[0] = '\0';
+}
+
 /* ---- encode ---------------------------------------------------------------- */
 
 static void encode_value(lua_State *L, int idx, strbuf_t *buf, int stack_idx);
@@ -224,11 +358,21 @@ static void encode_value(lua_State *L, int idx, strbuf_t *buf, int stack_idx);
 static void encode_string(lua_State *L, int idx, strbuf_t *buf) {
     size_t len;
     const char *s = lua_tolstring(L, idx, &len);
-    if (!strbuf_append_char(buf, '"'))
+    if ((!buf->sink && !strbuf_reserve(buf, len + 2)) || !strbuf_append_char(buf, '"'))
         encode_error(L, buf, "out of memory");
 
-    for (size_t i = 0; i < len; i++) {
-        unsigned char c = (unsigned char)s[i];
+    size_t i = 0;
+    while (i < len) {
+        size_t run = scan_plain((const unsigned char *)s + i, len - i);
+        if (run) {
+            if (!strbuf_append(buf, s + i, run))
+                encode_error(L, buf, "out of memory");
+            i += run;
+            if (i >= len)
+                break;
+        }
+
+        unsigned char c = (unsigned char)s[i++];
         const char *esc = NULL;
         char uesc[8];
         switch (c) {
@@ -254,25 +398,60 @@ static void encode_string(lua_State *L, int idx, strbuf_t *buf) {
             esc = "\\t";
             break;
         default:
-            if (c < 0x20) {
-                snprintf(uesc, sizeof(uesc), "\\u%04x", c);
-                esc = uesc;
-            }
+            snprintf(uesc, sizeof(uesc), "\\u%04x", c);
+            esc = uesc;
             break;
         }
-        if (esc) {
-            if (!strbuf_append_str(buf, esc))
-                encode_error(L, buf, "out of memory");
-        } else {
-            if (!strbuf_append_char(buf, (char)c))
-                encode_error(L, buf, "out of memory");
-        }
+        if (!strbuf_append_str(buf, esc))
+            encode_error(L, buf, "out of memory");
     }
     if (!strbuf_append_char(buf, '"'))
         encode_error(L, buf, "out of memory");
 }
 
+/* Plain decimal digits of v; returns the length written to out (>= 21 bytes). */
+static int format_integer(char *out, long long v) {
+    char tmp[24];
+    int n = 0;
+    unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+    do {
+        tmp[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    int len = 0;
+    if (v < 0)
+        out[len++] = '-';
+    while (n)
+        out[len++] = tmp[--n];
+    out[len] = '\0';
+    return len;
+}
+
+/* Fewest significant digits (15 to 17) that strtod reads back as v. */
+static int format_roundtrip(char *out, size_t size, double v) {
+    int n = 0;
+    for (int prec = 15; prec <= 17; prec++) {
+        n = snprintf(out, size, "%.*g", prec, v);
+        if (prec == 17 || strtod(out, NULL) == v)
+            break;
+    }
+    return n;
+}
+
 static void encode_number(lua_State *L, int idx, strbuf_t *buf) {
+    char tmp[64];
+    int n;
+#if LUA_VERSION_NUM >= 503
+    if (lua_isinteger(L, idx)) {
+        lua_Integer iv = lua_tointeger(L, idx);
+        if (buf->roundtrip || (iv > -JSON_EXACT_INT && iv < JSON_EXACT_INT)) {
+            n = format_integer(tmp, (long long)iv);
+            if (!strbuf_append(buf, tmp, (size_t)n))
+                encode_error(L, buf, "out of memory");
+            return;
+        }
+    }
+#endif
     lua_Number val = lua_tonumber(L, idx);
     if (val != val || val <= -HUGE_VAL || val >= HUGE_VAL) {
         const char *label = (val != val) ? "nan" : (val >= HUGE_VAL) ? "inf" : "-inf";
@@ -281,9 +460,15 @@ static void encode_number(lua_State *L, int idx, strbuf_t *buf) {
     /* Match Lua string.format("%.14g"): IEEE -0 becomes "0", not "-0". */
     if (val == 0)
         val += 0; /* (-0) + (+0) => +0; avoids dead-store elision of val=0 */
-    char tmp[64];
-    /* Match webase/ljson.lua: string.format("%.14g", val) */
-    int n = snprintf(tmp, sizeof(tmp), "%.14g", (double)val);
+    if (val > -JSON_EXACT_INT && val < JSON_EXACT_INT && val == (lua_Number)(long long)val) {
+        /* same text as "%.14g" for these, without the printf machinery */
+        n = format_integer(tmp, (long long)val);
+    } else if (buf->roundtrip) {
+        n = format_roundtrip(tmp, sizeof(tmp), (double)val);
+    } else {
+        /* Match webase/ljson.lua: string.format("%.14g", val) */
+        n = snprintf(tmp, sizeof(tmp), "%.14g", (double)val);
+    }
     if (n < 0 || (size_t)n >= sizeof(tmp))
         encode_error(L, buf, "number format failed");
     if (!strbuf_append(buf, tmp, (size_t)n))
@@ -420,6 +605,13 @@ static void encode_value(lua_State *L, int idx, strbuf_t *buf, int stack_idx) {
     }
 }
 
+static int roundtrip_enabled(lua_State *L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, JSON_ROUNDTRIP_KEY);
+    int on = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    return on;
+}
+
 static int json_encode(lua_State *L) {
     /* Ensure value at index 1 (encode() with no args → null). */
     if (lua_gettop(L) < 1)
@@ -430,6 +622,8 @@ static int json_encode(lua_State *L) {
     if (!buf.data)
         return json_error(L, "out of memory");
 
+    buf.roundtrip = roundtrip_enabled(L);
+
     /* stack map for circular refs (above the value) */
     lua_newtable(L);
     int stack_idx = lua_gettop(L);
@@ -441,16 +635,71 @@ static int json_encode(lua_State *L) {
     return 1;
 }
 
+/* Method names tried on an encode_to target, in order: httpd request,
+   fan.stream, tcpd connection. */
+static const char *const sink_methods[] = {"reply_chunk", "AddBytes", "send", NULL};
+
+static int json_encode_to(lua_State *L) {
+    luaL_checkany(L, 2);
+    lua_Integer chunk = luaL_optinteger(L, 3, JSON_CHUNK_SIZE);
+    luaL_argcheck(L, chunk >= JSON_CHUNK_MIN, 3, "chunk_size too small");
+    lua_settop(L, 2);
+
+    json_sink_t sink;
+    sink.L = L;
+    sink.self = 0;
+    sink.limit = (size_t)chunk;
+    sink.written = 0;
+    if (lua_isfunction(L, 1)) {
+        sink.fn = 1;
+    } else {
+        int t = lua_type(L, 1);
+        if (t == LUA_TTABLE || t == LUA_TUSERDATA) {
+            for (const char *const *m = sink_methods; *m; m++) {
+                lua_getfield(L, 1, *m);
+                if (lua_isfunction(L, -1))
+                    break;
+                lua_pop(L, 1);
+            }
+        }
+        if (lua_gettop(L) == 2)
+            return luaL_argerror(L, 1, "expected httpd request, tcpd connection, fan.stream or function");
+        sink.fn = 3;
+        sink.self = 1;
+    }
+
+    strbuf_t buf;
+    strbuf_init(&buf);
+    if (!buf.data || !strbuf_reserve(&buf, sink.limit)) {
+        strbuf_free(&buf);
+        return json_error(L, "out of memory");
+    }
+    buf.roundtrip = roundtrip_enabled(L);
+    buf.sink = &sink;
+
+    lua_newtable(L);
+    int stack_idx = lua_gettop(L);
+
+    encode_value(L, 2, &buf, stack_idx);
+    sink_write(&buf);
+
+    strbuf_free(&buf);
+    lua_pushinteger(L, (lua_Integer)sink.written);
+    return 1;
+}
+
 /* ---- decode ---------------------------------------------------------------- */
 
 typedef struct {
     const char *str;
     size_t len;
     size_t idx; /* 0-based */
+    int line0;  /* position of str[0] in the whole input, for messages */
+    int col0;
 } parse_t;
 
 static void decode_error_at(lua_State *L, parse_t *p, size_t at, const char *msg) {
-    int line = 1, col = 1;
+    int line = p->line0, col = p->col0;
     for (size_t i = 0; i < at && i < p->len; i++) {
         col++;
         if (p->str[i] == '\n') {
@@ -553,6 +802,9 @@ static void parse_string(lua_State *L, parse_t *p) {
     size_t k = i; /* start of unflushed raw span */
 
     while (i < p->len) {
+        i += scan_plain((const unsigned char *)p->str + i, p->len - i);
+        if (i >= p->len)
+            break;
         unsigned char x = (unsigned char)p->str[i];
         if (x < 32) {
             decode_error_at(L, p, i, "control character in string");
@@ -646,6 +898,22 @@ static void parse_number(lua_State *L, parse_t *p) {
     size_t nlen = x - i;
     if (nlen == 0 || nlen >= 128)
         decode_error_at(L, p, i, "invalid number");
+
+    /* Up to 15 digits: exact as a double, no strtod needed. */
+    const char *w = p->str + i;
+    size_t k = (w[0] == '-') ? 1 : 0;
+    if (nlen > k && nlen - k <= 15) {
+        long long v = 0;
+        size_t d = k;
+        for (; d < nlen && w[d] >= '0' && w[d] <= '9'; d++)
+            v = v * 10 + (w[d] - '0');
+        if (d == nlen) {
+            lua_pushnumber(L, (lua_Number)(k ? -v : v)); /* "-0" => +0 as below */
+            p->idx = x;
+            return;
+        }
+    }
+
     char tmp[128];
     memcpy(tmp, p->str + i, nlen);
     tmp[nlen] = '\0';
@@ -805,6 +1073,8 @@ static int json_decode(lua_State *L) {
     parse_t p;
     p.str = s;
     p.len = len;
+    p.line0 = 1;
+    p.col0 = 1;
     p.idx = next_char(&p, 0, is_space, 1);
     parse_value(L, &p);
     p.idx = next_char(&p, p.idx, is_space, 1);
@@ -813,6 +1083,385 @@ static int json_decode(lua_State *L) {
     return 1;
 }
 
+/* ---- incremental decoder ---------------------------------------------------- */
+
+#define JSON_DECODER_MT "json.decoder"
+#define JSON_DECODER_MAX_DEPTH 32
+
+/* Structural states for the containers above the emit depth. */
+enum {
+    DEC_VALUE,       /* a value (or, at depth 0, the next top-level value) */
+    DEC_ARRAY_FIRST, /* a value or ']' */
+    DEC_OBJECT_FIRST,/* a key or '}' */
+    DEC_KEY,
+    DEC_COLON,
+    DEC_NEXT,        /* ',' or the closing bracket */
+};
+
+typedef struct {
+    strbuf_t buf;     /* unconsumed input, starting at the pending token */
+    size_t pos;       /* next byte to look at */
+    size_t lc_pos;    /* buf offset that line/col refer to */
+    int line, col;
+    int emit_depth;
+    int depth;        /* open containers above emit_depth */
+    char stack[JSON_DECODER_MAX_DEPTH];
+    int state;
+    int failed;
+    int keyref;       /* pending object key */
+    int onvalueref;
+
+    /* raw scan of the value (or key) starting at value_start */
+    int in_value;
+    int is_key;
+    size_t value_start;
+    int vdepth;
+    int in_str;
+    int esc;
+} decoder_t;
+
+static decoder_t *check_decoder(lua_State *L) {
+    decoder_t *dec = (decoder_t *)luaL_checkudata(L, 1, JSON_DECODER_MT);
+    if (!dec->buf.data)
+        json_error(L, "decoder is closed");
+    if (dec->failed)
+        json_error(L, "decoder stopped after a previous error");
+    return dec;
+}
+
+/* Move the line/col bookkeeping forward to buf offset at (never backwards). */
+static void decoder_locate(decoder_t *dec, size_t at) {
+    const char *s = dec->buf.data;
+    size_t i = dec->lc_pos;
+    while (i < at) {
+        const char *nl = (const char *)memchr(s + i, '\n', at - i);
+        if (!nl) {
+            dec->col += (int)(at - i);
+            break;
+        }
+        dec->line++;
+        dec->col = 1;
+        i = (size_t)(nl - s) + 1;
+    }
+    dec->lc_pos = at;
+}
+
+/* Drop consumed bytes; called once per feed so a chunk full of small values
+   is not moved again for each of them. */
+static void decoder_compact(decoder_t *dec) {
+    size_t keep = dec->in_value ? dec->value_start : dec->pos;
+    if (keep == 0)
+        return;
+    decoder_locate(dec, keep);
+    dec->lc_pos = 0;
+    memmove(dec->buf.data, dec->buf.data + keep, dec->buf.len - keep);
+    dec->buf.len -= keep;
+    dec->buf.data[dec->buf.len] = '\0';
+    dec->pos -= keep;
+    if (dec->in_value)
+        dec->value_start = 0;
+}
+
+static void decoder_error(lua_State *L, decoder_t *dec, size_t at, const char *msg) {
+    parse_t p;
+    decoder_locate(dec, at);
+    p.str = dec->buf.data + at;
+    p.len = dec->buf.len - at;
+    p.idx = 0;
+    p.line0 = dec->line;
+    p.col0 = dec->col;
+    dec->failed = 1;
+    decode_error_at(L, &p, 0, msg);
+}
+
+/* Find the end of the value starting at value_start; returns 1 and sets *end
+   once it is complete. Scalars end at a delimiter, or at the end of input
+   when final is set. */
+static int decoder_scan_value(decoder_t *dec, int final, size_t *end) {
+    const char *s = dec->buf.data;
+    size_t len = dec->buf.len;
+    size_t i = dec->pos;
+    char first = s[dec->value_start];
+
+    if (first != '"' && first != '[' && first != '{') {
+        for (; i < len; i++) {
+            if (is_delim((unsigned char)s[i]))
+                break;
+        }
+        dec->pos = i;
+        if (i < len || final) {
+            *end = i;
+            return 1;
+        }
+        return 0;
+    }
+
+    for (; i < len; i++) {
+        char c = s[i];
+        if (dec->in_str) {
+            if (!dec->esc) {
+                i += scan_plain((const unsigned char *)s + i, len - i);
+                if (i >= len)
+                    break;
+                c = s[i];
+            }
+            if (dec->esc)
+                dec->esc = 0;
+            else if (c == '\\')
+                dec->esc = 1;
+            else if (c == '"') {
+                dec->in_str = 0;
+                if (dec->vdepth == 0) {
+                    dec->pos = i + 1;
+                    *end = i + 1;
+                    return 1;
+                }
+            }
+        } else if (c == '"') {
+            dec->in_str = 1;
+        } else if (c == '[' || c == '{') {
+            dec->vdepth++;
+        } else if (c == ']' || c == '}') {
+            if (--dec->vdepth == 0) {
+                dec->pos = i + 1;
+                *end = i + 1;
+                return 1;
+            }
+        }
+    }
+    dec->pos = len;
+    return 0;
+}
+
+/* Decode buf[value_start, end) with the strict parser; leaves the value on the stack. */
+static void decoder_parse_span(lua_State *L, decoder_t *dec, size_t end) {
+    parse_t p;
+    p.str = dec->buf.data + dec->value_start;
+    p.len = end - dec->value_start;
+    p.idx = 0;
+    decoder_locate(dec, dec->value_start);
+    p.line0 = dec->line;
+    p.col0 = dec->col;
+    dec->failed = 1; /* cleared unless the parser raised */
+    parse_value(L, &p);
+    if (p.idx != p.len)
+        decode_error_at(L, &p, p.idx, "trailing garbage");
+    dec->failed = 0;
+}
+
+static void decoder_after_value(decoder_t *dec) {
+    dec->state = dec->depth == 0 ? DEC_VALUE : DEC_NEXT;
+}
+
+/* Runs the scanner over the buffered input; emitted values are appended to
+   the list at results (or passed to onvalue). Returns the number emitted. */
+static int decoder_run(lua_State *L, decoder_t *dec, int results, int final) {
+    int n = 0;
+    while (1) {
+        if (dec->in_value) {
+            size_t end;
+            if (!decoder_scan_value(dec, final, &end))
+                break;
+            decoder_parse_span(L, dec, end);
+            dec->in_value = 0;
+            if (dec->is_key) {
+                if (dec->keyref != LUA_NOREF)
+                    luaL_unref(L, LUA_REGISTRYINDEX, dec->keyref);
+                dec->keyref = luaL_ref(L, LUA_REGISTRYINDEX);
+                dec->state = DEC_COLON;
+                continue;
+            }
+
+            n++;
+            /* before onvalue: if it raises, the next feed carries on
+               after this value. */
+            decoder_after_value(dec);
+            if (dec->onvalueref != LUA_NOREF) {
+                lua_rawgeti(L, LUA_REGISTRYINDEX, dec->onvalueref);
+                lua_insert(L, -2);
+                if (dec->depth > 0 && dec->stack[dec->depth - 1] == '{')
+                    lua_rawgeti(L, LUA_REGISTRYINDEX, dec->keyref);
+                else
+                    lua_pushnil(L);
+                lua_call(L, 2, 0);
+            } else {
+                lua_rawseti(L, results, n);
+            }
+            continue;
+        }
+
+        const char *s = dec->buf.data;
+        size_t len = dec->buf.len;
+        while (dec->pos < len && is_space((unsigned char)s[dec->pos]))
+            dec->pos++;
+        if (dec->pos >= len)
+            break;
+
+        size_t at = dec->pos;
+        char c = s[at];
+        switch (dec->state) {
+        case DEC_ARRAY_FIRST:
+            if (c == ']')
+                goto close;
+            /* fall through */
+        case DEC_VALUE:
+            if ((c == '[' || c == '{') && dec->depth < dec->emit_depth) {
+                dec->stack[dec->depth++] = c;
+                dec->state = c == '[' ? DEC_ARRAY_FIRST : DEC_OBJECT_FIRST;
+                dec->pos++;
+                continue;
+            }
+            dec->is_key = 0;
+            goto start_value;
+        case DEC_OBJECT_FIRST:
+            if (c == '}')
+                goto close;
+            /* fall through */
+        case DEC_KEY:
+            if (c != '"')
+                decoder_error(L, dec, at, "expected string for key");
+            dec->is_key = 1;
+            goto start_value;
+        case DEC_COLON:
+            if (c != ':')
+                decoder_error(L, dec, at, "expected ':' after key");
+            dec->pos++;
+            dec->state = DEC_VALUE;
+            continue;
+        case DEC_NEXT: {
+            char open = dec->stack[dec->depth - 1];
+            if (c == ',') {
+                dec->pos++;
+                dec->state = open == '[' ? DEC_VALUE : DEC_KEY;
+                continue;
+            }
+            if ((open == '[' && c == ']') || (open == '{' && c == '}'))
+                goto close;
+            decoder_error(L, dec, at, open == '[' ? "expected ']' or ','" : "expected '}' or ','");
+        }
+        }
+        continue;
+
+    close:
+        dec->pos++;
+        dec->depth--;
+        decoder_after_value(dec);
+        continue;
+
+    start_value:
+        dec->in_value = 1;
+        dec->value_start = at;
+        dec->vdepth = 0;
+        dec->in_str = 0;
+        dec->esc = 0;
+    }
+    return n;
+}
+
+static int decoder_feed_impl(lua_State *L, decoder_t *dec, const char *chunk, size_t len, int final) {
+    if (len && !strbuf_append(&dec->buf, chunk, len)) {
+        dec->failed = 1;
+        return json_error(L, "out of memory");
+    }
+
+    int results = 0;
+    if (dec->onvalueref == LUA_NOREF) {
+        lua_newtable(L);
+        results = lua_gettop(L);
+    }
+    int n = decoder_run(L, dec, results, final);
+    decoder_compact(dec);
+
+    if (final && (dec->in_value || dec->depth > 0)) {
+        decoder_error(L, dec, dec->buf.len, "unexpected end of input");
+    }
+
+    lua_pushinteger(L, n);
+    return results ? 2 : 1;
+}
+
+static int json_decoder_feed(lua_State *L) {
+    decoder_t *dec = check_decoder(L);
+    size_t len;
+    const char *chunk = luaL_checklstring(L, 2, &len);
+    return decoder_feed_impl(L, dec, chunk, len, 0);
+}
+
+static int json_decoder_finish(lua_State *L) {
+    decoder_t *dec = check_decoder(L);
+    return decoder_feed_impl(L, dec, NULL, 0, 1);
+}
+
+/* Bytes buffered for the value being received. */
+static int json_decoder_pending(lua_State *L) {
+    decoder_t *dec = (decoder_t *)luaL_checkudata(L, 1, JSON_DECODER_MT);
+    lua_pushinteger(L, (lua_Integer)dec->buf.len);
+    return 1;
+}
+
+static int json_decoder_gc(lua_State *L) {
+    decoder_t *dec = (decoder_t *)luaL_checkudata(L, 1, JSON_DECODER_MT);
+    strbuf_free(&dec->buf);
+    if (dec->keyref != LUA_NOREF) {
+        luaL_unref(L, LUA_REGISTRYINDEX, dec->keyref);
+        dec->keyref = LUA_NOREF;
+    }
+    if (dec->onvalueref != LUA_NOREF) {
+        luaL_unref(L, LUA_REGISTRYINDEX, dec->onvalueref);
+        dec->onvalueref = LUA_NOREF;
+    }
+    return 0;
+}
+
+static const luaL_Reg json_decoder_methods[] = {
+    {"feed", json_decoder_feed},
+    {"finish", json_decoder_finish},
+    {"pending", json_decoder_pending},
+    {NULL, NULL},
+};
+
+static int json_decoder(lua_State *L) {
+    int emit_depth = 0;
+    int onvalueref = LUA_NOREF;
+    if (!lua_isnoneornil(L, 1)) {
+        luaL_checktype(L, 1, LUA_TTABLE);
+        lua_getfield(L, 1, "depth");
+        emit_depth = (int)luaL_optinteger(L, -1, 0);
+        lua_pop(L, 1);
+        if (emit_depth < 0 || emit_depth > JSON_DECODER_MAX_DEPTH)
+            return json_errorf(L, "decoder depth must be between 0 and %d", JSON_DECODER_MAX_DEPTH);
+        lua_getfield(L, 1, "onvalue");
+        if (lua_isfunction(L, -1)) {
+            onvalueref = luaL_ref(L, LUA_REGISTRYINDEX);
+        } else {
+            lua_pop(L, 1);
+        }
+    }
+
+    decoder_t *dec = (decoder_t *)lua_newuserdata(L, sizeof(decoder_t));
+    memset(dec, 0, sizeof(decoder_t));
+    dec->keyref = LUA_NOREF;
+    dec->onvalueref = onvalueref;
+    dec->emit_depth = emit_depth;
+    dec->state = DEC_VALUE;
+    dec->line = 1;
+    dec->col = 1;
+    strbuf_init(&dec->buf);
+
+    if (luaL_newmetatable(L, JSON_DECODER_MT)) {
+        lua_newtable(L);
+        luaL_register(L, NULL, json_decoder_methods);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, json_decoder_gc);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
+
+    if (!dec->buf.data)
+        return json_error(L, "out of memory");
+    return 1;
+}
+
 /* ---- helpers: array / object / null / is_* --------------------------------- */
 
 static int json_array(lua_State *L) {
@@ -856,6 +1505,12 @@ static int json_enable_null(lua_State *L) {
     return 0;
 }
 
+static int json_enable_roundtrip(lua_State *L) {
+    lua_pushboolean(L, lua_toboolean(L, 1));
+    lua_setfield(L, LUA_REGISTRYINDEX, JSON_ROUNDTRIP_KEY);
+    return 0;
+}
+
 /* True if value is present (not Lua nil / JSON null sentinel). */
 static int json_is_present(lua_State *L) {
     if (lua_isnoneornil(L, 1)) {
@@ -888,10 +1543,13 @@ static int json_is_nonempty_string(lua_State *L) {
 
 static const luaL_Reg json_funcs[] = {
     {"encode", json_encode},
+    {"encode_to", json_encode_to},
     {"decode", json_decode},
+    {"decoder", json_decoder},
     {"array", json_array},
     {"object", json_object},
     {"enable_null", json_enable_null},
+    {"enable_roundtrip", json_enable_roundtrip},
     {"is_present", json_is_present},
     {"is_nonempty_string", json_is_nonempty_string},
     {NULL, NULL},
@@ -14,15 +14,13 @@
 
 #define MAX_U30 4294967296 // exclusive upper bound for u32/u30 value range (2^32)
 
+#define ENCODE_MAX_DEPTH 1000 // nested tables, the walk is recursive
+
 #define CTX_INDEX_TABLES 1
 #define CTX_INDEX_NUMBERS 2
 #define CTX_INDEX_STRINGS 3
 #define CTX_INDEX_FUNCS 4
 #define CTX_INDEX_U30S 5
-#define CTX_INDEX_TABLE_IDXS 6
-#define CTX_INDEX_NUM_IDXS 7
-#define CTX_INDEX_STRING_IDXS 8
-#define CTX_INDEX_FUNC_IDXS 9
 
 #define SYM_INDEX_MAP 1
 #define SYM_INDEX_MAP_VK 2
@@ -31,15 +29,6 @@
 #define FALSE_INDEX 1
 #define TRUE_INDEX 2
 
-typedef struct {
-    lua_Integer table_count;
-    lua_Integer number_count;
-    lua_Integer u30_count;
-    lua_Integer string_count;
-    lua_Integer func_count;
-
-    int index;
-} CTX;
 
 void ffi_stream_add_u30(BYTEARRAY *ba, uint32_t u);
 void ffi_stream_add_d64(BYTEARRAY *ba, double value);
@@ -50,359 +39,649 @@ bool ffi_stream_get_u30(BYTEARRAY *ba, uint32_t *result);
 bool ffi_stream_get_d64(BYTEARRAY *ba, double *result);
 void ffi_stream_get_string(BYTEARRAY *ba, uint8_t **buff, size_t *buflen);
 
-static void packer(lua_State *L, CTX *ctx, int obj_index);
+// Encode context.
+//
+// The values of the object are collected into one C-side hash map (tables
+// and functions by address, numbers by value, strings by content) plus a
+// list per kind in the order they were found. All of it lives in an arena
+// kept per lua_State and reset, not freed, between calls: slots are
+// invalidated by bumping a generation counter and the lists and output
+// buffers keep their capacity, so steady-state encoding allocates nothing
+// on the Lua side but the result string (and, on Lua 5.1, the closure
+// arena_run calls).
+
+#define LUA_OBJECTBUF_ARENA_TYPE "OBJECTBUF_ARENA_TYPE"
+
+#define ARENA_MIN_SLOTS 64
+
+typedef enum {
+    SLOT_TABLE,
+    SLOT_FUNCTION,
+    SLOT_NUMBER,
+    SLOT_U30,
+    SLOT_STRING,
+} SLOT_KIND;
 
-static void packer_number(lua_State *L, CTX *ctx, int obj_index) {
-    lua_Number value = lua_tonumber(L, obj_index);
+typedef struct {
+    uint64_t key;    // address, number bits or string hash
+    const char *str; // string slots only
+    size_t len;
+    uint32_t gen; // in use when equal to the arena's generation
+    uint32_t pos; // position in the list of its kind
+    uint8_t kind;
+} ARENA_SLOT;
 
-    lua_rawgeti(L, ctx->index, CTX_INDEX_NUM_IDXS);
-    lua_pushvalue(L, obj_index);
-    lua_rawget(L, -2);
+typedef struct {
+    double value;
+    uint32_t index;
+} ARENA_NUMBER;
 
-    if (lua_isnil(L, -1)) {
-        if (floor(value) != value || value >= MAX_U30 || value < 0) {
-            lua_rawgeti(L, ctx->index, CTX_INDEX_NUMBERS);
-            lua_pushvalue(L, obj_index);
-            lua_rawseti(L, -2, ++ctx->number_count);
+typedef struct {
+    const char *data; // owned by the object being encoded
+    size_t len;
+    uint32_t index;
+} ARENA_STRING;
 
-            lua_rawgeti(L, ctx->index, CTX_INDEX_NUM_IDXS);
-            lua_pushvalue(L, obj_index);
-            lua_pushinteger(L, ctx->number_count);
-            lua_rawset(L, -3);
+typedef struct {
+    ARENA_SLOT *slots;
+    uint32_t mask;
+    uint32_t used;
+    uint32_t gen;
+
+    ARENA_NUMBER *numbers;
+    uint32_t number_count;
+    uint32_t number_cap;
+
+    ARENA_NUMBER *u30s;
+    uint32_t u30_count;
+    uint32_t u30_cap;
+
+    ARENA_STRING *strings;
+    uint32_t string_count;
+    uint32_t string_cap;
+
+    // tables and functions stay Lua values, in two arrays reused across
+    // calls; the slots past the counts are cleared after each call.
+    int tables_ref;
+    uint32_t table_count;
+    int funcs_ref;
+    uint32_t func_count;
+    int strings_ref; // the strings as Lua values, only filled for the sym lookup
+    bool strings_listed;
+    uint32_t table_base;
+
+    BYTEARRAY body;
+    BYTEARRAY scratch;
+
+    bool busy;
+} ARENA;
 
-            // pop CTX_INDEX_NUMBERS & CTX_INDEX_NUM_IDXS
-            lua_pop(L, 2);
-        } else {
-            // table.insert(ctx.integer_u30s, num)
-            // ctx.number_index[num] = #(ctx.integer_u30s)
+typedef struct {
+    ARENA *a;
+    int tables_idx;
+    int funcs_idx;
+    int strings_idx;
+    int sym_map_idx;
+    int depth;
+} ENCODER;
+
+static char arena_key;
+
+static void arena_buf_reset(BYTEARRAY *ba) {
+    ba->offset = 0;
+    ba->total = ba->buflen;
+    ba->reading = false;
+}
 
-            lua_rawgeti(L, ctx->index, CTX_INDEX_U30S);
-            lua_pushvalue(L, obj_index);
-            lua_rawseti(L, -2, ++ctx->u30_count);
+static int arena_gc(lua_State *L) {
+    ARENA *a = luaL_checkudata(L, 1, LUA_OBJECTBUF_ARENA_TYPE);
+    free(a->slots);
+    free(a->numbers);
+    free(a->u30s);
+    free(a->strings);
+    a->slots = NULL;
+    a->numbers = NULL;
+    a->u30s = NULL;
+    a->strings = NULL;
+    bytearray_dealloc(&a->body);
+    bytearray_dealloc(&a->scratch);
+    CLEAR_REF(L, a->tables_ref)
+    CLEAR_REF(L, a->funcs_ref)
+    CLEAR_REF(L, a->strings_ref)
+    return 0;
+}
 
-            lua_rawgeti(L, ctx->index, CTX_INDEX_NUM_IDXS);
-            lua_pushvalue(L, obj_index);
-            lua_pushinteger(L, ctx->u30_count);
-            lua_rawset(L, -3);
+static ARENA *arena_new(lua_State *L) {
+    ARENA *a = lua_newuserdata(L, sizeof(ARENA));
+    memset(a, 0, sizeof(ARENA));
+    a->tables_ref = LUA_NOREF;
+    a->funcs_ref = LUA_NOREF;
+    a->strings_ref = LUA_NOREF;
+    if (luaL_newmetatable(L, LUA_OBJECTBUF_ARENA_TYPE)) {
+        lua_pushcfunction(L, &arena_gc);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
 
-            // pop CTX_INDEX_U30S & CTX_INDEX_NUM_IDXS
-            lua_pop(L, 2);
-        }
+    a->slots = calloc(ARENA_MIN_SLOTS, sizeof(ARENA_SLOT));
+    if (!a->slots || !bytearray_alloc(&a->body, 256) || !bytearray_alloc(&a->scratch, 256)) {
+        luaL_error(L, "objectbuf: out of memory.");
     }
+    a->mask = ARENA_MIN_SLOTS - 1;
+    a->gen = 1;
 
-    lua_pop(L, 2);
+    lua_newtable(L);
+    a->tables_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_newtable(L);
+    a->funcs_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_newtable(L);
+    a->strings_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    return a;
 }
 
-static void packer_string(lua_State *L, CTX *ctx, int obj_index) {
-    lua_rawgeti(L, ctx->index, CTX_INDEX_STRING_IDXS);
-    lua_pushvalue(L, obj_index);
-    lua_rawget(L, -2);
+// The arena of this lua_State, or a fresh one (left on the stack) when the
+// shared one is in use, e.g. by an encode that a __gc metamethod interrupted.
+static ARENA *arena_acquire(lua_State *L) {
+    lua_pushlightuserdata(L, &arena_key);
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    ARENA *a = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if (!a) {
+        lua_pushlightuserdata(L, &arena_key);
+        a = arena_new(L);
+        lua_rawset(L, LUA_REGISTRYINDEX);
+    } else if (a->busy) {
+        a = arena_new(L);
+    }
 
-    if (lua_isnil(L, -1)) {
-        lua_rawgeti(L, ctx->index, CTX_INDEX_STRINGS);
-        lua_pushvalue(L, obj_index);
-        lua_rawseti(L, -2, ++ctx->string_count);
+    if (++a->gen == 0) {
+        memset(a->slots, 0, (a->mask + 1) * sizeof(ARENA_SLOT));
+        a->gen = 1;
+    }
+    a->used = 0;
+    a->number_count = 0;
+    a->u30_count = 0;
+    a->string_count = 0;
+    a->table_count = 0;
+    a->func_count = 0;
+    a->strings_listed = false;
+    arena_buf_reset(&a->body);
+    a->busy = true;
+    return a;
+}
 
-        lua_rawgeti(L, ctx->index, CTX_INDEX_STRING_IDXS);
-        lua_pushvalue(L, obj_index);
-        lua_pushinteger(L, ctx->string_count);
-        lua_rawset(L, -3);
+static void arena_clear_list(lua_State *L, int ref, uint32_t count) {
+    if (count == 0) {
+        return;
+    }
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    uint32_t i = 1;
+    for (; i <= count; i++) {
+        lua_pushnil(L);
+        lua_rawseti(L, -2, i);
+    }
+    lua_pop(L, 1);
+}
 
-        // pop CTX_INDEX_STRINGS & CTX_INDEX_STRING_IDXS
-        lua_pop(L, 2);
+// Drops the values the call put in the arrays, so they can be collected.
+static void arena_release(lua_State *L, ARENA *a) {
+    arena_clear_list(L, a->tables_ref, a->table_count);
+    arena_clear_list(L, a->funcs_ref, a->func_count);
+    if (a->strings_listed) {
+        arena_clear_list(L, a->strings_ref, a->string_count);
     }
+    a->busy = false;
+}
 
-    lua_pop(L, 2);
+// Calls body(arena, ...) with this function's arguments under lua_pcall
+// and releases the arena whether it returns or raises, so an error (out of
+// memory, tables nested too deep) cannot leave the shared arena busy.
+static int arena_run(lua_State *L, lua_CFunction body) {
+    int nargs = lua_gettop(L);
+    luaL_checkstack(L, nargs + 4, NULL);
+    ARENA *a = arena_acquire(L);
+    lua_pushcfunction(L, body);
+    lua_pushlightuserdata(L, a);
+    int i = 1;
+    for (; i <= nargs; i++) {
+        lua_pushvalue(L, i);
+    }
+    int status = lua_pcall(L, nargs + 1, 1, 0);
+    arena_release(L, a);
+    if (status != 0) {
+        return lua_error(L);
+    }
+    return 1;
 }
 
-static void packer_function(lua_State *L, CTX *ctx, int obj_index) {
-    lua_rawgeti(L, ctx->index, CTX_INDEX_FUNC_IDXS);
-    lua_pushvalue(L, obj_index);
-    lua_rawget(L, -2);
+static void arena_fail(lua_State *L) {
+    luaL_error(L, "objectbuf: out of memory.");
+}
 
-    if (lua_isnil(L, -1)) {
-        lua_rawgeti(L, ctx->index, CTX_INDEX_FUNCS);
-        lua_pushvalue(L, obj_index);
-        lua_rawseti(L, -2, ++ctx->func_count);
+static bool arena_reserve(void **list, uint32_t *cap, uint32_t count, size_t size) {
+    if (count < *cap) {
+        return true;
+    }
+    uint32_t n = *cap ? *cap * 2 : 16;
+    void *p = realloc(*list, n * size);
+    if (!p) {
+        return false;
+    }
+    *list = p;
+    *cap = n;
+    return true;
+}
 
-        lua_rawgeti(L, ctx->index, CTX_INDEX_FUNC_IDXS);
-        lua_pushvalue(L, obj_index);
-        lua_pushinteger(L, ctx->func_count);
-        lua_rawset(L, -3);
+static inline uint64_t arena_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
 
-        // pop CTX_INDEX_FUNCS & CTX_INDEX_FUNC_IDXS
-        lua_pop(L, 2);
+// Length plus up to 32 sampled bytes; equal strings always hash equal.
+static uint64_t arena_hash_string(const char *s, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL ^ len;
+    size_t step = (len >> 5) + 1;
+    size_t i = 0;
+    for (; i < len; i += step) {
+        h = (h ^ (uint8_t)s[i]) * 0x100000001b3ULL;
     }
+    return h;
+}
 
-    lua_pop(L, 2);
+static inline int slot_class(uint8_t kind) {
+    switch (kind) {
+        case SLOT_NUMBER:
+        case SLOT_U30:
+            return 1;
+        case SLOT_STRING:
+            return 2;
+        default:
+            return 0;
+    }
 }
 
-static void packer_table(lua_State *L, CTX *ctx, int obj_index) {
-    lua_rawgeti(L, ctx->index, CTX_INDEX_TABLE_IDXS);
-    lua_pushvalue(L, obj_index);
-    lua_rawget(L, -2);
+// The slot holding key, or the empty slot where it belongs.
+static ARENA_SLOT *arena_find(ARENA *a, int cls, uint64_t key, const char *str, size_t len) {
+    uint32_t i = (uint32_t)arena_mix(key + cls) & a->mask;
+    while (true) {
+        ARENA_SLOT *slot = &a->slots[i];
+        if (slot->gen != a->gen) {
+            return slot;
+        }
+        if (slot->key == key && slot_class(slot->kind) == cls &&
+            (cls != 2 || (slot->len == len && (slot->str == str || memcmp(slot->str, str, len) == 0)))) {
+            return slot;
+        }
+        i = (i + 1) & a->mask;
+    }
+}
 
-    if (lua_isnil(L, -1)) {
-        lua_rawgeti(L, ctx->index, CTX_INDEX_TABLES);
-        lua_pushvalue(L, obj_index);
-        lua_rawseti(L, -2, ++ctx->table_count);
+static bool arena_grow(ARENA *a) {
+    uint32_t old_size = a->mask + 1;
+    ARENA_SLOT *old = a->slots;
+    ARENA_SLOT *slots = calloc(old_size * 2, sizeof(ARENA_SLOT));
+    if (!slots) {
+        return false;
+    }
+    a->slots = slots;
+    a->mask = old_size * 2 - 1;
 
-        lua_rawgeti(L, ctx->index, CTX_INDEX_TABLE_IDXS);
-        lua_pushvalue(L, obj_index);
-        lua_pushinteger(L, ctx->table_count);
-        lua_rawset(L, -3);
+    uint32_t i = 0;
+    for (; i < old_size; i++) {
+        if (old[i].gen == a->gen) {
+            *arena_find(a, slot_class(old[i].kind), old[i].key, old[i].str, old[i].len) = old[i];
+        }
+    }
+    free(old);
+    return true;
+}
+
+// Finds the slot of the value at idx; inserts it with *found = false when
+// new. NULL if the value's type is not collected.
+static ARENA_SLOT *arena_slot(lua_State *L, ENCODER *e, int idx, bool insert, bool *found) {
+    ARENA *a = e->a;
+    int cls;
+    uint64_t key;
+    const char *str = NULL;
+    size_t len = 0;
+
+    switch (lua_type(L, idx)) {
+        case LUA_TTABLE:
+        case LUA_TFUNCTION:
+            cls = 0;
+            key = (uint64_t)(uintptr_t)lua_topointer(L, idx);
+            break;
+        case LUA_TNUMBER: {
+            double value = lua_tonumber(L, idx);
+            if (value == 0) {
+                value = 0; // -0.0 is the same table key as 0
+            }
+            cls = 1;
+            memcpy(&key, &value, sizeof(key));
+            break;
+        }
+        case LUA_TSTRING:
+            cls = 2;
+            str = lua_tolstring(L, idx, &len);
+            key = arena_hash_string(str, len);
+            break;
+        default:
+            return NULL;
+    }
+
+    if (insert && (a->used + 1) * 2 > a->mask + 1 && !arena_grow(a)) {
+        arena_fail(L);
+    }
+
+    ARENA_SLOT *slot = arena_find(a, cls, key, str, len);
+    *found = slot->gen == a->gen;
+    if (!*found && insert) {
+        slot->gen = a->gen;
+        slot->key = key;
+        slot->str = str;
+        slot->len = len;
+        a->used++;
+    }
+    return slot;
+}
+
+static void packer(lua_State *L, ENCODER *e, int obj_index);
 
-        // pop CTX_INDEX_TABLES & CTX_INDEX_TABLE_IDXS
-        lua_pop(L, 2);
+static void packer_number(lua_State *L, ENCODER *e, int obj_index) {
+    ARENA *a = e->a;
+    bool found;
+    ARENA_SLOT *slot = arena_slot(L, e, obj_index, true, &found);
+    if (found) {
+        return;
+    }
+
+    lua_Number value = lua_tonumber(L, obj_index);
+    if (floor(value) != value || value >= MAX_U30 || value < 0) {
+        if (!arena_reserve((void **)&a->numbers, &a->number_cap, a->number_count, sizeof(ARENA_NUMBER))) {
+            arena_fail(L);
+        }
+        slot->kind = SLOT_NUMBER;
+        slot->pos = a->number_count;
+        a->numbers[a->number_count++].value = value;
     } else {
-        lua_pop(L, 2);
+        if (!arena_reserve((void **)&a->u30s, &a->u30_cap, a->u30_count, sizeof(ARENA_NUMBER))) {
+            arena_fail(L);
+        }
+        slot->kind = SLOT_U30;
+        slot->pos = a->u30_count;
+        a->u30s[a->u30_count++].value = value;
+    }
+}
+
+static void packer_string(lua_State *L, ENCODER *e, int obj_index) {
+    ARENA *a = e->a;
+    bool found;
+    ARENA_SLOT *slot = arena_slot(L, e, obj_index, true, &found);
+    if (found) {
         return;
     }
 
-    lua_pop(L, 2);
+    if (!arena_reserve((void **)&a->strings, &a->string_cap, a->string_count, sizeof(ARENA_STRING))) {
+        arena_fail(L);
+    }
+    slot->kind = SLOT_STRING;
+    slot->pos = a->string_count;
+    a->strings[a->string_count].data = slot->str;
+    a->strings[a->string_count].len = slot->len;
+    a->string_count++;
+
+    if (e->strings_idx) {
+        lua_pushvalue(L, obj_index);
+        lua_rawseti(L, e->strings_idx, a->string_count);
+    }
+}
+
+static void packer_function(lua_State *L, ENCODER *e, int obj_index) {
+    ARENA *a = e->a;
+    bool found;
+    ARENA_SLOT *slot = arena_slot(L, e, obj_index, true, &found);
+    if (found) {
+        return;
+    }
+
+    slot->kind = SLOT_FUNCTION;
+    slot->pos = a->func_count++;
+    lua_pushvalue(L, obj_index);
+    lua_rawseti(L, e->funcs_idx, a->func_count);
+}
+
+static void packer_table(lua_State *L, ENCODER *e, int obj_index) {
+    ARENA *a = e->a;
+    bool found;
+    ARENA_SLOT *slot = arena_slot(L, e, obj_index, true, &found);
+    if (found) {
+        return;
+    }
+    if (++e->depth > ENCODE_MAX_DEPTH || !lua_checkstack(L, 4)) {
+        luaL_error(L, "objectbuf: tables nested too deep.");
+    }
+
+    slot->kind = SLOT_TABLE;
+    slot->pos = a->table_count++;
+    lua_pushvalue(L, obj_index);
+    lua_rawseti(L, e->tables_idx, a->table_count);
 
     lua_pushnil(L);
     while (lua_next(L, obj_index) != 0) {
         int value_idx = lua_gettop(L);
         int key_idx = lua_gettop(L) - 1;
 
-        packer(L, ctx, key_idx);
-        packer(L, ctx, value_idx);
+        packer(L, e, key_idx);
+        packer(L, e, value_idx);
         lua_pop(L, 1);
     }
+    e->depth--;
 }
 
-static void packer(lua_State *L, CTX *ctx, int obj_index) {
+static void packer(lua_State *L, ENCODER *e, int obj_index) {
     switch (lua_type(L, obj_index)) {
         case LUA_TTABLE:
-            packer_table(L, ctx, obj_index);
+            packer_table(L, e, obj_index);
             break;
         case LUA_TBOOLEAN:
             // no need any packer job.
             break;
         case LUA_TSTRING:
-            packer_string(L, ctx, obj_index);
+            packer_string(L, e, obj_index);
             break;
         case LUA_TNUMBER:
-            packer_number(L, ctx, obj_index);
+            packer_number(L, e, obj_index);
             break;
         case LUA_TFUNCTION:
-            packer_function(L, ctx, obj_index);
+            packer_function(L, e, obj_index);
             break;
         default:
             break;
     }
 }
 
-static void ctx_init(CTX *ctx, lua_State *L) {
-    lua_newtable(L);
-    ctx->index = lua_gettop(L);
-
-    lua_newtable(L);
-    lua_rawseti(L, ctx->index, CTX_INDEX_TABLES);
-
-    lua_newtable(L);
-    lua_rawseti(L, ctx->index, CTX_INDEX_NUMBERS);
-
-    lua_newtable(L);
-    lua_rawseti(L, ctx->index, CTX_INDEX_U30S);
-
-    lua_newtable(L);
-    lua_rawseti(L, ctx->index, CTX_INDEX_STRINGS);
+// Pushes the arena's reusable arrays and walks the object at obj_index.
+static void encoder_init(lua_State *L, ENCODER *e, ARENA *a, int obj_index, int sym_map_idx) {
+    memset(e, 0, sizeof(ENCODER));
+    e->a = a;
+    e->sym_map_idx = sym_map_idx;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, a->tables_ref);
+    e->tables_idx = lua_gettop(L);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, a->funcs_ref);
+    e->funcs_idx = lua_gettop(L);
+    if (sym_map_idx) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, a->strings_ref);
+        e->strings_idx = lua_gettop(L);
+        a->strings_listed = true;
+    }
 
-    lua_newtable(L);
-    lua_rawseti(L, ctx->index, CTX_INDEX_FUNCS);
+    packer(L, e, obj_index);
+}
 
-    lua_newtable(L);
-    lua_rawseti(L, ctx->index, CTX_INDEX_TABLE_IDXS);
+// index of the value at idx: sym_map[v] or its place in the index dictionary.
+static uint32_t encoder_index(lua_State *L, ENCODER *e, int idx) {
+    if (e->sym_map_idx) {
+        lua_pushvalue(L, idx);
+        lua_rawget(L, e->sym_map_idx);
+        if (!lua_isnil(L, -1)) {
+            uint32_t index = (uint32_t)lua_tointeger(L, -1);
+            lua_pop(L, 1);
+            return index;
+        }
+        lua_pop(L, 1);
+    }
 
-    lua_newtable(L);
-    lua_rawseti(L, ctx->index, CTX_INDEX_NUM_IDXS);
+    if (lua_type(L, idx) == LUA_TBOOLEAN) {
+        return lua_toboolean(L, idx) ? TRUE_INDEX : FALSE_INDEX;
+    }
 
-    lua_newtable(L);
-    lua_rawseti(L, ctx->index, CTX_INDEX_STRING_IDXS);
+    bool found;
+    ARENA_SLOT *slot = arena_slot(L, e, idx, false, &found);
+    if (!slot || !found) {
+        return 0;
+    }
+    switch (slot->kind) {
+        case SLOT_NUMBER:
+            return e->a->numbers[slot->pos].index;
+        case SLOT_U30:
+            return e->a->u30s[slot->pos].index;
+        case SLOT_STRING:
+            return e->a->strings[slot->pos].index;
+        case SLOT_TABLE:
+            return e->a->table_base + slot->pos + 1;
+        default:
+            return 0;
+    }
+}
 
-    lua_newtable(L);
-    lua_rawseti(L, ctx->index, CTX_INDEX_FUNC_IDXS);
+// pops a value, true when the sym table already holds it.
+static bool encoder_in_sym(lua_State *L, ENCODER *e) {
+    lua_rawget(L, e->sym_map_idx);
+    bool in_sym = !lua_isnil(L, -1);
+    lua_pop(L, 1);
+    return in_sym;
 }
 
-LUA_API int luafan_objectbuf_encode(lua_State *L) {
+// (arena, obj, sym), run by arena_run.
+static int objectbuf_encode_body(lua_State *L) {
+    ARENA *a = lua_touserdata(L, 1);
+    lua_remove(L, 1);
+
     int obj_index = 1;
     int sym_idx = 0;
-    if (lua_isnoneornil(L, 1)) {
-        luaL_error(L, "no argument.");
-        return 0;
-    }
     if (lua_istable(L, 2)) {
         sym_idx = 2;
     }
 
-    if (lua_isboolean(L, 1)) {
-        int value = lua_toboolean(L, 1);
-        lua_pushstring(L, value ? "\x01" : "\x00");
-        return 1;
-    }
-
-    CTX ctx = {0};
-    ctx_init(&ctx, L);
-
-    packer(L, &ctx, obj_index);
-
-    uint8_t flag = 0;
-    BYTEARRAY bodystream;
-    bytearray_alloc(&bodystream, 64);
-    bytearray_write8(&bodystream, flag); // place holder.
-
-    lua_newtable(L);
-    int index_map_idx = lua_gettop(L);
     uint32_t index = 2;
-
-    if (!sym_idx) {
-        lua_newtable(L);
-    } else {
+    int sym_map_idx = 0;
+    if (sym_idx) {
         lua_rawgeti(L, sym_idx, SYM_INDEX_INDEX);
         index = lua_tointeger(L, -1);
         lua_pop(L, 1);
 
         lua_rawgeti(L, sym_idx, SYM_INDEX_MAP);
+        sym_map_idx = lua_gettop(L);
     }
-    int sym_map_idx = lua_gettop(L);
 
-    lua_pushboolean(L, false);
-    lua_pushinteger(L, FALSE_INDEX);
-    lua_rawset(L, index_map_idx);
+    ENCODER e;
+    encoder_init(L, &e, a, obj_index, sym_map_idx);
+    BYTEARRAY *body = &a->body;
+    BYTEARRAY *d = &a->scratch;
 
-    lua_pushboolean(L, true);
-    lua_pushinteger(L, TRUE_INDEX);
-    lua_rawset(L, index_map_idx);
+    uint8_t flag = 0;
+    bytearray_write8(body, flag); // place holder.
 
     // ---------------------------------------------------------------------------
-    if (ctx.number_count > 0) {
+    if (a->number_count > 0) {
         flag |= HAS_NUMBER_MASK;
         uint32_t realcount = 0;
-
-        BYTEARRAY d;
-        bytearray_alloc(&d, 0);
-
-        lua_rawgeti(L, ctx.index, CTX_INDEX_NUMBERS);
-        int i = 1;
-        for (; i <= ctx.number_count; i++) {
-            lua_rawgeti(L, -1, i);
-
-            lua_pushvalue(L, -1);
-            lua_rawget(L, sym_map_idx);
-            if (lua_isnil(L, -1)) {
-                lua_pop(L, 1);
-                ffi_stream_add_d64(&d, lua_tonumber(L, -1));
-                lua_pushinteger(L, index + (++realcount));
-                lua_rawset(L, index_map_idx);
-            } else {
-                lua_pop(L, 2); // pop sym number idx & number
+        arena_buf_reset(d);
+
+        uint32_t i = 0;
+        for (; i < a->number_count; i++) {
+            bool in_sym = false;
+            if (sym_map_idx) {
+                lua_pushnumber(L, a->numbers[i].value);
+                in_sym = encoder_in_sym(L, &e);
+            }
+            if (!in_sym) {
+                ffi_stream_add_d64(d, a->numbers[i].value);
+                a->numbers[i].index = index + (++realcount);
             }
         }
-        lua_pop(L, 1);
-
-        ffi_stream_add_u30(&bodystream, realcount);
-        bytearray_read_ready(&d);
-        bytearray_writebuffer(&bodystream, d.buffer, d.total);
-
-        bytearray_dealloc(&d);
 
+        ffi_stream_add_u30(body, realcount);
+        bytearray_writebuffer(body, d->buffer, d->offset);
         index += realcount;
     }
 
     // ---------------------------------------------------------------------------
-    if (ctx.u30_count > 0) {
+    if (a->u30_count > 0) {
         flag |= HAS_U30_MASK;
         uint32_t realcount = 0;
-
-        BYTEARRAY d;
-        bytearray_alloc(&d, 0);
-
-        lua_rawgeti(L, ctx.index, CTX_INDEX_U30S);
-        int i = 1;
-        for (; i <= ctx.u30_count; i++) {
-            lua_rawgeti(L, -1, i);
-
-            lua_pushvalue(L, -1);
-            lua_rawget(L, sym_map_idx);
-            if (lua_isnil(L, -1)) {
-                lua_pop(L, 1);
-                ffi_stream_add_u30(&d, lua_tointeger(L, -1));
-                lua_pushinteger(L, index + (++realcount));
-                lua_rawset(L, index_map_idx);
-            } else {
-                lua_pop(L, 2); // pop sym u30 idx & u30
+        arena_buf_reset(d);
+
+        uint32_t i = 0;
+        for (; i < a->u30_count; i++) {
+            bool in_sym = false;
+            if (sym_map_idx) {
+                lua_pushinteger(L, (lua_Integer)a->u30s[i].value);
+                in_sym = encoder_in_sym(L, &e);
+            }
+            if (!in_sym) {
+                ffi_stream_add_u30(d, (uint32_t)a->u30s[i].value);
+                a->u30s[i].index = index + (++realcount);
             }
         }
-        lua_pop(L, 1);
-
-        ffi_stream_add_u30(&bodystream, realcount);
-        bytearray_read_ready(&d);
-        bytearray_writebuffer(&bodystream, d.buffer, d.total);
-
-        bytearray_dealloc(&d);
 
+        ffi_stream_add_u30(body, realcount);
+        bytearray_writebuffer(body, d->buffer, d->offset);
         index += realcount;
     }
 
     // ---------------------------------------------------------------------------
-    if (ctx.string_count > 0) {
+    if (a->string_count > 0) {
         flag |= HAS_STRING_MASK;
         uint32_t realcount = 0;
-
-        BYTEARRAY d;
-        bytearray_alloc(&d, 0);
-
-        lua_rawgeti(L, ctx.index, CTX_INDEX_STRINGS);
-        int i = 1;
-        for (; i <= ctx.string_count; i++) {
-            lua_rawgeti(L, -1, i);
-
-            lua_pushvalue(L, -1);
-            lua_rawget(L, sym_map_idx);
-            if (lua_isnil(L, -1)) {
-                lua_pop(L, 1);
-                size_t len;
-                const char *buf = lua_tolstring(L, -1, &len);
-                ffi_stream_add_string(&d, buf, len);
-                lua_pushinteger(L, index + (++realcount));
-                lua_rawset(L, index_map_idx);
-            } else {
-                lua_pop(L, 2); // pop sym u30 idx & u30
+        arena_buf_reset(d);
+
+        uint32_t i = 0;
+        for (; i < a->string_count; i++) {
+            bool in_sym = false;
+            if (e.strings_idx) {
+                lua_rawgeti(L, e.strings_idx, i + 1);
+                in_sym = encoder_in_sym(L, &e);
+            }
+            if (!in_sym) {
+                ffi_stream_add_string(d, a->strings[i].data, a->strings[i].len);
+                a->strings[i].index = index + (++realcount);
             }
         }
-        lua_pop(L, 1);
-
-        ffi_stream_add_u30(&bodystream, realcount);
-        bytearray_read_ready(&d);
-        bytearray_writebuffer(&bodystream, d.buffer, d.total);
-
-        bytearray_dealloc(&d);
 
+        ffi_stream_add_u30(body, realcount);
+        bytearray_writebuffer(body, d->buffer, d->offset);
         index += realcount;
     }
+
     // ---------------------------------------------------------------------------
-    if (ctx.table_count) {
+    if (a->table_count) {
         flag |= HAS_TABLE_MASK;
-        ffi_stream_add_u30(&bodystream, ctx.table_count);
-
-        lua_rawgeti(L, ctx.index, CTX_INDEX_TABLES);
-        int i = 1;
-        for (; i <= ctx.table_count; i++) {
-            lua_rawgeti(L, -1, i);
-            lua_pushinteger(L, index + i);
-            lua_rawset(L, index_map_idx);
-        }
+        ffi_stream_add_u30(body, a->table_count);
+        a->table_base = index;
 
-        for (i = 1; i <= ctx.table_count; i++) {
-            lua_rawgeti(L, -1, i);
+        uint32_t i = 1;
+        for (; i <= a->table_count; i++) {
+            lua_rawgeti(L, e.tables_idx, i);
             int tb_idx = lua_gettop(L);
+            arena_buf_reset(d);
 
-            BYTEARRAY d;
-            bytearray_alloc(&d, 0);
-
-            int tb_count = 0;
+            uint32_t tb_count = 0;
             while (true) {
                 lua_rawgeti(L, tb_idx, tb_count + 1);
                 if (lua_isnil(L, -1)) {
@@ -411,17 +690,7 @@ LUA_API int luafan_objectbuf_encode(lua_State *L) {
                 }
                 tb_count++;
 
-                int value_idx = lua_gettop(L);
-                lua_pushvalue(L, value_idx);
-                lua_rawget(L, sym_map_idx);
-                if (lua_isnil(L, -1)) {
-                    lua_pop(L, 1);
-                    lua_pushvalue(L, value_idx);
-                    lua_rawget(L, index_map_idx);
-                }
-                ffi_stream_add_u30(&d, lua_tointeger(L, -1));
-                lua_pop(L, 1);
-
+                ffi_stream_add_u30(d, encoder_index(L, &e, lua_gettop(L)));
                 lua_pop(L, 1);
             }
 
@@ -438,56 +707,44 @@ LUA_API int luafan_objectbuf_encode(lua_State *L) {
                     continue;
                 }
 
-                // d:AddU30(sym_map[k] or index_map[k])
-                lua_pushvalue(L, key_idx);
-                lua_rawget(L, sym_map_idx);
-                if (lua_isnil(L, -1)) {
-                    lua_pop(L, 1);
-                    lua_pushvalue(L, key_idx);
-                    lua_rawget(L, index_map_idx);
-                }
-                ffi_stream_add_u30(&d, lua_tointeger(L, -1));
-                lua_pop(L, 1);
-
-                // d:AddU30(sym_map[v] or index_map[v])
-                lua_pushvalue(L, value_idx);
-                lua_rawget(L, sym_map_idx);
-                if (lua_isnil(L, -1)) {
-                    lua_pop(L, 1);
-                    lua_pushvalue(L, value_idx);
-                    lua_rawget(L, index_map_idx);
-                }
-                ffi_stream_add_u30(&d, lua_tointeger(L, -1));
-                lua_pop(L, 1);
-
+                ffi_stream_add_u30(d, encoder_index(L, &e, key_idx));
+                ffi_stream_add_u30(d, encoder_index(L, &e, value_idx));
                 lua_pop(L, 1);
             }
 
             lua_pop(L, 1);
 
-            bytearray_read_ready(&d);
+            // u30 of the array count, then the indices, as one string.
+            uint8_t count_buf[5];
+            BYTEARRAY c;
+            bytearray_wrap_buffer(&c, count_buf, sizeof(count_buf));
+            c.reading = false;
+            ffi_stream_add_u30(&c, tb_count);
 
-            BYTEARRAY d2;
-            bytearray_alloc(&d2, 0);
-            ffi_stream_add_u30(&d2, tb_count);
-            bytearray_read_ready(&d2);
+            ffi_stream_add_u30(body, (uint32_t)(d->offset + c.offset));
+            ffi_stream_add_bytes(body, (const char *)count_buf, c.offset);
+            ffi_stream_add_bytes(body, (const char *)d->buffer, d->offset);
+        }
+    }
 
-            ffi_stream_add_u30(&bodystream, d.total + d2.total);
-            ffi_stream_add_bytes(&bodystream, (const char *)d2.buffer, d2.total);
-            ffi_stream_add_bytes(&bodystream, (const char *)d.buffer, d.total);
+    body->buffer[0] = flag;
+    lua_pushlstring(L, (const char *)body->buffer, body->offset);
+    return 1;
+}
 
-            bytearray_dealloc(&d2);
-            bytearray_dealloc(&d);
-        }
-        lua_pop(L, 1);
+LUA_API int luafan_objectbuf_encode(lua_State *L) {
+    if (lua_isnoneornil(L, 1)) {
+        luaL_error(L, "no argument.");
+        return 0;
     }
 
-    bytearray_read_ready(&bodystream);
-    *((uint8_t *)bodystream.buffer) = flag;
-    lua_pushlstring(L, (const char *)bodystream.buffer, bodystream.total);
+    if (lua_isboolean(L, 1)) {
+        int value = lua_toboolean(L, 1);
+        lua_pushstring(L, value ? "\x01" : "\x00");
+        return 1;
+    }
 
-    bytearray_dealloc(&bodystream);
-    return 1;
+    return arena_run(L, objectbuf_encode_body);
 }
 
 LUA_API int luafan_objectbuf_decode(lua_State *L) {
@@ -713,17 +970,765 @@ LUA_API int luafan_objectbuf_decode(lua_State *L) {
     return 1;
 }
 
+// (arena, obj), run by arena_run.
+static int objectbuf_symbol_body(lua_State *L) {
+    ARENA *a = lua_touserdata(L, 1);
+    lua_remove(L, 1);
+
+    ENCODER e;
+    encoder_init(L, &e, a, 1, 0);
+
+    lua_createtable(L, CTX_INDEX_U30S, 0);
+    int ctx_idx = lua_gettop(L);
+    uint32_t i;
+
+    lua_createtable(L, a->table_count, 0);
+    for (i = 1; i <= a->table_count; i++) {
+        lua_rawgeti(L, e.tables_idx, i);
+        lua_rawseti(L, -2, i);
+    }
+    lua_rawseti(L, ctx_idx, CTX_INDEX_TABLES);
+
+    lua_createtable(L, a->number_count, 0);
+    for (i = 0; i < a->number_count; i++) {
+        lua_pushnumber(L, a->numbers[i].value);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_rawseti(L, ctx_idx, CTX_INDEX_NUMBERS);
+
+    lua_createtable(L, a->string_count, 0);
+    for (i = 0; i < a->string_count; i++) {
+        lua_pushlstring(L, a->strings[i].data, a->strings[i].len);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_rawseti(L, ctx_idx, CTX_INDEX_STRINGS);
+
+    lua_createtable(L, a->func_count, 0);
+    for (i = 1; i <= a->func_count; i++) {
+        lua_rawgeti(L, e.funcs_idx, i);
+        lua_rawseti(L, -2, i);
+    }
+    lua_rawseti(L, ctx_idx, CTX_INDEX_FUNCS);
+
+    lua_createtable(L, a->u30_count, 0);
+    for (i = 0; i < a->u30_count; i++) {
+        lua_pushinteger(L, (lua_Integer)a->u30s[i].value);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_rawseti(L, ctx_idx, CTX_INDEX_U30S);
+    return 1;
+}
+
 LUA_API int luafan_objectbuf_symbol(lua_State *L) {
     if (lua_gettop(L) == 0) {
         luaL_error(L, "no argument.");
     }
 
-    CTX ctx = {0};
-    ctx_init(&ctx, L);
+    return arena_run(L, objectbuf_symbol_body);
+}
+
+// ---------------------------------------------------------------------------
+// objectbuf.schema: fixed-shape encoder/decoder.
+//
+// A schema lists the fields of a message in order with their types, so a
+// message is a presence bitmap followed by the present values, with no
+// symbol tables and no dedup pass. Fields that are absent from the schema,
+// or whose value does not have the declared type, are collected into one
+// table that is appended in the generic format.
+
+#define LUA_OBJECTBUF_SCHEMA_TYPE "OBJECTBUF_SCHEMA_TYPE"
+
+/* first byte of a schema message, never set by the generic format. */
+#define SCHEMA_FLAG (1 << 2)
+#define SCHEMA_MAX_DEPTH 32
+
+typedef enum {
+    SCHEMA_TYPE_ANY,
+    SCHEMA_TYPE_NUMBER,
+    SCHEMA_TYPE_INTEGER,
+    SCHEMA_TYPE_STRING,
+    SCHEMA_TYPE_BOOLEAN,
+    SCHEMA_TYPE_NESTED,
+} SCHEMA_TYPE;
+
+typedef struct SCHEMA {
+    int count;
+    int keys_ref;  // [i] = key of field i, [count + i] = nested schema of field i
+    int index_ref; // key => field index
+    int narray;    // fields keyed 1..narray, to presize decoded tables
+    struct {
+        SCHEMA_TYPE type;
+        struct SCHEMA *nested;
+    } fields[1];
+} SCHEMA;
+
+/* tags of "any" values. */
+#define ANY_FALSE 0
+#define ANY_TRUE 1
+#define ANY_INTEGER 2
+#define ANY_NUMBER 3
+#define ANY_STRING 4
+#define ANY_TABLE 5
+#define ANY_GENERIC 6
+#define ANY_END 7
+
+static const char *const schema_type_names[] = {"any", "number", "integer", "string", "boolean", NULL};
+
+static void schema_add_varint(BYTEARRAY *ba, uint64_t u) {
+    uint8_t buf[10];
+    int n = 0;
+    while (u >= 0x80) {
+        buf[n++] = (uint8_t)(u | 0x80);
+        u >>= 7;
+    }
+    buf[n++] = (uint8_t)u;
+    bytearray_writebuffer(ba, buf, n);
+}
 
-    packer(L, &ctx, 1);
+static bool schema_get_varint(BYTEARRAY *ba, uint64_t *result) {
+    uint64_t value = 0;
+    int shift = 0;
+    uint8_t b;
+    do {
+        if (shift > 63 || !bytearray_read8(ba, &b)) {
+            return false;
+        }
+        value |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    *result = value;
+    return true;
+}
 
-    lua_settop(L, ctx.index);
+static bool schema_tointeger(lua_State *L, int idx, int64_t *out) {
+#if LUA_VERSION_NUM >= 503
+    if (lua_isinteger(L, idx)) {
+        *out = (int64_t)lua_tointeger(L, idx);
+        return true;
+    }
+#endif
+    lua_Number n = lua_tonumber(L, idx);
+    if (n != floor(n) || n < -9223372036854775808.0 || n >= 9223372036854775808.0) {
+        return false;
+    }
+    *out = (int64_t)n;
+    return true;
+}
+
+static bool schema_match(lua_State *L, const SCHEMA *s, int i, int idx) {
+    int t = lua_type(L, idx);
+    switch (s->fields[i].type) {
+        case SCHEMA_TYPE_ANY:
+            return t != LUA_TNIL;
+        case SCHEMA_TYPE_NUMBER:
+            return t == LUA_TNUMBER;
+        case SCHEMA_TYPE_INTEGER: {
+            int64_t v;
+            return t == LUA_TNUMBER && schema_tointeger(L, idx, &v);
+        }
+        case SCHEMA_TYPE_STRING:
+            return t == LUA_TSTRING;
+        case SCHEMA_TYPE_BOOLEAN:
+            return t == LUA_TBOOLEAN;
+        case SCHEMA_TYPE_NESTED:
+            return t == LUA_TTABLE;
+    }
+    return false;
+}
+
+// objectbuf.encode(value) as a length-prefixed string.
+static void schema_add_generic(lua_State *L, BYTEARRAY *out, int idx) {
+    lua_pushcfunction(L, luafan_objectbuf_encode);
+    lua_pushvalue(L, idx);
+    lua_call(L, 1, 1);
+    size_t len;
+    const char *data = lua_tolstring(L, -1, &len);
+    ffi_stream_add_string(out, data, len);
+    lua_pop(L, 1);
+}
+
+// Tagged value; tables as array part then key/value pairs up to ANY_END.
+// false for what only the generic format handles (deep or cyclic tables,
+// functions).
+static bool any_pack(lua_State *L, int idx, BYTEARRAY *out, int depth) {
+    switch (lua_type(L, idx)) {
+        case LUA_TBOOLEAN:
+            bytearray_write8(out, lua_toboolean(L, idx) ? ANY_TRUE : ANY_FALSE);
+            return true;
+        case LUA_TNUMBER: {
+            int64_t v = 0;
+#if LUA_VERSION_NUM >= 503
+            bool integer = lua_isinteger(L, idx) && schema_tointeger(L, idx, &v);
+#else
+            bool integer = schema_tointeger(L, idx, &v);
+#endif
+            if (integer) {
+                bytearray_write8(out, ANY_INTEGER);
+                schema_add_varint(out, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+            } else {
+                bytearray_write8(out, ANY_NUMBER);
+                ffi_stream_add_d64(out, lua_tonumber(L, idx));
+            }
+            return true;
+        }
+        case LUA_TSTRING: {
+            size_t len;
+            const char *data = lua_tolstring(L, idx, &len);
+            bytearray_write8(out, ANY_STRING);
+            ffi_stream_add_string(out, data, len);
+            return true;
+        }
+        case LUA_TTABLE:
+            break;
+        default:
+            return false;
+    }
+
+    if (depth > SCHEMA_MAX_DEPTH || !lua_checkstack(L, 4)) {
+        return false;
+    }
+    bytearray_write8(out, ANY_TABLE);
+
+    uint32_t count = 0;
+    while (true) {
+        lua_rawgeti(L, idx, count + 1);
+        bool more = !lua_isnil(L, -1);
+        lua_pop(L, 1);
+        if (!more) {
+            break;
+        }
+        count++;
+    }
+    ffi_stream_add_u30(out, count);
+    uint32_t i = 1;
+    for (; i <= count; i++) {
+        lua_rawgeti(L, idx, i);
+        bool ok = any_pack(L, lua_gettop(L), out, depth + 1);
+        lua_pop(L, 1);
+        if (!ok) {
+            return false;
+        }
+    }
+
+    lua_pushnil(L);
+    while (lua_next(L, idx) != 0) {
+        int value_idx = lua_gettop(L);
+        int64_t k;
+        if (lua_type(L, value_idx - 1) == LUA_TNUMBER && schema_tointeger(L, value_idx - 1, &k) && k >= 1 &&
+            k <= count) {
+            lua_pop(L, 1);
+            continue;
+        }
+        if (!any_pack(L, value_idx - 1, out, depth + 1) || !any_pack(L, value_idx, out, depth + 1)) {
+            lua_pop(L, 2);
+            return false;
+        }
+        lua_pop(L, 1);
+    }
+    bytearray_write8(out, ANY_END);
+    return true;
+}
+
+static void schema_add_any(lua_State *L, BYTEARRAY *out, int idx) {
+    size_t offset = out->offset;
+    int top = lua_gettop(L);
+    if (!any_pack(L, idx, out, 0)) {
+        out->offset = offset;
+        lua_settop(L, top);
+        bytearray_write8(out, ANY_GENERIC);
+        schema_add_generic(L, out, idx);
+    }
+}
+
+// Appends the table at obj_idx; returns an error message or NULL.
+static const char *schema_pack(lua_State *L, const SCHEMA *s, int obj_idx, BYTEARRAY *out, int depth) {
+    if (depth > SCHEMA_MAX_DEPTH) {
+        return "schema encode: nesting too deep.";
+    }
+    if (!lua_checkstack(L, s->count + 8)) {
+        return "schema encode: stack overflow.";
+    }
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, s->keys_ref);
+    int keys_idx = lua_gettop(L);
+    int values_idx = keys_idx + 1;
+
+    // bit i: field i is present, bit count: extra fields follow.
+    uint8_t bitmap[(s->count + 8) / 8];
+    memset(bitmap, 0, sizeof(bitmap));
+
+    int present = 0;
+    int i = 0;
+    for (; i < s->count; i++) {
+        lua_rawgeti(L, keys_idx, i + 1);
+        lua_rawget(L, obj_idx);
+        if (schema_match(L, s, i, -1)) {
+            bitmap[i / 8] |= 1 << (i % 8);
+            present++;
+        }
+    }
+
+    // every key of obj is a present field unless obj has more entries.
+    int total = 0;
+    lua_pushnil(L);
+    while (lua_next(L, obj_idx) != 0) {
+        lua_pop(L, 1);
+        total++;
+    }
+    int extra_idx = 0;
+    if (total > present) {
+        bitmap[s->count / 8] |= 1 << (s->count % 8);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, s->index_ref);
+        int index_idx = lua_gettop(L);
+        lua_newtable(L);
+        extra_idx = lua_gettop(L);
+
+        lua_pushnil(L);
+        while (lua_next(L, obj_idx) != 0) {
+            lua_pushvalue(L, -2);
+            lua_rawget(L, index_idx);
+            int field = (int)lua_tointeger(L, -1) - 1;
+            lua_pop(L, 1);
+            if (field < 0 || !(bitmap[field / 8] & (1 << (field % 8)))) {
+                lua_pushvalue(L, -2);
+                lua_insert(L, -2);
+                lua_rawset(L, extra_idx);
+            } else {
+                lua_pop(L, 1);
+            }
+        }
+    }
+
+    bytearray_writebuffer(out, bitmap, sizeof(bitmap));
+
+    for (i = 0; i < s->count; i++) {
+        if (!(bitmap[i / 8] & (1 << (i % 8)))) {
+            continue;
+        }
+        int idx = values_idx + i;
+        switch (s->fields[i].type) {
+            case SCHEMA_TYPE_NUMBER:
+                ffi_stream_add_d64(out, lua_tonumber(L, idx));
+                break;
+            case SCHEMA_TYPE_INTEGER: {
+                int64_t v = 0;
+                schema_tointeger(L, idx, &v);
+                // zigzag, so small negative values stay short.
+                schema_add_varint(out, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+                break;
+            }
+            case SCHEMA_TYPE_STRING: {
+                size_t len;
+                const char *data = lua_tolstring(L, idx, &len);
+                ffi_stream_add_string(out, data, len);
+                break;
+            }
+            case SCHEMA_TYPE_BOOLEAN:
+                bytearray_write8(out, lua_toboolean(L, idx) ? 1 : 0);
+                break;
+            case SCHEMA_TYPE_NESTED: {
+                const char *err = schema_pack(L, s->fields[i].nested, idx, out, depth + 1);
+                if (err) {
+                    return err;
+                }
+                break;
+            }
+            case SCHEMA_TYPE_ANY:
+                schema_add_any(L, out, idx);
+                break;
+        }
+    }
+
+    if (extra_idx) {
+        schema_add_any(L, out, extra_idx);
+    }
+
+    lua_settop(L, keys_idx - 1);
+    return NULL;
+}
+
+// objectbuf.decode of a length-prefixed string, pushes the value.
+// Corrupt data can make decode raise; that is reported like a nil result.
+static const char *schema_get_generic(lua_State *L, BYTEARRAY *in) {
+    uint8_t *buff = NULL;
+    size_t buflen = 0;
+    ffi_stream_get_string(in, &buff, &buflen);
+    if (!buff) {
+        return "schema decode failed, truncated value.";
+    }
+    lua_pushcfunction(L, luafan_objectbuf_decode);
+    lua_pushlstring(L, (const char *)buff, buflen);
+    if (lua_pcall(L, 1, 2, 0) != 0) {
+        lua_pop(L, 1);
+        return "schema decode failed, bad generic value.";
+    }
+    if (lua_isnil(L, -2)) {
+        return "schema decode failed, bad generic value.";
+    }
+    lua_pop(L, 1);
+    return NULL;
+}
+
+static const char *any_unpack(lua_State *L, BYTEARRAY *in, int depth);
+
+static const char *any_unpack_tagged(lua_State *L, BYTEARRAY *in, uint8_t tag, int depth) {
+    if (depth > SCHEMA_MAX_DEPTH + 1 || !lua_checkstack(L, 4)) {
+        return "schema decode failed, nesting too deep.";
+    }
+    switch (tag) {
+        case ANY_FALSE:
+        case ANY_TRUE:
+            lua_pushboolean(L, tag == ANY_TRUE);
+            return NULL;
+        case ANY_INTEGER: {
+            uint64_t u;
+            if (!schema_get_varint(in, &u)) {
+                return "schema decode failed, bad integer.";
+            }
+            int64_t v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+#if LUA_VERSION_NUM >= 503
+            lua_pushinteger(L, (lua_Integer)v);
+#else
+            lua_pushnumber(L, (lua_Number)v);
+#endif
+            return NULL;
+        }
+        case ANY_NUMBER: {
+            double d;
+            if (!ffi_stream_get_d64(in, &d)) {
+                return "schema decode failed, truncated number.";
+            }
+            lua_pushnumber(L, d);
+            return NULL;
+        }
+        case ANY_STRING: {
+            uint8_t *buff = NULL;
+            size_t buflen = 0;
+            ffi_stream_get_string(in, &buff, &buflen);
+            if (!buff) {
+                return "schema decode failed, truncated string.";
+            }
+            lua_pushlstring(L, (const char *)buff, buflen);
+            return NULL;
+        }
+        case ANY_GENERIC:
+            return schema_get_generic(L, in);
+        case ANY_TABLE:
+            break;
+        default:
+            return "schema decode failed, bad value tag.";
+    }
+
+    uint32_t count = 0;
+    if (!ffi_stream_get_u30(in, &count) || count > bytearray_read_available(in)) {
+        return "schema decode failed, bad array size.";
+    }
+    lua_createtable(L, count, 0);
+    int tb_idx = lua_gettop(L);
+    uint32_t i = 1;
+    for (; i <= count; i++) {
+        const char *err = any_unpack(L, in, depth + 1);
+        if (err) {
+            return err;
+        }
+        lua_rawseti(L, tb_idx, i);
+    }
+    while (true) {
+        if (!bytearray_read8(in, &tag)) {
+            return "schema decode failed, truncated table.";
+        }
+        if (tag == ANY_END) {
+            break;
+        }
+        const char *err = any_unpack_tagged(L, in, tag, depth + 1);
+        if (err) {
+            return err;
+        }
+        if (lua_type(L, -1) == LUA_TNUMBER && lua_tonumber(L, -1) != lua_tonumber(L, -1)) {
+            return "schema decode failed, bad key.";
+        }
+        err = any_unpack(L, in, depth + 1);
+        if (err) {
+            return err;
+        }
+        lua_rawset(L, tb_idx);
+    }
+    return NULL;
+}
+
+// Pushes the value written by schema_add_any.
+static const char *any_unpack(lua_State *L, BYTEARRAY *in, int depth) {
+    uint8_t tag;
+    if (!bytearray_read8(in, &tag)) {
+        return "schema decode failed, truncated value.";
+    }
+    return any_unpack_tagged(L, in, tag, depth);
+}
+
+// Pushes the decoded table; returns an error message or NULL.
+static const char *schema_unpack(lua_State *L, const SCHEMA *s, BYTEARRAY *in, int depth) {
+    if (depth > SCHEMA_MAX_DEPTH) {
+        return "schema decode failed, nesting too deep.";
+    }
+    if (!lua_checkstack(L, 8)) {
+        return "schema decode failed, stack overflow.";
+    }
+
+    uint8_t bitmap[(s->count + 8) / 8];
+    if (!bytearray_readbuffer(in, bitmap, sizeof(bitmap))) {
+        return "schema decode failed, truncated bitmap.";
+    }
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, s->keys_ref);
+    int keys_idx = lua_gettop(L);
+    lua_createtable(L, s->narray, s->count - s->narray);
+    int tb_idx = lua_gettop(L);
+
+    int i = 0;
+    for (; i < s->count; i++) {
+        if (!(bitmap[i / 8] & (1 << (i % 8)))) {
+            continue;
+        }
+        lua_rawgeti(L, keys_idx, i + 1);
+        switch (s->fields[i].type) {
+            case SCHEMA_TYPE_NUMBER: {
+                double d;
+                if (!ffi_stream_get_d64(in, &d)) {
+                    return "schema decode failed, truncated number.";
+                }
+                lua_pushnumber(L, d);
+                break;
+            }
+            case SCHEMA_TYPE_INTEGER: {
+                uint64_t u;
+                if (!schema_get_varint(in, &u)) {
+                    return "schema decode failed, bad integer.";
+                }
+                int64_t v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+#if LUA_VERSION_NUM >= 503
+                lua_pushinteger(L, (lua_Integer)v);
+#else
+                lua_pushnumber(L, (lua_Number)v);
+#endif
+                break;
+            }
+            case SCHEMA_TYPE_STRING: {
+                uint8_t *buff = NULL;
+                size_t buflen = 0;
+                ffi_stream_get_string(in, &buff, &buflen);
+                if (!buff) {
+                    return "schema decode failed, truncated string.";
+                }
+                lua_pushlstring(L, (const char *)buff, buflen);
+                break;
+            }
+            case SCHEMA_TYPE_BOOLEAN: {
+                uint8_t b;
+                if (!bytearray_read8(in, &b)) {
+                    return "schema decode failed, truncated boolean.";
+                }
+                lua_pushboolean(L, b);
+                break;
+            }
+            case SCHEMA_TYPE_NESTED: {
+                const char *err = schema_unpack(L, s->fields[i].nested, in, depth + 1);
+                if (err) {
+                    return err;
+                }
+                break;
+            }
+            case SCHEMA_TYPE_ANY: {
+                const char *err = any_unpack(L, in, 0);
+                if (err) {
+                    return err;
+                }
+                break;
+            }
+        }
+        lua_rawset(L, tb_idx);
+    }
+
+    if (bitmap[s->count / 8] & (1 << (s->count % 8))) {
+        const char *err = any_unpack(L, in, 0);
+        if (err) {
+            return err;
+        }
+        if (!lua_istable(L, -1)) {
+            return "schema decode failed, bad extra fields.";
+        }
+        lua_pushnil(L);
+        while (lua_next(L, -2) != 0) {
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_rawset(L, tb_idx);
+        }
+        lua_pop(L, 1);
+    }
+
+    lua_remove(L, keys_idx);
+    return NULL;
+}
+
+typedef struct {
+    const SCHEMA *s;
+    BYTEARRAY *out;
+} SCHEMA_ENCODE_ARGS;
+
+// (args, obj) -> encoded string; anything in here may raise, through
+// objectbuf.encode for generic fields or luaL_error.
+static int schema_encode_protected(lua_State *L) {
+    SCHEMA_ENCODE_ARGS *args = lua_touserdata(L, 1);
+    bytearray_write8(args->out, SCHEMA_FLAG);
+    const char *err = schema_pack(L, args->s, 2, args->out, 0);
+    if (err) {
+        return luaL_error(L, "%s", err);
+    }
+
+    bytearray_read_ready(args->out);
+    lua_pushlstring(L, (const char *)args->out->buffer, args->out->total);
+    return 1;
+}
+
+static int luafan_objectbuf_schema_encode(lua_State *L) {
+    SCHEMA *s = luaL_checkudata(L, 1, LUA_OBJECTBUF_SCHEMA_TYPE);
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    BYTEARRAY out;
+    SCHEMA_ENCODE_ARGS args = {s, &out};
+    lua_pushcfunction(L, schema_encode_protected);
+    lua_pushlightuserdata(L, &args);
+    lua_pushvalue(L, 2);
+    if (!bytearray_alloc(&out, 64)) {
+        return luaL_error(L, "objectbuf: out of memory.");
+    }
+    // the buffer is freed before any error raised while packing propagates.
+    int status = lua_pcall(L, 2, 1, 0);
+    bytearray_dealloc(&out);
+    if (status != 0) {
+        return lua_error(L);
+    }
+    return 1;
+}
+
+static int luafan_objectbuf_schema_decode(lua_State *L) {
+    SCHEMA *s = luaL_checkudata(L, 1, LUA_OBJECTBUF_SCHEMA_TYPE);
+    size_t len;
+    const char *buf = luaL_checklstring(L, 2, &len);
+    BYTEARRAY input;
+    bytearray_wrap_buffer(&input, (uint8_t *)buf, len); // will not change buf.
+
+    uint8_t flag = 0;
+    const char *err = NULL;
+    if (!bytearray_read8(&input, &flag) || flag != SCHEMA_FLAG) {
+        err = "schema decode failed, not a schema message.";
+    } else {
+        err = schema_unpack(L, s, &input, 0);
+        if (!err && bytearray_read_available(&input) > 0) {
+            err = "schema decode failed, trailing bytes.";
+        }
+    }
+
+    if (err) {
+        lua_pushnil(L);
+        lua_pushstring(L, err);
+        return 2;
+    }
+    return 1;
+}
+
+static int luafan_objectbuf_schema_gc(lua_State *L) {
+    SCHEMA *s = luaL_checkudata(L, 1, LUA_OBJECTBUF_SCHEMA_TYPE);
+    CLEAR_REF(L, s->keys_ref)
+    CLEAR_REF(L, s->index_ref)
+    return 0;
+}
+
+static SCHEMA *schema_test(lua_State *L, int idx) {
+    SCHEMA *s = lua_touserdata(L, idx);
+    if (!s || !lua_getmetatable(L, idx)) {
+        return NULL;
+    }
+    luaL_getmetatable(L, LUA_OBJECTBUF_SCHEMA_TYPE);
+    int same = lua_rawequal(L, -1, -2);
+    lua_pop(L, 2);
+    return same ? s : NULL;
+}
+
+LUA_API int luafan_objectbuf_schema(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    int count = (int)lua_objlen(L, 1);
+    if (count == 0) {
+        return luaL_error(L, "schema needs at least one field.");
+    }
+
+    SCHEMA *s = lua_newuserdata(L, sizeof(SCHEMA) + (count - 1) * sizeof(s->fields[0]));
+    memset(s, 0, sizeof(SCHEMA));
+    s->count = count;
+    s->keys_ref = LUA_NOREF;
+    s->index_ref = LUA_NOREF;
+    luaL_getmetatable(L, LUA_OBJECTBUF_SCHEMA_TYPE);
+    lua_setmetatable(L, -2);
+    int schema_idx = lua_gettop(L);
+
+    lua_createtable(L, count * 2, 0);
+    int keys_idx = lua_gettop(L);
+    lua_createtable(L, 0, count);
+    int index_idx = lua_gettop(L);
+
+    int i = 1;
+    for (; i <= count; i++) {
+        lua_rawgeti(L, 1, i);
+        if (!lua_istable(L, -1)) {
+            return luaL_error(L, "schema field %d: expected {key, type}.", i);
+        }
+        int spec_idx = lua_gettop(L);
+
+        lua_rawgeti(L, spec_idx, 1);
+        if (lua_isnil(L, -1)) {
+            return luaL_error(L, "schema field %d: missing key.", i);
+        }
+        lua_pushvalue(L, -1);
+        lua_rawget(L, index_idx);
+        if (!lua_isnil(L, -1)) {
+            return luaL_error(L, "schema field %d: duplicate key '%s'.", i, lua_tostring(L, -2));
+        }
+        lua_pop(L, 1);
+        if (lua_type(L, -1) == LUA_TNUMBER && lua_tonumber(L, -1) == s->narray + 1) {
+            s->narray++;
+        }
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, keys_idx, i);
+        lua_pushinteger(L, i);
+        lua_rawset(L, index_idx);
+
+        lua_rawgeti(L, spec_idx, 2);
+        if (lua_type(L, -1) == LUA_TSTRING) {
+            const char *name = lua_tostring(L, -1);
+            int t = 0;
+            while (schema_type_names[t] && strcmp(schema_type_names[t], name) != 0) {
+                t++;
+            }
+            if (!schema_type_names[t]) {
+                return luaL_error(L, "schema field %d: unknown type '%s'.", i, name);
+            }
+            s->fields[i - 1].type = (SCHEMA_TYPE)t;
+        } else {
+            SCHEMA *nested = schema_test(L, -1);
+            if (!nested) {
+                return luaL_error(L, "schema field %d: type must be a type name or a schema.", i);
+            }
+            s->fields[i - 1].type = SCHEMA_TYPE_NESTED;
+            s->fields[i - 1].nested = nested;
+            // keeps the nested schema alive.
+            lua_pushvalue(L, -1);
+            lua_rawseti(L, keys_idx, count + i);
+        }
+        lua_settop(L, index_idx);
+    }
+
+    s->index_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    s->keys_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_settop(L, schema_idx);
     return 1;
 }
 
@@ -732,9 +1737,27 @@ LUA_API int luaopen_fan_objectbuf_core(lua_State *L) {
         {"encode", luafan_objectbuf_encode},
         {"decode", luafan_objectbuf_decode},
         {"symbol", luafan_objectbuf_symbol},
+        {"schema", luafan_objectbuf_schema},
         {NULL, NULL},
     };
 
+    luaL_newmetatable(L, LUA_OBJECTBUF_SCHEMA_TYPE);
+    lua_pushcfunction(L, &luafan_objectbuf_schema_encode);
+    lua_setfield(L, -2, "encode");
+
+    lua_pushcfunction(L, &luafan_objectbuf_schema_decode);
+    lua_setfield(L, -2, "decode");
+
+    lua_pushstring(L, "__index");
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -3);
+
+    lua_pushstring(L, "__gc");
+    lua_pushcfunction(L, &luafan_objectbuf_schema_gc);
+    lua_rawset(L, -3);
+
+    lua_pop(L, 1);
+
     lua_newtable(L);
     luaL_register(L, NULL, objectbuflib);
     return 1;
@@ -0,0 +1,487 @@
+#include "shard.h"
+#include "tcpd_server.h"
+
+#define SHARD_MAX (EVENT_MGR_MAX_WORKERS + 1)
+
+LUA_API int luaopen_fan_tcpd(lua_State *L);
+
+// One Lua state per event loop. Shard 0 is the state that loaded fan.shard
+// (the main loop); shards 1..N each run on worker N-1 and are created and
+// closed on that worker's thread.
+typedef struct {
+    int id;
+    int worker_id;      // event_mgr worker index, -1 for the main state
+    lua_State *L;       // NULL until booted / after the worker stopped
+
+    int onMessageRef;
+    int onAcceptRef;
+} shard_t;
+
+static shard_t shards[SHARD_MAX];
+static int num_shards = 0;
+static int main_ready = 0;
+static int own_workers = 0; // shard.start started the workers, shard.stop ends them
+
+// shard.stop waits here for the shards to close their states.
+static pthread_mutex_t stop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stop_cond = PTHREAD_COND_INITIALIZER;
+static int stops_pending = 0;
+
+// Shard owning the calling thread (NULL on the main thread)
+static _Thread_local shard_t *current_shard = NULL;
+
+typedef struct {
+    shard_t *shard;
+    char *script;
+    char *path;
+    char *cpath;
+} shard_boot_t;
+
+typedef struct {
+    shard_t *target;
+    int from;
+    size_t len;
+    char data[];
+} shard_msg_t;
+
+typedef struct {
+    shard_t *target;
+    evutil_socket_t fd;
+    struct sockaddr_storage addr;
+    tcpd_config_t config;
+} shard_accept_t;
+
+static shard_t *shard_current(lua_State *L) {
+    if (current_shard) {
+        return current_shard;
+    }
+
+    if (!main_ready) {
+        shards[0].id = 0;
+        shards[0].worker_id = -1;
+        shards[0].L = utlua_mainthread(L);
+        shards[0].onMessageRef = LUA_NOREF;
+        shards[0].onAcceptRef = LUA_NOREF;
+        main_ready = 1;
+    }
+    return &shards[0];
+}
+
+int shard_count(void) {
+    return num_shards;
+}
+
+static char *dup_package_field(lua_State *L, const char *field) {
+    char *value = NULL;
+    lua_getglobal(L, "package");
+    if (lua_istable(L, -1)) {
+        lua_getfield(L, -1, field);
+        if (lua_isstring(L, -1)) {
+            value = strdup(lua_tostring(L, -1));
+        }
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+    return value;
+}
+
+static void set_package_field(lua_State *L, const char *field, const char *value) {
+    if (!value) {
+        return;
+    }
+    lua_getglobal(L, "package");
+    lua_pushstring(L, value);
+    lua_setfield(L, -2, field);
+    lua_pop(L, 1);
+}
+
+// Runs on the worker thread after its loop exits: close the state there so
+// every __gc (bufferevents, timers) runs against a live base on its owner.
+static void shard_stop(void *arg) {
+    shard_t *shard = (shard_t *)arg;
+    if (shard->L) {
+        lua_close(shard->L);
+        shard->L = NULL;
+    }
+    shard->onMessageRef = LUA_NOREF;
+    shard->onAcceptRef = LUA_NOREF;
+    current_shard = NULL;
+}
+
+// Posted by shard.stop: close the state while the worker keeps running.
+static void shard_stop_task(void *arg) {
+    shard_t *shard = (shard_t *)arg;
+    shard_stop(shard);
+    event_mgr_worker_on_stop(shard->worker_id, NULL, NULL);
+
+    pthread_mutex_lock(&stop_lock);
+    stops_pending--;
+    pthread_cond_signal(&stop_cond);
+    pthread_mutex_unlock(&stop_lock);
+}
+
+// Runs on the worker thread: create the shard's state and run its script.
+static void shard_boot(void *arg) {
+    shard_boot_t *boot = (shard_boot_t *)arg;
+    shard_t *shard = boot->shard;
+
+    event_mgr_worker_make_local();
+    current_shard = shard;
+
+    lua_State *L = luaL_newstate();
+    luaL_openlibs(L);
+    set_package_field(L, "path", boot->path);
+    set_package_field(L, "cpath", boot->cpath);
+
+    shard->L = L;
+    event_mgr_worker_on_stop(shard->worker_id, shard_stop, shard);
+
+    // The script runs as a coroutine so it may yield (fan.sleep etc.),
+    // and receives (shard_id, shard_count) as `...`.
+    lua_State *co = lua_newthread(L);
+    int ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    if (luaL_loadfile(co, boot->script) != 0) {
+        LOGE("shard %d: %s\n", shard->id, lua_tostring(co, -1));
+    } else {
+        lua_pushinteger(co, shard->id);
+        lua_pushinteger(co, num_shards);
+        FAN_RESUME(co, L, 2);
+    }
+    luaL_unref(L, LUA_REGISTRYINDEX, ref);
+
+    free(boot->script);
+    free(boot->path);
+    free(boot->cpath);
+    free(boot);
+}
+
+static void shard_deliver_message(void *arg) {
+    shard_msg_t *msg = (shard_msg_t *)arg;
+    shard_t *shard = msg->target;
+    lua_State *L = shard->L;
+
+    if (!L || shard->onMessageRef == LUA_NOREF) {
+        free(msg);
+        return;
+    }
+
+    lua_lock(L);
+    fan_cb_setup_t cbs = fan_cb_setup(L, shard->onMessageRef);
+    if (!cbs.co) {
+        lua_unlock(L);
+        free(msg);
+        return;
+    }
+
+    // Guard: verify the registry slot still holds a function
+    if (!lua_isfunction(cbs.co, -1)) {
+        LOGE("shard_deliver_message: onMessageRef=%d resolved to %s, expected function\n",
+             shard->onMessageRef, luaL_typename(cbs.co, -1));
+        lua_pop(cbs.co, 1);
+        lua_unlock(L);
+        FAN_CB_CLEANUP(L, cbs);
+        free(msg);
+        return;
+    }
+
+    lua_pushinteger(cbs.co, msg->from);
+    lua_pushlstring(cbs.co, msg->data, msg->len);
+    free(msg);
+
+    lua_unlock(L);
+    FAN_RESUME(cbs.co, L, 2);
+    FAN_CB_CLEANUP(L, cbs);
+}
+
+static void shard_deliver_accept(void *arg) {
+    shard_accept_t *acc = (shard_accept_t *)arg;
+    shard_t *shard = acc->target;
+    lua_State *L = shard->L;
+
+    if (!L || shard->onAcceptRef == LUA_NOREF) {
+        evutil_closesocket(acc->fd);
+        free(acc);
+        return;
+    }
+
+    lua_lock(L);
+    fan_cb_setup_t cbs = fan_cb_setup(L, shard->onAcceptRef);
+    if (!cbs.co) {
+        lua_unlock(L);
+        evutil_closesocket(acc->fd);
+        free(acc);
+        return;
+    }
+
+    // Guard: verify the registry slot still holds a function
+    if (!lua_isfunction(cbs.co, -1)) {
+        LOGE("shard_deliver_accept: onAcceptRef=%d resolved to %s, expected function\n",
+             shard->onAcceptRef, luaL_typename(cbs.co, -1));
+        lua_pop(cbs.co, 1);
+        lua_unlock(L);
+        FAN_CB_CLEANUP(L, cbs);
+        evutil_closesocket(acc->fd);
+        free(acc);
+        return;
+    }
+
+    tcpd_accept_push(cbs.co, event_mgr_worker_base(shard->worker_id), acc->fd,
+                     (struct sockaddr *)&acc->addr, &acc->config);
+    free(acc);
+
+    lua_unlock(L);
+    FAN_RESUME(cbs.co, L, 1);
+    FAN_CB_CLEANUP(L, cbs);
+}
+
+static shard_accept_t *shard_accept_new(shard_t *target, evutil_socket_t fd, const struct sockaddr *addr,
+                                        int socklen, const tcpd_config_t *config) {
+    if (socklen <= 0 || (size_t)socklen > sizeof(struct sockaddr_storage)) {
+        return NULL;
+    }
+
+    shard_accept_t *acc = calloc(1, sizeof(shard_accept_t));
+    if (!acc) {
+        return NULL;
+    }
+    acc->target = target;
+    acc->fd = fd;
+    memcpy(&acc->addr, addr, socklen);
+    acc->config = *config;
+    return acc;
+}
+
+int shard_dispatch_accept(evutil_socket_t fd, const struct sockaddr *addr, int socklen,
+                          const tcpd_config_t *config) {
+    if (num_shards == 0) {
+        return -1;
+    }
+
+    int wid = event_mgr_next_worker();
+    if (wid < 0 || wid >= num_shards) {
+        return -1;
+    }
+
+    shard_accept_t *acc = shard_accept_new(&shards[wid + 1], fd, addr, socklen, config);
+    if (!acc) {
+        return -1;
+    }
+
+    if (event_mgr_post(wid, shard_deliver_accept, acc) != 0) {
+        free(acc);
+        return -1;
+    }
+    return 0;
+}
+
+int shard_accept_local(evutil_socket_t fd, const struct sockaddr *addr, int socklen,
+                       const tcpd_config_t *config) {
+    if (!current_shard || !current_shard->L) {
+        return -1;
+    }
+
+    shard_accept_t *acc = shard_accept_new(current_shard, fd, addr, socklen, config);
+    if (!acc) {
+        return -1;
+    }
+
+    shard_deliver_accept(acc);
+    return 0;
+}
+
+// shard.start{script = "path.lua" [, workers = n]} -> number of shards
+LUA_API int luafan_shard_start(lua_State *L) {
+#if (LUA_VERSION_NUM < 502)
+    return luaL_error(L, "fan.shard requires Lua 5.2 or newer");
+#else
+    luaL_checktype(L, 1, LUA_TTABLE);
+    shard_current(L);
+
+    if (current_shard) {
+        return luaL_error(L, "shard.start can only be called from the main state");
+    }
+    if (num_shards > 0) {
+        return luaL_error(L, "shards already started");
+    }
+
+    lua_getfield(L, 1, "script");
+    const char *script = luaL_checkstring(L, -1);
+    lua_pop(L, 1);
+
+    int workers = 0;
+    SET_INT_FROM_TABLE(L, workers, 1, "workers");
+    if (workers <= 0) {
+        workers = EVENT_MGR_DEFAULT_WORKERS;
+    }
+
+    event_mgr_init();
+    if (event_mgr_worker_count() == 0) {
+        if (event_mgr_workers_init(workers) != 0) {
+            return luaL_error(L, "failed to start %d workers", workers);
+        }
+        own_workers = 1;
+    }
+
+    int count = event_mgr_worker_count();
+    if (count > SHARD_MAX - 1) {
+        count = SHARD_MAX - 1;
+    }
+
+    // Publish the count before any boot task runs so shards see it.
+    num_shards = count;
+
+    for (int i = 0; i < count; i++) {
+        shard_t *shard = &shards[i + 1];
+        shard->id = i + 1;
+        shard->worker_id = i;
+        shard->L = NULL;
+        shard->onMessageRef = LUA_NOREF;
+        shard->onAcceptRef = LUA_NOREF;
+
+        shard_boot_t *boot = calloc(1, sizeof(shard_boot_t));
+        if (!boot) {
+            return luaL_error(L, "Memory allocation failure");
+        }
+        boot->shard = shard;
+        boot->script = strdup(script);
+        boot->path = dup_package_field(L, "path");
+        boot->cpath = dup_package_field(L, "cpath");
+
+        if (event_mgr_post(i, shard_boot, boot) != 0) {
+            free(boot->script);
+            free(boot->path);
+            free(boot->cpath);
+            free(boot);
+            return luaL_error(L, "failed to boot shard %d", i + 1);
+        }
+    }
+
+    lua_pushinteger(L, count);
+    return 1;
+#endif
+}
+
+// shard.stop() closes every worker shard's state on its own thread, then
+// stops the worker threads and frees their bases if shard.start started
+// them. shard.start may be called again afterwards.
+LUA_API int luafan_shard_stop(lua_State *L) {
+    shard_current(L);
+    if (current_shard) {
+        return luaL_error(L, "shard.stop can only be called from the main state");
+    }
+    if (num_shards == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&stop_lock);
+    for (int i = 1; i <= num_shards; i++) {
+        // A worker that is not running any more closed its shard on exit.
+        if (event_mgr_post(shards[i].worker_id, shard_stop_task, &shards[i]) == 0) {
+            stops_pending++;
+        }
+    }
+    while (stops_pending > 0) {
+        pthread_cond_wait(&stop_cond, &stop_lock);
+    }
+    pthread_mutex_unlock(&stop_lock);
+
+    // No more messages or accepts are routed to the shards.
+    num_shards = 0;
+
+    if (own_workers) {
+        event_mgr_workers_stop_threads();
+        event_mgr_workers_free_bases();
+        own_workers = 0;
+    }
+    return 0;
+}
+
+// shard.id() -> 0 for the main state, 1..N inside a shard
+LUA_API int luafan_shard_id(lua_State *L) {
+    lua_pushinteger(L, shard_current(L)->id);
+    return 1;
+}
+
+// shard.count() -> number of worker shards
+LUA_API int luafan_shard_count(lua_State *L) {
+    lua_pushinteger(L, num_shards);
+    return 1;
+}
+
+// shard.send(target, data) -> true, or false if the target does not exist
+LUA_API int luafan_shard_send(lua_State *L) {
+    lua_Integer target = luaL_checkinteger(L, 1);
+    size_t len = 0;
+    const char *data = luaL_checklstring(L, 2, &len);
+    shard_t *self = shard_current(L);
+
+    if (target < 0 || target > num_shards) {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+
+    shard_msg_t *msg = malloc(sizeof(shard_msg_t) + len);
+    if (!msg) {
+        return luaL_error(L, "Memory allocation failure");
+    }
+    msg->target = &shards[target];
+    msg->from = self->id;
+    msg->len = len;
+    memcpy(msg->data, data, len);
+
+    if (event_mgr_post(msg->target->worker_id, shard_deliver_message, msg) != 0) {
+        free(msg);
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+// shard.onmessage(function(from, data) ... end)
+LUA_API int luafan_shard_onmessage(lua_State *L) {
+    shard_t *self = shard_current(L);
+    lua_settop(L, 1);
+    CLEAR_REF(L, self->onMessageRef);
+    if (lua_isfunction(L, 1)) {
+        self->onMessageRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    return 0;
+}
+
+// shard.onaccept(function(apt) ... end) -- connections from tcpd.bind{shard=true}
+LUA_API int luafan_shard_onaccept(lua_State *L) {
+    shard_t *self = shard_current(L);
+    lua_settop(L, 1);
+
+#if (LUA_VERSION_NUM >= 502)
+    // Accept objects are built in this state, so make sure the tcpd
+    // metatables are registered here.
+    luaL_requiref(L, "fan.tcpd", luaopen_fan_tcpd, 0);
+    lua_pop(L, 1);
+#endif
+
+    CLEAR_REF(L, self->onAcceptRef);
+    if (lua_isfunction(L, 1)) {
+        self->onAcceptRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    return 0;
+}
+
+static const struct luaL_Reg shardlib[] = {
+    {"start", luafan_shard_start},
+    {"stop", luafan_shard_stop},
+    {"id", luafan_shard_id},
+    {"count", luafan_shard_count},
+    {"send", luafan_shard_send},
+    {"onmessage", luafan_shard_onmessage},
+    {"onaccept", luafan_shard_onaccept},
+    {NULL, NULL},
+};
+
+LUA_API int luaopen_fan_shard(lua_State *L) {
+    lua_newtable(L);
+    luaL_register(L, NULL, shardlib);
+    return 1;
+}
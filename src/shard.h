@@ -0,0 +1,28 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "tcpd_common.h"
+
+// Per-worker Lua shards (fan.shard).
+//
+// Each shard is an independent lua_State bound to one event_mgr worker
+// thread; shard 0 is the main state. Shards share nothing and communicate
+// by message passing (shard.send), so no lua_lock is ever contended.
+
+// Number of started worker shards (0 if fan.shard.start has not run).
+int shard_count(void);
+
+// Hand an accepted socket to the next shard (round-robin over workers).
+// On success the shard owns `fd`; on failure the caller must close it.
+int shard_dispatch_accept(evutil_socket_t fd, const struct sockaddr *addr, int socklen,
+                          const tcpd_config_t *config);
+
+// Deliver an accepted socket to the shard running on the calling worker
+// thread, so the connection never changes threads. Returns -1 (caller
+// keeps `fd`) if this thread has no shard.
+int shard_accept_local(evutil_socket_t fd, const struct sockaddr *addr, int socklen,
+                       const tcpd_config_t *config);
+
+LUA_API int luaopen_fan_shard(lua_State *L);
+
+#endif // SHARD_H
@@ -0,0 +1,529 @@
+#if defined(__APPLE__) && defined(__clang__)
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#endif
+
+#include "utlua.h"
+#include "shmring.h"
+
+#include <poll.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define LUA_SHMRING_TYPE "SHMRING_TYPE"
+
+#define SHMRING_MIN_CAPACITY 4096
+#define SHMRING_DEFAULT_CAPACITY (1024 * 1024)
+
+// Messages handed to Lua per wakeup before yielding back to the event loop.
+#define SHMRING_BATCH 256
+
+#define SHMRING_CACHELINE 64
+
+// Shared header, one cache line per writer so producer and consumer do not
+// bounce each other's line.
+struct shmring_shared {
+    size_t head; // consumer position
+    char pad1[SHMRING_CACHELINE - sizeof(size_t)];
+    size_t tail; // producer position
+    char pad2[SHMRING_CACHELINE - sizeof(size_t)];
+    int waiting; // consumer is (about to be) asleep
+    char pad3[SHMRING_CACHELINE - sizeof(int)];
+};
+
+struct shmring_s {
+    struct shmring_shared *shared;
+    uint8_t *data;
+    size_t capacity; // private copies: the peer cannot change our bounds
+    size_t mask;
+    size_t map_len;
+    size_t peek_len; // bytes taken by the message returned by shmring_peek
+};
+
+typedef uint32_t shmring_len_t;
+
+shmring_t *shmring_create(size_t capacity) {
+    size_t cap = SHMRING_MIN_CAPACITY;
+    while (cap < capacity) {
+        if (cap > SIZE_MAX / 4) {
+            return NULL;
+        }
+        cap <<= 1;
+    }
+
+    shmring_t *ring = calloc(1, sizeof(shmring_t));
+    if (!ring) {
+        return NULL;
+    }
+
+    ring->map_len = sizeof(struct shmring_shared) + cap;
+    void *map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->shared = (struct shmring_shared *)map;
+    ring->data = (uint8_t *)map + sizeof(struct shmring_shared);
+    ring->capacity = cap;
+    ring->mask = cap - 1;
+    return ring;
+}
+
+void shmring_destroy(shmring_t *ring) {
+    if (!ring) {
+        return;
+    }
+    munmap(ring->shared, ring->map_len);
+    free(ring);
+}
+
+size_t shmring_capacity(const shmring_t *ring) {
+    return ring->capacity;
+}
+
+size_t shmring_max_message(const shmring_t *ring) {
+    size_t max = ring->capacity - sizeof(shmring_len_t);
+    return max > UINT32_MAX ? UINT32_MAX : max;
+}
+
+static void ring_write(shmring_t *ring, size_t pos, const void *src, size_t n) {
+    size_t off = pos & ring->mask;
+    size_t first = ring->capacity - off;
+    if (first >= n) {
+        memcpy(ring->data + off, src, n);
+    } else {
+        memcpy(ring->data + off, src, first);
+        memcpy(ring->data, (const uint8_t *)src + first, n - first);
+    }
+}
+
+static void ring_read(shmring_t *ring, size_t pos, void *dst, size_t n) {
+    size_t off = pos & ring->mask;
+    size_t first = ring->capacity - off;
+    if (first >= n) {
+        memcpy(dst, ring->data + off, n);
+    } else {
+        memcpy(dst, ring->data + off, first);
+        memcpy((uint8_t *)dst + first, ring->data, n - first);
+    }
+}
+
+int shmring_push(shmring_t *ring, const void *data, size_t len, int *wake) {
+    *wake = 0;
+    if (len > shmring_max_message(ring)) {
+        return -1;
+    }
+
+    size_t need = sizeof(shmring_len_t) + len;
+    size_t tail = ring->shared->tail; // only we write it
+    size_t head = __atomic_load_n(&ring->shared->head, __ATOMIC_ACQUIRE);
+    if (ring->capacity - (tail - head) < need) {
+        return 0;
+    }
+
+    shmring_len_t n = (shmring_len_t)len;
+    ring_write(ring, tail, &n, sizeof(n));
+    ring_write(ring, tail + sizeof(n), data, len);
+
+    // Publish, then look at the flag: paired with the store-then-load in
+    // shmring_sleep, either the consumer sees the new tail or we see it
+    // waiting.
+    __atomic_store_n(&ring->shared->tail, tail + need, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->shared->waiting, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&ring->shared->waiting, 0, __ATOMIC_SEQ_CST)) {
+        *wake = 1;
+    }
+    return 1;
+}
+
+int shmring_peek(shmring_t *ring, const void **p1, size_t *n1, const void **p2, size_t *n2) {
+    size_t head = ring->shared->head; // only we write it
+    size_t tail = __atomic_load_n(&ring->shared->tail, __ATOMIC_ACQUIRE);
+    if (tail == head) {
+        return 0;
+    }
+
+    shmring_len_t len;
+    size_t used = tail - head;
+    if (used < sizeof(len) || used > ring->capacity) {
+        return -1;
+    }
+    ring_read(ring, head, &len, sizeof(len));
+    if (len > used - sizeof(len)) {
+        return -1;
+    }
+
+    size_t off = (head + sizeof(len)) & ring->mask;
+    size_t first = ring->capacity - off;
+    *p1 = ring->data + off;
+    if (first >= len) {
+        *n1 = len;
+        *p2 = NULL;
+        *n2 = 0;
+    } else {
+        *n1 = first;
+        *p2 = ring->data;
+        *n2 = len - first;
+    }
+    ring->peek_len = sizeof(len) + len;
+    return 1;
+}
+
+void shmring_pop(shmring_t *ring) {
+    size_t head = ring->shared->head;
+    __atomic_store_n(&ring->shared->head, head + ring->peek_len, __ATOMIC_RELEASE);
+    ring->peek_len = 0;
+}
+
+int shmring_sleep(shmring_t *ring) {
+    __atomic_store_n(&ring->shared->waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->shared->tail, __ATOMIC_SEQ_CST) != ring->shared->head) {
+        __atomic_store_n(&ring->shared->waiting, 0, __ATOMIC_SEQ_CST);
+        return 0;
+    }
+    return 1;
+}
+
+// -- fan.shmring --
+
+typedef struct {
+    shmring_t *ring;
+    int fds[2]; // wakeup pipe: [0] read by the consumer, [1] written by the producer
+
+    int onReadRef;
+    int onDisconnectedRef;
+    int selfRef; // keeps a bound ring alive while its event is registered
+
+    lua_State *mainthread;
+    struct event *read_ev;
+
+    int draining;
+    int closed;
+} SHMRING;
+
+static void shmring_release(SHMRING *r) {
+    if (r->read_ev) {
+        event_free(r->read_ev);
+        r->read_ev = NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (r->fds[i] >= 0) {
+            close(r->fds[i]);
+            r->fds[i] = -1;
+        }
+    }
+    if (r->ring) {
+        shmring_destroy(r->ring);
+        r->ring = NULL;
+    }
+    r->closed = 1;
+}
+
+static void shmring_clear_refs(SHMRING *r) {
+    if (r->mainthread) {
+        CLEAR_REF(r->mainthread, r->onReadRef)
+        CLEAR_REF(r->mainthread, r->onDisconnectedRef)
+        CLEAR_REF(r->mainthread, r->selfRef)
+    }
+}
+
+static void shmring_disconnected(SHMRING *r, const char *reason) {
+    if (r->read_ev) {
+        event_del(r->read_ev);
+    }
+
+    if (r->onDisconnectedRef == LUA_NOREF) {
+        return;
+    }
+
+    lua_State *mainthread = r->mainthread;
+    lua_lock(mainthread);
+    fan_cb_setup_t cbs = fan_cb_setup(mainthread, r->onDisconnectedRef);
+    if (!cbs.co) {
+        lua_unlock(mainthread);
+        return;
+    }
+
+    lua_pushstring(cbs.co, reason);
+    lua_unlock(mainthread);
+    FAN_RESUME(cbs.co, mainthread, 1);
+    FAN_CB_CLEANUP(mainthread, cbs);
+}
+
+// Hand queued messages to onread, each in its own coroutine. Returns 0 if
+// the ring is corrupt.
+static int shmring_deliver(SHMRING *r) {
+    int budget = SHMRING_BATCH;
+
+    while (!r->closed) {
+        const void *p1, *p2;
+        size_t n1, n2;
+        int rc = shmring_peek(r->ring, &p1, &n1, &p2, &n2);
+        if (rc < 0) {
+            return 0;
+        }
+        if (rc == 0) {
+            if (shmring_sleep(r->ring)) {
+                break;
+            }
+            continue;
+        }
+
+        if (budget-- == 0) {
+            // Let other events run; come back without a wakeup byte.
+            event_active(r->read_ev, EV_READ, 0);
+            break;
+        }
+
+        lua_State *mainthread = r->mainthread;
+        lua_lock(mainthread);
+        fan_cb_setup_t cbs = fan_cb_setup(mainthread, r->onReadRef);
+        if (!cbs.co) {
+            lua_unlock(mainthread);
+            shmring_pop(r->ring);
+            continue;
+        }
+
+        if (n2 == 0) {
+            lua_pushlstring(cbs.co, (const char *)p1, n1);
+        } else {
+            luaL_Buffer b;
+            luaL_buffinit(cbs.co, &b);
+            luaL_addlstring(&b, (const char *)p1, n1);
+            luaL_addlstring(&b, (const char *)p2, n2);
+            luaL_pushresult(&b);
+        }
+        shmring_pop(r->ring);
+
+        lua_unlock(mainthread);
+        FAN_RESUME(cbs.co, mainthread, 1);
+        FAN_CB_CLEANUP(mainthread, cbs);
+    }
+    return 1;
+}
+
+static void shmring_read_cb(evutil_socket_t fd, short event, void *arg) {
+    SHMRING *r = (SHMRING *)arg;
+
+    // Drain the wakeup bytes first: a push after this point either finds
+    // the consumer draining or sets a fresh byte.
+    char drain[64];
+    ssize_t n;
+    while ((n = read(fd, drain, sizeof(drain))) > 0) {
+    }
+    int eof = (n == 0);
+
+    r->draining = 1;
+    int ok = shmring_deliver(r);
+    if (!r->closed) {
+        if (!ok) {
+            LOGE("shmring_read_cb: corrupt ring header\n");
+            shmring_disconnected(r, "ring corrupt.");
+        } else if (eof) {
+            // Every producer end is closed: the peer process is gone.
+            shmring_disconnected(r, "peer closed.");
+        }
+    }
+    r->draining = 0;
+
+    if (r->closed) {
+        shmring_clear_refs(r);
+    }
+}
+
+// 1 once no process holds the read end of the wakeup pipe. Checked before
+// writing a wakeup, so a send outside the event loop cannot die of SIGPIPE.
+static int shmring_peer_gone(int fd) {
+    struct pollfd pfd = {fd, POLLOUT, 0};
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLERR | POLLHUP));
+}
+
+LUA_API int luafan_shmring_new(lua_State *L) {
+    lua_Integer capacity = luaL_optinteger(L, 1, SHMRING_DEFAULT_CAPACITY);
+    luaL_argcheck(L, capacity > 0, 1, "capacity must be positive");
+
+    SHMRING *r = (SHMRING *)lua_newuserdata(L, sizeof(SHMRING));
+    memset(r, 0, sizeof(SHMRING));
+    r->fds[0] = r->fds[1] = -1;
+    r->onReadRef = LUA_NOREF;
+    r->onDisconnectedRef = LUA_NOREF;
+    r->selfRef = LUA_NOREF;
+    luaL_getmetatable(L, LUA_SHMRING_TYPE);
+    lua_setmetatable(L, -2);
+
+    r->ring = shmring_create((size_t)capacity);
+    if (!r->ring) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+
+    if (pipe(r->fds) != 0) {
+        int err = errno;
+        shmring_release(r);
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(err));
+        return 2;
+    }
+    for (int i = 0; i < 2; i++) {
+        evutil_make_socket_nonblocking(r->fds[i]);
+        evutil_make_socket_closeonexec(r->fds[i]);
+    }
+
+    return 1;
+}
+
+// ring:bind{onread = f(data), ondisconnected = f(reason)} makes this process
+// the consumer.
+LUA_API int luafan_shmring_bind(lua_State *L) {
+    SHMRING *r = luaL_checkudata(L, 1, LUA_SHMRING_TYPE);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_settop(L, 2);
+
+    if (r->closed) {
+        return luaL_error(L, "ring closed.");
+    }
+    if (r->read_ev) {
+        return luaL_error(L, "ring bound already.");
+    }
+    if (r->fds[0] < 0) {
+        return luaL_error(L, "ring used for sending already.");
+    }
+
+    r->mainthread = utlua_mainthread(L);
+    SET_FUNC_REF_FROM_TABLE(L, r->onReadRef, 2, "onread")
+    if (r->onReadRef == LUA_NOREF) {
+        return luaL_error(L, "onread not defined.");
+    }
+    SET_FUNC_REF_FROM_TABLE(L, r->onDisconnectedRef, 2, "ondisconnected")
+
+    // Only the producer writes wakeups; dropping our copy lets EOF on the
+    // pipe tell us the producer process is gone.
+    close(r->fds[1]);
+    r->fds[1] = -1;
+
+    r->read_ev = event_new(event_mgr_base(), r->fds[0], EV_PERSIST | EV_READ, shmring_read_cb, r);
+    if (!r->read_ev) {
+        return luaL_error(L, "event_new failed.");
+    }
+    event_add(r->read_ev, NULL);
+
+    lua_pushvalue(L, 1);
+    r->selfRef = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    // Messages pushed before bind: the producer saw no sleeper.
+    event_active(r->read_ev, EV_READ, 0);
+
+    lua_settop(L, 1);
+    return 1;
+}
+
+// ring:send(data) -> true, false when the ring is full, nil + err when the
+// consumer is gone. The first send makes this process the producer.
+LUA_API int luafan_shmring_send(lua_State *L) {
+    SHMRING *r = luaL_checkudata(L, 1, LUA_SHMRING_TYPE);
+    size_t len = 0;
+    const char *data = luaL_checklstring(L, 2, &len);
+
+    if (r->closed || r->fds[1] < 0) {
+        lua_pushnil(L);
+        lua_pushliteral(L, "ring closed.");
+        return 2;
+    }
+
+    // Only the consumer reads wakeups; dropping our copy lets the write
+    // below fail with EPIPE once the consumer process is gone.
+    if (r->fds[0] >= 0) {
+        close(r->fds[0]);
+        r->fds[0] = -1;
+    }
+
+    int wake = 0;
+    int rc = shmring_push(r->ring, data, len, &wake);
+    if (rc < 0) {
+        return luaL_error(L, "message of %d bytes exceeds ring capacity %d", (int)len,
+                          (int)shmring_max_message(r->ring));
+    }
+
+    // A full ring nudges the consumer too: a consumer that died while busy
+    // never goes to sleep, so this write is how the producer finds out.
+    if (wake || rc == 0) {
+        int gone = shmring_peer_gone(r->fds[1]);
+        if (!gone) {
+            char c = 0;
+            ssize_t n;
+            do {
+                n = write(r->fds[1], &c, 1);
+            } while (n < 0 && errno == EINTR);
+            gone = n < 0 && errno == EPIPE;
+        }
+        if (gone) {
+            lua_pushnil(L);
+            lua_pushliteral(L, "peer closed.");
+            return 2;
+        }
+    }
+
+    lua_pushboolean(L, rc);
+    return 1;
+}
+
+LUA_API int luafan_shmring_capacity(lua_State *L) {
+    SHMRING *r = luaL_checkudata(L, 1, LUA_SHMRING_TYPE);
+    lua_pushinteger(L, r->ring ? (lua_Integer)shmring_max_message(r->ring) : 0);
+    return 1;
+}
+
+LUA_API int luafan_shmring_close(lua_State *L) {
+    SHMRING *r = luaL_checkudata(L, 1, LUA_SHMRING_TYPE);
+
+    shmring_release(r);
+    if (!r->draining) {
+        shmring_clear_refs(r);
+    }
+
+    return 0;
+}
+
+LUA_API int luafan_shmring_gc(lua_State *L) {
+    return luafan_shmring_close(L);
+}
+
+static const struct luaL_Reg shmringlib[] = {
+    {"new", luafan_shmring_new},
+    {NULL, NULL},
+};
+
+LUA_API int luaopen_fan_shmring(lua_State *L) {
+    luaL_newmetatable(L, LUA_SHMRING_TYPE);
+    lua_pushcfunction(L, &luafan_shmring_send);
+    lua_setfield(L, -2, "send");
+
+    lua_pushcfunction(L, &luafan_shmring_bind);
+    lua_setfield(L, -2, "bind");
+
+    lua_pushcfunction(L, &luafan_shmring_capacity);
+    lua_setfield(L, -2, "capacity");
+
+    lua_pushstring(L, "__index");
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -3);
+
+    lua_pushstring(L, "__gc");
+    lua_pushcfunction(L, &luafan_shmring_gc);
+    lua_rawset(L, -3);
+
+    lua_pushstring(L, "close");
+    lua_pushcfunction(L, &luafan_shmring_close);
+    lua_rawset(L, -3);
+
+    lua_pop(L, 1);
+
+    lua_newtable(L);
+    luaL_register(L, NULL, shmringlib);
+    return 1;
+}
@@ -0,0 +1,42 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stddef.h>
+
+// Single-producer single-consumer message ring in shared memory (fan.shmring).
+//
+// The ring is mmap'd MAP_SHARED|MAP_ANONYMOUS, so it must be created before
+// fork(); afterwards one process produces and the other consumes. Messages
+// are length-prefixed and may wrap around the end of the data area. The
+// producer only advances `tail` and the consumer only advances `head`, so
+// neither side takes a lock, and the producer learns from a shared flag
+// whether the consumer is asleep and needs a wakeup.
+
+typedef struct shmring_s shmring_t;
+
+// capacity is rounded up to a power of two (at least 4KB). NULL on failure.
+shmring_t *shmring_create(size_t capacity);
+void shmring_destroy(shmring_t *ring);
+
+size_t shmring_capacity(const shmring_t *ring);
+
+// Largest message shmring_push can ever accept.
+size_t shmring_max_message(const shmring_t *ring);
+
+// Append one message: 1 on success, 0 if it does not fit right now, -1 if
+// it is larger than shmring_max_message. *wake is set to 1 when the
+// consumer is asleep and has to be signalled.
+int shmring_push(shmring_t *ring, const void *data, size_t len, int *wake);
+
+// Next message as one or two spans (*n2 > 0 when it wraps). 1 if there is
+// one, 0 if the ring is empty, -1 if the shared header is corrupt.
+int shmring_peek(shmring_t *ring, const void **p1, size_t *n1, const void **p2, size_t *n2);
+
+// Release the message returned by the last shmring_peek.
+void shmring_pop(shmring_t *ring);
+
+// The consumer is about to wait for a wakeup. Returns 1 if it may sleep,
+// 0 if a message arrived meanwhile and it must keep draining.
+int shmring_sleep(shmring_t *ring);
+
+#endif // SHMRING_H
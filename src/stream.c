@@ -35,6 +35,8 @@ bool ffi_stream_prepare_get(BYTEARRAY *ba);
 bool ffi_stream_prepare_add(BYTEARRAY *ba);
 bool ffi_stream_empty(BYTEARRAY *ba);
 
+LUA_API int luaopen_fan_stream_core(lua_State *L);
+
 LUA_API int luafan_stream_new(lua_State *L) {
     size_t len = 0;
     const char *data = luaL_optlstring(L, 1, NULL, &len);
@@ -47,6 +49,29 @@ LUA_API int luafan_stream_new(lua_State *L) {
     return 1;
 }
 
+/* Push a read-ready stream that takes ownership of the malloc'd buf,
+   e.g. a response body assembled in C, without copying it. */
+void luafan_stream_push_buffer(lua_State *L, uint8_t *buf, size_t len) {
+    BYTEARRAY *ba = (BYTEARRAY *)lua_newuserdata(L, sizeof(BYTEARRAY));
+
+    luaL_getmetatable(L, LUA_STREAM_TYPE);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        lua_pushcfunction(L, luaopen_fan_stream_core);
+        lua_call(L, 0, 0);
+        luaL_getmetatable(L, LUA_STREAM_TYPE);
+    }
+    lua_setmetatable(L, -2);
+
+    ba->buffer = buf;
+    ba->buflen = len;
+    ba->total = len;
+    ba->offset = 0;
+    ba->mark = 0;
+    ba->reading = true;
+    ba->wrapbuffer = false;
+}
+
 LUA_API int luafan_stream_gc(lua_State *L) {
     BYTEARRAY *ba = (BYTEARRAY *)luaL_checkudata(L, 1, LUA_STREAM_TYPE);
     ffi_stream_gc(ba);
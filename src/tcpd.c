@@ -466,6 +466,9 @@ LUA_API int luaopen_fan_tcpd(lua_State *L) {
     // Register server and accept metatables
     tcpd_server_register_metatables(L);
 
+    // Register input buffer view metatable
+    tcpd_buffer_register_metatable(L);
+
     // Create the main tcpd module table
     lua_newtable(L);
     luaL_register(L, NULL, tcpdlib);
@@ -0,0 +1,314 @@
+#include "tcpd_common.h"
+#include <event2/buffer.h>
+#include <string.h>
+
+#define LUA_TCPD_BUFFER_TYPE "<tcpd.buffer>"
+
+// Zero-copy view over a connection's input evbuffer.
+//
+// In `buffer_view` read mode, onread receives this object instead of a Lua
+// string. Bytes stay in the bufferevent's input evbuffer until the parser
+// consumes them with read/readline/drain, so only the bytes actually needed
+// are materialised as Lua strings. Whatever is left behind is still there on
+// the next onread (which fires when more data arrives).
+//
+// The view does not own the connection: it keeps the connection userdata
+// alive through its uservalue and resolves `conn->buf` under buf_mutex on
+// every call, so it degrades to an empty buffer once the connection closes.
+typedef struct {
+    tcpd_base_conn_t *conn;
+} tcpd_buffer_view_t;
+
+// Lock the connection and return its input evbuffer (locked), or NULL if
+// the connection is gone. Must be paired with view_unlock.
+static struct evbuffer *view_lock(tcpd_buffer_view_t *view) {
+    tcpd_base_conn_t *conn = view->conn;
+    if (!conn || conn->cleaned_up) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&conn->buf_mutex);
+    if (!conn->buf) {
+        pthread_mutex_unlock(&conn->buf_mutex);
+        return NULL;
+    }
+
+    struct evbuffer *input = bufferevent_get_input(conn->buf);
+    evbuffer_lock(input);
+    return input;
+}
+
+static void view_unlock(tcpd_buffer_view_t *view, struct evbuffer *input) {
+    evbuffer_unlock(input);
+    pthread_mutex_unlock(&view->conn->buf_mutex);
+}
+
+// Push `len` bytes starting at `pos` as a single Lua string. When the range
+// lives in one chain we hand the pointer straight to lua_pushlstring;
+// otherwise the chains are gathered with luaL_Buffer.
+static void push_range(lua_State *L, struct evbuffer *input, struct evbuffer_ptr *pos, size_t len) {
+    if (len == 0) {
+        lua_pushliteral(L, "");
+        return;
+    }
+
+    struct evbuffer_iovec vec[8];
+    int n = evbuffer_peek(input, (ev_ssize_t)len, pos, vec, 8);
+    if (n == 1 && vec[0].iov_len >= len) {
+        lua_pushlstring(L, (const char *)vec[0].iov_base, len);
+        return;
+    }
+
+    if (n > 8) {
+        // Highly fragmented input: let libevent gather it for us.
+        luaL_Buffer b;
+        char *dst = luaL_buffinitsize(L, &b, len);
+        evbuffer_copyout_from(input, pos, dst, len);
+        luaL_pushresultsize(&b, len);
+        return;
+    }
+
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    size_t remain = len;
+    for (int i = 0; i < n && remain > 0; i++) {
+        size_t chunk = vec[i].iov_len < remain ? vec[i].iov_len : remain;
+        luaL_addlstring(&b, (const char *)vec[i].iov_base, chunk);
+        remain -= chunk;
+    }
+    luaL_pushresult(&b);
+}
+
+// Resolve an optional byte count argument: nil/none means "everything".
+static size_t opt_count(lua_State *L, int arg, size_t available) {
+    if (lua_isnoneornil(L, arg)) {
+        return available;
+    }
+    lua_Integer n = luaL_checkinteger(L, arg);
+    if (n < 0) {
+        return 0;
+    }
+    return (size_t)n < available ? (size_t)n : available;
+}
+
+// view:length() / #view
+static int tcpd_buffer_length(lua_State *L) {
+    tcpd_buffer_view_t *view = luaL_checkudata(L, 1, LUA_TCPD_BUFFER_TYPE);
+    struct evbuffer *input = view_lock(view);
+    size_t len = input ? evbuffer_get_length(input) : 0;
+    if (input) {
+        view_unlock(view, input);
+    }
+    lua_pushinteger(L, (lua_Integer)len);
+    return 1;
+}
+
+// view:peek([n [, offset]]) -> string, without consuming anything.
+// offset is 0-based from the head of the buffer.
+static int tcpd_buffer_peek(lua_State *L) {
+    tcpd_buffer_view_t *view = luaL_checkudata(L, 1, LUA_TCPD_BUFFER_TYPE);
+    lua_Integer offset = luaL_optinteger(L, 3, 0);
+
+    struct evbuffer *input = view_lock(view);
+    if (!input) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    size_t available = evbuffer_get_length(input);
+    if (offset < 0 || (size_t)offset > available) {
+        view_unlock(view, input);
+        lua_pushnil(L);
+        return 1;
+    }
+
+    size_t len = opt_count(L, 2, available - (size_t)offset);
+    struct evbuffer_ptr pos;
+    evbuffer_ptr_set(input, &pos, (size_t)offset, EVBUFFER_PTR_SET);
+    push_range(L, input, &pos, len);
+
+    view_unlock(view, input);
+    return 1;
+}
+
+// view:read([n]) -> string, consuming it. Returns nil when fewer than n
+// bytes are buffered, so framed parsers can simply wait for the next onread.
+static int tcpd_buffer_read(lua_State *L) {
+    tcpd_buffer_view_t *view = luaL_checkudata(L, 1, LUA_TCPD_BUFFER_TYPE);
+
+    struct evbuffer *input = view_lock(view);
+    if (!input) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    size_t available = evbuffer_get_length(input);
+    size_t len = available;
+    if (!lua_isnoneornil(L, 2)) {
+        lua_Integer n = luaL_checkinteger(L, 2);
+        if (n < 0 || (size_t)n > available) {
+            view_unlock(view, input);
+            lua_pushnil(L);
+            return 1;
+        }
+        len = (size_t)n;
+    }
+
+    push_range(L, input, NULL, len);
+    evbuffer_drain(input, len);
+
+    view_unlock(view, input);
+    return 1;
+}
+
+// view:readline([style]) -> line (without terminator) or nil.
+// style: "crlf" (default), "lf", "crlf_strict", "any".
+static int tcpd_buffer_readline(lua_State *L) {
+    tcpd_buffer_view_t *view = luaL_checkudata(L, 1, LUA_TCPD_BUFFER_TYPE);
+    static const char *const styles[] = {"crlf", "lf", "crlf_strict", "any", NULL};
+    static const enum evbuffer_eol_style style_values[] = {
+        EVBUFFER_EOL_CRLF, EVBUFFER_EOL_LF, EVBUFFER_EOL_CRLF_STRICT, EVBUFFER_EOL_ANY};
+    enum evbuffer_eol_style style = style_values[luaL_checkoption(L, 2, "crlf", styles)];
+
+    struct evbuffer *input = view_lock(view);
+    if (!input) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    size_t eol_len = 0;
+    struct evbuffer_ptr eol = evbuffer_search_eol(input, NULL, &eol_len, style);
+    if (eol.pos < 0) {
+        view_unlock(view, input);
+        lua_pushnil(L);
+        return 1;
+    }
+
+    push_range(L, input, NULL, (size_t)eol.pos);
+    evbuffer_drain(input, (size_t)eol.pos + eol_len);
+
+    view_unlock(view, input);
+    return 1;
+}
+
+// view:search(needle [, init]) -> 1-based position (like string.find) or nil.
+static int tcpd_buffer_search(lua_State *L) {
+    tcpd_buffer_view_t *view = luaL_checkudata(L, 1, LUA_TCPD_BUFFER_TYPE);
+    size_t needle_len = 0;
+    const char *needle = luaL_checklstring(L, 2, &needle_len);
+    lua_Integer init = luaL_optinteger(L, 3, 1);
+
+    struct evbuffer *input = view_lock(view);
+    if (!input) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    size_t available = evbuffer_get_length(input);
+    if (init < 1 || (size_t)(init - 1) > available) {
+        view_unlock(view, input);
+        lua_pushnil(L);
+        return 1;
+    }
+
+    struct evbuffer_ptr start;
+    evbuffer_ptr_set(input, &start, (size_t)(init - 1), EVBUFFER_PTR_SET);
+    struct evbuffer_ptr found = evbuffer_search(input, needle, needle_len, &start);
+
+    view_unlock(view, input);
+
+    if (found.pos < 0) {
+        lua_pushnil(L);
+    } else {
+        lua_pushinteger(L, (lua_Integer)found.pos + 1);
+    }
+    return 1;
+}
+
+// view:drain(n) -> number of bytes discarded.
+static int tcpd_buffer_drain(lua_State *L) {
+    tcpd_buffer_view_t *view = luaL_checkudata(L, 1, LUA_TCPD_BUFFER_TYPE);
+
+    struct evbuffer *input = view_lock(view);
+    if (!input) {
+        lua_pushinteger(L, 0);
+        return 1;
+    }
+
+    size_t len = opt_count(L, 2, evbuffer_get_length(input));
+    evbuffer_drain(input, len);
+
+    view_unlock(view, input);
+    lua_pushinteger(L, (lua_Integer)len);
+    return 1;
+}
+
+static int tcpd_buffer_tostring(lua_State *L) {
+    tcpd_buffer_view_t *view = luaL_checkudata(L, 1, LUA_TCPD_BUFFER_TYPE);
+    struct evbuffer *input = view_lock(view);
+    size_t len = input ? evbuffer_get_length(input) : 0;
+    if (input) {
+        view_unlock(view, input);
+    }
+    lua_pushfstring(L, "<tcpd.buffer length=%d>", (int)len);
+    return 1;
+}
+
+// Push the buffer view for `conn` onto `co`.
+//
+// The view is cached as the connection userdata's uservalue (and the view's
+// uservalue points back at the connection), so steady-state reads allocate
+// nothing. If the connection object is not reachable from the weak table, a
+// detached view is created for this call only.
+void tcpd_push_buffer_view(lua_State *co, tcpd_base_conn_t *conn) {
+    tcpd_push_connection_object(co, conn);
+    int conn_idx = lua_gettop(co);
+
+    if (!lua_isnil(co, conn_idx)) {
+        lua_getuservalue(co, conn_idx);
+        if (luaL_testudata(co, -1, LUA_TCPD_BUFFER_TYPE)) {
+            lua_remove(co, conn_idx);
+            return;
+        }
+        lua_pop(co, 1);
+    }
+
+    tcpd_buffer_view_t *view = lua_newuserdata(co, sizeof(tcpd_buffer_view_t));
+    view->conn = conn;
+    luaL_getmetatable(co, LUA_TCPD_BUFFER_TYPE);
+    lua_setmetatable(co, -2);
+
+    if (!lua_isnil(co, conn_idx)) {
+        lua_pushvalue(co, conn_idx);
+        lua_setuservalue(co, -2);    // view -> conn keeps conn alive
+        lua_pushvalue(co, -1);
+        lua_setuservalue(co, conn_idx); // conn -> view caches the view
+    }
+
+    lua_remove(co, conn_idx);
+}
+
+void tcpd_buffer_register_metatable(lua_State *L) {
+    luaL_newmetatable(L, LUA_TCPD_BUFFER_TYPE);
+    lua_pushcfunction(L, tcpd_buffer_length);
+    lua_setfield(L, -2, "length");
+    lua_pushcfunction(L, tcpd_buffer_peek);
+    lua_setfield(L, -2, "peek");
+    lua_pushcfunction(L, tcpd_buffer_read);
+    lua_setfield(L, -2, "read");
+    lua_pushcfunction(L, tcpd_buffer_readline);
+    lua_setfield(L, -2, "readline");
+    lua_pushcfunction(L, tcpd_buffer_search);
+    lua_setfield(L, -2, "search");
+    lua_pushcfunction(L, tcpd_buffer_drain);
+    lua_setfield(L, -2, "drain");
+    lua_pushcfunction(L, tcpd_buffer_length);
+    lua_setfield(L, -2, "__len");
+    lua_pushcfunction(L, tcpd_buffer_tostring);
+    lua_setfield(L, -2, "__tostring");
+    lua_pushstring(L, "buffer");
+    lua_setfield(L, -2, "__typename");
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+}
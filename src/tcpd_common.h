@@ -52,6 +52,9 @@ typedef struct tcpd_config {
 
     // Callback behavior settings
     int callback_self_first;  // When enabled, pass connection object as first parameter to all callbacks
+
+    // Read mode
+    int buffer_view;  // When enabled, onread receives a zero-copy view of the input evbuffer instead of a string
 } tcpd_config_t;
 
 // Base connection structure - common fields for all connection types
@@ -154,6 +157,10 @@ void tcpd_connection_cleanup_on_disconnect(tcpd_base_conn_t *conn);
 // Helper function to push connection object to Lua stack
 void tcpd_push_connection_object(lua_State *co, tcpd_base_conn_t *conn);
 
+// Zero-copy input buffer view (tcpd_buffer.c)
+void tcpd_push_buffer_view(lua_State *co, tcpd_base_conn_t *conn);
+void tcpd_buffer_register_metatable(lua_State *L);
+
 // Helper function to format TCP connection info
 char* tcpd_format_connection_info(const tcpd_base_conn_t *conn);
 
@@ -41,6 +41,9 @@ int tcpd_config_set_defaults(tcpd_config_t *config) {
     // Callback behavior settings
     config->callback_self_first = 0;  // Disabled by default for backward compatibility
 
+    // Read mode - deliver onread data as Lua strings by default
+    config->buffer_view = 0;
+
     return 0;
 }
 
@@ -134,6 +137,11 @@ int tcpd_config_from_lua_table(lua_State *L, int table_index, tcpd_config_t *con
     config->callback_self_first = lua_toboolean(L, -1);
     lua_pop(L, 1);
 
+    // Read mode
+    lua_getfield(L, table_index, "buffer_view");
+    config->buffer_view = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+
     return 0;
 }
 
@@ -3,8 +3,6 @@
 #include <event2/buffer.h>
 #include <string.h>
 
-#define BUFLEN 1024
-
 // Forward declarations
 static tcpd_error_t tcpd_analyze_event_error(struct bufferevent *bev, short events);
 static void tcpd_call_lua_callback(lua_State *mainthread, int callback_ref, int argc);
@@ -20,6 +18,22 @@ void tcpd_push_connection_object(lua_State *co, tcpd_base_conn_t *conn) {
     utlua_push_self_from_weak_table(co, conn);
 }
 
+// Push the onread payload for `input` onto `co`.
+// In buffer_view mode this is the zero-copy view and nothing is consumed;
+// otherwise the whole input is linearised in place (a no-op when it already
+// sits in one chain), copied once into a Lua string and drained.
+static void tcpd_push_read_payload(lua_State *co, tcpd_base_conn_t *conn, struct evbuffer *input) {
+    if (conn->config.buffer_view) {
+        tcpd_push_buffer_view(co, conn);
+        return;
+    }
+
+    size_t len = evbuffer_get_length(input);
+    unsigned char *data = evbuffer_pullup(input, -1);
+    lua_pushlstring(co, (const char *)data, data ? len : 0);
+    evbuffer_drain(input, len);
+}
+
 // Common read callback for all connection types
 void tcpd_common_readcb(struct bufferevent *bev, void *ctx) {
     tcpd_base_conn_t *conn = (tcpd_base_conn_t *)ctx;
@@ -42,33 +56,21 @@ void tcpd_common_readcb(struct bufferevent *bev, void *ctx) {
         return;
     }
 
-    char buf[BUFLEN];
-    int n;
-    BYTEARRAY ba = {0};
-    bytearray_alloc(&ba, BUFLEN * 2);
-
     struct evbuffer *input = bufferevent_get_input(bev);
-    while ((n = evbuffer_remove(input, buf, sizeof(buf))) > 0) {
-        bytearray_writebuffer(&ba, buf, n);
-    }
-    bytearray_read_ready(&ba);
 
     lua_State *mainthread = conn->mainthread;
     if (!mainthread) {
-        bytearray_dealloc(&ba);
         return;
     }
     lua_lock(mainthread);
     // Recheck ref under lock — may have been cleared by another thread
     if (conn->onReadRef == LUA_NOREF) {
         lua_unlock(mainthread);
-        bytearray_dealloc(&ba);
         return;
     }
     fan_cb_setup_t cbs = fan_cb_setup(mainthread, conn->onReadRef);
     if (!cbs.co) {
         lua_unlock(mainthread);
-        bytearray_dealloc(&ba);
         return;
     }
 
@@ -79,7 +81,6 @@ void tcpd_common_readcb(struct bufferevent *bev, void *ctx) {
         lua_pop(cbs.co, 1);
         lua_unlock(mainthread);
         FAN_CB_CLEANUP(mainthread, cbs);
-        bytearray_dealloc(&ba);
         return;
     }
 
@@ -87,18 +88,16 @@ void tcpd_common_readcb(struct bufferevent *bev, void *ctx) {
     int argc = 1;
     if (conn->config.callback_self_first) {
         tcpd_push_connection_object(cbs.co, conn);
-        lua_pushlstring(cbs.co, (const char *)ba.buffer, ba.total);
+        tcpd_push_read_payload(cbs.co, conn, input);
         argc = 2;
     } else {
-        lua_pushlstring(cbs.co, (const char *)ba.buffer, ba.total);
+        tcpd_push_read_payload(cbs.co, conn, input);
         argc = 1;
     }
 
     lua_unlock(mainthread);
     FAN_RESUME(cbs.co, mainthread, argc);
     FAN_CB_CLEANUP(mainthread, cbs);
-
-    bytearray_dealloc(&ba);
 }
 
 // Common write callback for all connection types
@@ -216,34 +215,20 @@ void tcpd_common_eventcb(struct bufferevent *bev, short events, void *ctx) {
             size_t pending = evbuffer_get_length(input);
 
             if (pending > 0) {
-                // Read all remaining data from buffer
-                char buf[BUFLEN];
-                int n;
-                BYTEARRAY ba = {0};
-                bytearray_alloc(&ba, pending + BUFLEN);
-
-                while ((n = evbuffer_remove(input, buf, sizeof(buf))) > 0) {
-                    bytearray_writebuffer(&ba, buf, n);
-                }
-                bytearray_read_ready(&ba);
-
                 // Call onRead callback with remaining data
                 lua_State *mainthread = conn->mainthread;
                 if (!mainthread) {
-                    bytearray_dealloc(&ba);
                     goto after_eof_read;
                 }
                 lua_lock(mainthread);
                 // Recheck ref under lock — may have been cleared by another thread
                 if (conn->onReadRef == LUA_NOREF) {
                     lua_unlock(mainthread);
-                    bytearray_dealloc(&ba);
                     goto after_eof_read;
                 }
                 fan_cb_setup_t cbs = fan_cb_setup(mainthread, conn->onReadRef);
                 if (!cbs.co) {
                     lua_unlock(mainthread);
-                    bytearray_dealloc(&ba);
                     goto after_eof_read;
                 }
 
@@ -254,25 +239,22 @@ void tcpd_common_eventcb(struct bufferevent *bev, short events, void *ctx) {
                     lua_pop(cbs.co, 1);
                     lua_unlock(mainthread);
                     FAN_CB_CLEANUP(mainthread, cbs);
-                    bytearray_dealloc(&ba);
                     goto after_eof_read;
                 }
 
                 int argc = 1;
                 if (conn->config.callback_self_first) {
                     tcpd_push_connection_object(cbs.co, conn);
-                    lua_pushlstring(cbs.co, (const char *)ba.buffer, ba.total);
+                    tcpd_push_read_payload(cbs.co, conn, input);
                     argc = 2;
                 } else {
-                    lua_pushlstring(cbs.co, (const char *)ba.buffer, ba.total);
+                    tcpd_push_read_payload(cbs.co, conn, input);
                     argc = 1;
                 }
 
                 lua_unlock(mainthread);
                 FAN_RESUME(cbs.co, mainthread, argc);
                 FAN_CB_CLEANUP(mainthread, cbs);
-
-                bytearray_dealloc(&ba);
             }
         }
 after_eof_read:
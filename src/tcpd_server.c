@@ -1,6 +1,8 @@
 #include "tcpd_server.h"
+#include "shard.h"
 #include "tcpd_ssl.h"
 #include <net/if.h>
+#include <stdatomic.h>
 #include <sys/un.h>
 
 #ifdef __linux__
@@ -19,11 +21,62 @@ typedef struct {
 // Forward declarations
 static void tcpd_accept_cleanup_on_disconnect(tcpd_accept_conn_t *accept);
 
-// Server connection listener callback
-void tcpd_server_listener_cb(struct evconnlistener *listener, evutil_socket_t fd,
-                            struct sockaddr *addr, int socklen, void *arg) {
-    tcpd_server_t *server = (tcpd_server_t *)arg;
+// Fill in the accept connection's peer ip/port from the accepted address
+static void tcpd_accept_set_peer(tcpd_accept_conn_t *accept, const struct sockaddr *addr) {
+    memset(accept->base.ip, 0, INET6_ADDRSTRLEN);
+    if (addr->sa_family == AF_INET) {
+        const struct sockaddr_in *addr_in = (const struct sockaddr_in *)addr;
+        inet_ntop(addr_in->sin_family, (const void *)&(addr_in->sin_addr), accept->base.ip, INET_ADDRSTRLEN);
+        accept->base.port = ntohs(addr_in->sin_port);
+    } else if (addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *addr_in = (const struct sockaddr_in6 *)addr;
+        inet_ntop(addr_in->sin6_family, (const void *)&(addr_in->sin6_addr), accept->base.ip, INET6_ADDRSTRLEN);
+        accept->base.port = ntohs(addr_in->sin6_port);
+    }
+}
+
+// Create an accept connection object for `fd` on `L`, with its bufferevent
+// on `base`. Used for connections handed to a per-worker Lua shard: the
+// shard's state and `base` are both owned by the calling thread, so the
+// bufferevent needs no locking and EV_READ can be enabled right away.
+// Pushes the accept object (or nil, closing `fd`) and returns 0 on success.
+int tcpd_accept_push(lua_State *L, struct event_base *base, evutil_socket_t fd,
+                     const struct sockaddr *addr, const tcpd_config_t *config) {
+    tcpd_accept_conn_t *accept = lua_newuserdata(L, sizeof(tcpd_accept_conn_t));
+    memset(accept, 0, sizeof(tcpd_accept_conn_t));
+
+    tcpd_base_conn_init(&accept->base, TCPD_CONN_TYPE_ACCEPT, utlua_mainthread(L));
+    accept->base.config = *config;
+
+    luaL_getmetatable(L, LUA_TCPD_ACCEPT_TYPE);
+    lua_setmetatable(L, -2);
+
+    struct bufferevent *bev = bufferevent_socket_new(base, fd,
+        BEV_OPT_CLOSE_ON_FREE | BEV_OPT_DEFER_CALLBACKS);
+    if (!bev) {
+        evutil_closesocket(fd);
+        lua_pop(L, 1);
+        lua_pushnil(L);
+        return -1;
+    }
+
+    accept->base.buf = bev;
+    accept->base.state = TCPD_CONN_CONNECTED;
 
+    bufferevent_setcb(bev, tcpd_common_readcb, tcpd_common_writecb, tcpd_common_eventcb, &accept->base);
+    bufferevent_enable(bev, EV_READ | EV_WRITE);
+
+    tcpd_config_apply_buffers(config, bev, fd);
+    tcpd_config_apply_keepalive(config, fd);
+
+    tcpd_accept_set_peer(accept, addr);
+    return 0;
+}
+
+// Run the server's onaccept for an accepted socket, with the connection's
+// bufferevent on `accept_base`. Always called on the main thread.
+static void tcpd_server_accept(tcpd_server_t *server, struct event_base *accept_base, int use_worker,
+                               evutil_socket_t fd, struct sockaddr *addr) {
     if (server->onAcceptRef == LUA_NOREF) return;
 
     lua_State *mainthread = server->mainthread;
@@ -55,14 +108,6 @@ void tcpd_server_listener_cb(struct evconnlistener *listener, evutil_socket_t fd
     luaL_getmetatable(cbs.co, LUA_TCPD_ACCEPT_TYPE);
     lua_setmetatable(cbs.co, -2);
 
-    struct event_base *accept_base;
-    int use_worker = (event_mgr_worker_count() > 0);
-    if (use_worker) {
-        int wid = event_mgr_next_worker();
-        accept_base = event_mgr_worker_base(wid);
-    } else {
-        accept_base = evconnlistener_get_base(listener);
-    }
     int extra_bev_flags = use_worker ? BEV_OPT_THREADSAFE | BEV_OPT_UNLOCK_CALLBACKS : 0;
     struct bufferevent *bev;
 
@@ -75,7 +120,8 @@ void tcpd_server_listener_cb(struct evconnlistener *listener, evutil_socket_t fd
     }
 
     if (!bev) {
-        // Handle error
+        // Handle error: replace the half-built accept object with nil
+        lua_pop(cbs.co, 1);
         lua_pushnil(cbs.co);
         lua_unlock(mainthread);
         FAN_RESUME(cbs.co, mainthread, 1);
@@ -101,17 +147,7 @@ void tcpd_server_listener_cb(struct evconnlistener *listener, evutil_socket_t fd
     tcpd_config_apply_keepalive(&server->config, fd);
 
     // Extract client address
-    memset(accept->base.ip, 0, INET6_ADDRSTRLEN);
-    if (addr->sa_family == AF_INET) {
-        struct sockaddr_in *addr_in = (struct sockaddr_in *)addr;
-        inet_ntop(addr_in->sin_family, (void *)&(addr_in->sin_addr), accept->base.ip, INET_ADDRSTRLEN);
-        accept->base.port = ntohs(addr_in->sin_port);
-    } else {
-        struct sockaddr_in6 *addr_in = (struct sockaddr_in6 *)addr;
-        inet_ntop(addr_in->sin6_family, (void *)&(addr_in->sin6_addr), accept->base.ip, INET6_ADDRSTRLEN);
-        accept->base.port = ntohs(addr_in->sin6_port);
-    }
-
+    tcpd_accept_set_peer(accept, addr);
 
     // Check if callback_self_first is enabled for the server onaccept callback
     int argc = 1;
@@ -131,10 +167,291 @@ void tcpd_server_listener_cb(struct evconnlistener *listener, evutil_socket_t fd
     FAN_CB_CLEANUP(mainthread, cbs);
 }
 
+// Server connection listener callback
+void tcpd_server_listener_cb(struct evconnlistener *listener, evutil_socket_t fd,
+                            struct sockaddr *addr, int socklen, void *arg) {
+    tcpd_server_t *server = (tcpd_server_t *)arg;
+
+    if (server->shard) {
+        // Hand the socket to a shard; it builds the connection in its own state.
+        if (shard_dispatch_accept(fd, addr, socklen, &server->config) != 0) {
+            evutil_closesocket(fd);
+        }
+        return;
+    }
+
+    if (server->onAcceptRef == LUA_NOREF) return;
+
+    struct event_base *accept_base;
+    int use_worker = (event_mgr_worker_count() > 0);
+    if (use_worker) {
+        int wid = event_mgr_next_worker();
+        accept_base = event_mgr_worker_base(wid);
+    } else {
+        accept_base = evconnlistener_get_base(listener);
+    }
+
+    tcpd_server_accept(server, accept_base, use_worker, fd, addr);
+}
+
+// -- SO_REUSEPORT listeners --
+//
+// With `reuseport_shards = N` the server opens N listening sockets bound to
+// the same address with SO_REUSEPORT, one per worker base, and the kernel
+// spreads incoming connections over them. accept() therefore runs on the
+// workers in parallel instead of funnelling through the main loop.
+//
+// Sockets are created and bound synchronously (so errors and the chosen
+// port are known to tcpd.bind), then each evconnlistener is registered and
+// later freed on its own worker thread through event_mgr_post, since the
+// worker bases are running. The group outlives the server userdata until
+// every worker has released its listener and every in-flight accept handed
+// to the main thread has been delivered, hence the refcount.
+
+typedef struct tcpd_reuseport_slot {
+    struct tcpd_reuseport_group *group;
+    int worker_id;
+    evutil_socket_t fd;
+    struct evconnlistener *listener;
+} tcpd_reuseport_slot_t;
+
+struct tcpd_reuseport_group {
+    _Atomic int refs;
+    tcpd_server_t *server;  // NULL once the server is closed (main thread only)
+    int shard;
+    tcpd_config_t config;
+    int count;
+    tcpd_reuseport_slot_t slots[EVENT_MGR_MAX_WORKERS];
+};
+
+typedef struct {
+    struct tcpd_reuseport_group *group;
+    evutil_socket_t fd;
+    struct sockaddr_storage addr;
+} tcpd_reuseport_accept_t;
+
+static void tcpd_reuseport_unref(struct tcpd_reuseport_group *group) {
+    if (atomic_fetch_sub(&group->refs, 1) == 1) {
+        free(group);
+    }
+}
+
+// Main thread: run onaccept for a socket accepted by a worker listener.
+static void tcpd_reuseport_deliver(void *arg) {
+    tcpd_reuseport_accept_t *pending = (tcpd_reuseport_accept_t *)arg;
+    tcpd_server_t *server = pending->group->server;
+
+    if (server && server->onAcceptRef != LUA_NOREF) {
+        // The Lua side lives on the main loop, so the connection does too.
+        tcpd_server_accept(server, event_mgr_base(), 0,
+                           pending->fd, (struct sockaddr *)&pending->addr);
+    } else {
+        evutil_closesocket(pending->fd);
+    }
+
+    tcpd_reuseport_unref(pending->group);
+    free(pending);
+}
+
+// Worker thread: a connection arrived on this worker's listener.
+static void tcpd_reuseport_listener_cb(struct evconnlistener *listener, evutil_socket_t fd,
+                                       struct sockaddr *addr, int socklen, void *arg) {
+    tcpd_reuseport_slot_t *slot = (tcpd_reuseport_slot_t *)arg;
+    struct tcpd_reuseport_group *group = slot->group;
+
+    if (group->shard) {
+        if (shard_accept_local(fd, addr, socklen, &group->config) != 0) {
+            evutil_closesocket(fd);
+        }
+        return;
+    }
+
+    tcpd_reuseport_accept_t *pending = calloc(1, sizeof(tcpd_reuseport_accept_t));
+    if (!pending || socklen <= 0 || (size_t)socklen > sizeof(pending->addr)) {
+        free(pending);
+        evutil_closesocket(fd);
+        return;
+    }
+    pending->group = group;
+    pending->fd = fd;
+    memcpy(&pending->addr, addr, socklen);
+
+    atomic_fetch_add(&group->refs, 1);
+    if (event_mgr_post(-1, tcpd_reuseport_deliver, pending) != 0) {
+        tcpd_reuseport_unref(group);
+        free(pending);
+        evutil_closesocket(fd);
+    }
+}
+
+static void tcpd_reuseport_listen_task(void *arg) {
+    tcpd_reuseport_slot_t *slot = (tcpd_reuseport_slot_t *)arg;
+    // backlog 0: the socket is already listening
+    slot->listener = evconnlistener_new(event_mgr_worker_base(slot->worker_id),
+                                        tcpd_reuseport_listener_cb, slot,
+                                        LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE, 0, slot->fd);
+    if (!slot->listener) {
+        LOGE("tcpd reuseport: failed to listen on worker %d\n", slot->worker_id);
+    }
+}
+
+static void tcpd_reuseport_release_task(void *arg) {
+    tcpd_reuseport_slot_t *slot = (tcpd_reuseport_slot_t *)arg;
+    if (slot->listener) {
+        evconnlistener_free(slot->listener);
+        slot->listener = NULL;
+    } else if (slot->fd >= 0) {
+        evutil_closesocket(slot->fd);
+    }
+    slot->fd = -1;
+    tcpd_reuseport_unref(slot->group);
+}
+
+static evutil_socket_t tcpd_reuseport_socket(const struct sockaddr *addr, ev_socklen_t addrlen) {
+    evutil_socket_t fd = socket(addr->sa_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (evutil_make_socket_nonblocking(fd) < 0 ||
+        evutil_make_socket_closeonexec(fd) < 0 ||
+        evutil_make_listen_socket_reuseable(fd) < 0 ||
+        evutil_make_listen_socket_reuseable_port(fd) < 0 ||
+        bind(fd, addr, addrlen) < 0 ||
+        listen(fd, 128) < 0) {
+        evutil_closesocket(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void tcpd_server_reuseport_close(tcpd_server_t *server) {
+    struct tcpd_reuseport_group *group = server->reuseport;
+    if (!group) return;
+
+    server->reuseport = NULL;
+    group->server = NULL;
+
+    for (int i = 0; i < group->count; i++) {
+        tcpd_reuseport_slot_t *slot = &group->slots[i];
+        if (event_mgr_post(slot->worker_id, tcpd_reuseport_release_task, slot) != 0) {
+            // Worker already gone: its base is not dispatching, free in place.
+            tcpd_reuseport_release_task(slot);
+        }
+    }
+
+    tcpd_reuseport_unref(group);
+}
+
+static void tcpd_server_reuseport_open(lua_State *L, tcpd_server_t *server) {
+    struct sockaddr_storage ss;
+    ev_socklen_t sslen = 0;
+    memset(&ss, 0, sizeof(ss));
+
+    if (server->host) {
+        char portbuf[6];
+        evutil_snprintf(portbuf, sizeof(portbuf), "%d", server->port);
+
+        struct evutil_addrinfo hints = {0};
+        struct evutil_addrinfo *answer = NULL;
+        hints.ai_family = server->ipv6 ? AF_INET6 : AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+        hints.ai_flags = EVUTIL_AI_ADDRCONFIG;
+
+        int err = evutil_getaddrinfo(server->host, portbuf, &hints, &answer);
+        if (err < 0 || !answer) {
+            if (L) {
+                luaL_error(L, "invalid bind address %s:%d", server->host, server->port);
+            }
+            return;
+        }
+        memcpy(&ss, answer->ai_addr, answer->ai_addrlen);
+        sslen = answer->ai_addrlen;
+        evutil_freeaddrinfo(answer);
+    } else if (!server->ipv6) {
+        struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = htonl(0);
+        sin->sin_port = htons(server->port);
+        sslen = sizeof(struct sockaddr_in);
+    } else {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ss;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(server->port);
+        sslen = sizeof(struct sockaddr_in6);
+    }
+
+    int count = server->reuseport_shards;
+    if (count > event_mgr_worker_count()) {
+        count = event_mgr_worker_count();
+    }
+
+    struct tcpd_reuseport_group *group = calloc(1, sizeof(struct tcpd_reuseport_group));
+    if (!group) return;
+    atomic_init(&group->refs, 1);
+    group->server = server;
+    group->shard = server->shard;
+    group->config = server->config;
+
+    for (int i = 0; i < count; i++) {
+        evutil_socket_t fd = tcpd_reuseport_socket((struct sockaddr *)&ss, sslen);
+        if (fd < 0) {
+            break;
+        }
+
+        // port 0: every other socket must join the port the kernel picked
+        if (i == 0 && regress_get_socket_port(fd) > 0) {
+            int port = regress_get_socket_port(fd);
+            if (ss.ss_family == AF_INET6) {
+                ((struct sockaddr_in6 *)&ss)->sin6_port = htons(port);
+            } else {
+                ((struct sockaddr_in *)&ss)->sin_port = htons(port);
+            }
+        }
+
+        tcpd_reuseport_slot_t *slot = &group->slots[i];
+        slot->group = group;
+        slot->worker_id = i;
+        slot->fd = fd;
+        group->count++;
+        atomic_fetch_add(&group->refs, 1);
+    }
+
+    if (group->count != count) {
+        // Partial failure: report like a failed bind (no listener).
+        server->reuseport = group;
+        tcpd_server_reuseport_close(server);
+        return;
+    }
+
+    for (int i = 0; i < group->count; i++) {
+        event_mgr_post(i, tcpd_reuseport_listen_task, &group->slots[i]);
+    }
+    server->reuseport = group;
+}
+
+// Listening socket of the server (first reuseport socket in sharded mode)
+static evutil_socket_t tcpd_server_fd(tcpd_server_t *server) {
+    if (server->reuseport && server->reuseport->count > 0) {
+        return server->reuseport->slots[0].fd;
+    }
+    if (server->listener) {
+        return evconnlistener_get_fd(server->listener);
+    }
+    return -1;
+}
+
 // Server rebind function implementation
 void tcpd_server_rebind(lua_State *L, tcpd_server_t *server) {
     if (!server) return;
 
+    if (server->reuseport_shards > 0) {
+        tcpd_server_reuseport_close(server);
+        tcpd_server_reuseport_open(L, server);
+        return;
+    }
+
     if (server->listener) {
         evconnlistener_free(server->listener);
         server->listener = NULL;
@@ -215,13 +532,8 @@ LUA_API int lua_tcpd_server_rebind(lua_State *L) {
 LUA_API int lua_tcpd_server_localinfo(lua_State *L) {
     tcpd_server_t *server = luaL_checkudata(L, 1, LUA_TCPD_SERVER_TYPE);
 
-    if (!server->listener) {
-        lua_pushnil(L);
-        return 1;
-    }
-
     // Get the actual bound address and port
-    evutil_socket_t fd = evconnlistener_get_fd(server->listener);
+    evutil_socket_t fd = tcpd_server_fd(server);
     if (fd < 0) {
         lua_pushnil(L);
         return 1;
@@ -287,6 +599,35 @@ LUA_API int tcpd_bind(lua_State *L) {
     // Extract configuration
     tcpd_config_from_lua_table(L, 1, &server->config);
 
+    lua_getfield(L, 1, "shard");
+    server->shard = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+
+    SET_INT_FROM_TABLE(L, server->reuseport_shards, 1, "reuseport_shards");
+    if (server->reuseport_shards > 0) {
+        if (server->unix_path) {
+            return luaL_error(L, "reuseport_shards is not supported with unix_path");
+        }
+        if (server->config.ssl_enabled) {
+            return luaL_error(L, "ssl is not supported with reuseport_shards");
+        }
+        if (server->reuseport_shards > EVENT_MGR_MAX_WORKERS) {
+            server->reuseport_shards = EVENT_MGR_MAX_WORKERS;
+        }
+        if (event_mgr_worker_count() == 0 && event_mgr_workers_init(server->reuseport_shards) != 0) {
+            return luaL_error(L, "failed to start %d workers", server->reuseport_shards);
+        }
+    }
+
+    if (server->shard) {
+        if (server->config.ssl_enabled) {
+            return luaL_error(L, "ssl is not supported with shard=true");
+        }
+        if (shard_count() == 0) {
+            return luaL_error(L, "shard=true requires fan.shard.start() first");
+        }
+    }
+
     // Set up SSL if enabled
     if (server->config.ssl_enabled) {
 #if FAN_HAS_OPENSSL
@@ -306,12 +647,12 @@ LUA_API int tcpd_bind(lua_State *L) {
     // Create listener
     tcpd_server_rebind(L, server);
 
-    if (!server->listener) {
+    if (!server->listener && !server->reuseport) {
         return 0;
     }
 
     if (!server->port) {
-        server->port = regress_get_socket_port(evconnlistener_get_fd(server->listener));
+        server->port = regress_get_socket_port(tcpd_server_fd(server));
     }
 
     lua_pushinteger(L, server->port);
@@ -527,6 +868,7 @@ static int tcpd_server_gc(lua_State *L) {
         evconnlistener_free(server->listener);
         server->listener = NULL;
     }
+    tcpd_server_reuseport_close(server);
 
     // Clean up host string
     if (server->host) {
@@ -3,6 +3,8 @@
 
 #include "tcpd_common.h"
 
+struct tcpd_reuseport_group;
+
 // Server structure definition
 typedef struct tcpd_server {
     struct evconnlistener *listener;
@@ -15,6 +17,9 @@ typedef struct tcpd_server {
     int port;
     int ipv6;
     char *unix_path;  // if set, bind on AF_UNIX instead of TCP
+    int shard;        // if set, accepted sockets are handed to fan.shard workers
+    int reuseport_shards;  // if > 0, one SO_REUSEPORT listener per worker base
+    struct tcpd_reuseport_group *reuseport;
 
     tcpd_config_t config;
     tcpd_ssl_context_t *ssl_ctx;
@@ -39,6 +44,10 @@ LUA_API int tcpd_accept_read_resume(lua_State *L);
 LUA_API int tcpd_accept_getsockname(lua_State *L);
 LUA_API int tcpd_accept_getpeername(lua_State *L);
 
+// Create an accept connection for `fd` on the calling thread's state/base
+int tcpd_accept_push(lua_State *L, struct event_base *base, evutil_socket_t fd,
+                     const struct sockaddr *addr, const tcpd_config_t *config);
+
 // Metatable registration
 void tcpd_server_register_metatables(lua_State *L);
 
@@ -1,6 +1,12 @@
 #include "udpd_common.h"
 #include "evdns.h"
 #include <net/if.h>
+#include <netinet/udp.h>
+#include <sys/uio.h>
+
+#if defined(__linux__) && !defined(UDP_SEGMENT)
+#define UDP_SEGMENT 103
+#endif
 
 // Refactored UDP module using modular components
 // This file now focuses on Lua interface and high-level coordination
@@ -375,6 +381,292 @@ LUA_API int udpd_conn_send(lua_State *L) {
     return 1;
 }
 
+// Resolve the target of datagram `i` (1-based) for send_batch: `dests` is
+// either a single dest, an array of dests parallel to the buffers, or nil.
+// Missing entries use the connection's default destination.
+static int udpd_batch_target(lua_State *L, udpd_conn_t *conn, int dests, int i,
+                             const struct sockaddr **addr, socklen_t *addrlen) {
+    udpd_dest_t *dest = NULL;
+    if (lua_istable(L, dests)) {
+        lua_rawgeti(L, dests, i);
+        dest = luaL_testudata(L, -1, LUA_UDPD_DEST_TYPE);
+        lua_pop(L, 1);  // still referenced by the dests table
+    } else if (!lua_isnoneornil(L, dests)) {
+        dest = udpd_dest_from_lua(L, dests);
+    }
+
+    if (dest) {
+        *addr = (const struct sockaddr *)&dest->addr;
+        *addrlen = dest->addrlen;
+    } else {
+        if (conn->base.addrlen == 0) {
+            return -1;
+        }
+        *addr = (const struct sockaddr *)&conn->base.addr;
+        *addrlen = conn->base.addrlen;
+    }
+    return 0;
+}
+
+// Send `count` datagrams described by `iov`/`addrs` with as few syscalls as
+// possible. Returns the number of datagrams sent, or -1 if the first one
+// failed (errno set).
+static int udpd_send_datagrams(evutil_socket_t fd, struct iovec *iov,
+                               const struct sockaddr **addrs, socklen_t *addrlens, int count) {
+    int sent = 0;
+
+#ifdef __linux__
+    struct mmsghdr msgs[UDPD_MAX_BATCH_SIZE];
+    while (sent < count) {
+        int chunk = count - sent;
+        if (chunk > UDPD_MAX_BATCH_SIZE) {
+            chunk = UDPD_MAX_BATCH_SIZE;
+        }
+        memset(msgs, 0, sizeof(struct mmsghdr) * chunk);
+        for (int i = 0; i < chunk; i++) {
+            msgs[i].msg_hdr.msg_iov = &iov[sent + i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = (void *)addrs[sent + i];
+            msgs[i].msg_hdr.msg_namelen = addrlens[sent + i];
+        }
+
+        int n = sendmmsg(fd, msgs, chunk, 0);
+        if (n < 0) {
+            return sent > 0 ? sent : -1;
+        }
+        sent += n;
+        if (n < chunk) {
+            break;  // socket buffer full; report the partial count
+        }
+    }
+#else
+    for (; sent < count; sent++) {
+        if (sendto(fd, iov[sent].iov_base, iov[sent].iov_len, 0, addrs[sent], addrlens[sent]) < 0) {
+            return sent > 0 ? sent : -1;
+        }
+    }
+#endif
+
+    return sent;
+}
+
+// Lua: conn:send_batch({buf1, buf2, ...} [, dest | {dest1, dest2, ...}])
+// Returns the number of datagrams sent (may be short, even 0, if the socket
+// buffer fills up), nil, err for a bad argument, or nil, err, errno when
+// the socket call failed.
+LUA_API int udpd_conn_send_batch(lua_State *L) {
+    udpd_conn_t *conn = luaL_checkudata(L, 1, LUA_UDPD_CONNECTION_TYPE);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_settop(L, 3);
+    // Checked up front: the loop below must not raise while holding the
+    // scratch arrays.
+    luaL_argcheck(L, lua_isnil(L, 3) || lua_istable(L, 3) || luaL_testudata(L, 3, LUA_UDPD_DEST_TYPE), 3,
+                  "dest or array of dests expected");
+
+    if (conn->base.socket_fd < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Socket not created");
+        return 2;
+    }
+
+    int count = (int)lua_objlen(L, 2);
+    if (count == 0) {
+        lua_pushinteger(L, 0);
+        return 1;
+    }
+
+    struct iovec *iov = malloc(sizeof(struct iovec) * count);
+    const struct sockaddr **addrs = malloc(sizeof(struct sockaddr *) * count);
+    socklen_t *addrlens = malloc(sizeof(socklen_t) * count);
+    if (!iov || !addrs || !addrlens) {
+        free(iov);
+        free(addrs);
+        free(addrlens);
+        return luaL_error(L, "Memory allocation failure");
+    }
+
+    const char *err = NULL;
+    for (int i = 0; i < count && !err; i++) {
+        size_t len = 0;
+        const char *data = NULL;
+        // Only real strings: lua_tolstring would convert a number on the
+        // stack into a new string that nothing anchors once popped.
+        lua_rawgeti(L, 2, i + 1);
+        if (lua_type(L, -1) == LUA_TSTRING) {
+            data = lua_tolstring(L, -1, &len);
+        }
+        lua_pop(L, 1);  // still referenced by the buffers table
+
+        if (!data) {
+            err = "send_batch expects an array of strings";
+        } else if (!udpd_validate_packet_size(len)) {
+            err = "Packet size exceeds UDP maximum";
+        } else if (udpd_batch_target(L, conn, 3, i + 1, &addrs[i], &addrlens[i]) < 0) {
+            err = "No destination address available";
+        }
+        iov[i].iov_base = (void *)data;
+        iov[i].iov_len = len;
+    }
+
+    int sent = err ? -1 : udpd_send_datagrams(conn->base.socket_fd, iov, addrs, addrlens, count);
+    int saved_errno = errno;
+
+    free(iov);
+    free(addrs);
+    free(addrlens);
+
+    if (err) {
+        lua_pushnil(L);
+        lua_pushstring(L, err);
+        return 2;
+    }
+    if (sent < 0) {
+        if (saved_errno == EAGAIN || saved_errno == EWOULDBLOCK || saved_errno == ENOBUFS) {
+            sent = 0;  // buffer full before the first datagram
+        } else {
+            lua_pushnil(L);
+            lua_pushstring(L, strerror(saved_errno));
+            lua_pushinteger(L, saved_errno);
+            return 3;
+        }
+    }
+
+    lua_pushinteger(L, sent);
+    return 1;
+}
+
+// Hand `len` bytes to the kernel as one UDP_SEGMENT (GSO) send that the
+// stack splits into `segment_size` datagrams. Returns bytes sent or -1.
+static ssize_t udpd_send_gso(evutil_socket_t fd, const char *data, size_t len, uint16_t segment_size,
+                             const struct sockaddr *addr, socklen_t addrlen) {
+#if defined(__linux__)
+    struct iovec iov = {(void *)data, len};
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_name = (void *)addr;
+    msg.msg_namelen = addrlen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cm), &segment_size, sizeof(uint16_t));
+
+    return sendmsg(fd, &msg, 0);
+#else
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+// Lua: conn:send_gso(buf, segment_size [, dest])
+// Sends `buf` as consecutive datagrams of `segment_size` bytes (the last
+// one may be shorter). Uses UDP GSO where the kernel supports it, handing
+// up to UDPD_GSO_MAX_SEGMENTS segments over per syscall; otherwise falls
+// back to send_batch-style sendmmsg. Returns bytes sent, or nil, err.
+LUA_API int udpd_conn_send_gso(lua_State *L) {
+    udpd_conn_t *conn = luaL_checkudata(L, 1, LUA_UDPD_CONNECTION_TYPE);
+    size_t len = 0;
+    const char *data = luaL_checklstring(L, 2, &len);
+    lua_Integer segment = luaL_checkinteger(L, 3);
+    lua_settop(L, 4);
+
+    if (segment <= 0 || segment > UDPD_MAX_PACKET_SIZE) {
+        return luaL_argerror(L, 3, "segment_size out of range");
+    }
+    if (conn->base.socket_fd < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Socket not created");
+        return 2;
+    }
+
+    const struct sockaddr *addr = NULL;
+    socklen_t addrlen = 0;
+    if (udpd_batch_target(L, conn, 4, 1, &addr, &addrlen) < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "No destination address available");
+        return 2;
+    }
+
+    size_t seg = (size_t)segment;
+    size_t offset = 0;
+
+    // Largest GSO super-datagram: whole segments only, within both the
+    // UDP payload limit and the kernel's per-send segment cap.
+    size_t per_send = (UDPD_MAX_PACKET_SIZE / seg) * seg;
+    if (per_send > seg * UDPD_GSO_MAX_SEGMENTS) {
+        per_send = seg * UDPD_GSO_MAX_SEGMENTS;
+    }
+
+    while (offset < len && !conn->base.gso_unsupported && per_send > seg) {
+        size_t chunk = len - offset < per_send ? len - offset : per_send;
+        ssize_t n = udpd_send_gso(conn->base.socket_fd, data + offset, chunk, (uint16_t)seg, addr, addrlen);
+        if (n < 0) {
+            if (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP) {
+                // No GSO on this socket/device: remember and use sendmmsg.
+                conn->base.gso_unsupported = 1;
+                break;
+            }
+            if (offset == 0) {
+                lua_pushnil(L);
+                lua_pushstring(L, strerror(errno));
+                return 2;
+            }
+            lua_pushinteger(L, (lua_Integer)offset);
+            return 1;
+        }
+        offset += chunk;
+    }
+
+    if (offset < len) {
+        int count = (int)((len - offset + seg - 1) / seg);
+        struct iovec *iov = malloc(sizeof(struct iovec) * count);
+        const struct sockaddr **addrs = malloc(sizeof(struct sockaddr *) * count);
+        socklen_t *addrlens = malloc(sizeof(socklen_t) * count);
+        if (!iov || !addrs || !addrlens) {
+            free(iov);
+            free(addrs);
+            free(addrlens);
+            return luaL_error(L, "Memory allocation failure");
+        }
+
+        for (int i = 0; i < count; i++) {
+            size_t start = offset + (size_t)i * seg;
+            iov[i].iov_base = (void *)(data + start);
+            iov[i].iov_len = len - start < seg ? len - start : seg;
+            addrs[i] = addr;
+            addrlens[i] = addrlen;
+        }
+
+        int sent = udpd_send_datagrams(conn->base.socket_fd, iov, addrs, addrlens, count);
+        int saved_errno = errno;
+        size_t bytes = 0;
+        for (int i = 0; i < sent; i++) {
+            bytes += iov[i].iov_len;
+        }
+
+        free(iov);
+        free(addrs);
+        free(addrlens);
+
+        if (sent < 0 && offset == 0) {
+            lua_pushnil(L);
+            lua_pushstring(L, strerror(saved_errno));
+            return 2;
+        }
+        offset += bytes;
+    }
+
+    lua_pushinteger(L, (lua_Integer)offset);
+    return 1;
+}
+
 // Request send ready notification
 LUA_API int udpd_conn_send_request(lua_State *L) {
     udpd_conn_t *conn = luaL_checkudata(L, 1, LUA_UDPD_CONNECTION_TYPE);
@@ -438,6 +730,12 @@ LUA_API int luaopen_fan_udpd(lua_State *L) {
     lua_pushcfunction(L, udpd_conn_send);
     lua_setfield(L, -2, "send");
 
+    lua_pushcfunction(L, udpd_conn_send_batch);
+    lua_setfield(L, -2, "send_batch");
+
+    lua_pushcfunction(L, udpd_conn_send_gso);
+    lua_setfield(L, -2, "send_gso");
+
     lua_pushcfunction(L, udpd_conn_send_request);
     lua_setfield(L, -2, "send_req");
 
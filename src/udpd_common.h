@@ -44,6 +44,9 @@ typedef struct udpd_config {
     int reuse_addr;
     int reuse_port;
 
+    // Datagrams pulled per wakeup in onread_batch mode (recvmmsg)
+    int batch_size;
+
     // Note: UDP uses base.send_buffer_size and base.receive_buffer_size
     // No separate UDP buffer sizes needed - eliminates redundancy
 } udpd_config_t;
@@ -60,6 +63,10 @@ typedef struct udpd_base_conn {
     int _ref_;  // Generic Lua reference for REF_STATE macros
     int onReadRef;
     int onSendReadyRef;
+    int onReadBatchRef;
+
+    // onread_batch state: weak-valued table interning sender address -> dest object
+    int destCacheRef;
 
     // Configuration
     udpd_config_t config;
@@ -86,6 +93,9 @@ typedef struct udpd_base_conn {
     // across Lua resume.
     pthread_mutex_t event_mutex;
 
+    // Set once a UDP_SEGMENT send is rejected; send_gso then uses sendmmsg
+    int gso_unsupported;
+
     // Worker thread assignment (-1 = main event_base)
     int worker_id;
 
@@ -192,6 +202,9 @@ tcpd_error_t udpd_error_bind_failed(const char *host, int port);
 // Constants
 #define UDPD_DEFAULT_BUFFER_SIZE (256 * 1024)
 #define UDPD_MAX_PACKET_SIZE 65507  // Maximum UDP packet size
+#define UDPD_DEFAULT_BATCH_SIZE 32
+#define UDPD_MAX_BATCH_SIZE 256
+#define UDPD_GSO_MAX_SEGMENTS 64   // kernel UDP_MAX_SEGMENTS
 #define LUA_UDPD_CONNECTION_TYPE "UDPD_CONNECTION_TYPE"
 #define LUA_UDPD_DEST_TYPE "LUA_UDPD_DEST_TYPE"
 
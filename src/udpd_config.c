@@ -31,6 +31,7 @@ int udpd_config_set_defaults(udpd_config_t *config) {
     config->multicast_ttl = 1;
     config->reuse_addr = 1;
     config->reuse_port = 0;
+    config->batch_size = UDPD_DEFAULT_BATCH_SIZE;
 
     // Set UDP-specific buffer defaults in base config if not already set
     if (config->base.send_buffer_size == 0) {
@@ -63,6 +64,7 @@ int udpd_config_from_lua_table(lua_State *L, int table_index, udpd_config_t *con
     config->multicast_ttl = 1;
     config->reuse_addr = 1;
     config->reuse_port = 0;
+    config->batch_size = UDPD_DEFAULT_BATCH_SIZE;
 
     // Set UDP-specific buffer defaults only if not already set by Lua table
     if (config->base.send_buffer_size == 0) {
@@ -110,6 +112,18 @@ int udpd_config_from_lua_table(lua_State *L, int table_index, udpd_config_t *con
     }
     lua_pop(L, 1);
 
+    lua_getfield(L, table_index, "batch_size");
+    if (lua_type(L, -1) == LUA_TNUMBER) {
+        int batch_size = (int)lua_tointeger(L, -1);
+        if (batch_size < 1) {
+            batch_size = 1;
+        } else if (batch_size > UDPD_MAX_BATCH_SIZE) {
+            batch_size = UDPD_MAX_BATCH_SIZE;
+        }
+        config->batch_size = batch_size;
+    }
+    lua_pop(L, 1);
+
     // Buffer sizes are handled by tcpd_config_from_lua_table() in base config
     // No separate UDP buffer handling needed - eliminates field conflicts
 
@@ -253,6 +267,7 @@ int udpd_config_copy(udpd_config_t *dest, const udpd_config_t *src) {
     dest->multicast_ttl = src->multicast_ttl;
     dest->reuse_addr = src->reuse_addr;
     dest->reuse_port = src->reuse_port;
+    dest->batch_size = src->batch_size;
 
     // Copy allocated strings
     if (src->multicast_group) {
@@ -2,6 +2,7 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
 // Helper function to push UDP connection object to Lua stack from weak table
 void udpd_push_connection_object(lua_State *co, udpd_base_conn_t *conn) {
@@ -18,11 +19,261 @@ void udpd_push_connection_object(lua_State *co, udpd_base_conn_t *conn) {
 // 8 MB stack (pthread_create with NULL attr), so 64 KB here is safe.
 #define UDPD_RECV_BUFFER_SIZE 65536
 
+// Receive slots for onread_batch mode. One slot per datagram, each sized
+// for the largest UDP payload so batching never truncates where the
+// single-datagram path would not.
+//
+// Every datagram is copied into a Lua string before the callback runs, so
+// the slots are only busy inside one read callback. Connections dispatched
+// by the same event base therefore share one set per thread, grown to the
+// largest batch_size seen there, instead of each reserving its own.
+struct udpd_batch {
+    int capacity;
+    char *buffers;  // capacity * UDPD_RECV_BUFFER_SIZE
+    size_t *lens;
+    struct sockaddr_storage *addrs;
+    socklen_t *addrlens;
+#ifdef __linux__
+    struct iovec *iov;
+    struct mmsghdr *msgs;
+#endif
+};
+
+static void udpd_batch_free(struct udpd_batch *batch) {
+    if (!batch) return;
+    free(batch->buffers);
+    free(batch->lens);
+    free(batch->addrs);
+    free(batch->addrlens);
+#ifdef __linux__
+    free(batch->iov);
+    free(batch->msgs);
+#endif
+    free(batch);
+}
+
+static struct udpd_batch *udpd_batch_new(int capacity) {
+    struct udpd_batch *batch = calloc(1, sizeof(struct udpd_batch));
+    if (!batch) return NULL;
+
+    batch->capacity = capacity;
+    batch->buffers = malloc((size_t)capacity * UDPD_RECV_BUFFER_SIZE);
+    batch->lens = calloc(capacity, sizeof(size_t));
+    batch->addrs = calloc(capacity, sizeof(struct sockaddr_storage));
+    batch->addrlens = calloc(capacity, sizeof(socklen_t));
+#ifdef __linux__
+    batch->iov = calloc(capacity, sizeof(struct iovec));
+    batch->msgs = calloc(capacity, sizeof(struct mmsghdr));
+    if (!batch->iov || !batch->msgs) {
+        udpd_batch_free(batch);
+        return NULL;
+    }
+#endif
+    if (!batch->buffers || !batch->lens || !batch->addrs || !batch->addrlens) {
+        udpd_batch_free(batch);
+        return NULL;
+    }
+    return batch;
+}
+
+static _Thread_local struct udpd_batch *shared_batch;
+
+// Return this thread's receive slots with room for at least `capacity`
+// datagrams, or NULL on allocation failure.
+static struct udpd_batch *udpd_batch_get(int capacity) {
+    if (shared_batch && shared_batch->capacity >= capacity) {
+        return shared_batch;
+    }
+
+    struct udpd_batch *batch = udpd_batch_new(capacity);
+    if (!batch) {
+        return NULL;
+    }
+    udpd_batch_free(shared_batch);
+    shared_batch = batch;
+    return batch;
+}
+
+// Pull up to `want` datagrams without blocking. Returns the number
+// received, or -1 with errno set if nothing could be read.
+static int udpd_batch_receive(evutil_socket_t fd, struct udpd_batch *batch, int want) {
+    int count = 0;
+
+#ifdef __linux__
+    for (int i = 0; i < want; i++) {
+        batch->iov[i].iov_base = batch->buffers + (size_t)i * UDPD_RECV_BUFFER_SIZE;
+        batch->iov[i].iov_len = UDPD_RECV_BUFFER_SIZE;
+        memset(&batch->msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+        batch->msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+        batch->msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+        batch->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    }
+
+    count = recvmmsg(fd, batch->msgs, want, MSG_DONTWAIT, NULL);
+    if (count < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (batch->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            LOGE("UDP packet truncated to %d bytes\n", UDPD_RECV_BUFFER_SIZE);
+        }
+        batch->lens[i] = batch->msgs[i].msg_len;
+        batch->addrlens[i] = batch->msgs[i].msg_hdr.msg_namelen;
+    }
+#else
+    // No recvmmsg: drain with recvfrom, same batching semantics.
+    for (; count < want; count++) {
+        char *buffer = batch->buffers + (size_t)count * UDPD_RECV_BUFFER_SIZE;
+        batch->addrlens[count] = sizeof(struct sockaddr_storage);
+        ssize_t len = recvfrom(fd, buffer, UDPD_RECV_BUFFER_SIZE, 0,
+                               (struct sockaddr *)&batch->addrs[count], &batch->addrlens[count]);
+        if (len < 0) {
+            if (count == 0) {
+                return -1;
+            }
+            break;
+        }
+        batch->lens[count] = (size_t)len;
+    }
+#endif
+
+    return count;
+}
+
+// Push the dest object for `addr`, reusing the one already handed out for
+// this peer if Lua still holds it. `cache` is the absolute index of the
+// connection's weak-valued intern table.
+static void udpd_push_interned_dest(lua_State *co, int cache,
+                                    const struct sockaddr_storage *addr, socklen_t addrlen) {
+    lua_pushlstring(co, (const char *)addr, addrlen);
+    lua_pushvalue(co, -1);
+    lua_rawget(co, cache);
+    if (lua_isuserdata(co, -1)) {
+        lua_remove(co, -2);  // drop key
+        return;
+    }
+    lua_pop(co, 1);
+
+    udpd_dest_t *dest = lua_newuserdata(co, sizeof(udpd_dest_t));
+    luaL_getmetatable(co, LUA_UDPD_DEST_TYPE);
+    lua_setmetatable(co, -2);
+
+    memcpy(&dest->addr, addr, addrlen);
+    dest->addrlen = addrlen;
+    dest->host = NULL;  // Will be resolved on demand
+    dest->port = udpd_dest_get_port(dest);
+
+    lua_pushvalue(co, -1);
+    lua_insert(co, -3);       // dest, key, dest
+    lua_rawset(co, cache);    // cache[key] = dest
+}
+
+// Push the connection's dest intern table, creating it on first use.
+static void udpd_push_dest_cache(lua_State *co, udpd_base_conn_t *conn) {
+    if (conn->destCacheRef != LUA_NOREF) {
+        lua_rawgeti(co, LUA_REGISTRYINDEX, conn->destCacheRef);
+        if (lua_istable(co, -1)) {
+            return;
+        }
+        lua_pop(co, 1);
+    }
+
+    lua_newtable(co);
+    lua_newtable(co);
+    lua_pushliteral(co, "v");
+    lua_setfield(co, -2, "__mode");
+    lua_setmetatable(co, -2);
+
+    lua_pushvalue(co, -1);
+    conn->destCacheRef = luaL_ref(co, LUA_REGISTRYINDEX);
+}
+
+// Deliver `count` received datagrams to onread_batch as two parallel
+// arrays: packets[i] (string) and dests[i] (UDP_AddrInfo).
+static void udpd_process_received_batch(udpd_base_conn_t *conn, struct udpd_batch *batch, int count) {
+    lua_State *mainthread = conn->mainthread;
+    lua_lock(mainthread);
+    fan_cb_setup_t cbs = fan_cb_setup(mainthread, conn->onReadBatchRef);
+    if (!cbs.co) {
+        lua_unlock(mainthread);
+        return;
+    }
+
+    // Guard: verify the registry slot still holds a function
+    if (!lua_isfunction(cbs.co, -1)) {
+        LOGE("udpd_process_received_batch: onReadBatchRef=%d resolved to %s, expected function\n",
+             conn->onReadBatchRef, luaL_typename(cbs.co, -1));
+        lua_pop(cbs.co, 1);
+        lua_unlock(mainthread);
+        FAN_CB_CLEANUP(mainthread, cbs);
+        return;
+    }
+
+    int argc = 0;
+    // Check if callback_self_first is enabled
+    if (conn->config.base.callback_self_first) {
+        udpd_push_connection_object(cbs.co, conn);
+        argc++;
+    }
+
+    lua_createtable(cbs.co, count, 0);
+    int packets = lua_gettop(cbs.co);
+    lua_createtable(cbs.co, count, 0);
+    int dests = lua_gettop(cbs.co);
+    udpd_push_dest_cache(cbs.co, conn);
+    int cache = lua_gettop(cbs.co);
+
+    for (int i = 0; i < count; i++) {
+        lua_pushlstring(cbs.co, batch->buffers + (size_t)i * UDPD_RECV_BUFFER_SIZE, batch->lens[i]);
+        lua_rawseti(cbs.co, packets, i + 1);
+        udpd_push_interned_dest(cbs.co, cache, &batch->addrs[i], batch->addrlens[i]);
+        lua_rawseti(cbs.co, dests, i + 1);
+    }
+    lua_pop(cbs.co, 1);  // cache
+    argc += 2;
+
+    lua_unlock(mainthread);
+    FAN_RESUME(cbs.co, mainthread, argc);
+    FAN_CB_CLEANUP(mainthread, cbs);
+}
+
+static void udpd_batch_readcb(evutil_socket_t fd, udpd_base_conn_t *conn) {
+    int want = conn->config.batch_size > 0 ? conn->config.batch_size : UDPD_DEFAULT_BATCH_SIZE;
+    struct udpd_batch *batch = udpd_batch_get(want);
+    if (!batch) {
+        LOGE("UDP batch allocation failed on fd %d\n", fd);
+        return;
+    }
+
+    int count = udpd_batch_receive(fd, batch, want);
+    if (count < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            udpd_handle_read_error(conn, errno);
+        }
+        return;
+    }
+
+    if (count > 0) {
+        udpd_process_received_batch(conn, batch, count);
+    }
+}
+
 // Common read callback for UDP connections
 void udpd_common_readcb(evutil_socket_t fd, short what, void *ctx) {
     udpd_base_conn_t *conn = (udpd_base_conn_t *)ctx;
 
-    if (!conn || conn->onReadRef == LUA_NOREF) {
+    if (!conn) {
+        return;
+    }
+
+    if (conn->onReadBatchRef != LUA_NOREF) {
+        udpd_batch_readcb(fd, conn);
+        return;
+    }
+
+    if (conn->onReadRef == LUA_NOREF) {
         return;
     }
 
@@ -190,6 +441,8 @@ int udpd_base_conn_init(udpd_base_conn_t *conn, udpd_conn_type_t type, lua_State
     conn->mainthread = L;
     conn->onReadRef = LUA_NOREF;
     conn->onSendReadyRef = LUA_NOREF;
+    conn->onReadBatchRef = LUA_NOREF;
+    conn->destCacheRef = LUA_NOREF;
 
     // Initialize configuration
     udpd_config_init(&conn->config);
@@ -233,6 +486,8 @@ void udpd_base_conn_cleanup(udpd_base_conn_t *conn) {
     if (conn->mainthread) {
         CLEAR_REF(conn->mainthread, conn->onReadRef);
         CLEAR_REF(conn->mainthread, conn->onSendReadyRef);
+        CLEAR_REF(conn->mainthread, conn->onReadBatchRef);
+        CLEAR_REF(conn->mainthread, conn->destCacheRef);
 
         // Clean up REF_STATE reference
         REF_STATE_CLEAR(conn);
@@ -300,6 +555,15 @@ int udpd_base_conn_set_callbacks(udpd_base_conn_t *conn, lua_State *L, int table
         conn->onReadRef = LUA_NOREF;
     }
 
+    // Set onread_batch callback (takes precedence over onread)
+    lua_getfield(L, table_index, "onread_batch");
+    if (lua_type(L, -1) == LUA_TFUNCTION) {
+        conn->onReadBatchRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    } else {
+        lua_pop(L, 1);
+        conn->onReadBatchRef = LUA_NOREF;
+    }
+
     // Set onsendready callback
     lua_getfield(L, table_index, "onsendready");
     if (lua_type(L, -1) == LUA_TFUNCTION) {
@@ -451,7 +715,7 @@ int udpd_base_conn_setup_events(udpd_base_conn_t *conn) {
     pthread_mutex_lock(&conn->event_mutex);
 
     // Set up read event if callback is registered
-    if (conn->onReadRef != LUA_NOREF) {
+    if (conn->onReadRef != LUA_NOREF || conn->onReadBatchRef != LUA_NOREF) {
         conn->read_ev = event_new(ev_base, conn->socket_fd,
                                  EV_READ | EV_PERSIST, udpd_common_readcb, conn);
         if (!conn->read_ev) {
@@ -0,0 +1,350 @@
+// websocket_deflate.c — permessage-deflate negotiation and per-message (de)compression
+
+#include "websocket_deflate.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+// Every compressed message ends in an empty stored block that the sender
+// strips and the receiver appends back (RFC 7692 section 7.2.1).
+static const unsigned char ws_deflate_tail[4] = {0x00, 0x00, 0xff, 0xff};
+
+typedef struct {
+    z_stream strm;
+    int ready;
+    int level;
+    int window_bits;
+} ws_zstream_t;
+
+struct ws_deflate {
+    ws_deflate_params_t params;
+    int level;
+    size_t threshold;
+    size_t max_message_size;
+    ws_zstream_t deflater;  // used with server context takeover
+    ws_zstream_t inflater;  // used with client context takeover
+};
+
+// Per-thread streams for connections that reset their context per message.
+static _Thread_local ws_zstream_t shared_deflater;
+static _Thread_local ws_zstream_t shared_inflater;
+
+void ws_deflate_config_init(ws_deflate_config_t *config) {
+    config->level = Z_DEFAULT_COMPRESSION;
+    config->context_takeover = 1;
+    config->client_context_takeover = 1;
+    config->max_window_bits = 15;
+    config->threshold = WS_DEFLATE_DEFAULT_THRESHOLD;
+    config->max_message_size = WS_DEFLATE_DEFAULT_MAX_MESSAGE;
+}
+
+// ============================================================
+// Negotiation
+// ============================================================
+
+static const char *ws_skip_space(const char *p, const char *end) {
+    while (p < end && isspace((unsigned char)*p)) p++;
+    return p;
+}
+
+static size_t ws_trim_len(const char *p, const char *end) {
+    while (end > p && isspace((unsigned char)end[-1])) end--;
+    return (size_t)(end - p);
+}
+
+static int ws_token_is(const char *p, size_t len, const char *name) {
+    return strlen(name) == len && strncasecmp(p, name, len) == 0;
+}
+
+// Parse a window-bits value, optionally quoted; returns -1 if invalid.
+static int ws_parse_window_bits(const char *p, size_t len) {
+    if (len >= 2 && p[0] == '"' && p[len - 1] == '"') {
+        p++;
+        len -= 2;
+    }
+    if (len == 0 || len > 2) return -1;
+    int value = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!isdigit((unsigned char)p[i])) return -1;
+        value = value * 10 + (p[i] - '0');
+    }
+    return (value >= 8 && value <= 15) ? value : -1;
+}
+
+// Evaluate one offer ("permessage-deflate; param; param=value").
+static int ws_deflate_accept_offer(const char *p, const char *end, const ws_deflate_config_t *config,
+                                   ws_deflate_params_t *params) {
+    const char *semi = memchr(p, ';', (size_t)(end - p));
+    const char *name_end = semi ? semi : end;
+    p = ws_skip_space(p, name_end);
+    if (!ws_token_is(p, ws_trim_len(p, name_end), WS_DEFLATE_EXTENSION)) {
+        return 0;
+    }
+
+    params->server_no_context_takeover = !config->context_takeover;
+    params->client_no_context_takeover = !config->client_context_takeover;
+    params->server_max_window_bits = config->max_window_bits;
+
+    int seen_snct = 0, seen_cnct = 0, seen_smwb = 0, seen_cmwb = 0;
+
+    while (semi) {
+        p = semi + 1;
+        semi = memchr(p, ';', (size_t)(end - p));
+        const char *param_end = semi ? semi : end;
+
+        p = ws_skip_space(p, param_end);
+        const char *eq = memchr(p, '=', (size_t)(param_end - p));
+        size_t key_len = ws_trim_len(p, eq ? eq : param_end);
+        const char *value = NULL;
+        size_t value_len = 0;
+        if (eq) {
+            value = ws_skip_space(eq + 1, param_end);
+            value_len = ws_trim_len(value, param_end);
+        }
+
+        if (ws_token_is(p, key_len, "server_no_context_takeover")) {
+            if (seen_snct++ || value) return 0;
+            params->server_no_context_takeover = 1;
+        } else if (ws_token_is(p, key_len, "client_no_context_takeover")) {
+            if (seen_cnct++ || value) return 0;
+            params->client_no_context_takeover = 1;
+        } else if (ws_token_is(p, key_len, "server_max_window_bits")) {
+            int bits = value ? ws_parse_window_bits(value, value_len) : -1;
+            // zlib cannot produce a raw stream limited to a 256 byte window.
+            if (seen_smwb++ || bits < 9) return 0;
+            if (bits < params->server_max_window_bits) {
+                params->server_max_window_bits = bits;
+            }
+        } else if (ws_token_is(p, key_len, "client_max_window_bits")) {
+            // We always inflate with a full window, so any client limit works.
+            if (seen_cmwb++ || (value && ws_parse_window_bits(value, value_len) < 0)) return 0;
+        } else {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int ws_deflate_negotiate(const char *offers, const ws_deflate_config_t *config,
+                         ws_deflate_params_t *params, char *response, size_t response_len) {
+    if (!offers) return 0;
+
+    const char *p = offers;
+    const char *end = offers + strlen(offers);
+    while (p < end) {
+        const char *comma = memchr(p, ',', (size_t)(end - p));
+        const char *offer_end = comma ? comma : end;
+
+        if (ws_deflate_accept_offer(p, offer_end, config, params)) {
+            int n = snprintf(response, response_len, "%s%s%s", WS_DEFLATE_EXTENSION,
+                             params->server_no_context_takeover ? "; server_no_context_takeover" : "",
+                             params->client_no_context_takeover ? "; client_no_context_takeover" : "");
+            if (params->server_max_window_bits < 15 && n > 0 && (size_t)n < response_len) {
+                snprintf(response + n, response_len - n, "; server_max_window_bits=%d",
+                         params->server_max_window_bits);
+            }
+            return 1;
+        }
+
+        p = comma ? comma + 1 : end;
+    }
+
+    return 0;
+}
+
+// ============================================================
+// zlib streams
+// ============================================================
+
+static z_stream *ws_deflater_get(ws_deflate_t *ws) {
+    ws_zstream_t *z = ws->params.server_no_context_takeover ? &shared_deflater : &ws->deflater;
+    int window_bits = ws->params.server_max_window_bits;
+
+    if (z->ready && (z->level != ws->level || z->window_bits != window_bits)) {
+        deflateEnd(&z->strm);
+        z->ready = 0;
+    }
+    if (!z->ready) {
+        memset(&z->strm, 0, sizeof(z->strm));
+        if (deflateInit2(&z->strm, ws->level, Z_DEFLATED, -window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return NULL;
+        }
+        z->ready = 1;
+        z->level = ws->level;
+        z->window_bits = window_bits;
+    }
+    return &z->strm;
+}
+
+static z_stream *ws_inflater_get(ws_deflate_t *ws) {
+    ws_zstream_t *z = ws->params.client_no_context_takeover ? &shared_inflater : &ws->inflater;
+    if (!z->ready) {
+        memset(&z->strm, 0, sizeof(z->strm));
+        if (inflateInit2(&z->strm, -15) != Z_OK) {
+            return NULL;
+        }
+        z->ready = 1;
+        z->window_bits = 15;
+    }
+    return &z->strm;
+}
+
+ws_deflate_t *ws_deflate_new(const ws_deflate_config_t *config, const ws_deflate_params_t *params) {
+    ws_deflate_t *ws = calloc(1, sizeof(ws_deflate_t));
+    if (!ws) return NULL;
+
+    ws->params = *params;
+    ws->level = config->level;
+    ws->threshold = config->threshold;
+    ws->max_message_size = config->max_message_size;
+    return ws;
+}
+
+void ws_deflate_free(ws_deflate_t *ws) {
+    if (!ws) return;
+    if (ws->deflater.ready) deflateEnd(&ws->deflater.strm);
+    if (ws->inflater.ready) inflateEnd(&ws->inflater.strm);
+    free(ws);
+}
+
+int ws_deflate_wants(const ws_deflate_t *ws, size_t len) {
+    return ws && len >= ws->threshold;
+}
+
+int ws_deflate_share_key(const ws_deflate_t *ws) {
+    if (!ws->params.server_no_context_takeover) {
+        return -1;
+    }
+    return (ws->level + 1) * 16 + ws->params.server_max_window_bits;
+}
+
+// ============================================================
+// Compression
+// ============================================================
+
+int ws_deflate_compress(ws_deflate_t *ws, const char *data, size_t len,
+                        char **out, size_t *out_len) {
+    z_stream *strm = ws_deflater_get(ws);
+    if (!strm) return -1;
+
+    size_t cap = deflateBound(strm, (uLong)len) + 16;
+    char *buf = malloc(cap);
+    if (!buf) return -1;
+
+    strm->next_in = (Bytef *)data;
+    strm->avail_in = (uInt)len;
+    size_t produced = 0;
+    int rc;
+
+    do {
+        if (produced == cap) {
+            char *grown = realloc(buf, cap * 2);
+            if (!grown) {
+                free(buf);
+                return -1;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+        strm->next_out = (Bytef *)buf + produced;
+        strm->avail_out = (uInt)(cap - produced);
+        rc = deflate(strm, Z_SYNC_FLUSH);
+        produced = cap - strm->avail_out;
+    } while (rc == Z_OK && (strm->avail_in > 0 || strm->avail_out == 0));
+
+    int no_takeover = ws->params.server_no_context_takeover;
+    if (no_takeover) {
+        deflateReset(strm);
+    }
+
+    if ((rc != Z_OK && rc != Z_BUF_ERROR) || produced < sizeof(ws_deflate_tail) ||
+        memcmp(buf + produced - sizeof(ws_deflate_tail), ws_deflate_tail, sizeof(ws_deflate_tail)) != 0) {
+        free(buf);
+        return -1;
+    }
+    produced -= sizeof(ws_deflate_tail);
+
+    // Without context takeover nothing depends on this message, so an
+    // incompressible one can go out as-is. With takeover the peer must see
+    // exactly what our window saw.
+    if (no_takeover && produced >= len) {
+        free(buf);
+        return 0;
+    }
+
+    *out = buf;
+    *out_len = produced;
+    return 1;
+}
+
+// ============================================================
+// Decompression
+// ============================================================
+
+static int ws_inflate_chunk(z_stream *strm, const char *data, size_t len, char **buf,
+                            size_t *cap, size_t *produced, size_t limit) {
+    strm->next_in = (Bytef *)data;
+    strm->avail_in = (uInt)len;
+
+    for (;;) {
+        if (*produced == *cap) {
+            if (*cap >= limit) return -1;
+            size_t grown_cap = *cap * 2 > limit ? limit : *cap * 2;
+            char *grown = realloc(*buf, grown_cap);
+            if (!grown) return -1;
+            *buf = grown;
+            *cap = grown_cap;
+        }
+        strm->next_out = (Bytef *)*buf + *produced;
+        strm->avail_out = (uInt)(*cap - *produced);
+        int rc = inflate(strm, Z_SYNC_FLUSH);
+        *produced = *cap - strm->avail_out;
+
+        if (rc == Z_STREAM_END) {
+            // The peer closed its stream with a final block; whatever
+            // follows starts a fresh one.
+            inflateReset(strm);
+            if (strm->avail_in == 0) return 0;
+            continue;
+        }
+        if (rc != Z_OK && rc != Z_BUF_ERROR) return -1;
+        if (strm->avail_out > 0) return 0;  // input consumed, output flushed
+    }
+}
+
+int ws_deflate_decompress(ws_deflate_t *ws, const char *data, size_t len,
+                          char **out, size_t *out_len) {
+    z_stream *strm = ws_inflater_get(ws);
+    if (!strm) return -1;
+
+    size_t limit = ws->max_message_size;
+    size_t cap = len * 4 + 64;
+    if (cap > limit) cap = limit;
+    char *buf = malloc(cap);
+    if (!buf) return -1;
+
+    size_t produced = 0;
+    int rc = ws_inflate_chunk(strm, data, len, &buf, &cap, &produced, limit);
+    if (rc == 0) {
+        rc = ws_inflate_chunk(strm, (const char *)ws_deflate_tail, sizeof(ws_deflate_tail),
+                              &buf, &cap, &produced, limit);
+    }
+
+    // A failed stream has an unknown window; start the next message clean.
+    if (rc < 0 || ws->params.client_no_context_takeover) {
+        inflateReset(strm);
+    }
+
+    if (rc < 0) {
+        free(buf);
+        return -1;
+    }
+
+    *out = buf;
+    *out_len = produced;
+    return 0;
+}
@@ -0,0 +1,68 @@
+#ifndef WEBSOCKET_DEFLATE_H
+#define WEBSOCKET_DEFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// WebSocket permessage-deflate (RFC 7692).
+//
+// A connection that keeps its compression context between messages owns
+// its own z_streams. With no context takeover every message starts from an
+// empty window, so the streams are reset per message and shared by all
+// connections on the same thread instead.
+
+#define WS_DEFLATE_EXTENSION "permessage-deflate"
+#define WS_DEFLATE_DEFAULT_THRESHOLD 64
+#define WS_DEFLATE_DEFAULT_MAX_MESSAGE (16 * 1024 * 1024)
+
+typedef struct {
+    int level;                    // zlib level, -1 for Z_DEFAULT_COMPRESSION
+    int context_takeover;         // server keeps its LZ77 window between messages
+    int client_context_takeover;  // ask the client to keep its window (0 = request reset)
+    int max_window_bits;          // server window, 9..15
+    size_t threshold;             // smaller messages are sent uncompressed
+    size_t max_message_size;      // inflate limit per message
+} ws_deflate_config_t;
+
+// Parameters agreed with the peer.
+typedef struct {
+    int server_no_context_takeover;
+    int client_no_context_takeover;
+    int server_max_window_bits;
+} ws_deflate_params_t;
+
+typedef struct ws_deflate ws_deflate_t;
+
+void ws_deflate_config_init(ws_deflate_config_t *config);
+
+// Pick the first acceptable offer in one Sec-WebSocket-Extensions header
+// value. On success fills `params`, writes the response header value into
+// `response` and returns 1; returns 0 if no offer can be accepted.
+int ws_deflate_negotiate(const char *offers, const ws_deflate_config_t *config,
+                         ws_deflate_params_t *params, char *response, size_t response_len);
+
+ws_deflate_t *ws_deflate_new(const ws_deflate_config_t *config, const ws_deflate_params_t *params);
+void ws_deflate_free(ws_deflate_t *ws);
+
+// Whether a message of `len` bytes should be compressed.
+int ws_deflate_wants(const ws_deflate_t *ws, size_t len);
+
+// Connections whose deflate returns the same non-negative key produce
+// identical output for the same message (no context takeover, same level
+// and window), so one compressed frame can be shared between them.
+// Returns -1 for contexts that carry history between messages.
+int ws_deflate_share_key(const ws_deflate_t *ws);
+
+// Compress one whole message. On success returns 1 with a malloc'd
+// payload in `out` (caller frees), or 0 if the message should go out
+// uncompressed after all. Returns -1 on zlib failure.
+int ws_deflate_compress(ws_deflate_t *ws, const char *data, size_t len,
+                        char **out, size_t *out_len);
+
+// Inflate one whole message (all fragments joined). Returns 0 with a
+// malloc'd payload in `out`, or -1 on corrupt input or when the result
+// exceeds max_message_size.
+int ws_deflate_decompress(ws_deflate_t *ws, const char *data, size_t len,
+                          char **out, size_t *out_len);
+
+#endif // WEBSOCKET_DEFLATE_H
@@ -0,0 +1,143 @@
+// websocket_mask.c — WebSocket payload mask/unmask kernels with runtime dispatch
+
+#include "websocket_mask.h"
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WEBSOCKET_MASK_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define WEBSOCKET_MASK_NEON 1
+#endif
+
+// Reference implementation, one byte at a time.
+static void websocket_mask_scalar(uint8_t *data, size_t len, uint32_t mask_key) {
+    const uint8_t *mask_bytes = (const uint8_t *)&mask_key;
+    for (size_t i = 0; i < len; i++) {
+        data[i] ^= mask_bytes[i & 3];
+    }
+}
+
+// Eight bytes per step. Every vector kernel finishes its tail here; callers
+// always pass a 4-byte-aligned offset into the payload, so the mask phase
+// is unchanged. memcpy keeps the loads legal for unaligned payloads and
+// compiles down to plain moves.
+static void websocket_mask_word(uint8_t *data, size_t len, uint32_t mask_key) {
+    uint64_t mask64 = ((uint64_t)mask_key << 32) | mask_key;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        word ^= mask64;
+        memcpy(data + i, &word, 8);
+    }
+
+    websocket_mask_scalar(data + i, len - i, mask_key);
+}
+
+#ifdef WEBSOCKET_MASK_X86
+__attribute__((target("sse2")))
+static void websocket_mask_sse2(uint8_t *data, size_t len, uint32_t mask_key) {
+    const __m128i mask = _mm_set1_epi32((int)mask_key);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        _mm_storeu_si128((__m128i *)(data + i), _mm_xor_si128(v, mask));
+    }
+
+    websocket_mask_word(data + i, len - i, mask_key);
+}
+
+__attribute__((target("avx2")))
+static void websocket_mask_avx2(uint8_t *data, size_t len, uint32_t mask_key) {
+    const __m256i mask = _mm256_set1_epi32((int)mask_key);
+    size_t i = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(data + i + 32));
+        _mm256_storeu_si256((__m256i *)(data + i), _mm256_xor_si256(a, mask));
+        _mm256_storeu_si256((__m256i *)(data + i + 32), _mm256_xor_si256(b, mask));
+    }
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        _mm256_storeu_si256((__m256i *)(data + i), _mm256_xor_si256(v, mask));
+    }
+
+    websocket_mask_word(data + i, len - i, mask_key);
+}
+#endif
+
+#ifdef WEBSOCKET_MASK_NEON
+static void websocket_mask_neon(uint8_t *data, size_t len, uint32_t mask_key) {
+    const uint8x16_t mask = vreinterpretq_u8_u32(vdupq_n_u32(mask_key));
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        vst1q_u8(data + i, veorq_u8(vld1q_u8(data + i), mask));
+    }
+
+    websocket_mask_word(data + i, len - i, mask_key);
+}
+#endif
+
+static websocket_mask_kernel_t kernels[4];
+static int kernel_count = 0;
+static websocket_mask_fn selected = websocket_mask_scalar;
+static const char *selected_name = "scalar";
+static pthread_once_t probe_once = PTHREAD_ONCE_INIT;
+
+static void websocket_mask_add_kernel(const char *name, websocket_mask_fn fn) {
+    kernels[kernel_count].name = name;
+    kernels[kernel_count].fn = fn;
+    kernel_count++;
+}
+
+// Kernels are registered slowest first; the last one usable wins.
+static void websocket_mask_probe(void) {
+    websocket_mask_add_kernel("scalar", websocket_mask_scalar);
+    websocket_mask_add_kernel("word", websocket_mask_word);
+#ifdef WEBSOCKET_MASK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        websocket_mask_add_kernel("sse2", websocket_mask_sse2);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        websocket_mask_add_kernel("avx2", websocket_mask_avx2);
+    }
+#endif
+#ifdef WEBSOCKET_MASK_NEON
+    websocket_mask_add_kernel("neon", websocket_mask_neon);
+#endif
+
+    selected = kernels[kernel_count - 1].fn;
+    selected_name = kernels[kernel_count - 1].name;
+}
+
+void websocket_mask(uint8_t *data, size_t len, uint32_t mask_key) {
+    // Short control frames: dispatch overhead outweighs any vector win.
+    if (len < 16) {
+        websocket_mask_scalar(data, len, mask_key);
+        return;
+    }
+
+    pthread_once(&probe_once, websocket_mask_probe);
+    selected(data, len, mask_key);
+}
+
+const char *websocket_mask_kernel_name(void) {
+    pthread_once(&probe_once, websocket_mask_probe);
+    return selected_name;
+}
+
+const websocket_mask_kernel_t *websocket_mask_kernels(int *count) {
+    pthread_once(&probe_once, websocket_mask_probe);
+    if (count) {
+        *count = kernel_count;
+    }
+    return kernels;
+}
@@ -0,0 +1,28 @@
+#ifndef WEBSOCKET_MASK_H
+#define WEBSOCKET_MASK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// WebSocket payload masking (RFC 6455 section 5.3).
+//
+// `mask_key` holds the four masking-key bytes in wire order (memcpy'd from
+// the frame header), so the same call masks and unmasks. The best kernel
+// for the running CPU is picked on first use.
+
+typedef void (*websocket_mask_fn)(uint8_t *data, size_t len, uint32_t mask_key);
+
+typedef struct {
+    const char *name;
+    websocket_mask_fn fn;
+} websocket_mask_kernel_t;
+
+void websocket_mask(uint8_t *data, size_t len, uint32_t mask_key);
+
+// Name of the kernel websocket_mask dispatches to ("avx2", "sse2", ...).
+const char *websocket_mask_kernel_name(void);
+
+// Every kernel usable on this CPU, scalar first; for tests and benchmarks.
+const websocket_mask_kernel_t *websocket_mask_kernels(int *count);
+
+#endif // WEBSOCKET_MASK_H
@@ -82,6 +82,21 @@ extern test_suite_t luafan_suite;
 extern void luafan_setup(void);
 extern void luafan_teardown(void);
 
+// From test_websocket_mask.c
+extern test_suite_t websocket_mask_suite;
+extern void websocket_mask_setup(void);
+extern void websocket_mask_teardown(void);
+
+// From test_websocket_deflate.c
+extern test_suite_t websocket_deflate_suite;
+extern void websocket_deflate_setup(void);
+extern void websocket_deflate_teardown(void);
+
+// From test_shmring.c
+extern test_suite_t shmring_suite;
+extern void shmring_setup(void);
+extern void shmring_teardown(void);
+
 
 /* Main function to run all test suites */
 int main(void) {
@@ -134,6 +149,15 @@ int main(void) {
     luafan_suite.setup = luafan_setup;
     luafan_suite.teardown = luafan_teardown;
 
+    websocket_mask_suite.setup = websocket_mask_setup;
+    websocket_mask_suite.teardown = websocket_mask_teardown;
+
+    websocket_deflate_suite.setup = websocket_deflate_setup;
+    websocket_deflate_suite.teardown = websocket_deflate_teardown;
+
+    shmring_suite.setup = shmring_setup;
+    shmring_suite.teardown = shmring_teardown;
+
     // Create array of all test suites
     test_suite_t* suites[] = {
         &bytearray_suite,
@@ -151,11 +175,14 @@ int main(void) {
         &fifo_suite,
         &luamariadb_suite,
         &luafan_posix_suite,
-        &luafan_suite
+        &luafan_suite,
+        &websocket_mask_suite,
+        &websocket_deflate_suite,
+        &shmring_suite
     };
 
     // Run all tests
-    int failures = run_all_tests(suites, 16);
+    int failures = run_all_tests(suites, 19);
 
     return failures > 0 ? 1 : 0;
 }
\ No newline at end of file
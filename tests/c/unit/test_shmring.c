@@ -0,0 +1,170 @@
+#include "test_framework.h"
+#include "shmring.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Test the shared-memory SPSC ring behind fan.shmring: framing across the
+ * wrap point, full/oversized pushes, the sleep/wake handshake, and one
+ * producer/consumer pair across fork().
+ */
+
+// Copy the message returned by shmring_peek into out, return its length
+static size_t read_message(shmring_t *ring, char *out) {
+    const void *p1, *p2;
+    size_t n1, n2;
+    if (shmring_peek(ring, &p1, &n1, &p2, &n2) != 1) {
+        return (size_t)-1;
+    }
+    memcpy(out, p1, n1);
+    if (n2) {
+        memcpy(out + n1, p2, n2);
+    }
+    shmring_pop(ring);
+    return n1 + n2;
+}
+
+// Test capacity rounding and the size limits of push
+TEST_CASE(test_shmring_capacity) {
+    shmring_t *ring = shmring_create(5000);
+    TEST_ASSERT_NOT_NULL(ring);
+    TEST_ASSERT_EQUAL(8192, (int)shmring_capacity(ring));
+    TEST_ASSERT_EQUAL(8188, (int)shmring_max_message(ring));
+
+    static char big[8192];
+    int wake = 0;
+    TEST_ASSERT_EQUAL(-1, shmring_push(ring, big, 8189, &wake));
+    TEST_ASSERT_EQUAL(1, shmring_push(ring, big, 8188, &wake));
+    TEST_ASSERT_EQUAL(0, shmring_push(ring, "", 0, &wake));
+    shmring_destroy(ring);
+
+    ring = shmring_create(1);
+    TEST_ASSERT_NOT_NULL(ring);
+    TEST_ASSERT_EQUAL(4096, (int)shmring_capacity(ring));
+    shmring_destroy(ring);
+}
+
+// Test messages come back intact and in order while the positions wrap
+TEST_CASE(test_shmring_wraparound) {
+    shmring_t *ring = shmring_create(4096);
+    TEST_ASSERT_NOT_NULL(ring);
+
+    char msg[1500], out[1500];
+    int wake = 0;
+    int wrapped = 0;
+    for (int i = 0; i < 200; i++) {
+        size_t len = (size_t)(i * 97) % sizeof(msg);
+        for (size_t k = 0; k < len; k++) {
+            msg[k] = (char)(i + k);
+        }
+        TEST_ASSERT_EQUAL(1, shmring_push(ring, msg, len, &wake));
+
+        const void *p1, *p2;
+        size_t n1, n2;
+        TEST_ASSERT_EQUAL(1, shmring_peek(ring, &p1, &n1, &p2, &n2));
+        if (n2) {
+            wrapped++;
+        }
+        TEST_ASSERT_EQUAL((int)len, (int)read_message(ring, out));
+        TEST_ASSERT_TRUE(memcmp(msg, out, len) == 0);
+    }
+    TEST_ASSERT_TRUE(wrapped > 0);
+
+    const void *p1, *p2;
+    size_t n1, n2;
+    TEST_ASSERT_EQUAL(0, shmring_peek(ring, &p1, &n1, &p2, &n2));
+    shmring_destroy(ring);
+}
+
+// Test a push wakes the consumer only after it declared it is sleeping
+TEST_CASE(test_shmring_sleep_wake) {
+    shmring_t *ring = shmring_create(4096);
+    TEST_ASSERT_NOT_NULL(ring);
+    char out[16];
+    int wake = 0;
+
+    TEST_ASSERT_EQUAL(1, shmring_push(ring, "a", 1, &wake));
+    TEST_ASSERT_EQUAL(0, wake);
+
+    // Not allowed to sleep while a message is queued.
+    TEST_ASSERT_EQUAL(0, shmring_sleep(ring));
+    TEST_ASSERT_EQUAL(1, (int)read_message(ring, out));
+    TEST_ASSERT_EQUAL(1, shmring_sleep(ring));
+
+    TEST_ASSERT_EQUAL(1, shmring_push(ring, "b", 1, &wake));
+    TEST_ASSERT_EQUAL(1, wake);
+    TEST_ASSERT_EQUAL(1, shmring_push(ring, "c", 1, &wake));
+    TEST_ASSERT_EQUAL(0, wake);
+    shmring_destroy(ring);
+}
+
+// Test a child process consumes what the parent produces
+TEST_CASE(test_shmring_across_fork) {
+    shmring_t *ring = shmring_create(4096);
+    TEST_ASSERT_NOT_NULL(ring);
+    const int count = 20000;
+
+    pid_t pid = fork();
+    TEST_ASSERT_TRUE(pid >= 0);
+    if (pid == 0) {
+        int expect = 0;
+        char out[64];
+        while (expect < count) {
+            size_t len = read_message(ring, out);
+            if (len == (size_t)-1) {
+                usleep(100);
+                continue;
+            }
+            int value;
+            if (len != sizeof(value)) {
+                _exit(2);
+            }
+            memcpy(&value, out, sizeof(value));
+            if (value != expect) {
+                _exit(3);
+            }
+            expect++;
+        }
+        _exit(0);
+    }
+
+    int wake = 0;
+    for (int i = 0; i < count;) {
+        int rc = shmring_push(ring, &i, sizeof(i), &wake);
+        if (rc == 1) {
+            i++;
+        } else {
+            usleep(100);
+        }
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    TEST_ASSERT_TRUE(WIFEXITED(status));
+    TEST_ASSERT_EQUAL(0, WEXITSTATUS(status));
+    shmring_destroy(ring);
+}
+
+TEST_SUITE_BEGIN(shmring)
+    TEST_SUITE_ADD(test_shmring_capacity)
+    TEST_SUITE_ADD(test_shmring_wraparound)
+    TEST_SUITE_ADD(test_shmring_sleep_wake)
+    TEST_SUITE_ADD(test_shmring_across_fork)
+TEST_SUITE_END(shmring)
+
+TEST_SUITE_ADD_NAME(test_shmring_capacity)
+TEST_SUITE_ADD_NAME(test_shmring_wraparound)
+TEST_SUITE_ADD_NAME(test_shmring_sleep_wake)
+TEST_SUITE_ADD_NAME(test_shmring_across_fork)
+
+TEST_SUITE_FINISH(shmring)
+
+/* Test suite setup/teardown functions */
+void shmring_setup(void) {
+    printf("Setting up shmring test suite...\n");
+}
+
+void shmring_teardown(void) {
+    printf("Tearing down shmring test suite...\n");
+}
@@ -0,0 +1,149 @@
+#include "test_framework.h"
+#include "websocket_deflate.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Test permessage-deflate negotiation and per-message (de)compression */
+
+// Test offer parsing and the negotiated response header
+TEST_CASE(test_websocket_deflate_negotiate) {
+    ws_deflate_config_t config;
+    ws_deflate_params_t params;
+    char response[128];
+    ws_deflate_config_init(&config);
+
+    TEST_ASSERT_EQUAL(1, ws_deflate_negotiate("permessage-deflate", &config, &params,
+                                              response, sizeof(response)));
+    TEST_ASSERT_STRING_EQUAL("permessage-deflate", response);
+    TEST_ASSERT_EQUAL(0, params.server_no_context_takeover);
+
+    TEST_ASSERT_EQUAL(1, ws_deflate_negotiate("x-webkit-deflate-frame, permessage-deflate; "
+                                              "server_no_context_takeover; client_max_window_bits",
+                                              &config, &params, response, sizeof(response)));
+    TEST_ASSERT_STRING_EQUAL("permessage-deflate; server_no_context_takeover", response);
+    TEST_ASSERT_EQUAL(1, params.server_no_context_takeover);
+
+    TEST_ASSERT_EQUAL(1, ws_deflate_negotiate("permessage-deflate; server_max_window_bits=\"10\"",
+                                              &config, &params, response, sizeof(response)));
+    TEST_ASSERT_EQUAL(10, params.server_max_window_bits);
+    TEST_ASSERT_STRING_EQUAL("permessage-deflate; server_max_window_bits=10", response);
+
+    // A window zlib cannot honour falls through to the next offer.
+    TEST_ASSERT_EQUAL(1, ws_deflate_negotiate("permessage-deflate; server_max_window_bits=8, permessage-deflate",
+                                              &config, &params, response, sizeof(response)));
+    TEST_ASSERT_EQUAL(15, params.server_max_window_bits);
+
+    TEST_ASSERT_EQUAL(0, ws_deflate_negotiate("permessage-deflate; unknown_param", &config, &params,
+                                              response, sizeof(response)));
+    TEST_ASSERT_EQUAL(0, ws_deflate_negotiate("permessage-deflate; server_no_context_takeover; "
+                                              "server_no_context_takeover",
+                                              &config, &params, response, sizeof(response)));
+    TEST_ASSERT_EQUAL(0, ws_deflate_negotiate("", &config, &params, response, sizeof(response)));
+    TEST_ASSERT_EQUAL(0, ws_deflate_negotiate(NULL, &config, &params, response, sizeof(response)));
+
+    // Server-side configuration always shows up in the response.
+    config.context_takeover = 0;
+    config.client_context_takeover = 0;
+    TEST_ASSERT_EQUAL(1, ws_deflate_negotiate("permessage-deflate", &config, &params,
+                                              response, sizeof(response)));
+    TEST_ASSERT_STRING_EQUAL("permessage-deflate; server_no_context_takeover; client_no_context_takeover",
+                             response);
+}
+
+// Test compress/decompress round trips, with and without context takeover
+TEST_CASE(test_websocket_deflate_roundtrip) {
+    ws_deflate_config_t config;
+    ws_deflate_config_init(&config);
+
+    for (int takeover = 0; takeover <= 1; takeover++) {
+        ws_deflate_params_t params = {!takeover, !takeover, 15};
+        ws_deflate_t *sender = ws_deflate_new(&config, &params);
+        ws_deflate_t *receiver = ws_deflate_new(&config, &params);
+        TEST_ASSERT_NOT_NULL(sender);
+        TEST_ASSERT_NOT_NULL(receiver);
+
+        char message[2048];
+        for (size_t i = 0; i < sizeof(message); i++) {
+            message[i] = "{\"key\": \"value\"}, "[i % 18];
+        }
+
+        size_t first_len = 0;
+        for (int round = 0; round < 3; round++) {
+            char *packed = NULL, *plain = NULL;
+            size_t packed_len = 0, plain_len = 0;
+
+            TEST_ASSERT_EQUAL(1, ws_deflate_compress(sender, message, sizeof(message), &packed, &packed_len));
+            TEST_ASSERT_TRUE(packed_len < sizeof(message));
+            if (round == 0) {
+                first_len = packed_len;
+            } else if (takeover) {
+                TEST_ASSERT_TRUE(packed_len < first_len);
+            } else {
+                TEST_ASSERT_EQUAL(first_len, packed_len);
+            }
+
+            TEST_ASSERT_EQUAL(0, ws_deflate_decompress(receiver, packed, packed_len, &plain, &plain_len));
+            TEST_ASSERT_EQUAL(sizeof(message), plain_len);
+            TEST_ASSERT_TRUE(plain && memcmp(plain, message, sizeof(message)) == 0);
+            free(packed);
+            free(plain);
+        }
+
+        ws_deflate_free(sender);
+        ws_deflate_free(receiver);
+    }
+}
+
+// Test the inflate size limit and corrupt input
+TEST_CASE(test_websocket_deflate_limits) {
+    ws_deflate_config_t config;
+    ws_deflate_config_init(&config);
+    ws_deflate_params_t params = {1, 1, 15};
+    ws_deflate_t *sender = ws_deflate_new(&config, &params);
+
+    config.max_message_size = 1000;
+    ws_deflate_t *receiver = ws_deflate_new(&config, &params);
+
+    char zeros[4096];
+    memset(zeros, 0, sizeof(zeros));
+    char *packed = NULL, *plain = NULL;
+    size_t packed_len = 0, plain_len = 0;
+
+    TEST_ASSERT_EQUAL(1, ws_deflate_compress(sender, zeros, sizeof(zeros), &packed, &packed_len));
+    TEST_ASSERT_EQUAL(-1, ws_deflate_decompress(receiver, packed, packed_len, &plain, &plain_len));
+    free(packed);
+
+    const char garbage[] = "\xff\xff\xff\xff\xff";
+    TEST_ASSERT_EQUAL(-1, ws_deflate_decompress(receiver, garbage, sizeof(garbage) - 1, &plain, &plain_len));
+
+    // The stream recovers for the next message.
+    TEST_ASSERT_EQUAL(0, ws_deflate_decompress(receiver, "\xf2\x48\xcd\xc9\xc9\x07\x00", 7, &plain, &plain_len));
+    TEST_ASSERT_EQUAL(5, plain_len);
+    TEST_ASSERT_TRUE(memcmp(plain, "Hello", 5) == 0);
+    free(plain);
+
+    ws_deflate_free(sender);
+    ws_deflate_free(receiver);
+}
+
+TEST_SUITE_BEGIN(websocket_deflate)
+    TEST_SUITE_ADD(test_websocket_deflate_negotiate)
+    TEST_SUITE_ADD(test_websocket_deflate_roundtrip)
+    TEST_SUITE_ADD(test_websocket_deflate_limits)
+TEST_SUITE_END(websocket_deflate)
+
+TEST_SUITE_ADD_NAME(test_websocket_deflate_negotiate)
+TEST_SUITE_ADD_NAME(test_websocket_deflate_roundtrip)
+TEST_SUITE_ADD_NAME(test_websocket_deflate_limits)
+
+TEST_SUITE_FINISH(websocket_deflate)
+
+/* Test suite setup/teardown functions */
+void websocket_deflate_setup(void) {
+    printf("Setting up websocket deflate test suite...\n");
+}
+
+void websocket_deflate_teardown(void) {
+    printf("Tearing down websocket deflate test suite...\n");
+}
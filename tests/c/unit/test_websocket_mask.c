@@ -0,0 +1,144 @@
+#include "test_framework.h"
+#include "websocket_mask.h"
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Test WebSocket mask kernels against the RFC 6455 byte-wise definition,
+ * plus a throughput comparison across payload sizes.
+ */
+
+static double get_time_microseconds() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+static void reference_mask(uint8_t *data, size_t len, const uint8_t key[4]) {
+    for (size_t i = 0; i < len; i++) {
+        data[i] ^= key[i % 4];
+    }
+}
+
+// Test the scalar kernel is always available and dispatch picks a kernel
+TEST_CASE(test_websocket_mask_kernel_list) {
+    int count = 0;
+    const websocket_mask_kernel_t *kernels = websocket_mask_kernels(&count);
+
+    TEST_ASSERT_NOT_NULL(kernels);
+    TEST_ASSERT_TRUE(count >= 2);
+    TEST_ASSERT_STRING_EQUAL("scalar", kernels[0].name);
+    TEST_ASSERT_NOT_NULL(websocket_mask_kernel_name());
+    TEST_ASSERT_STRING_EQUAL(kernels[count - 1].name, websocket_mask_kernel_name());
+}
+
+// Test every kernel matches the reference for all lengths and alignments
+TEST_CASE(test_websocket_mask_matches_reference) {
+    const uint8_t key[4] = {0x37, 0xfa, 0x21, 0x3d};
+    uint32_t mask_key;
+    memcpy(&mask_key, key, 4);
+
+    uint8_t source[300];
+    for (size_t i = 0; i < sizeof(source); i++) {
+        source[i] = (uint8_t)(i * 131 + 7);
+    }
+
+    int count = 0;
+    const websocket_mask_kernel_t *kernels = websocket_mask_kernels(&count);
+
+    for (int k = 0; k < count; k++) {
+        for (size_t offset = 0; offset < 8; offset++) {
+            for (size_t len = 0; len + offset <= sizeof(source); len += (len < 80 ? 1 : 37)) {
+                uint8_t expected[300];
+                uint8_t actual[300];
+                memcpy(expected, source, sizeof(source));
+                memcpy(actual, source, sizeof(source));
+
+                reference_mask(expected + offset, len, key);
+                kernels[k].fn(actual + offset, len, mask_key);
+
+                int same = memcmp(expected, actual, sizeof(source)) == 0;
+                TEST_ASSERT(same, "kernel %s mismatch at offset=%zu len=%zu", kernels[k].name, offset, len);
+                if (!same) {
+                    return;
+                }
+            }
+        }
+    }
+}
+
+// Test masking twice restores the payload through the dispatcher
+TEST_CASE(test_websocket_mask_roundtrip) {
+    const char *text = "Hello, WebSocket! This payload is long enough to reach the vector path.";
+    size_t len = strlen(text);
+    uint8_t buf[128];
+    memcpy(buf, text, len);
+
+    websocket_mask(buf, len, 0xdeadbeef);
+    TEST_ASSERT_TRUE(memcmp(buf, text, len) != 0);
+    websocket_mask(buf, len, 0xdeadbeef);
+    TEST_ASSERT_TRUE(memcmp(buf, text, len) == 0);
+
+    // RFC 6455 5.7 example: masked "Hello"
+    uint8_t hello[] = {0x7f, 0x9f, 0x4d, 0x51, 0x58};
+    const uint8_t key[4] = {0x37, 0xfa, 0x21, 0x3d};
+    uint32_t mask_key;
+    memcpy(&mask_key, key, 4);
+    websocket_mask(hello, sizeof(hello), mask_key);
+    TEST_ASSERT_TRUE(memcmp(hello, "Hello", 5) == 0);
+}
+
+// Benchmark every kernel across payload sizes
+TEST_CASE(benchmark_websocket_mask_kernels) {
+    static const size_t sizes[] = {64, 1024, 64 * 1024, 4 * 1024 * 1024};
+    const size_t total_bytes = 64 * 1024 * 1024;
+
+    uint8_t *buf = malloc(sizes[3] + 1);
+    TEST_ASSERT_NOT_NULL(buf);
+    memset(buf, 0x5a, sizes[3] + 1);
+
+    int count = 0;
+    const websocket_mask_kernel_t *kernels = websocket_mask_kernels(&count);
+
+    printf("\n=== WEBSOCKET MASK THROUGHPUT (dispatch: %s) ===\n", websocket_mask_kernel_name());
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t iterations = total_bytes / sizes[s];
+        for (int k = 0; k < count; k++) {
+            // Offset by one byte so unaligned payloads are what we measure.
+            double start = get_time_microseconds();
+            for (size_t i = 0; i < iterations; i++) {
+                kernels[k].fn(buf + 1, sizes[s], 0x3d21fa37);
+            }
+            double time_us = get_time_microseconds() - start;
+            double mb_per_sec = (double)(iterations * sizes[s]) / (1024 * 1024) / (time_us / 1000000.0);
+            printf("%8zu bytes  %-7s %10.2f MB/sec\n", sizes[s], kernels[k].name, mb_per_sec);
+        }
+    }
+    printf("=====================================================\n\n");
+
+    free(buf);
+}
+
+TEST_SUITE_BEGIN(websocket_mask)
+    TEST_SUITE_ADD(test_websocket_mask_kernel_list)
+    TEST_SUITE_ADD(test_websocket_mask_matches_reference)
+    TEST_SUITE_ADD(test_websocket_mask_roundtrip)
+    TEST_SUITE_ADD(benchmark_websocket_mask_kernels)
+TEST_SUITE_END(websocket_mask)
+
+TEST_SUITE_ADD_NAME(test_websocket_mask_kernel_list)
+TEST_SUITE_ADD_NAME(test_websocket_mask_matches_reference)
+TEST_SUITE_ADD_NAME(test_websocket_mask_roundtrip)
+TEST_SUITE_ADD_NAME(benchmark_websocket_mask_kernels)
+
+TEST_SUITE_FINISH(websocket_mask)
+
+/* Test suite setup/teardown functions */
+void websocket_mask_setup(void) {
+    printf("Setting up websocket mask test suite...\n");
+}
+
+void websocket_mask_teardown(void) {
+    printf("Tearing down websocket mask test suite...\n");
+}
@@ -175,6 +175,32 @@ local test_files = {
     "test_reliable_udp.lua",                -- Reliable UDP transport data structures
     "test_httpd_comprehensive.lua",        -- Comprehensive httpd tests (request/response/keepalive/WebSocket)
     "test_http_client.lua",                -- HTTP client tests with local httpd (creates server, ASan leak)
+    "test_tcpd_buffer_view.lua",            -- tcpd buffer_view zero-copy read mode
+    "test_fan_shard.lua",                   -- Per-worker Lua shards with message passing
+    "test_tcpd_reuseport.lua",              -- SO_REUSEPORT listeners per worker
+    "test_udpd_recv_batch.lua",             -- Batched UDP receive (onread_batch)
+    "test_udpd_send_batch.lua",             -- Batched UDP send (send_batch/send_gso)
+    "test_httpd_websocket_deflate.lua",     -- WebSocket permessage-deflate
+    "test_httpd_websocket_broadcast.lua",   -- WebSocket broadcast with shared frames
+    "test_httpd_reuseport.lua",             -- Per-worker evhttp instances (reuseport_shards)
+    "test_httpd_body_stream.lua",           -- req:body_chunks()/body_to_file() and max_body_size
+    "test_httpd_reply_file.lua",            -- req:reply_file() in the core and Lua httpd
+    "test_httpd_router.lua",                -- Segment trie router
+    "test_httpd_router_performance.lua",    -- Router benchmark (trie vs pattern)
+    "test_httpd_metrics.lua",               -- Metrics endpoint and latency histograms
+    "test_http_http2.lua",                  -- HTTP/2 multiplexing (skips without nghttpd)
+    "test_http_pool.lua",                   -- Pooled curl easy handles
+    "test_http_body.lua",                   -- Chunk-list bodies, body_stream and max_body_size
+    "test_http_output_file.lua",            -- Downloads to output_file with resume
+    "test_json_decoder.lua",                -- json.decoder() incremental decoding
+    "test_json_performance.lua",            -- JSON encode/decode benchmark
+    "test_json_encode_to.lua",              -- json.encode_to() into httpd/tcpd/stream targets
+    "test_worker_shmring.lua",              -- Shared-memory rings for fan.worker
+    "test_worker_loadbalance.lua",          -- fan.worker load balancing policies
+    "test_worker_map.lua",                  -- master:map() batching
+    "test_objectbuf_schema.lua",            -- objectbuf.schema fixed-shape messages
+    "test_objectbuf_arena.lua",             -- objectbuf encode arena and golden bytes
+    "test_objectbuf_performance.lua",       -- objectbuf encode/decode benchmark
     -- Add more test files here as they are completed
 }
 
@@ -0,0 +1,153 @@
+#!/usr/bin/env lua
+
+-- Test per-worker Lua shards (fan.shard)
+-- Boots one Lua state per worker, exchanges messages with them, checks
+-- that tcpd.bind{shard=true} hands accepted connections to the shards and
+-- that shard.stop shuts them down so they can be started again.
+
+local TestFramework = require('test_framework')
+
+local fan = require "fan"
+_G.fan = fan
+local tcpd = require "fan.tcpd"
+local shard = require "fan.shard"
+
+local SHARD_SCRIPT = [[
+local shard = require "fan.shard"
+local id, count = ...
+
+shard.onmessage(function(from, data)
+    shard.send(from, string.format("pong:%d:%s", shard.id(), data))
+end)
+
+shard.onaccept(function(apt)
+    apt:bind {
+        onread = function(buf)
+            apt:send(string.format("shard%d:%s", id, buf))
+        end
+    }
+end)
+
+shard.send(0, string.format("ready:%d:%d", id, count))
+]]
+
+local script_path = os.tmpname()
+local f = assert(io.open(script_path, "w"))
+f:write(SHARD_SCRIPT)
+f:close()
+
+local function wait_for(cond, timeout)
+    local waited = 0
+    while not cond() and waited < timeout do
+        fan.sleep(0.05)
+        waited = waited + 0.05
+    end
+    return cond()
+end
+
+local suite = TestFramework.create_suite("Shard Tests")
+
+suite:set_teardown(function()
+    shard.stop()
+    os.remove(script_path)
+end)
+
+suite:test("main_state_is_shard_zero", TestFramework.async_test(function()
+    TestFramework.assert_equal(shard.id(), 0, "main state should be shard 0")
+    TestFramework.assert_false(pcall(tcpd.bind, {host = "127.0.0.1", port = 0, shard = true}),
+        "tcpd.bind{shard=true} should fail before shard.start")
+end))
+
+suite:test("start_exchange_and_accept", TestFramework.async_test(function()
+    local ready = {}
+    local pongs = {}
+
+    shard.onmessage(function(from, data)
+        local kind, rest = data:match("^(%a+):(.*)$")
+        if kind == "ready" then
+            ready[from] = rest
+        elseif kind == "pong" then
+            pongs[from] = rest
+        end
+    end)
+
+    if shard.count() > 0 then
+        TestFramework.skip_test("shards already started in this process")
+    end
+
+    local count = shard.start {script = script_path, workers = 2}
+    TestFramework.assert_equal(count, 2, "shard.start return value")
+    TestFramework.assert_equal(shard.count(), 2)
+
+    TestFramework.assert_true(wait_for(function() return ready[1] and ready[2] end, 3),
+        "shards did not report ready")
+    TestFramework.assert_equal(ready[1], "1:2")
+    TestFramework.assert_equal(ready[2], "2:2")
+
+    shard.send(1, "a")
+    shard.send(2, "b")
+    TestFramework.assert_false(shard.send(3, "c"), "send to a missing shard should return false")
+
+    TestFramework.assert_true(wait_for(function() return pongs[1] and pongs[2] end, 3),
+        "shards did not answer messages")
+    TestFramework.assert_equal(pongs[1], "1:a")
+    TestFramework.assert_equal(pongs[2], "2:b")
+
+    local server = tcpd.bind {host = "127.0.0.1", port = 0, shard = true}
+    local port = server:localinfo().port
+
+    local replies = {}
+    local clients = {}
+    for i = 1, 2 do
+        clients[i] = tcpd.connect {
+            host = "127.0.0.1",
+            port = port,
+            onconnected = function()
+                clients[i]:send("hi" .. i)
+            end,
+            onread = function(buf)
+                replies[i] = buf
+            end
+        }
+    end
+
+    wait_for(function() return replies[1] and replies[2] end, 3)
+
+    for i = 1, 2 do
+        clients[i]:close()
+    end
+    server:close()
+
+    local seen = {}
+    for i = 1, 2 do
+        local sid, payload = tostring(replies[i]):match("^shard(%d+):(.*)$")
+        TestFramework.assert_equal(payload, "hi" .. i, "reply " .. i .. ": " .. tostring(replies[i]))
+        seen[sid] = true
+    end
+    TestFramework.assert_true(seen["1"] and seen["2"], "connections were not spread across shards")
+end))
+
+suite:test("stop_then_start_again", TestFramework.async_test(function()
+    local ready = {}
+    shard.onmessage(function(from, data)
+        if data:match("^ready:") then
+            ready[from] = true
+        end
+    end)
+
+    shard.stop()
+    TestFramework.assert_equal(shard.count(), 0, "no shards after stop")
+    TestFramework.assert_false(shard.send(1, "x"), "send to a stopped shard should return false")
+
+    TestFramework.assert_equal(shard.start {script = script_path, workers = 2}, 2, "restart")
+    TestFramework.assert_true(wait_for(function() return ready[1] and ready[2] end, 3),
+        "restarted shards did not report ready")
+
+    -- Stop while the workers are running: each shard closes on its thread.
+    shard.stop()
+    TestFramework.assert_equal(shard.count(), 0, "no shards after the second stop")
+    TestFramework.assert_false(shard.send(2, "x"))
+end))
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
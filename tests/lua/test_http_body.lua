@@ -0,0 +1,80 @@
+#!/usr/bin/env lua
+
+-- Test response body collection in fan.http.core
+-- Covers single- and multi-chunk bodies, body_stream and max_body_size for
+-- replies with and without Content-Length.
+
+local TestFramework = require('test_framework')
+
+local fan = require "fan"
+_G.fan = fan
+local httpd = require "fan.httpd.core"
+local http = require "fan.http.core"
+
+local BIG = string.rep("0123456789abcdef", 12800) -- 200KB, several chunks
+
+local suite = TestFramework.create_suite("HTTP response body Tests")
+
+local server = nil
+
+local function url(path)
+    return string.format("http://127.0.0.1:%d%s", server.port, path)
+end
+
+suite:set_setup(function()
+    server = httpd.bind {
+        host = "127.0.0.1",
+        port = 0,
+        onService = function(req, resp)
+            if req.path == "/small" then
+                resp:reply(200, "OK", "small body")
+            elseif req.path == "/big" then
+                resp:reply(200, "OK", BIG)
+            elseif req.path == "/chunked" then
+                resp:reply_start(200, "OK")
+                for i = 1, 10 do
+                    resp:reply_chunk(BIG:sub(1, 10000))
+                end
+                resp:reply_end()
+            else
+                resp:reply(404, "Not Found", "")
+            end
+        end
+    }
+end)
+
+suite:test("collect_bodies", TestFramework.async_test(function()
+    local small = http.get(url("/small"))
+    local big = http.get(url("/big"))
+    local chunked = http.get(url("/chunked"))
+    TestFramework.assert_equal(small.body, "small body")
+    TestFramework.assert_true(big.body == BIG, "big body length " .. #(big.body or ""))
+    TestFramework.assert_equal(#(chunked.body or ""), 100000, "chunked body length")
+end))
+
+suite:test("body_stream", TestFramework.async_test(function()
+    local resp = http.get {url = url("/big"), body_stream = true}
+    local stream = resp.body
+    TestFramework.assert_type(stream, "userdata")
+    TestFramework.assert_equal(stream:available(), #BIG)
+    TestFramework.assert_equal(stream:GetBytes(16), "0123456789abcdef")
+    TestFramework.assert_equal(stream:available(), #BIG - 16)
+end))
+
+suite:test("max_body_size_with_content_length", TestFramework.async_test(function()
+    local resp = http.get {url = url("/big"), max_body_size = 1000}
+    TestFramework.assert_equal(resp.error, "response body exceeds max_body_size")
+    TestFramework.assert_nil(resp.body)
+end))
+
+suite:test("max_body_size_chunked", TestFramework.async_test(function()
+    local resp = http.get {url = url("/chunked"), max_body_size = 50000}
+    TestFramework.assert_equal(resp.error, "response body exceeds max_body_size")
+
+    resp = http.get {url = url("/chunked"), max_body_size = 100000}
+    TestFramework.assert_nil(resp.error, "body at the limit rejected")
+    TestFramework.assert_equal(#(resp.body or ""), 100000)
+end))
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
@@ -0,0 +1,132 @@
+#!/usr/bin/env lua
+
+-- Test HTTP/2 multiplexing in fan.http.core
+-- Runs concurrent h2 requests against a local nghttpd (TLS with a throwaway
+-- self-signed certificate) and checks that they all share one connection.
+-- Skipped when nghttpd (nghttp2) or openssl is not installed.
+
+local TestFramework = require('test_framework')
+
+local fan = require "fan"
+_G.fan = fan
+local http = require "fan.http.core"
+
+local REQUESTS = 8
+
+local suite = TestFramework.create_suite("HTTP/2 multiplexing Tests")
+
+local function sh(cmd)
+    -- os.execute returns 0 on Lua 5.1 and true on 5.2+.
+    local ok = os.execute(cmd)
+    return ok == true or ok == 0
+end
+
+local available = sh("command -v nghttpd >/dev/null 2>&1") and sh("command -v openssl >/dev/null 2>&1")
+
+local root = os.tmpname()
+os.remove(root)
+local port = 20000 + (os.time() % 20000)
+local pidfile = root .. "/nghttpd.pid"
+local key, cert = root .. "/key.pem", root .. "/cert.pem"
+
+local function url(path)
+    return string.format("https://127.0.0.1:%d%s", port, path)
+end
+
+suite:set_setup(function()
+    if not available then
+        return
+    end
+    os.execute("mkdir -p " .. root)
+    local f = assert(io.open(root .. "/data.txt", "wb"))
+    f:write(string.rep("h2 payload\n", 1000))
+    f:close()
+
+    sh(string.format("openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=127.0.0.1 -keyout %s -out %s >/dev/null 2>&1",
+        key, cert))
+    os.execute(string.format("nghttpd -d %s %d %s %s >/dev/null 2>&1 & echo $! > %s", root, port, key, cert, pidfile))
+end)
+
+suite:set_teardown(function()
+    if not available then
+        return
+    end
+    local pf = io.open(pidfile, "r")
+    local pid = pf and pf:read("*l")
+    if pf then
+        pf:close()
+    end
+    if pid then
+        os.execute("kill " .. pid .. " 2>/dev/null")
+    end
+    os.execute("rm -rf " .. root)
+end)
+
+-- Issue `count` requests at once; returns the response tables.
+local function burst(count)
+    local responses = {}
+    local done = 0
+    for i = 1, count do
+        http.get {
+            url = url("/data.txt?n=" .. i),
+            http2 = true,
+            cainfo = cert,
+            ssl_verifyhost = 0,
+            oncomplete = function(resp)
+                responses[i] = resp
+                done = done + 1
+            end
+        }
+    end
+    local waited = 0
+    while done < count and waited < 5 do
+        fan.sleep(0.05)
+        waited = waited + 0.05
+    end
+    return responses, done
+end
+
+suite:test("server_ready", TestFramework.async_test(function()
+    if not available then
+        TestFramework.skip_test("nghttpd or openssl not found")
+    end
+
+    -- Wait for nghttpd to listen. forbid_reuse closes the probe's
+    -- connection so the next test starts without one to reuse.
+    local resp
+    for _ = 1, 40 do
+        resp = http.get {url = url("/data.txt"), http2 = true, cainfo = cert, ssl_verifyhost = 0, forbid_reuse = 1}
+        if resp.responseCode == 200 then
+            break
+        end
+        fan.sleep(0.05)
+    end
+    TestFramework.assert_equal(resp.responseCode, 200, "nghttpd did not start: " .. tostring(resp.error))
+    TestFramework.assert_equal(resp.http_version, 2)
+end))
+
+-- Without a host connection cap, only PIPEWAIT keeps the burst from
+-- opening a connection per request: exactly one connect is expected.
+suite:test("concurrent_requests_share_one_connection", TestFramework.async_test(function()
+    if not available then
+        TestFramework.skip_test("nghttpd or openssl not found")
+    end
+
+    http.multiplex {max_concurrent_streams = 100, max_host_connections = 0}
+    local responses, done = burst(REQUESTS)
+    TestFramework.assert_equal(done, REQUESTS, "requests completed")
+
+    local connects = 0
+    for i = 1, REQUESTS do
+        local resp = responses[i]
+        TestFramework.assert_equal(resp.responseCode, 200,
+            string.format("request %d failed: %s", i, tostring(resp.error)))
+        TestFramework.assert_equal(#(resp.body or ""), 11000, "request " .. i .. " body")
+        TestFramework.assert_equal(resp.http_version, 2, "request " .. i .. " HTTP version")
+        connects = connects + resp.num_connects
+    end
+    TestFramework.assert_equal(connects, 1, "connections opened for " .. REQUESTS .. " multiplexed requests")
+end))
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
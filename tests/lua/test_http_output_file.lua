@@ -0,0 +1,133 @@
+#!/usr/bin/env lua
+
+-- Test http.get{output_file=} in fan.http.core
+-- Downloads to a file, resumes a partial file with Range, restarts when the
+-- server ignores the range, keeps error bodies out of the file and throttles
+-- onprogress.
+
+local TestFramework = require('test_framework')
+
+local fan = require "fan"
+_G.fan = fan
+local httpd = require "fan.httpd.core"
+local http = require "fan.http.core"
+
+local SIZE = 300 * 1024
+local parts = {}
+for i = 1, SIZE / 16 do
+    parts[i] = string.format("%015d\n", i)
+end
+local DATA = table.concat(parts)
+
+local source = os.tmpname()
+local target = os.tmpname()
+
+local function write_file(path, data)
+    local f = assert(io.open(path, "wb"))
+    f:write(data)
+    f:close()
+end
+
+local function read_file(path)
+    local f = io.open(path, "rb")
+    if not f then
+        return nil
+    end
+    local data = f:read("*a")
+    f:close()
+    return data
+end
+
+local suite = TestFramework.create_suite("HTTP output_file Tests")
+
+local server = nil
+
+local function url(path)
+    return string.format("http://127.0.0.1:%d%s", server.port, path)
+end
+
+suite:set_setup(function()
+    write_file(source, DATA)
+    server = httpd.bind {
+        host = "127.0.0.1",
+        port = 0,
+        onService = function(req, resp)
+            if req.path == "/file" then
+                resp:reply_file(200, source)
+            elseif req.path == "/norange" then
+                resp:reply(200, "OK", DATA)
+            else
+                resp:reply(404, "Not Found", "missing")
+            end
+        end
+    }
+end)
+
+suite:set_teardown(function()
+    os.remove(source)
+    os.remove(target)
+end)
+
+suite:test("plain_download", TestFramework.async_test(function()
+    local resp = http.get {url = url("/file"), output_file = target}
+    TestFramework.assert_equal(resp.responseCode, 200, "download: " .. tostring(resp.error))
+    TestFramework.assert_nil(resp.error)
+    TestFramework.assert_nil(resp.body, "body must go to the file only")
+    TestFramework.assert_true(read_file(target) == DATA, "downloaded file differs")
+end))
+
+-- Resume a partial file; progress is reported against the whole file.
+suite:test("resume_with_throttled_progress", TestFramework.async_test(function()
+    write_file(target, DATA:sub(1, 100 * 1024))
+    local calls, last_now, last_total = 0, 0, 0
+    local resp = http.get {
+        url = url("/file"),
+        output_file = target,
+        resume = true,
+        progress_interval = 10,
+        onprogress = function(dltotal, dlnow)
+            calls = calls + 1
+            last_now, last_total = dlnow, dltotal
+        end
+    }
+    TestFramework.assert_equal(resp.responseCode, 206, "resume: " .. tostring(resp.error))
+    TestFramework.assert_nil(resp.error)
+    TestFramework.assert_equal(resp.resumed_from, 100 * 1024)
+    TestFramework.assert_true(read_file(target) == DATA, "resumed file differs")
+    TestFramework.assert_true(calls <= 3, "onprogress not throttled: " .. calls .. " calls")
+    TestFramework.assert_equal(last_now, SIZE, "final dlnow")
+    TestFramework.assert_equal(last_total, SIZE, "final dltotal")
+end))
+
+-- A server that ignores Range answers 200: the file starts over.
+suite:test("restart_when_range_ignored", TestFramework.async_test(function()
+    write_file(target, "stale partial content")
+    local resp = http.get {url = url("/norange"), output_file = target, resume = true}
+    TestFramework.assert_equal(resp.responseCode, 200, "norange: " .. tostring(resp.error))
+    TestFramework.assert_nil(resp.error)
+    TestFramework.assert_nil(resp.resumed_from)
+    TestFramework.assert_true(read_file(target) == DATA, "file not restarted when range was ignored")
+end))
+
+-- Error bodies do not touch the file.
+suite:test("error_body_not_written", TestFramework.async_test(function()
+    write_file(target, DATA)
+    local resp = http.get {url = url("/missing"), output_file = target, resume = true}
+    TestFramework.assert_equal(resp.responseCode, 404)
+    TestFramework.assert_equal(resp.body, "missing")
+    TestFramework.assert_true(read_file(target) == DATA, "404 response changed the file")
+end))
+
+suite:test("max_body_size", TestFramework.async_test(function()
+    local resp = http.get {url = url("/file"), output_file = target, max_body_size = 1024}
+    TestFramework.assert_equal(resp.error, "response body exceeds max_body_size")
+end))
+
+suite:test("unwritable_output_file", TestFramework.async_test(function()
+    TestFramework.assert_error(function()
+        http.get {url = url("/file"), output_file = "/nonexistent/dir/file"}
+    end, "output_file")
+end))
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
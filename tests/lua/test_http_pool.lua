@@ -0,0 +1,93 @@
+#!/usr/bin/env lua
+
+-- Test the easy-handle pool of fan.http.core
+-- Sequential requests reuse one pooled handle; options set by one request
+-- (method, body, headers, cookies, timeouts) must not leak into the next.
+
+local TestFramework = require('test_framework')
+
+local fan = require "fan"
+_G.fan = fan
+local httpd = require "fan.httpd.core"
+local http = require "fan.http.core"
+
+local suite = TestFramework.create_suite("HTTP handle pool Tests")
+
+local server = nil
+
+local function url(path)
+    return string.format("http://127.0.0.1:%d%s", server.port, path)
+end
+
+suite:set_setup(function()
+    server = httpd.bind {
+        host = "127.0.0.1",
+        port = 0,
+        onService = function(req, resp)
+            if req.path == "/cookie" then
+                resp:addheader("Set-Cookie", "session=abc; Path=/")
+            end
+            local body = req.body or ""
+            resp:reply(200, "OK", string.format("%s|%d|%s|%s", req.method, #body,
+                tostring(req.headers["X-Test"]), tostring(req.headers["Cookie"])))
+        end
+    }
+end)
+
+suite:set_teardown(function()
+    http.pool {max_idle = 32}
+end)
+
+suite:test("options_do_not_leak_between_requests", TestFramework.async_test(function()
+    -- Start from an empty pool so the idle count only reflects this test.
+    http.pool {max_idle = 0}
+    http.pool {max_idle = 4}
+    local before = http.pool_stats()
+
+    -- request table and expected echoed "method|body length|X-Test|Cookie".
+    local steps = {
+        {http.post, {url = url("/"), body = "hello", headers = {["X-Test"] = "1"}}, "POST|5|1|nil"},
+        {http.get, {url = url("/")}, "GET|0|nil|nil"},
+        {http.head, {url = url("/")}, nil},
+        {http.get, {url = url("/cookie"), timeout = 3, conntimeout = 3}, "GET|0|nil|nil"},
+        {http.get, {url = url("/")}, "GET|0|nil|nil"},
+        {http.put, {url = url("/"), body = "abc"}, "PUT|3|nil|nil"},
+        {http.delete, {url = url("/")}, "DELETE|0|nil|nil"},
+        {http.get, {url = url("/")}, "GET|0|nil|nil"},
+    }
+
+    for i, step in ipairs(steps) do
+        local resp = step[1](step[2])
+        TestFramework.assert_equal(resp.responseCode, 200,
+            string.format("step %d: %s", i, tostring(resp.error)))
+        if step[3] then
+            TestFramework.assert_equal(resp.body, step[3], "step " .. i)
+        else
+            TestFramework.assert_nil(resp.body, string.format("step %d: HEAD returned a body", i))
+        end
+    end
+
+    local stats = http.pool_stats()
+    local hits = stats.hits - before.hits
+    TestFramework.assert_true(hits >= #steps - 1,
+        string.format("only %d of %d requests reused a pooled handle", hits, #steps))
+    TestFramework.assert_equal(stats.idle, 1, "idle handles")
+    TestFramework.assert_true(stats.hit_rate > 0 and stats.hit_rate <= 1, "hit_rate " .. stats.hit_rate)
+end))
+
+-- Shrinking the pool frees idle handles; 0 disables reuse.
+suite:test("max_idle_zero_disables_reuse", TestFramework.async_test(function()
+    http.pool {max_idle = 0}
+    local stats = http.pool_stats()
+    local resp = http.get(url("/"))
+    local after = http.pool_stats()
+
+    TestFramework.assert_equal(stats.idle, 0, "pool not trimmed")
+    TestFramework.assert_equal(after.idle, 0, "handle kept with pooling disabled")
+    TestFramework.assert_equal(resp.responseCode, 200)
+    TestFramework.assert_equal(after.misses, stats.misses + 1,
+        "request with pooling disabled did not create a handle")
+end))
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
@@ -0,0 +1,114 @@
+#!/usr/bin/env lua
+
+-- Test chunked request body consumption in fan.httpd
+-- Covers req:body_chunks(), req:body_to_file() and the max_body_size
+-- limit that keeps oversized uploads from being buffered.
+
+local TestFramework = require('test_framework')
+
+local fan = require "fan"
+_G.fan = fan
+local tcpd = require "fan.tcpd"
+local httpd = require "fan.httpd.core"
+
+local BODY_SIZE = 300 * 1024
+
+local function wait_for(cond, timeout)
+    local waited = 0
+    while not cond() and waited < timeout do
+        fan.sleep(0.05)
+        waited = waited + 0.05
+    end
+    return cond()
+end
+
+-- Send one request on a fresh connection and return the raw response.
+local function request(port, head, body)
+    local session = {buf = ""}
+    session.conn = tcpd.connect {
+        host = "127.0.0.1",
+        port = port,
+        onread = function(data)
+            session.buf = session.buf .. data
+        end,
+        ondisconnected = function()
+            session.closed = true
+        end
+    }
+    session.conn:send(head .. "Content-Length: " .. #body .. "\r\nConnection: close\r\n\r\n" .. body)
+    wait_for(function() return session.closed end, 3)
+    session.conn:close()
+    return session.buf
+end
+
+local suite = TestFramework.create_suite("HTTPD request body streaming Tests")
+
+local pieces = {}
+for i = 0, BODY_SIZE / 16 - 1 do
+    pieces[#pieces + 1] = string.format("%015d\n", i)
+end
+local body = table.concat(pieces)
+local path = os.tmpname()
+
+local server = nil
+local chunk_count = 0
+local chunk_max = 0
+local streamed = nil
+local written = nil
+
+suite:set_setup(function()
+    server = httpd.bind {
+        host = "127.0.0.1",
+        port = 0,
+        max_body_size = BODY_SIZE * 2,
+        onService = function(req, resp)
+            if req.path == "/chunks" then
+                local parts = {}
+                for chunk in req:body_chunks(16 * 1024) do
+                    chunk_count = chunk_count + 1
+                    chunk_max = math.max(chunk_max, #chunk)
+                    parts[#parts + 1] = chunk
+                end
+                streamed = table.concat(parts)
+                resp:reply(200, "OK", tostring(#streamed))
+            elseif req.path == "/file" then
+                written = req:body_to_file(path)
+                resp:reply(200, "OK", tostring(written))
+            else
+                resp:reply(404, "Not Found", "")
+            end
+        end
+    }
+end)
+
+suite:set_teardown(function()
+    os.remove(path)
+end)
+
+suite:test("body_chunks", TestFramework.async_test(function()
+    local reply = request(server.port, "POST /chunks HTTP/1.1\r\nHost: localhost\r\n", body)
+    TestFramework.assert_true(reply:find("\r\n\r\n" .. BODY_SIZE, 1, true) ~= nil,
+        "unexpected /chunks reply: " .. reply:sub(1, 200))
+    TestFramework.assert_true(streamed == body, "body_chunks did not reproduce the body")
+    TestFramework.assert_true(chunk_max <= 16 * 1024 and chunk_count >= BODY_SIZE / (16 * 1024),
+        string.format("unexpected chunking: %d chunks, largest %d", chunk_count, chunk_max))
+end))
+
+suite:test("body_to_file", TestFramework.async_test(function()
+    request(server.port, "POST /file HTTP/1.1\r\nHost: localhost\r\n", body)
+    local f = io.open(path, "rb")
+    local content = f and f:read("*a")
+    if f then
+        f:close()
+    end
+    TestFramework.assert_equal(written, BODY_SIZE, "body_to_file return value")
+    TestFramework.assert_true(content == body, "file content differs from the body")
+end))
+
+suite:test("max_body_size_rejects", TestFramework.async_test(function()
+    local reply = request(server.port, "POST /chunks HTTP/1.1\r\nHost: localhost\r\n", body .. body .. "x")
+    TestFramework.assert_match(reply, "^HTTP/1.1 413", "oversized body not rejected: " .. reply:sub(1, 100))
+end))
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
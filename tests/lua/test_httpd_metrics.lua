@@ -0,0 +1,114 @@
+#!/usr/bin/env lua
+
+-- Test the /metrics endpoint of fan.httpd.core
+-- Checks request counters, req:set_metrics_route() labels and the
+-- Prometheus latency histogram for plain and chunked replies.
+
+local TestFramework = require('test_framework')
+
+local fan = require "fan"
+_G.fan = fan
+local tcpd = require "fan.tcpd"
+local httpd = require "fan.httpd.core"
+
+local function wait_for(cond, timeout)
+    local waited = 0
+    while not cond() and waited < timeout do
+        fan.sleep(0.05)
+        waited = waited + 0.05
+    end
+    return cond()
+end
+
+-- One request per connection; returns the raw response.
+local function request(port, path)
+    local session = {buf = ""}
+    session.conn = tcpd.connect {
+        host = "127.0.0.1",
+        port = port,
+        onread = function(data)
+            session.buf = session.buf .. data
+        end,
+        ondisconnected = function()
+            session.closed = true
+        end
+    }
+    session.conn:send("GET " .. path .. " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n")
+    wait_for(function() return session.closed end, 3)
+    session.conn:close()
+    return session.buf
+end
+
+local function metric(text, name)
+    return tonumber(text:match("\n" .. name:gsub("[%[%]%(%)%.%-%+%*%?%^%$]", "%%%0") .. " ([%d%.]+)"))
+end
+
+local suite = TestFramework.create_suite("HTTPD metrics Tests")
+
+local USERS = 'httpd_request_duration_seconds_count{route="/users/:id",code="2xx"}'
+local STREAM = 'httpd_request_duration_seconds_count{route="/stream",code="2xx"}'
+local UNLABELED = 'httpd_request_duration_seconds_count{route="*",code="4xx"}'
+
+local text = nil
+
+suite:set_setup(TestFramework.async_test(function()
+    local server = httpd.bind {
+        host = "127.0.0.1",
+        port = 0,
+        onService = function(req, resp)
+            if req.path:find("^/users/") then
+                req:set_metrics_route("/users/:id")
+                fan.sleep(0.01)
+                resp:reply(200, "OK", "user")
+            elseif req.path == "/stream" then
+                req:set_metrics_route("/stream")
+                resp:reply_start(200, "OK")
+                resp:reply_chunk("abc")
+                resp:reply_end()
+            else
+                resp:reply(404, "Not Found", "")
+            end
+        end
+    }
+
+    for i = 1, 3 do
+        request(server.port, "/users/" .. i)
+    end
+    request(server.port, "/stream")
+    request(server.port, "/missing")
+
+    text = request(server.port, "/metrics")
+end))
+
+suite:test("endpoint_and_counters", function()
+    TestFramework.assert_match(text, "^HTTP/1.1 200", "metrics endpoint failed: " .. text:sub(1, 100))
+    TestFramework.assert_true(text:find("# TYPE httpd_request_duration_seconds histogram", 1, true) ~= nil,
+        "histogram type line missing")
+    TestFramework.assert_true((metric(text, "requests_total") or 0) >= 5,
+        "requests_total " .. tostring(metric(text, "requests_total")))
+    TestFramework.assert_equal(metric(text, "requests_active"), 0, "requests_active")
+end)
+
+suite:test("route_labels", function()
+    TestFramework.assert_equal(metric(text, USERS), 3, "route count")
+    TestFramework.assert_equal(metric(text, STREAM), 1, "chunked reply not observed")
+    TestFramework.assert_true((metric(text, UNLABELED) or 0) >= 1, "unlabeled 4xx missing")
+end)
+
+-- Buckets are cumulative and end at the count; the 10ms sleep lands
+-- above the 0.008192 bound.
+suite:test("latency_histogram_buckets", function()
+    local last = 0
+    for le, value in text:gmatch('httpd_request_duration_seconds_bucket{route="/users/:id",code="2xx",le="([^"]+)"} (%d+)') do
+        value = tonumber(value)
+        TestFramework.assert_true(value >= last, "bucket le=" .. le .. " decreased")
+        if le == "0.008192" then
+            TestFramework.assert_equal(value, 0, "10ms requests counted below 8ms")
+        end
+        last = value
+    end
+    TestFramework.assert_equal(last, 3, "+Inf bucket")
+end)
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
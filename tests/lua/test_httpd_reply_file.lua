@@ -0,0 +1,183 @@
+#!/usr/bin/env lua
+
+-- Test req:reply_file() in both fan.httpd implementations
+-- Checks full, ranged, unsatisfiable, conditional (If-Modified-Since) and
+-- HEAD replies, plus the error returned for a missing file.
+
+local TestFramework = require('test_framework')
+
+-- Mock config module if needed
+package.preload['config'] = package.preload['config'] or function()
+    return {}
+end
+
+-- Mock zlib module if not installed; reply_file never compresses
+if not pcall(require, "zlib") then
+    package.preload['zlib'] = function()
+        return {}
+    end
+end
+
+local fan = require "fan"
+_G.fan = fan
+local tcpd = require "fan.tcpd"
+local has_lfs = pcall(require, "lfs")
+
+local suite = TestFramework.create_suite("HTTPD reply_file Tests")
+
+local function wait_for(cond, timeout)
+    local waited = 0
+    while not cond() and waited < timeout do
+        fan.sleep(0.05)
+        waited = waited + 0.05
+    end
+    return cond()
+end
+
+-- One request per connection; returns status, headers (lowercased) and body.
+local function request(port, path, extra)
+    local session = {buf = ""}
+    session.conn = tcpd.connect {
+        host = "127.0.0.1",
+        port = port,
+        onread = function(data)
+            session.buf = session.buf .. data
+        end,
+        ondisconnected = function()
+            session.closed = true
+        end
+    }
+    local method = extra and extra.method or "GET"
+    session.conn:send(method .. " " .. path .. " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n" ..
+        (extra and extra.headers or "") .. "\r\n")
+    wait_for(function() return session.closed end, 3)
+    session.conn:close()
+
+    local head, body = session.buf:match("^(.-)\r\n\r\n(.*)$")
+    if not head then
+        return nil, {}, session.buf
+    end
+    local status = tonumber(head:match("^HTTP/1%.%d (%d+)"))
+    local headers = {}
+    for k, v in head:gmatch("\r\n([^:\r\n]+):%s*([^\r\n]*)") do
+        headers[k:lower()] = v
+    end
+    return status, headers, body
+end
+
+local path = os.tmpname() .. ".txt"
+local pieces = {}
+for i = 1, 2000 do
+    pieces[i] = string.format("line %05d\n", i)
+end
+local content = table.concat(pieces)
+
+-- Error raised by a second reply_file after the request was answered.
+local double_reply_error = {}
+
+local function onService(req, resp)
+    if req.path == "/asset.txt" then
+        resp:reply_file(200, path, {content_type = "text/plain; charset=utf-8"})
+    elseif req.path == "/twice" then
+        resp:reply(200, "OK", "first")
+        local ok, err = pcall(resp.reply_file, resp, 200, path)
+        double_reply_error[#double_reply_error + 1] = ok and "no error" or tostring(err)
+    else
+        local ok, err = resp:reply_file(200, path .. ".missing")
+        resp:reply(404, "Not Found", tostring(err))
+    end
+end
+
+local ports = {}
+
+suite:set_setup(function()
+    local f = assert(io.open(path, "wb"))
+    f:write(content)
+    f:close()
+
+    ports.core = require("fan.httpd.core").bind {host = "127.0.0.1", port = 0, onService = onService}.port
+    ports.lua = require("fan.httpd.httpd").bind {host = "127.0.0.1", port = 0, onService = onService}.port
+end)
+
+suite:set_teardown(function()
+    os.remove(path)
+end)
+
+-- `conditional`: the implementation knows the file's mtime.
+local function add_tests(impl, conditional)
+    suite:test(impl .. "_full_reply", TestFramework.async_test(function()
+        local status, headers, body = request(ports[impl], "/asset.txt")
+        TestFramework.assert_equal(status, 200)
+        TestFramework.assert_true(body == content, "body differs from the file")
+        TestFramework.assert_equal(headers["content-type"], "text/plain; charset=utf-8")
+        TestFramework.assert_equal(headers["accept-ranges"], "bytes")
+        if conditional then
+            TestFramework.assert_match(headers["last-modified"] or "", "GMT$", "last-modified")
+        end
+    end))
+
+    suite:test(impl .. "_ranges", TestFramework.async_test(function()
+        local status, headers, body = request(ports[impl], "/asset.txt", {headers = "Range: bytes=10-19\r\n"})
+        TestFramework.assert_equal(status, 206)
+        TestFramework.assert_equal(body, content:sub(11, 20))
+        TestFramework.assert_equal(headers["content-range"], "bytes 10-19/" .. #content)
+
+        status, headers, body = request(ports[impl], "/asset.txt", {headers = "Range: bytes=-5\r\n"})
+        TestFramework.assert_equal(status, 206, "suffix range")
+        TestFramework.assert_equal(body, content:sub(-5))
+    end))
+
+    suite:test(impl .. "_unsatisfiable_range", TestFramework.async_test(function()
+        local status, headers, body = request(ports[impl], "/asset.txt", {headers = "Range: bytes=99999-\r\n"})
+        TestFramework.assert_equal(status, 416)
+        TestFramework.assert_equal(headers["content-range"], "bytes */" .. #content)
+        TestFramework.assert_equal(headers["content-length"], "0")
+        TestFramework.assert_equal(body, "")
+    end))
+
+    if conditional then
+        suite:test(impl .. "_not_modified", TestFramework.async_test(function()
+            local _, headers = request(ports[impl], "/asset.txt")
+            local status, headers304, body = request(ports[impl], "/asset.txt",
+                {headers = "If-Modified-Since: " .. headers["last-modified"] .. "\r\n"})
+            TestFramework.assert_equal(status, 304)
+            TestFramework.assert_equal(body, "")
+            TestFramework.assert_nil(headers304["content-type"], "304 must not carry Content-Type")
+            TestFramework.assert_nil(headers304["content-length"], "304 must not carry Content-Length")
+        end))
+    end
+
+    suite:test(impl .. "_modified_since_epoch", TestFramework.async_test(function()
+        local status, _, body = request(ports[impl], "/asset.txt",
+            {headers = "If-Modified-Since: Thu, 01 Jan 1970 00:00:00 GMT\r\n"})
+        TestFramework.assert_equal(status, 200)
+        TestFramework.assert_true(body == content, "body differs from the file")
+    end))
+
+    suite:test(impl .. "_head", TestFramework.async_test(function()
+        local status, headers, body = request(ports[impl], "/asset.txt", {method = "HEAD"})
+        TestFramework.assert_equal(status, 200)
+        TestFramework.assert_equal(body, "")
+        TestFramework.assert_equal(tonumber(headers["content-length"]), #content)
+    end))
+
+    suite:test(impl .. "_missing_file", TestFramework.async_test(function()
+        local status = request(ports[impl], "/missing")
+        TestFramework.assert_equal(status, 404)
+    end))
+
+    suite:test(impl .. "_reply_twice_raises", TestFramework.async_test(function()
+        local before = #double_reply_error
+        local status, _, body = request(ports[impl], "/twice")
+        TestFramework.assert_equal(status, 200)
+        TestFramework.assert_equal(body, "first")
+        TestFramework.assert_equal(#double_reply_error, before + 1)
+        TestFramework.assert_match(double_reply_error[#double_reply_error], "reply has completed already")
+    end))
+end
+
+add_tests("core", true)
+add_tests("lua", has_lfs)
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
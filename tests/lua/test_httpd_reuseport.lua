@@ -0,0 +1,137 @@
+#!/usr/bin/env lua
+
+-- Test per-worker evhttp instances (reuseport_shards) in fan.httpd
+-- Requests are parsed on worker bases and dispatched to onService on the
+-- main state; plain, chunked and keep-alive replies travel back to the
+-- worker that owns the connection.
+
+local TestFramework = require('test_framework')
+
+local fan = require "fan"
+_G.fan = fan
+local tcpd = require "fan.tcpd"
+local httpd = require "fan.httpd.core"
+
+local function wait_for(cond, timeout)
+    local waited = 0
+    while not cond() and waited < timeout do
+        fan.sleep(0.05)
+        waited = waited + 0.05
+    end
+    return cond()
+end
+
+-- Raw HTTP client collecting everything the server writes.
+local function open(port)
+    local session = {buf = ""}
+    session.conn = tcpd.connect {
+        host = "127.0.0.1",
+        port = port,
+        onread = function(data)
+            session.buf = session.buf .. data
+        end
+    }
+    return session
+end
+
+local function count(s, pattern)
+    local n = 0
+    for _ in s:gmatch(pattern) do
+        n = n + 1
+    end
+    return n
+end
+
+local suite = TestFramework.create_suite("HTTPD reuseport_shards Tests")
+
+local server = nil
+local served = 0
+
+suite:set_setup(function()
+    server = httpd.bind {
+        host = "127.0.0.1",
+        port = 0,
+        reuseport_shards = 2,
+        onService = function(req, resp)
+            served = served + 1
+            if req.path == "/chunked" then
+                resp:reply_start(200, "OK")
+                resp:reply_chunk("a")
+                fan.sleep(0.01)
+                resp:reply_chunk("b")
+                resp:reply_end()
+                return
+            end
+
+            resp:addheader("X-Served-By", "main")
+            resp:reply(200, "OK", string.format("%s %s %s %s %s %s",
+                req.method, req.path, tostring(req.query), tostring(req.headers["X-Test"]),
+                tostring(req.body), req.remoteip))
+        end
+    }
+end)
+
+suite:test("server_bound", function()
+    TestFramework.assert_not_nil(server, "httpd.bind returned nil")
+    TestFramework.assert_true(server.port and server.port > 0, "reuseport server has no port")
+end)
+
+-- Keep-alive: two requests on one connection, answered in order.
+suite:test("keepalive_replies_in_order", TestFramework.async_test(function()
+    local before = served
+    local ka = open(server.port)
+    ka.conn:send("GET /echo?x=1 HTTP/1.1\r\nHost: localhost\r\nX-Test: one\r\n\r\n")
+    wait_for(function() return ka.buf:find("127.0.0.1", 1, true) end, 3)
+    ka.conn:send("POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\n\r\nhello")
+    wait_for(function() return count(ka.buf, "HTTP/1.1 200 OK") == 2 and ka.buf:find("hello", 1, true) end, 3)
+    ka.conn:close()
+
+    TestFramework.assert_true(ka.buf:find("GET /echo x=1 one nil 127.0.0.1", 1, true) ~= nil,
+        "unexpected GET reply: " .. ka.buf)
+    TestFramework.assert_true(ka.buf:find("POST /echo nil nil hello 127.0.0.1", 1, true) ~= nil,
+        "unexpected POST reply: " .. ka.buf)
+    TestFramework.assert_true(ka.buf:find("X-Served-By: main", 1, true) ~= nil,
+        "reply header missing: " .. ka.buf)
+    TestFramework.assert_equal(served - before, 2, "onService calls")
+end))
+
+-- Chunked reply streamed through the worker.
+suite:test("chunked_reply_through_worker", TestFramework.async_test(function()
+    local chunked = open(server.port)
+    chunked.conn:send("GET /chunked HTTP/1.1\r\nHost: localhost\r\n\r\n")
+    wait_for(function() return chunked.buf:find("0\r\n\r\n", 1, true) end, 3)
+    chunked.conn:close()
+
+    TestFramework.assert_true(chunked.buf:find("1\r\na\r\n1\r\nb\r\n0\r\n\r\n", 1, true) ~= nil,
+        "unexpected chunked reply: " .. chunked.buf)
+end))
+
+-- Concurrent connections spread over the worker listeners.
+suite:test("concurrent_connections", TestFramework.async_test(function()
+    local before = served
+    local sessions = {}
+    for i = 1, 8 do
+        sessions[i] = open(server.port)
+        sessions[i].conn:send("GET /echo?n=" .. i .. " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n")
+    end
+    wait_for(function()
+        for i = 1, 8 do
+            if not sessions[i].buf:find("n=" .. i .. " ", 1, true) then
+                return false
+            end
+        end
+        return true
+    end, 3)
+    for i = 1, 8 do
+        sessions[i].conn:close()
+    end
+
+    for i = 1, 8 do
+        TestFramework.assert_true(sessions[i].buf:find("GET /echo n=" .. i .. " ", 1, true) ~= nil,
+            "missing reply for connection " .. i .. ": " .. sessions[i].buf)
+    end
+    TestFramework.assert_equal(served - before, 8, "onService calls")
+end))
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
@@ -0,0 +1,108 @@
+#!/usr/bin/env lua
+
+-- Test the fan.httpd.router segment trie and the Router built on it
+-- Covers static, :param and wildcard routes, match precedence with
+-- backtracking, duplicate registration and the Lua pattern fallback.
+
+local TestFramework = require('test_framework')
+
+-- Mock config module if needed
+package.preload['config'] = package.preload['config'] or function()
+    return {}
+end
+
+-- Mock zlib module if not installed; routing never touches gzip
+if not pcall(require, "zlib") then
+    package.preload['zlib'] = function()
+        return {}
+    end
+end
+
+local radix = require "fan.httpd.router"
+local Router = require("fan.httpd.httpd").Router
+
+local suite = TestFramework.create_suite("HTTPD router Tests")
+
+local function new_tree()
+    local tree = radix.new()
+    TestFramework.assert_true(tree:add("GET", "/users", "list"), "add static")
+    TestFramework.assert_true(tree:add("GET", "/users/:id", "show"), "add param")
+    TestFramework.assert_true(tree:add("GET", "/users/new", "new"), "add static sibling")
+    TestFramework.assert_true(tree:add("GET", "/users/:id/posts/:post_id", "post"), "add nested")
+    TestFramework.assert_true(tree:add("GET", "/static/*path", "static"), "add wildcard")
+    TestFramework.assert_true(tree:add("GET", "/", "root"), "add root")
+    TestFramework.assert_true(tree:add("post", "/users", "create"), "add other method")
+    return tree
+end
+
+suite:test("add_and_count", function()
+    local tree = new_tree()
+    TestFramework.assert_false(tree:add("GET", "/users/:uid", "dup"), "duplicate must be refused")
+    TestFramework.assert_equal(tree:count(), 7)
+end)
+
+suite:test("unsupported_shapes", function()
+    local tree = radix.new()
+    local ok, err = tree:add("GET", "/files/:name.json", "file")
+    TestFramework.assert_nil(ok, "partial-segment param is not a trie route")
+    TestFramework.assert_not_nil(err)
+    TestFramework.assert_nil(tree:add("GET", "/a/*rest/b", "x"), "wildcard must be last")
+end)
+
+suite:test("static_and_param_match", function()
+    local tree = new_tree()
+    local handler, params = tree:match("GET", "/users")
+    TestFramework.assert_equal(handler, "list")
+    TestFramework.assert_nil(next(params))
+
+    handler, params = tree:match("GET", "/users/42")
+    TestFramework.assert_equal(handler, "show")
+    TestFramework.assert_equal(params.id, "42")
+
+    TestFramework.assert_equal(tree:match("GET", "/users/new"), "new", "static before param")
+end)
+
+suite:test("backtrack_and_wildcard", function()
+    local tree = new_tree()
+    local handler, params = tree:match("GET", "/users/new/posts/7")
+    TestFramework.assert_equal(handler, "post", "backtrack to param")
+    TestFramework.assert_equal(params.id, "new")
+    TestFramework.assert_equal(params.post_id, "7")
+
+    handler, params = tree:match("GET", "/static/css/site.css")
+    TestFramework.assert_equal(handler, "static")
+    TestFramework.assert_equal(params.path, "css/site.css")
+end)
+
+suite:test("root_methods_and_misses", function()
+    local tree = new_tree()
+    TestFramework.assert_equal(tree:match("GET", "/"), "root")
+    TestFramework.assert_equal(tree:match("POST", "/users"), "create")
+    TestFramework.assert_nil(tree:match("PUT", "/users"), "method miss")
+    TestFramework.assert_nil(tree:match("GET", "/users//posts/1"), "empty param")
+    TestFramework.assert_nil(tree:match("GET", "/users/"), "trailing slash")
+    TestFramework.assert_nil(tree:match("GET", "/nope"), "no match")
+end)
+
+-- Router keeps its API; pattern-only routes still match after the trie.
+suite:test("router_trie_and_pattern_fallback", function()
+    local router = Router.new()
+    router:get("/api/v1.0/items/:id", function() return "item" end)
+    router:get("/files/:name.json", function() return "json" end)
+
+    local handler, params = router:match("GET", "/api/v1.0/items/9")
+    TestFramework.assert_not_nil(handler, "router trie")
+    TestFramework.assert_equal(handler(), "item")
+    TestFramework.assert_equal(params.id, "9")
+    TestFramework.assert_nil(router:match("GET", "/api/v1x0/items/9"), "literal dot")
+
+    handler, params = router:match("GET", "/files/report.json")
+    TestFramework.assert_not_nil(handler, "router fallback")
+    TestFramework.assert_equal(handler(), "json")
+    TestFramework.assert_equal(params.name, "report")
+
+    TestFramework.assert_nil(router:match("GET", "/files/report"), "router miss")
+end)
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
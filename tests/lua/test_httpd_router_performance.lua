@@ -0,0 +1,93 @@
+#!/usr/bin/env lua
+-- Router Benchmark for LuaFan HTTPD
+-- Compares the C segment trie with the Lua pattern router at 10/100/1000
+-- routes. Set ROUTER_BENCH_LOOKUPS for longer runs.
+
+local TestFramework = require('test_framework')
+
+-- Mock config module if needed
+package.preload['config'] = package.preload['config'] or function()
+    return {}
+end
+
+-- Mock zlib module if not installed; only Router is benchmarked
+if not pcall(require, "zlib") then
+    package.preload['zlib'] = function()
+        return {}
+    end
+end
+
+local Router = require("fan.httpd.httpd").Router
+
+local LOOKUPS = tonumber(os.getenv("ROUTER_BENCH_LOOKUPS")) or 20000
+local ROUTE_COUNTS = {10, 100, 1000}
+
+-- A gateway-like table: a third static, a third with one parameter and a
+-- third with two, spread over a handful of prefixes.
+local function route_paths(n)
+    local routes, requests = {}, {}
+    for i = 1, n do
+        local prefix = "/api/v" .. (i % 3 + 1) .. "/svc" .. (i % 17)
+        local kind = i % 3
+        if kind == 0 then
+            routes[i] = prefix .. "/res" .. i
+            requests[i] = routes[i]
+        elseif kind == 1 then
+            routes[i] = prefix .. "/res" .. i .. "/:id"
+            requests[i] = prefix .. "/res" .. i .. "/" .. (i * 7)
+        else
+            routes[i] = prefix .. "/res" .. i .. "/:id/items/:item"
+            requests[i] = prefix .. "/res" .. i .. "/" .. i .. "/items/" .. (i * 3)
+        end
+    end
+    return routes, requests
+end
+
+local function build(routes, use_tree)
+    local router = Router.new()
+    if not use_tree then
+        router.tree = nil
+    end
+    for i, path in ipairs(routes) do
+        router:get(path, i)
+    end
+    return router
+end
+
+local function bench(router, requests)
+    local count = #requests
+    local start = os.clock()
+    for i = 1, LOOKUPS do
+        local idx = (i * 7919) % count + 1
+        local handler = router:match("GET", requests[idx])
+        if handler ~= idx then
+            error(string.format("route %d resolved to %s", idx, tostring(handler)))
+        end
+    end
+    return os.clock() - start
+end
+
+local suite = TestFramework.create_suite("HTTPD router benchmark")
+
+print(string.format("%-8s %14s %14s %9s", "routes", "lua (ns/op)", "trie (ns/op)", "speedup"))
+
+for _, n in ipairs(ROUTE_COUNTS) do
+    suite:test(string.format("lookup_%d_routes", n), function()
+        local routes, requests = route_paths(n)
+        local tree_router = build(routes, true)
+        if not tree_router.tree then
+            TestFramework.skip_test("fan.httpd.router is not available")
+        end
+        local lua_time = bench(build(routes, false), requests)
+        local tree_time = bench(tree_router, requests)
+
+        print(string.format("%-8d %14.0f %14.0f %8.1fx", n,
+            lua_time / LOOKUPS * 1e9, tree_time / LOOKUPS * 1e9, lua_time / math.max(tree_time, 1e-9)))
+        if n >= 100 then
+            TestFramework.assert_true(tree_time <= lua_time, "trie router slower than pattern router")
+        end
+    end)
+end
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
@@ -0,0 +1,170 @@
+#!/usr/bin/env lua
+
+-- Test httpd.websocket_broadcast in fan.httpd.core
+-- Fans one message out to plain and permessage-deflate clients and checks
+-- every open connection gets the frame while closed ones are skipped.
+
+local TestFramework = require('test_framework')
+
+local fan = require "fan"
+_G.fan = fan
+local tcpd = require "fan.tcpd"
+local httpd = require "fan.httpd.core"
+
+local function wait_for(cond, timeout)
+    local waited = 0
+    while not cond() and waited < timeout do
+        fan.sleep(0.05)
+        waited = waited + 0.05
+    end
+    return cond()
+end
+
+local function open(port, path, extensions)
+    local session = {buf = "", frames = {}}
+
+    session.conn = tcpd.connect {
+        host = "127.0.0.1",
+        port = port,
+        onread = function(data)
+            session.buf = session.buf .. data
+            if not session.headers then
+                local head_end = session.buf:find("\r\n\r\n", 1, true)
+                if not head_end then
+                    return
+                end
+                session.headers = session.buf:sub(1, head_end + 3)
+                session.buf = session.buf:sub(head_end + 4)
+            end
+            while #session.buf >= 2 do
+                local b1, b2 = session.buf:byte(1, 2)
+                local len, offset = b2 & 0x7f, 2
+                if len == 126 then
+                    if #session.buf < 4 then
+                        break
+                    end
+                    len, offset = string.unpack(">I2", session.buf, 3), 4
+                end
+                if #session.buf < offset + len then
+                    break
+                end
+                table.insert(session.frames, {
+                    rsv1 = (b1 & 0x40) ~= 0,
+                    opcode = b1 & 0x0f,
+                    payload = session.buf:sub(offset + 1, offset + len)
+                })
+                session.buf = session.buf:sub(offset + len + 1)
+            end
+        end
+    }
+
+    session.conn:send(
+        "GET " .. path .. " HTTP/1.1\r\n" ..
+        "Host: localhost\r\n" ..
+        "Upgrade: websocket\r\n" ..
+        "Connection: Upgrade\r\n" ..
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n" ..
+        (extensions and ("Sec-WebSocket-Extensions: " .. extensions .. "\r\n") or "") ..
+        "Sec-WebSocket-Version: 13\r\n\r\n"
+    )
+    return session
+end
+
+-- Upgrade two plain, two no-takeover and one takeover client and wait
+-- until the server holds all of them. Returns accepted requests, sessions.
+local function open_all()
+    local accepted = {}
+
+    local server = httpd.bind {
+        host = "127.0.0.1",
+        port = 0,
+        onService = function(req, resp)
+            req:websocket_accept {
+                deflate = {threshold = 0, context_takeover = req.path ~= "/takeover"}
+            }
+            table.insert(accepted, req)
+            while req:websocket_receive() do
+            end
+        end
+    }
+
+    local sessions = {
+        open(server.port, "/plain", nil),
+        open(server.port, "/plain", nil),
+        open(server.port, "/reset", "permessage-deflate"),
+        open(server.port, "/reset", "permessage-deflate"),
+        open(server.port, "/takeover", "permessage-deflate")
+    }
+
+    TestFramework.assert_true(wait_for(function() return #accepted == #sessions end, 3),
+        "not all clients upgraded")
+    return accepted, sessions, server
+end
+
+local function close_all(sessions)
+    for _, s in ipairs(sessions) do
+        s.conn:close()
+    end
+    fan.sleep(0.1)
+end
+
+local suite = TestFramework.create_suite("WebSocket broadcast Tests")
+
+suite:test("broadcast_shares_frames", TestFramework.async_test(function()
+    local accepted, sessions, server = open_all()
+    local message = string.rep("broadcast payload ", 40)
+
+    -- Non-request entries are ignored.
+    local sent = httpd.websocket_broadcast({"bogus", table.unpack(accepted)}, 1, message)
+    local delivered = wait_for(function()
+        for _, s in ipairs(sessions) do
+            if #s.frames < 1 then
+                return false
+            end
+        end
+        return true
+    end, 3)
+    close_all(sessions)
+
+    TestFramework.assert_equal(sent, #sessions, "connections reached")
+    TestFramework.assert_true(delivered, "not every client received the broadcast")
+
+    local f = {}
+    for i, s in ipairs(sessions) do
+        f[i] = s.frames[1]
+    end
+    TestFramework.assert_false(f[1].rsv1, "plain clients must get uncompressed frames")
+    TestFramework.assert_equal(f[1].payload, message)
+    TestFramework.assert_equal(f[2].payload, message)
+    TestFramework.assert_true(f[3].rsv1 and f[4].rsv1 and f[5].rsv1,
+        "deflate clients did not get compressed frames")
+    TestFramework.assert_equal(f[3].payload, f[4].payload, "shared compressed frame mismatch")
+    TestFramework.assert_true(#f[3].payload < #message, "frame was not compressed")
+end))
+
+-- Closed connections are skipped.
+suite:test("closed_connections_skipped", TestFramework.async_test(function()
+    local accepted, sessions, server = open_all()
+
+    sessions[1].conn:close()
+    wait_for(function()
+        for _, req in ipairs(accepted) do
+            if req:websocket_state() == "closed" then
+                return true
+            end
+        end
+        return false
+    end, 2)
+
+    local sent = httpd.websocket_broadcast(accepted, 9, "ping")
+    local received = wait_for(function() return #sessions[2].frames >= 1 end, 2)
+    table.remove(sessions, 1)
+    close_all(sessions)
+
+    TestFramework.assert_equal(sent, 4, "broadcast to a closed connection")
+    TestFramework.assert_true(received, "control frame broadcast not received")
+    TestFramework.assert_equal(sessions[1].frames[1].opcode, 9)
+end))
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
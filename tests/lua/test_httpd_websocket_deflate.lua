@@ -0,0 +1,171 @@
+#!/usr/bin/env lua
+
+-- Test WebSocket permessage-deflate (RFC 7692) in fan.httpd
+-- Drives a raw TCP client through the upgrade, sends compressed frames
+-- (single and fragmented) and checks the server's compressed echoes.
+
+local TestFramework = require('test_framework')
+
+local fan = require "fan"
+_G.fan = fan
+local tcpd = require "fan.tcpd"
+local httpd = require "fan.httpd.core"
+
+-- "Hello" compressed with an empty window (RFC 7692 section 7.2.3.1).
+local HELLO_DEFLATED = "\xf2\x48\xcd\xc9\xc9\x07\x00"
+
+local function wait_for(cond, timeout)
+    local waited = 0
+    while not cond() and waited < timeout do
+        fan.sleep(0.05)
+        waited = waited + 0.05
+    end
+    return cond()
+end
+
+-- Client frames must be masked.
+local function client_frame(first_byte, payload)
+    local key = {0x11, 0x22, 0x33, 0x44}
+    local masked = {}
+    for i = 1, #payload do
+        masked[i] = string.char(payload:byte(i) ~ key[(i - 1) % 4 + 1])
+    end
+    return string.char(first_byte, 0x80 | #payload, table.unpack(key)) .. table.concat(masked)
+end
+
+-- Connect, upgrade with `extensions` and return a session table.
+local function open(port, path, extensions)
+    local session = {buf = "", frames = {}}
+
+    session.conn = tcpd.connect {
+        host = "127.0.0.1",
+        port = port,
+        onread = function(data)
+            session.buf = session.buf .. data
+            if not session.headers then
+                local head_end = session.buf:find("\r\n\r\n", 1, true)
+                if not head_end then
+                    return
+                end
+                session.headers = session.buf:sub(1, head_end + 3)
+                session.buf = session.buf:sub(head_end + 4)
+            end
+            while #session.buf >= 2 do
+                local b1, b2 = session.buf:byte(1, 2)
+                local len = b2 & 0x7f
+                if len >= 126 or #session.buf < 2 + len then
+                    break
+                end
+                table.insert(session.frames, {
+                    rsv1 = (b1 & 0x40) ~= 0,
+                    opcode = b1 & 0x0f,
+                    payload = session.buf:sub(3, 2 + len)
+                })
+                session.buf = session.buf:sub(3 + len)
+            end
+        end
+    }
+
+    session.conn:send(
+        "GET " .. path .. " HTTP/1.1\r\n" ..
+        "Host: localhost\r\n" ..
+        "Upgrade: websocket\r\n" ..
+        "Connection: Upgrade\r\n" ..
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n" ..
+        (extensions and ("Sec-WebSocket-Extensions: " .. extensions .. "\r\n") or "") ..
+        "Sec-WebSocket-Version: 13\r\n\r\n"
+    )
+
+    wait_for(function() return session.headers end, 2)
+    return session
+end
+
+local function expect_frames(session, n)
+    return wait_for(function() return #session.frames >= n end, 2)
+end
+
+-- Echo server; records the negotiated extension per path in `negotiated`.
+local function start_server(negotiated)
+    return httpd.bind {
+        host = "127.0.0.1",
+        port = 0,
+        onService = function(req, resp)
+            local takeover = req.path ~= "/reset"
+            local ok, ext = req:websocket_accept {
+                deflate = {threshold = 0, context_takeover = takeover}
+            }
+            negotiated[req.path] = ext or false
+            while true do
+                local msg, opcode = req:websocket_receive()
+                if not msg then
+                    break
+                end
+                req:websocket_send(msg, opcode)
+            end
+        end
+    }
+end
+
+local suite = TestFramework.create_suite("WebSocket permessage-deflate Tests")
+
+-- No context takeover: small messages that would grow go back as-is,
+-- compressible ones go back compressed.
+suite:test("no_context_takeover", TestFramework.async_test(function()
+    local server = start_server({})
+    local s = open(server.port, "/reset", "permessage-deflate; client_max_window_bits")
+    TestFramework.assert_not_nil(s.headers, "no upgrade response")
+    TestFramework.assert_true(s.headers:find("Sec-WebSocket-Extensions: permessage-deflate; server_no_context_takeover", 1, true) ~= nil,
+        "missing or unexpected extension response: " .. s.headers)
+
+    local long = string.rep("a", 100)
+    s.conn:send(client_frame(0xc1, HELLO_DEFLATED))
+    s.conn:send(client_frame(0x81, long))
+    local echoed = expect_frames(s, 2)
+    s.conn:close()
+
+    TestFramework.assert_true(echoed, "no echo on /reset")
+    TestFramework.assert_false(s.frames[1].rsv1, "small reply should not be compressed")
+    TestFramework.assert_equal(s.frames[1].payload, "Hello")
+    TestFramework.assert_true(s.frames[2].rsv1 and #s.frames[2].payload < #long,
+        "compressible message was not compressed")
+end))
+
+-- Context takeover: the second echo back-references the first.
+suite:test("context_takeover_and_fragments", TestFramework.async_test(function()
+    local negotiated = {}
+    local server = start_server(negotiated)
+    local s = open(server.port, "/takeover", "permessage-deflate")
+    TestFramework.assert_equal(negotiated["/takeover"], "permessage-deflate")
+
+    -- Fragmented compressed message: RSV1 only on the first frame.
+    s.conn:send(client_frame(0x41, HELLO_DEFLATED:sub(1, 3)))
+    s.conn:send(client_frame(0x80, HELLO_DEFLATED:sub(4)))
+    s.conn:send(client_frame(0xc1, HELLO_DEFLATED))
+    local echoed = expect_frames(s, 2)
+    s.conn:close()
+
+    TestFramework.assert_true(echoed, "no echo on /takeover")
+    TestFramework.assert_equal(s.frames[1].payload, HELLO_DEFLATED,
+        "fragmented compressed message was not reassembled")
+    TestFramework.assert_true(s.frames[2].rsv1 and #s.frames[2].payload < #HELLO_DEFLATED,
+        "second message did not reuse the compression context")
+end))
+
+-- No offer: plain frames, no extension header.
+suite:test("no_offer_plain_frames", TestFramework.async_test(function()
+    local server = start_server({})
+    local s = open(server.port, "/plain", nil)
+    s.conn:send(client_frame(0x81, "Hello"))
+    local echoed = expect_frames(s, 1)
+    s.conn:close()
+
+    TestFramework.assert_not_nil(s.headers, "no upgrade response")
+    TestFramework.assert_nil(s.headers:find("Sec-WebSocket-Extensions", 1, true),
+        "extension negotiated without an offer")
+    TestFramework.assert_true(echoed, "no echo on /plain")
+    TestFramework.assert_false(s.frames[1].rsv1)
+    TestFramework.assert_equal(s.frames[1].payload, "Hello")
+end))
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
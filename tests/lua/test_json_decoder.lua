@@ -0,0 +1,187 @@
+#!/usr/bin/env lua
+
+-- Test json.decoder(): incremental decoding of streamed JSON
+-- Feeds documents in arbitrary splits and checks the emitted values,
+-- depth-based streaming of large arrays, error reporting and finish().
+
+local TestFramework = require('test_framework')
+
+-- The rockspecs build json as its own module; the CMake build links
+-- json.c into fan.so, where only luaopen_json can reach it.
+local has_json, json = pcall(require, "json")
+if not has_json then
+    local path = package.searchpath and package.searchpath("fan", package.cpath)
+    local open = path and package.loadlib(path, "luaopen_json")
+    if open then
+        package.preload["json"] = open
+        has_json, json = pcall(require, "json")
+    end
+end
+
+local suite = TestFramework.create_suite("JSON incremental decoder Tests")
+
+suite:test("module_available", function()
+    TestFramework.assert_true(has_json, "json module could not be loaded: " .. tostring(json))
+end)
+
+if not has_json then
+    local failures = TestFramework.run_suite(suite)
+    os.exit(failures > 0 and 1 or 0)
+end
+
+-- Feed text in pieces of `step` bytes; returns all emitted values
+-- (none when the decoder has an onvalue callback).
+local function feed_all(dec, text, step)
+    local out = {}
+    local function collect(values, n)
+        for k = 1, n or 0 do
+            out[#out + 1] = values[k]
+        end
+    end
+    for i = 1, #text, step do
+        collect(dec:feed(text:sub(i, i + step - 1)))
+    end
+    collect(dec:finish())
+    return out
+end
+
+-- NDJSON split at every possible boundary decodes like json.decode per line.
+suite:test("ndjson_any_split", function()
+    local lines = {
+        '{"id":1,"name":"a\\"b","tags":["x","y"]}',
+        '[1,2.5,-3e2,true,false]',
+        '"plain string with } and ] inside"',
+        '{"nested":{"deep":[{"k":"\\u00e9"}]}}',
+        '12345',
+    }
+    local ndjson = table.concat(lines, "\n") .. "\n"
+    for _, step in ipairs({1, 2, 3, 7, #ndjson}) do
+        local values = feed_all(json.decoder(), ndjson, step)
+        TestFramework.assert_equal(#values, #lines, "ndjson count step " .. step)
+        for i, line in ipairs(lines) do
+            TestFramework.assert_equal(json.encode(values[i]), json.encode(json.decode(line)),
+                "ndjson value " .. i .. " step " .. step)
+        end
+    end
+end)
+
+-- A trailing number is only complete at a delimiter or at finish().
+suite:test("number_waits_for_delimiter", function()
+    local dec = json.decoder()
+    local _, n = dec:feed("42")
+    TestFramework.assert_equal(n, 0, "number waits for delimiter")
+    local values, m = dec:finish()
+    TestFramework.assert_equal(m, 1, "finish flushes number")
+    TestFramework.assert_equal(values[1], 42)
+end)
+
+-- depth = 1 streams the elements of a top-level array.
+suite:test("depth_1_streams_array_elements", function()
+    local parts = {}
+    for i = 1, 10000 do
+        parts[i] = string.format('{"i":%d,"s":"item %d [x]"}', i, i)
+    end
+    local text = "[" .. table.concat(parts, ",") .. "]"
+    local count, sum, max_pending = 0, 0, 0
+    local keyed = false
+    local dec = json.decoder {
+        depth = 1,
+        onvalue = function(value, key)
+            count = count + 1
+            sum = sum + value.i
+            keyed = keyed or key ~= nil
+        end
+    }
+    for i = 1, #text, 1000 do
+        dec:feed(text:sub(i, i + 999))
+        max_pending = math.max(max_pending, dec:pending())
+    end
+    dec:finish()
+    TestFramework.assert_false(keyed, "array elements have no key")
+    TestFramework.assert_equal(count, 10000, "streamed element count")
+    TestFramework.assert_equal(sum, 10000 * 10001 / 2, "streamed element sum")
+    TestFramework.assert_true(max_pending < 1100, "buffer stays bounded: " .. max_pending)
+end)
+
+-- depth = 1 on an object reports member keys; depth = 2 goes one level further.
+suite:test("object_members_and_depth_2", function()
+    local got = {}
+    local dec = json.decoder {
+        depth = 1,
+        onvalue = function(value, key)
+            got[#got + 1] = {key, value}
+        end
+    }
+    feed_all(dec, '{"count": 2, "items": [1, 2], "ok": true}', 4)
+    TestFramework.assert_equal(#got, 3, "object members")
+    TestFramework.assert_equal(got[1][1], "count")
+    TestFramework.assert_equal(got[1][2], 2)
+    TestFramework.assert_equal(got[2][1], "items")
+    TestFramework.assert_equal(#got[2][2], 2)
+    TestFramework.assert_equal(got[3][1], "ok")
+    TestFramework.assert_equal(got[3][2], true)
+
+    local values = feed_all(json.decoder {depth = 2}, '{"a": [1, [2, 3]], "b": {"c": "d"}}', 5)
+    TestFramework.assert_equal(#values, 3, "depth 2 values: " .. json.encode(values))
+    TestFramework.assert_equal(values[1], 1)
+    TestFramework.assert_equal(values[2][2], 3)
+    TestFramework.assert_equal(values[3], "d")
+end)
+
+-- Errors carry the stream position and stop the decoder.
+suite:test("errors_report_position_and_stop", function()
+    local dec = json.decoder {depth = 1}
+    dec:feed("[1,\n2 ")
+    local ok, err = pcall(dec.feed, dec, "3]")
+    TestFramework.assert_false(ok, "structural error")
+    TestFramework.assert_true(err:find("expected ']' or ','", 1, true) ~= nil, err)
+    TestFramework.assert_true(err:find("line 2 col 3", 1, true) ~= nil, err)
+
+    local ok2, err2 = pcall(dec.feed, dec, "[]")
+    TestFramework.assert_false(ok2, "decoder stops after error")
+    TestFramework.assert_true(err2:find("previous error", 1, true) ~= nil, err2)
+end)
+
+-- An onvalue that raises fails that feed only; the next feed carries on
+-- with the values after the one that raised.
+suite:test("onvalue_error_keeps_decoder_usable", function()
+    local got = {}
+    local dec = json.decoder {
+        depth = 1,
+        onvalue = function(value)
+            if value == 2 then
+                error("reject 2")
+            end
+            got[#got + 1] = value
+        end
+    }
+    local ok, err = pcall(dec.feed, dec, "[1, 2, 3")
+    TestFramework.assert_false(ok, "onvalue error reaches feed")
+    TestFramework.assert_true(tostring(err):find("reject 2", 1, true) ~= nil, tostring(err))
+    dec:feed(", 4]")
+    dec:finish()
+    TestFramework.assert_equal(#got, 3, "values around the rejected one")
+    TestFramework.assert_true(got[1] == 1 and got[2] == 3 and got[3] == 4, "values in order")
+end)
+
+suite:test("value_truncation_and_depth_errors", function()
+    local ok, err = pcall(function()
+        local d = json.decoder()
+        d:feed('{"a": tru}\n')
+    end)
+    TestFramework.assert_false(ok, "value error")
+    TestFramework.assert_true(err:find("invalid literal 'tru'", 1, true) ~= nil, err)
+
+    ok, err = pcall(function()
+        local d = json.decoder()
+        d:feed('{"a": [1, 2')
+        d:finish()
+    end)
+    TestFramework.assert_false(ok, "truncated input")
+    TestFramework.assert_true(err:find("unexpected end of input", 1, true) ~= nil, err)
+
+    TestFramework.assert_false(pcall(json.decoder, {depth = 100}), "depth limit")
+end)
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
@@ -0,0 +1,148 @@
+#!/usr/bin/env lua
+
+-- Test json.encode_to(): encoding straight into an httpd chunked reply, a
+-- tcpd connection, a fan.stream or a function, in bounded chunks.
+
+local TestFramework = require('test_framework')
+
+local fan = require "fan"
+_G.fan = fan
+local httpd = require "fan.httpd.core"
+local http = require "fan.http.core"
+local tcpd = require "fan.tcpd"
+local stream = require "fan.stream.core"
+
+-- fan.so exports luaopen_json for builds without a separate json module.
+local has_json, json = pcall(require, "json")
+if not has_json then
+    local path = package.searchpath and package.searchpath("fan", package.cpath)
+    local open = path and package.loadlib(path, "luaopen_json")
+    if open then
+        package.preload["json"] = open
+        has_json, json = pcall(require, "json")
+    end
+end
+
+local suite = TestFramework.create_suite("JSON encode_to Tests")
+
+suite:test("module_available", function()
+    TestFramework.assert_true(has_json, "json module could not be loaded: " .. tostring(json))
+end)
+
+if not has_json then
+    local failures = TestFramework.run_suite(suite)
+    os.exit(failures > 0 and 1 or 0)
+end
+
+local rows = json.array()
+for i = 1, 5000 do
+    rows[i] = {id = i, name = "row " .. i, tags = json.array({"a", "b\n\"c\""}), score = i / 8}
+end
+local doc = {total = #rows, rows = rows}
+local EXPECTED = json.encode(doc)
+
+-- Function target: every chunk is within chunk_size and the pieces add up.
+suite:test("function_target", function()
+    local chunks, largest = {}, 0
+    local written = json.encode_to(function(chunk)
+        chunks[#chunks + 1] = chunk
+        largest = math.max(largest, #chunk)
+    end, doc, 4096)
+    TestFramework.assert_true(table.concat(chunks) == EXPECTED, "function output")
+    TestFramework.assert_equal(written, #EXPECTED, "function bytes")
+    TestFramework.assert_true(largest <= 4096, "chunk bound: " .. largest)
+    TestFramework.assert_true(#chunks > #EXPECTED / 4096, "several chunks: " .. #chunks)
+end)
+
+-- A single string longer than a chunk is split as well.
+suite:test("long_string_is_split", function()
+    local big = string.rep("x", 100000)
+    local chunks, largest = {}, 0
+    json.encode_to(function(chunk)
+        chunks[#chunks + 1] = chunk
+        largest = math.max(largest, #chunk)
+    end, json.array({big}), 1000)
+    TestFramework.assert_true(table.concat(chunks) == '["' .. big .. '"]', "long string")
+    TestFramework.assert_true(largest <= 1000, "long string bound: " .. largest)
+end)
+
+suite:test("stream_target", function()
+    local s = stream.new()
+    local written = json.encode_to(s, doc)
+    s:prepare_get()
+    TestFramework.assert_equal(written, #EXPECTED, "stream bytes")
+    TestFramework.assert_equal(s:available(), #EXPECTED, "stream available")
+    TestFramework.assert_true(s:GetBytes(s:available()) == EXPECTED, "stream content")
+end)
+
+-- Errors: bad target, writer errors, encode errors.
+suite:test("errors", function()
+    local ok, err = pcall(json.encode_to, {}, doc)
+    TestFramework.assert_false(ok, "bad target")
+    TestFramework.assert_true(err:find("expected httpd request", 1, true) ~= nil, err)
+
+    ok, err = pcall(json.encode_to, function() error("disk full") end, doc)
+    TestFramework.assert_false(ok, "writer error")
+    TestFramework.assert_true(err:find("disk full", 1, true) ~= nil, err)
+
+    TestFramework.assert_false(pcall(json.encode_to, function() end, {rows = {}}), "encode error")
+
+    ok, err = pcall(json.encode_to, function() end, doc, 1)
+    TestFramework.assert_false(ok, "chunk too small")
+    TestFramework.assert_true(err:find("chunk_size", 1, true) ~= nil, err)
+end)
+
+-- httpd request target: the reply goes out as chunks.
+suite:test("httpd_target", TestFramework.async_test(function()
+    local server = httpd.bind {
+        host = "127.0.0.1",
+        port = 0,
+        onService = function(req, resp)
+            resp:addheader("Content-Type", "application/json")
+            resp:reply_start(200, "OK")
+            json.encode_to(resp, doc)
+            resp:reply_end()
+        end
+    }
+    local resp = http.get(string.format("http://127.0.0.1:%d/", server.port))
+    TestFramework.assert_equal(resp.responseCode, 200, tostring(resp.error))
+    TestFramework.assert_true(resp.body == EXPECTED, "httpd body length " .. #(resp.body or ""))
+end))
+
+suite:test("tcpd_target", TestFramework.async_test(function()
+    local received = {}
+    local size = 0
+    local listener = tcpd.bind {
+        host = "127.0.0.1",
+        port = 0,
+        onaccept = function(apt)
+            apt:bind {
+                onread = function()
+                    json.encode_to(apt, doc)
+                end
+            }
+        end
+    }
+    local conn = tcpd.connect {
+        host = "127.0.0.1",
+        port = listener:localinfo().port,
+        onread = function(data)
+            received[#received + 1] = data
+            size = size + #data
+        end
+    }
+    conn:send("go")
+    for _ = 1, 100 do
+        if size >= #EXPECTED then
+            break
+        end
+        fan.sleep(0.05)
+    end
+    conn:close()
+    listener:close()
+
+    TestFramework.assert_true(table.concat(received) == EXPECTED, "tcpd content size " .. size)
+end))
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
@@ -0,0 +1,168 @@
+#!/usr/bin/env lua
+-- JSON Benchmark for the C json module
+-- Encodes and decodes payloads shaped like common API responses (an issue
+-- list, a GeoJSON feature collection, a chat log with escapes and non-ASCII
+-- text, a metrics dump of integers) and reports MB/s. Set
+-- JSON_BENCH_SECONDS for longer runs. The round-trip check runs with
+-- json.enable_roundtrip, since "%.14g" does not keep every coordinate.
+
+local TestFramework = require('test_framework')
+
+-- Prefer a standalone json module; fan.so also carries luaopen_json.
+local has_json, json = pcall(require, "json")
+if not has_json then
+    local path = package.searchpath and package.searchpath("fan", package.cpath)
+    local open = path and package.loadlib(path, "luaopen_json")
+    if open then
+        package.preload["json"] = open
+        has_json, json = pcall(require, "json")
+    end
+end
+
+local suite = TestFramework.create_suite("JSON benchmark")
+
+suite:test("module_available", function()
+    TestFramework.assert_true(has_json, "json module could not be loaded: " .. tostring(json))
+end)
+
+if not has_json then
+    local failures = TestFramework.run_suite(suite)
+    os.exit(failures > 0 and 1 or 0)
+end
+
+local SECONDS = tonumber(os.getenv("JSON_BENCH_SECONDS")) or 0.3
+
+-- Deterministic pseudo-random numbers so every run sees the same corpus.
+local seed = 42
+local function rand(n)
+    seed = (seed * 1103515245 + 12345) % 2147483648
+    return seed % n
+end
+
+local words = {"fix", "crash", "when", "loading", "config", "timeout", "in", "worker", "pool",
+    "add", "support", "for", "http2", "streams", "über", "naïve", "日本語", "emoji 🎉"}
+local function sentence(n)
+    local t = {}
+    for i = 1, n do
+        t[i] = words[rand(#words) + 1]
+    end
+    return table.concat(t, " ")
+end
+
+local function issues()
+    local list = json.array()
+    for i = 1, 200 do
+        list[i] = {
+            id = 100000000 + i * 37,
+            number = i,
+            title = sentence(6),
+            state = rand(2) == 0 and "open" or "closed",
+            locked = false,
+            comments = rand(50),
+            created_at = string.format("2024-%02d-%02dT%02d:%02d:%02dZ", rand(12) + 1, rand(28) + 1,
+                rand(24), rand(60), rand(60)),
+            user = {login = "user" .. rand(1000), id = rand(10000000), site_admin = false,
+                avatar_url = "https://avatars.example.com/u/" .. rand(10000000) .. "?v=4"},
+            labels = json.array({{name = "bug", color = "d73a4a"}, {name = "help wanted", color = "008672"}}),
+            body = sentence(40) .. "\n\n```lua\nlocal x = \"quoted\"\n```\n",
+        }
+    end
+    return list
+end
+
+local function geojson()
+    local features = json.array()
+    for i = 1, 300 do
+        local ring = json.array()
+        for k = 1, 20 do
+            ring[k] = json.array({-122.4194 + rand(100000) / 1e6, 37.7749 + rand(100000) / 1e6})
+        end
+        features[i] = {
+            type = "Feature",
+            properties = {name = "parcel " .. i, area = rand(1000000) / 100, height = rand(300) + 0.5},
+            geometry = {type = "Polygon", coordinates = json.array({ring})},
+        }
+    end
+    return {type = "FeatureCollection", features = features}
+end
+
+local function chat()
+    local messages = json.array()
+    for i = 1, 500 do
+        messages[i] = {
+            ts = 1700000000 + i * 13,
+            from = "user" .. rand(40),
+            text = sentence(15) .. "\t\"reply\"\\n" .. string.char(1) .. " path C:\\tmp\\" .. i,
+            reactions = json.array({"+1", "eyes"}),
+        }
+    end
+    return {channel = "general", messages = messages}
+end
+
+local function metrics()
+    local series = json.array()
+    for i = 1, 400 do
+        local points = json.array()
+        for k = 1, 30 do
+            points[k] = json.array({1700000000 + k * 60, rand(1000000)})
+        end
+        series[i] = {metric = "requests_total", host = "web" .. (i % 16), points = points}
+    end
+    return {series = series}
+end
+
+local corpus = {
+    {"issues", issues()},
+    {"geojson", geojson()},
+    {"chat", chat()},
+    {"metrics", metrics()},
+}
+
+local function same(a, b)
+    if type(a) ~= "table" or type(b) ~= "table" then
+        return a == b
+    end
+    for k, v in pairs(a) do
+        if not same(v, b[k]) then
+            return false
+        end
+    end
+    for k in pairs(b) do
+        if a[k] == nil then
+            return false
+        end
+    end
+    return true
+end
+
+local function rate(fn, bytes)
+    local count = 0
+    local start = os.clock()
+    local elapsed = 0
+    repeat
+        fn()
+        count = count + 1
+        elapsed = os.clock() - start
+    until elapsed >= SECONDS
+    return bytes * count / elapsed / 1e6
+end
+
+print(string.format("%-10s %10s %14s %14s", "payload", "bytes", "encode (MB/s)", "decode (MB/s)"))
+
+for _, entry in ipairs(corpus) do
+    local name, value = entry[1], entry[2]
+    suite:test(name, function()
+        json.enable_roundtrip(true)
+        local survived = same(json.decode(json.encode(value)), value)
+        json.enable_roundtrip(false)
+        TestFramework.assert_true(survived, name .. " does not survive a round trip")
+
+        local text = json.encode(value)
+        local enc = rate(function() json.encode(value) end, #text)
+        local dec = rate(function() json.decode(text) end, #text)
+        print(string.format("%-10s %10d %14.1f %14.1f", name, #text, enc, dec))
+    end)
+end
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
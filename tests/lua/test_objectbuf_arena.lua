@@ -0,0 +1,182 @@
+#!/usr/bin/env lua
+
+-- Test the arena behind objectbuf.encode: output is byte-identical to the
+-- encoder it replaced, steady-state encoding allocates nothing on the Lua
+-- side but the result string, output still round trips (shared and cyclic
+-- tables, symbols), an encode that raises does not leave the arena busy,
+-- and an encode run from a __gc metamethod in the middle of another encode
+-- does not corrupt either.
+
+local TestFramework = require('test_framework')
+
+local objectbuf = require "fan.objectbuf"
+
+local suite = TestFramework.create_suite("objectbuf encode arena Tests")
+
+local function same(a, b, seen)
+    if type(a) ~= "table" or type(b) ~= "table" then
+        return a == b
+    end
+    seen = seen or {}
+    if seen[a] then
+        return seen[a] == b
+    end
+    seen[a] = b
+    for k, v in pairs(a) do
+        if not same(v, b[k], seen) then
+            return false
+        end
+    end
+    for k in pairs(b) do
+        if a[k] == nil then
+            return false
+        end
+    end
+    return true
+end
+
+local function hex(s)
+    return (s:gsub(".", function(c)
+        return string.format("%02x", c:byte())
+    end))
+end
+
+-- Bytes produced by the encoder before the arena. Arrays and single-key
+-- tables only, so the output does not depend on the hash order of the
+-- Lua version.
+local shared = {"s"}
+local GOLDEN = {
+    {"u30 boundaries", {0, 1, 127, 128, 16383, 16384, 2097151, 2097152, 268435455, 268435456, 4294967295},
+        "4815010002037f04800105ff7f0680800107ffff7f088080800109ffffff7f0a80808080010bffffffff0f010c0b040307090b0d0f11131517"},
+    {"number boundaries", {4294967296, -1, 0.5, -0.5, 1e300},
+        "c805000000000000f041000000000000f0bf000000000000e03f000000000000e0bf9c7500883ce4377e0501020304050106050304050607"},
+    {"negative zero", {0, -0.0, 1}, "480401000203010403040403"},
+    {"strings", {"", "a", "a", string.rep("x", 200)},
+        "68040102030403000161c801" .. string.rep("78", 200) .. "01050407080809"},
+    {"booleans", {true, false, true}, "4803010203010403020102"},
+    {"shared tables", {shared, shared, {shared}}, "6803010203010173030403080809020106020108"},
+    {"hash key", {k = {1, "k"}}, "6802010201016b020300050703020305"},
+    {"string", "text", "20010474657874"},
+    {"u30", 12345, "4001b960"},
+    {"number", -0.5, "8001000000000000e0bf"},
+}
+
+suite:test("golden_bytes", function()
+    for _, case in ipairs(GOLDEN) do
+        TestFramework.assert_equal(hex(objectbuf.encode(case[2])), case[3], case[1])
+    end
+end)
+
+suite:test("golden_bytes_with_symbols", function()
+    local sym = objectbuf.symbol({"GET", "POST", 200, 404, 1.5})
+    local obj = {"GET", 200, 1.5, "other", 7, "POST", 404}
+    local data = objectbuf.encode(obj, sym)
+    TestFramework.assert_equal(hex(data), "e80002070601056f74686572010807030b050f0d040c")
+    TestFramework.assert_true(same(obj, objectbuf.decode(data, sym)), "symbol round trip")
+end)
+
+local rows = {}
+for i = 1, 200 do
+    rows[i] = {id = i, name = "row " .. i, tags = {"a", "b"}, score = i / 8, big = 2 ^ 40 + i, neg = -i}
+end
+local loop = {name = "loop", list = {shared, shared}}
+loop.self = loop
+
+-- Round trips, including shared and cyclic tables and symbols.
+suite:test("round_trips", function()
+    for i, obj in ipairs({rows, loop, {1, 2.5, -3, "x", true, false}, "text", 12345, -0.5}) do
+        TestFramework.assert_true(same(obj, objectbuf.decode(objectbuf.encode(obj))), "round trip " .. i)
+    end
+    local out = objectbuf.decode(objectbuf.encode(loop))
+    TestFramework.assert_true(out.self == out, "cycle kept")
+    TestFramework.assert_true(out.list[1] == out.list[2], "shared table kept")
+    local sym = objectbuf.symbol(rows)
+    TestFramework.assert_true(same(rows, objectbuf.decode(objectbuf.encode(rows, sym), sym)), "symbol round trip")
+end)
+
+-- Bytes allocated per encode once the arena is warm.
+local function allocated_per_call(obj)
+    objectbuf.encode(obj)
+    collectgarbage()
+    collectgarbage("stop")
+    local before = collectgarbage("count")
+    local loops = 200
+    for _ = 1, loops do
+        objectbuf.encode(obj)
+    end
+    local per_call = (collectgarbage("count") - before) * 1024 / loops
+    collectgarbage("restart")
+    return per_call
+end
+
+-- Only the result strings are allocated once the arena is warm.
+suite:test("steady_state_allocations", function()
+    for _, case in ipairs({{"small", {"123", "echo", 42, true}}, {"rows", rows}}) do
+        local size = #objectbuf.encode(case[2])
+        local per_call = allocated_per_call(case[2])
+        TestFramework.assert_true(per_call <= size + 64,
+            string.format("%s: %.0f bytes/call, result %d", case[1], per_call, size))
+    end
+end)
+
+-- An encode that raises part way gives the arena back: later encodes
+-- still reuse it instead of allocating a fresh one each call.
+suite:test("error_releases_arena", function()
+    local deep = {}
+    local t = deep
+    for _ = 1, 1500 do
+        t.next = {}
+        t = t.next
+    end
+    for _ = 1, 3 do
+        local ok, err = pcall(objectbuf.encode, deep)
+        TestFramework.assert_false(ok, "deep table encoded")
+        TestFramework.assert_true(tostring(err):find("nested too deep", 1, true) ~= nil, tostring(err))
+    end
+
+    local msg = {"123", "echo", 42, true}
+    local per_call = allocated_per_call(msg)
+    local size = #objectbuf.encode(msg)
+    TestFramework.assert_true(per_call <= size + 64,
+        string.format("arena left busy: %.0f bytes/call, result %d", per_call, size))
+    TestFramework.assert_true(same(msg, objectbuf.decode(objectbuf.encode(msg))), "round trip after error")
+end)
+
+-- Encodes from finalizers while other encodes are running.
+suite:test("reentrant_encode", function()
+    collectgarbage("setpause", 10)
+    collectgarbage("setstepmul", 1000)
+    local bad = 0
+    local inner = {"inner", {1, 2, 3}, x = 1.5}
+    local inner_data = objectbuf.encode(inner)
+    local mt = {
+        __gc = function()
+            if objectbuf.encode(inner) ~= inner_data then
+                bad = bad + 1
+            end
+        end
+    }
+    -- the GC settings are restored even if an encode raises.
+    local ok, err = pcall(function()
+        for n = 1, 300, 10 do
+            for _ = 1, 20 do
+                setmetatable({}, mt)
+            end
+            local obj = {}
+            for i = 1, n do
+                obj[i] = {i, "v" .. i, {n = i}}
+            end
+            if not same(obj, objectbuf.decode(objectbuf.encode(obj))) then
+                bad = bad + 1
+            end
+        end
+        collectgarbage()
+    end)
+    collectgarbage("setpause", 200)
+    collectgarbage("setstepmul", 200)
+    TestFramework.assert_true(ok, tostring(err))
+    TestFramework.assert_equal(bad, 0, "corrupted encodes")
+end)
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
@@ -0,0 +1,44 @@
+#!/usr/bin/env lua
+-- objectbuf Benchmark
+-- Encodes a worker-call sized message and a 200-row result set and reports
+-- calls per second. Set OBJECTBUF_BENCH_LOOPS for longer runs.
+
+local TestFramework = require('test_framework')
+
+local utils = require "fan.utils"
+local objectbuf = require "fan.objectbuf"
+
+local LOOPS = tonumber(os.getenv("OBJECTBUF_BENCH_LOOPS")) or 100000
+
+local suite = TestFramework.create_suite("objectbuf benchmark")
+
+local function bench(name, obj, loops)
+    local data = objectbuf.encode(obj)
+    local start = utils.gettime()
+    for _ = 1, loops do
+        objectbuf.encode(obj)
+    end
+    local enc = utils.gettime() - start
+    start = utils.gettime()
+    for _ = 1, loops do
+        objectbuf.decode(data)
+    end
+    local dec = utils.gettime() - start
+    print(string.format("%-10s %6d bytes  encode %9.0f/s  decode %9.0f/s", name, #data, loops / enc, loops / dec))
+end
+
+suite:test("message", function()
+    local msg = {key = "1234", name = "render", id = 42, ok = true, pos = {x = 10.25, y = -3.5}, args = {"page", 7}}
+    bench("message", msg, LOOPS)
+end)
+
+suite:test("rows", function()
+    local rows = {}
+    for i = 1, 200 do
+        rows[i] = {id = i, name = "row " .. i, tags = {"a", "b"}, score = i / 8, big = 2 ^ 40 + i, neg = -i}
+    end
+    bench("200 rows", rows, math.max(1, math.floor(LOOPS / 1000)))
+end)
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
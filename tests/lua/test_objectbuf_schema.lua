@@ -0,0 +1,202 @@
+#!/usr/bin/env lua
+
+-- Test objectbuf.schema(): fixed-shape messages round trip, unknown keys and
+-- mistyped values fall back to the generic format, malformed input is
+-- rejected, and throughput against objectbuf.encode/decode and cjson.
+
+local TestFramework = require('test_framework')
+
+local utils = require "fan.utils"
+local objectbuf = require "fan.objectbuf"
+
+local suite = TestFramework.create_suite("objectbuf.schema Tests")
+
+local function same(a, b)
+    if type(a) ~= "table" or type(b) ~= "table" then
+        return a == b and math.type(a) == math.type(b)
+    end
+    for k, v in pairs(a) do
+        if not same(v, b[k]) then
+            return false
+        end
+    end
+    for k in pairs(b) do
+        if a[k] == nil then
+            return false
+        end
+    end
+    return true
+end
+
+local point = objectbuf.schema {
+    {"x", "number"},
+    {"y", "number"},
+}
+
+local task = objectbuf.schema {
+    {1, "string"},
+    {2, "string"},
+    {"id", "integer"},
+    {"ok", "boolean"},
+    {"pos", point},
+    {"args", "any"},
+}
+
+-- Round trip, including absent fields and integer edge values.
+suite:test("round_trip", function()
+    for i, msg in ipairs({
+        {"17", "echo", id = 5, ok = true, pos = {x = 1.5, y = -2.25}, args = {1, "a", {b = false}}},
+        {"18", "echo"},
+        {id = -1, ok = false},
+        {id = math.maxinteger},
+        {id = math.mininteger, pos = {}},
+    }) do
+        local data = task:encode(msg)
+        local out, err = task:decode(data)
+        TestFramework.assert_true(same(msg, out), "round trip " .. i .. ": " .. tostring(err))
+    end
+end)
+
+-- Unknown keys and values of another type travel in the generic part.
+suite:test("fallback_fields", function()
+    local msg = {"1", "f", id = 2.5, ok = "yes", pos = 7, extra = {deep = {1, 2}}, [10] = "ten"}
+    local out = task:decode(task:encode(msg))
+    TestFramework.assert_true(same(msg, out), "fallback fields")
+end)
+
+-- Cyclic "any" values are left to the generic format, which keeps the cycle.
+suite:test("cyclic_any", function()
+    local loop = {name = "loop"}
+    loop.self = loop
+    local out = task:decode(task:encode({args = loop}))
+    TestFramework.assert_not_nil(out)
+    TestFramework.assert_true(out.args.self == out.args, "cycle kept")
+    TestFramework.assert_equal(out.args.name, "loop")
+end)
+
+-- Schema messages are smaller than the generic format for fixed shapes.
+suite:test("compact", function()
+    local msg = {"123", "add", id = 1000, ok = true, pos = {x = 1, y = 2}}
+    local small, generic = #task:encode(msg), #objectbuf.encode(msg)
+    TestFramework.assert_true(small < generic, small .. " vs " .. generic)
+end)
+
+-- Malformed schemas and input.
+suite:test("malformed_schemas_and_input", function()
+    local ok, err = pcall(objectbuf.schema, {{"a", "float"}})
+    TestFramework.assert_false(ok, "unknown type")
+    TestFramework.assert_true(err:find("unknown type", 1, true) ~= nil, err)
+    ok, err = pcall(objectbuf.schema, {{"a", "string"}, {"a", "integer"}})
+    TestFramework.assert_false(ok, "duplicate key")
+    TestFramework.assert_true(err:find("duplicate key", 1, true) ~= nil, err)
+    TestFramework.assert_false(pcall(objectbuf.schema, {}), "empty schema")
+
+    local data = task:encode({"1", "f", id = 3})
+    local out, msg = task:decode(data:sub(1, -2))
+    TestFramework.assert_nil(out, "truncated")
+    TestFramework.assert_not_nil(msg)
+    out, msg = task:decode(data .. "x")
+    TestFramework.assert_nil(out, "trailing bytes")
+    TestFramework.assert_not_nil(msg)
+    out, msg = task:decode(objectbuf.encode({"1", "f"}))
+    TestFramework.assert_nil(out, "generic data")
+    TestFramework.assert_not_nil(msg)
+    TestFramework.assert_nil(point:decode(data), "wrong schema")
+
+    local nested = objectbuf.schema {{"pos", "any"}}
+    local chain = objectbuf.schema {{"next", nested}}
+    TestFramework.assert_equal(chain:decode(chain:encode({next = {pos = 1}})).next.pos, 1, "nested schema kept")
+end)
+
+-- Corrupt generic data inside a message is reported, never raised.
+suite:test("corrupt_generic_value", function()
+    local loop = {name = "loop", list = {1, 2, 3, "x"}}
+    loop.self = loop
+    local data = task:encode({"1", "f", args = loop})
+    local raised = 0
+    for p = 2, #data do
+        for v = 0, 255 do
+            local corrupt = data:sub(1, p - 1) .. string.char(v) .. data:sub(p + 1)
+            local ok, out, err = pcall(task.decode, task, corrupt)
+            if not ok then
+                raised = raised + 1
+            elseif out == nil then
+                TestFramework.assert_type(err, "string", "error message")
+            end
+        end
+    end
+    TestFramework.assert_equal(raised, 0, "decode raised")
+end)
+
+-- An encode that raises part way frees its buffer (watch under ASan) and
+-- leaves the schema usable.
+suite:test("encode_error_midway", function()
+    local schema = objectbuf.schema {{"v", "integer"}}
+    local msg = {v = 1}
+    for _ = 1, 40 do
+        schema = objectbuf.schema {{"v", "integer"}, {"next", schema}}
+        msg = {v = 1, next = msg}
+    end
+    for _ = 1, 1000 do
+        local ok, err = pcall(schema.encode, schema, msg)
+        TestFramework.assert_false(ok, "encode past the depth limit")
+        TestFramework.assert_true(err:find("nesting too deep", 1, true) ~= nil, err)
+    end
+    TestFramework.assert_equal(schema:decode(schema:encode({v = 7})).v, 7, "encode after errors")
+end)
+
+-- Throughput on a worker-call sized message.
+local json
+do
+    local ok, mod = pcall(require, "cjson")
+    if ok then
+        json = mod
+    else
+        local path = package.searchpath and package.searchpath("fan", package.cpath)
+        local open = path and package.loadlib(path, "luaopen_json")
+        json = open and open()
+    end
+end
+
+local LOOPS = tonumber(os.getenv("SCHEMA_BENCH_LOOPS") or 200000)
+-- hash keys only, so cjson can encode it too.
+local call = objectbuf.schema {
+    {"key", "string"},
+    {"name", "string"},
+    {"id", "integer"},
+    {"ok", "boolean"},
+    {"pos", point},
+    {"args", "any"},
+}
+local msg = {key = "1234", name = "render", id = 42, ok = true, pos = {x = 10.25, y = -3.5}, args = {"page", 7}}
+local function bench(name, encode, decode)
+    local data = encode(msg)
+    local start = utils.gettime()
+    for _ = 1, LOOPS do
+        encode(msg)
+    end
+    local enc = utils.gettime() - start
+    start = utils.gettime()
+    for _ = 1, LOOPS do
+        decode(data)
+    end
+    local dec = utils.gettime() - start
+    print(string.format("%-10s %4d bytes  encode %8.0f/s  decode %8.0f/s", name, #data, LOOPS / enc, LOOPS / dec))
+    return enc, dec
+end
+
+suite:test("faster_than_generic", function()
+    local schema_enc, schema_dec = bench("schema", function(v) return call:encode(v) end,
+        function(d) return call:decode(d) end)
+    local generic_enc, generic_dec = bench("objectbuf", objectbuf.encode, objectbuf.decode)
+    if json then
+        bench("cjson", json.encode, json.decode)
+    end
+    TestFramework.assert_true(schema_enc < generic_enc,
+        string.format("encode slower than generic: %.3fs vs %.3fs", schema_enc, generic_enc))
+    TestFramework.assert_true(schema_dec < generic_dec,
+        string.format("decode slower than generic: %.3fs vs %.3fs", schema_dec, generic_dec))
+end)
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
@@ -324,6 +324,62 @@ suite:test("moretosend_fresh", function()
     TestFramework.assert_false(t:_moretosend())
 end)
 
+-- Test: send_batch counts only the datagrams the socket took and puts the
+-- rest back at the head of the chain, in order
+suite:test("send_batch_requeues_unsent", function()
+    local config = require('config')
+    config.udp_send_total = config.udp_send_total or 0
+
+    local apt = { conn = { send_req = function() end } }
+    reliable_udp.init_conn(apt)
+    apt._WAITING_COUNT = 100
+    for i = 1, 5 do
+        apt:send("msg" .. i)
+    end
+    local pop = function()
+        local package = apt._output_chain:pop()
+        if package then
+            apt.output_chain_count = apt.output_chain_count - 1
+        end
+        return package
+    end
+
+    local batches, rebinds = {}, 0
+    local conn = {
+        result = { 2 },
+        send_batch = function(self, bufs)
+            batches[#batches + 1] = bufs
+            return table.unpack(self.result)
+        end,
+        rebind = function()
+            rebinds = rebinds + 1
+        end
+    }
+
+    -- socket buffer full after two datagrams
+    TestFramework.assert_equal(2, reliable_udp.send_batch(conn, pop))
+    TestFramework.assert_equal(2, apt.udp_send_total)
+    TestFramework.assert_equal(2, apt._output_wait_count)
+    TestFramework.assert_equal(3, apt.output_chain_count)
+
+    -- a bad argument: nothing counted, no rebind
+    conn.result = { nil, "bad argument" }
+    TestFramework.assert_equal(0, reliable_udp.send_batch(conn, pop))
+    TestFramework.assert_equal(0, rebinds)
+    TestFramework.assert_equal(2, apt.udp_send_total)
+    TestFramework.assert_equal(batches[1][3], batches[2][1], "unsent datagrams go first")
+    TestFramework.assert_equal(batches[1][5], batches[2][3])
+
+    -- a socket error rebinds
+    for i = 1, 2 do
+        apt:send("more" .. i)
+    end
+    conn.result = { nil, "Network is unreachable", 101 }
+    TestFramework.assert_equal(0, reliable_udp.send_batch(conn, pop))
+    TestFramework.assert_equal(1, rebinds)
+    TestFramework.assert_equal(2, apt.udp_send_total)
+end)
+
 -- Run
 local failures = TestFramework.run_suite(suite)
 os.exit(failures > 0 and 1 or 0)
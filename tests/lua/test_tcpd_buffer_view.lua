@@ -0,0 +1,107 @@
+#!/usr/bin/env lua
+
+-- Test zero-copy buffer_view read mode in fan.tcpd
+-- Verifies that onread receives a view over the input evbuffer and that
+-- unconsumed bytes are kept for the next onread.
+
+local TestFramework = require('test_framework')
+
+local fan = require "fan"
+_G.fan = fan
+local tcpd = require "fan.tcpd"
+
+local suite = TestFramework.create_suite("TCPD buffer_view Tests")
+
+suite:test("view_readline_peek_search_read_across_reads", TestFramework.async_test(function()
+    local lines = {}
+    local header = nil
+    local body = nil
+    local view_type = nil
+    local peeked = nil
+    local found = nil
+    local accepted = nil  -- keep the accept connection reachable
+
+    local server = tcpd.bind {
+        host = "127.0.0.1",
+        port = 0,
+        buffer_view = true,
+        callback_self_first = true,
+        onaccept = function(_, apt)
+            accepted = apt
+            apt:bind {
+                onread = function(conn, view)
+                    view_type = view_type or type(view)
+                    if type(view) ~= "userdata" then
+                        return
+                    end
+
+                    -- Two text lines, then a 4-byte length-prefixed body.
+                    while #lines < 2 do
+                        local line = view:readline()
+                        if not line then
+                            return
+                        end
+                        table.insert(lines, line)
+                    end
+
+                    if not header then
+                        if view:length() < 4 then
+                            return
+                        end
+                        peeked = view:peek(4)
+                        found = view:search("hel")
+                        header = tonumber(view:read(4))
+                    end
+
+                    if body then
+                        return
+                    end
+                    body = view:read(header)
+                    if body then
+                        conn:send("ok:" .. #view)
+                    end
+                end
+            }
+        end
+    }
+    TestFramework.assert_not_nil(server, "tcpd.bind returned nil")
+
+    local port = server:localinfo().port
+    local reply = nil
+
+    local c = tcpd.connect {
+        host = "127.0.0.1",
+        port = port,
+        callback_self_first = true,
+        onconnected = function(conn)
+            conn:send("first\r\nsec")
+            fan.sleep(0.05)
+            conn:send("ond\n0005hel")
+            fan.sleep(0.05)
+            conn:send("lo!")
+        end,
+        onread = function(conn, buf)
+            reply = buf
+            conn:close()
+        end
+    }
+
+    local waited = 0
+    while not reply and waited < 3 do
+        fan.sleep(0.1)
+        waited = waited + 0.1
+    end
+
+    server:close()
+
+    TestFramework.assert_equal(view_type, "userdata", "onread should receive a buffer view")
+    TestFramework.assert_equal(lines[1], "first")
+    TestFramework.assert_equal(lines[2], "second")
+    TestFramework.assert_equal(peeked, "0005", "peek must not consume")
+    TestFramework.assert_equal(found, 5, "search offset")
+    TestFramework.assert_equal(body, "hello")
+    TestFramework.assert_equal(reply, "ok:1", "leftover byte must stay buffered")
+end))
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
@@ -0,0 +1,140 @@
+#!/usr/bin/env lua
+
+-- Test SO_REUSEPORT accept sharding in fan.tcpd
+-- Opens one listener per worker with tcpd.bind{reuseport_shards=N}, both
+-- delivering to the main state and to per-worker shards (shard=true).
+
+local TestFramework = require('test_framework')
+
+local fan = require "fan"
+_G.fan = fan
+local tcpd = require "fan.tcpd"
+local shard = require "fan.shard"
+
+local SHARD_SCRIPT = [[
+local shard = require "fan.shard"
+local id = ...
+
+shard.onaccept(function(apt)
+    apt:bind {
+        onread = function(buf)
+            apt:send(string.format("shard%d:%s", id, buf))
+        end
+    }
+end)
+
+shard.send(0, "ready")
+]]
+
+local script_path = os.tmpname()
+local f = assert(io.open(script_path, "w"))
+f:write(SHARD_SCRIPT)
+f:close()
+
+local function wait_for(cond, timeout)
+    local waited = 0
+    while not cond() and waited < timeout do
+        fan.sleep(0.05)
+        waited = waited + 0.05
+    end
+    return cond()
+end
+
+-- Connect `n` clients to `port`, send "hi<i>" on each and collect replies.
+local function roundtrip(port, n)
+    local replies = {}
+    local clients = {}
+    for i = 1, n do
+        clients[i] = tcpd.connect {
+            host = "127.0.0.1",
+            port = port,
+            onconnected = function()
+                clients[i]:send("hi" .. i)
+            end,
+            onread = function(buf)
+                replies[i] = buf
+            end
+        }
+    end
+
+    wait_for(function()
+        for i = 1, n do
+            if not replies[i] then
+                return false
+            end
+        end
+        return true
+    end, 3)
+
+    for i = 1, n do
+        clients[i]:close()
+    end
+    return replies
+end
+
+local suite = TestFramework.create_suite("TCPD reuseport_shards Tests")
+
+suite:set_teardown(function()
+    os.remove(script_path)
+end)
+
+-- Accepts on the workers, onaccept in the main state.
+suite:test("reuseport_onaccept_in_main_state", TestFramework.async_test(function()
+    local accepted = {}
+    local server = tcpd.bind {
+        host = "127.0.0.1",
+        port = 0,
+        reuseport_shards = 2,
+        onaccept = function(apt)
+            table.insert(accepted, apt)
+            apt:bind {
+                onread = function(buf)
+                    apt:send("main:" .. buf)
+                end
+            }
+        end
+    }
+    TestFramework.assert_not_nil(server, "tcpd.bind returned nil")
+
+    local port = server:localinfo() and server:localinfo().port
+    TestFramework.assert_true(port and port > 0, "reuseport server has no port")
+
+    local replies = roundtrip(port, 1)
+    server:close()
+    TestFramework.assert_equal(replies[1], "main:hi1")
+end))
+
+-- Accepts and connections both stay on the workers' shards.
+suite:test("reuseport_accepts_on_shards", TestFramework.async_test(function()
+    -- Shards are process-wide; reuse them if another suite already started
+    -- them (their onaccept answers in the same "shard<id>:" format).
+    if shard.count() == 0 then
+        local ready = 0
+        shard.onmessage(function(from, data)
+            if data == "ready" then
+                ready = ready + 1
+            end
+        end)
+
+        shard.start {script = script_path, workers = 2}
+        TestFramework.assert_true(wait_for(function() return ready == 2 end, 3),
+            "shards did not report ready")
+    end
+
+    local sharded = tcpd.bind {
+        host = "127.0.0.1",
+        port = 0,
+        reuseport_shards = 2,
+        shard = true
+    }
+    local replies = roundtrip(sharded:localinfo().port, 8)
+    sharded:close()
+
+    for i = 1, 8 do
+        local payload = tostring(replies[i]):match("^shard%d+:(.*)$")
+        TestFramework.assert_equal(payload, "hi" .. i, "shard reply " .. i .. ": " .. tostring(replies[i]))
+    end
+end))
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
@@ -0,0 +1,108 @@
+#!/usr/bin/env lua
+
+-- Test batched UDP receive (onread_batch) in fan.udpd
+-- Verifies that datagrams queued between wakeups arrive together in one
+-- callback and that repeat senders reuse the same dest object.
+
+local TestFramework = require('test_framework')
+
+local fan = require "fan"
+_G.fan = fan
+local udpd = require "fan.udpd"
+
+local TOTAL = 20
+
+local suite = TestFramework.create_suite("UDPD onread_batch Tests")
+
+-- Collect everything sent by `client` into `server`'s onread_batch.
+local function batch_server(batch_size)
+    local state = {received = {}, batches = 0, largest = 0, same_dest = true, mismatch = false}
+    state.server = udpd.new {
+        bind_host = "127.0.0.1",
+        bind_port = 0,
+        batch_size = batch_size,
+        callback_self_first = true,
+        onread_batch = function(self, packets, dests)
+            state.batches = state.batches + 1
+            if #packets ~= #dests then
+                state.mismatch = true
+            end
+            state.largest = math.max(state.largest, #packets)
+            for i = 1, #packets do
+                table.insert(state.received, packets[i])
+                state.first_dest = state.first_dest or dests[i]
+                if not rawequal(state.first_dest, dests[i]) then
+                    state.same_dest = false
+                end
+            end
+        end
+    }
+    return state
+end
+
+local function wait_received(state, n)
+    local waited = 0
+    while #state.received < n and waited < 3 do
+        fan.sleep(0.05)
+        waited = waited + 0.05
+    end
+end
+
+suite:test("batched_delivery_with_interned_dests", TestFramework.async_test(function()
+    local state = batch_server(8)
+    local client = udpd.new {
+        host = "127.0.0.1",
+        port = state.server:getPort()
+    }
+
+    -- Queue everything before yielding so the server sees a backlog.
+    for i = 1, TOTAL do
+        client:send("pkt" .. i)
+    end
+    wait_received(state, TOTAL)
+
+    local client_port = client:getPort()
+    client:close()
+    state.server:close()
+
+    TestFramework.assert_false(state.mismatch, "packets/dests length mismatch")
+    TestFramework.assert_equal(#state.received, TOTAL, "datagrams received")
+    TestFramework.assert_equal(state.received[1], "pkt1")
+    TestFramework.assert_equal(state.received[TOTAL], "pkt" .. TOTAL)
+    TestFramework.assert_true(state.largest >= 2 and state.largest <= 8,
+        "unexpected batch size: " .. state.largest)
+    TestFramework.assert_true(state.same_dest, "repeat sender did not reuse its dest object")
+    TestFramework.assert_equal(state.first_dest:getPort(), client_port, "dest port mismatch")
+end))
+
+-- Receive slots are shared per event loop thread; connections with
+-- different batch sizes must still each get their own datagrams.
+suite:test("connections_share_receive_slots", TestFramework.async_test(function()
+    local small = batch_server(2)
+    local large = batch_server(16)
+    local to_small = udpd.new {host = "127.0.0.1", port = small.server:getPort()}
+    local to_large = udpd.new {host = "127.0.0.1", port = large.server:getPort()}
+
+    for i = 1, TOTAL do
+        to_small:send("s" .. i)
+        to_large:send("l" .. i)
+    end
+    wait_received(small, TOTAL)
+    wait_received(large, TOTAL)
+
+    to_small:close()
+    to_large:close()
+    small.server:close()
+    large.server:close()
+
+    TestFramework.assert_equal(#small.received, TOTAL)
+    TestFramework.assert_equal(#large.received, TOTAL)
+    TestFramework.assert_true(small.largest <= 2, "batch_size=2 exceeded: " .. small.largest)
+    for i = 1, TOTAL do
+        TestFramework.assert_equal(small.received[i], "s" .. i)
+        TestFramework.assert_equal(large.received[i], "l" .. i)
+    end
+end))
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
@@ -0,0 +1,128 @@
+#!/usr/bin/env lua
+
+-- Test batched UDP send (send_batch / send_gso) in fan.udpd
+-- Verifies that one call emits one datagram per buffer, to per-datagram
+-- destinations, and that send_gso splits a buffer at segment boundaries.
+
+local TestFramework = require('test_framework')
+
+local fan = require "fan"
+_G.fan = fan
+local udpd = require "fan.udpd"
+
+local suite = TestFramework.create_suite("UDPD send_batch/send_gso Tests")
+
+local function wait_for(cond, timeout)
+    local waited = 0
+    while not cond() and waited < timeout do
+        fan.sleep(0.05)
+        waited = waited + 0.05
+    end
+    return cond()
+end
+
+local function new_server(received)
+    return udpd.new {
+        bind_host = "127.0.0.1",
+        bind_port = 0,
+        onread = function(buf)
+            table.insert(received, buf)
+        end
+    }
+end
+
+suite:test("send_batch_default_and_per_datagram_dests", TestFramework.async_test(function()
+    local a_received, b_received = {}, {}
+    local server_a = new_server(a_received)
+    local server_b = new_server(b_received)
+
+    local client = udpd.new {
+        host = "127.0.0.1",
+        port = server_a:getPort()
+    }
+
+    -- Default destination for every datagram.
+    local sent, err = client:send_batch {"one", "two", "three"}
+    TestFramework.assert_equal(sent, 3, "send_batch: " .. tostring(err))
+
+    -- Per-datagram destinations, with a hole falling back to the default.
+    local dest_b = udpd.make_dest("127.0.0.1", server_b:getPort())
+    sent, err = client:send_batch({"b1", "a4", "b2"}, {dest_b, nil, dest_b})
+    TestFramework.assert_equal(sent, 3, "send_batch with dests: " .. tostring(err))
+
+    wait_for(function() return #a_received >= 4 and #b_received >= 2 end, 3)
+
+    client:close()
+    server_a:close()
+    server_b:close()
+
+    table.sort(a_received)
+    TestFramework.assert_equal(table.concat(a_received, ","), "a4,one,three,two")
+    TestFramework.assert_equal(b_received[1], "b1")
+    TestFramework.assert_equal(b_received[2], "b2")
+end))
+
+suite:test("send_batch_rejects_bad_buffers", TestFramework.async_test(function()
+    local received = {}
+    local server = new_server(received)
+    local client = udpd.new {
+        host = "127.0.0.1",
+        port = server:getPort()
+    }
+
+    local sent, err = client:send_batch({string.rep("x", 70000)})
+    TestFramework.assert_nil(sent, "oversized datagram should be rejected")
+    TestFramework.assert_not_nil(err)
+
+    -- Numbers are not converted: the converted string would be unanchored.
+    sent, err = client:send_batch({"ok", 42})
+    TestFramework.assert_nil(sent, "non-string element should be rejected")
+    TestFramework.assert_match(err, "array of strings")
+
+    -- A bad dests argument raises before anything is allocated.
+    local ok
+    ok, err = pcall(client.send_batch, client, {"ok"}, "x")
+    TestFramework.assert_false(ok, "string dests should raise")
+    TestFramework.assert_match(tostring(err), "dest")
+
+    collectgarbage("collect")
+    fan.sleep(0.1)
+
+    client:close()
+    server:close()
+
+    TestFramework.assert_equal(#received, 0, "nothing should be sent for a rejected batch")
+end))
+
+suite:test("send_gso_splits_at_segment_boundaries", TestFramework.async_test(function()
+    local received = {}
+    local server = new_server(received)
+    local client = udpd.new {
+        host = "127.0.0.1",
+        port = server:getPort()
+    }
+
+    -- 10 segments of 100 bytes plus a 50 byte tail.
+    local payload = {}
+    for i = 0, 10 do
+        table.insert(payload, string.rep(string.char(65 + i), i < 10 and 100 or 50))
+    end
+    payload = table.concat(payload)
+
+    local sent, err = client:send_gso(payload, 100)
+    TestFramework.assert_equal(sent, #payload, "send_gso: " .. tostring(err))
+
+    wait_for(function() return #received >= 11 end, 3)
+
+    client:close()
+    server:close()
+
+    TestFramework.assert_equal(#received, 11, "send_gso segment count")
+    TestFramework.assert_equal(#received[1], 100)
+    TestFramework.assert_equal(#received[11], 50)
+    TestFramework.assert_equal(table.concat(received), payload,
+        "send_gso segments do not reassemble the payload")
+end))
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
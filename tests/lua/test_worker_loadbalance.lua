@@ -0,0 +1,183 @@
+#!/usr/bin/env lua
+
+-- Test fan.worker's load balancer: the three policies, waiting for a free
+-- slot, dead slaves, latency weighting, and dispatch cost against slave count.
+
+local TestFramework = require('test_framework')
+
+local fan = require "fan"
+_G.fan = fan
+local utils = require "fan.utils"
+local loadbalance = require "fan.worker.loadbalance"
+
+local suite = TestFramework.create_suite("fan.worker load balancer Tests")
+
+local function new_balancer(policy, slavecount, max_job_count)
+    local lb = loadbalance.new(max_job_count, policy)
+    local slaves = {}
+    for i = 1, slavecount do
+        slaves[i] = {id = i, jobcount = 0}
+        lb:add(slaves[i])
+    end
+    return lb, slaves
+end
+
+-- Every policy fills all slots, never overloads a slave, then makes callers wait.
+for _, policy in ipairs({"least", "roundrobin", "p2c"}) do
+    suite:test(policy .. "_slots_waiters_and_dead_slaves", function()
+        local lb, slaves = new_balancer(policy, 4, 2)
+        for _ = 1, 8 do
+            lb:findbest()
+        end
+        for i = 1, 4 do
+            TestFramework.assert_equal(slaves[i].jobcount, 2, policy .. " fills slots")
+        end
+
+        local got
+        local co = coroutine.create(function()
+            got = lb:findbest()
+        end)
+        coroutine.resume(co)
+        TestFramework.assert_nil(got, policy .. " waits when full")
+        TestFramework.assert_equal(coroutine.status(co), "suspended")
+        lb:telldone(slaves[3])
+        TestFramework.assert_true(got == slaves[3], policy .. " wakes waiter")
+        TestFramework.assert_equal(slaves[3].jobcount, 2)
+
+        -- A dead slave is never picked again, even once its slots free up.
+        lb:remove(slaves[1])
+        lb:telldone(slaves[1])
+        lb:telldone(slaves[1])
+        lb:telldone(slaves[2])
+        TestFramework.assert_true(lb:findbest() == slaves[2], policy .. " skips dead slave")
+        TestFramework.assert_nil(lb:_take(), policy .. " no free slot left")
+    end)
+end
+
+-- Round robin visits the slaves in turn.
+suite:test("roundrobin_order", function()
+    local lb = new_balancer("roundrobin", 3, 4)
+    local order = {}
+    for i = 1, 6 do
+        order[i] = lb:findbest().id
+    end
+    TestFramework.assert_equal(table.concat(order, ","), "1,2,3,1,2,3")
+end)
+
+-- Least loaded with equal latency keeps the job counts within one of each other.
+suite:test("least_spreads_evenly", function()
+    local lb, slaves = new_balancer("least", 5, 100)
+    for _ = 1, 23 do
+        lb:findbest()
+    end
+    lb:telldone(slaves[2])
+    lb:telldone(slaves[2])
+    TestFramework.assert_true(lb:findbest() == slaves[2], "least refills idle slave")
+    local low, high = math.huge, 0
+    for _, s in ipairs(slaves) do
+        low = math.min(low, s.jobcount)
+        high = math.max(high, s.jobcount)
+    end
+    TestFramework.assert_true(high - low <= 1, "least spreads evenly: " .. low .. ".." .. high)
+end)
+
+-- A slave answering 10x slower gets far fewer of the tasks.
+for _, policy in ipairs({"least", "p2c"}) do
+    suite:test(policy .. "_favours_fast_slaves", TestFramework.async_test(function()
+        local lb, slaves = new_balancer(policy, 3, 8)
+        local delay = {0.02, 0.002, 0.002}
+        local served = {0, 0, 0}
+        local key = 0
+        local running = 0
+        for _ = 1, 12 do
+            running = running + 1
+            coroutine.wrap(function()
+                for _ = 1, 40 do
+                    local slave = lb:findbest()
+                    key = key + 1
+                    local task_key = tostring(key)
+                    lb:sent(slave, task_key)
+                    fan.sleep(delay[slave.id])
+                    served[slave.id] = served[slave.id] + 1
+                    lb:telldone(slave, task_key)
+                end
+                running = running - 1
+            end)()
+        end
+        while running > 0 do
+            fan.sleep(0.01)
+        end
+        TestFramework.assert_true(served[1] * 3 < served[2] and served[1] * 3 < served[3],
+            policy .. " favours fast slaves: " .. table.concat(served, ","))
+    end))
+end
+
+-- Dispatch cost: each slave kept half busy, one dispatch and one completion
+-- per task. The per-task cost should not grow with the slave count.
+local TASKS = tonumber(os.getenv("LB_BENCH_TASKS") or 1000000)
+
+local function bench(policy, slavecount, tasks)
+    local lb = new_balancer(policy, slavecount, 8)
+    local inflight, keys, head, tail = {}, {}, 1, 0
+    for _ = 1, slavecount * 4 do
+        tail = tail + 1
+        inflight[tail] = lb:findbest()
+        keys[tail] = false
+    end
+    local start = utils.gettime()
+    for i = 1, tasks do
+        local slave = lb:findbest()
+        lb:sent(slave, i)
+        tail = tail + 1
+        inflight[tail], keys[tail] = slave, i
+
+        lb:telldone(inflight[head], keys[head] or nil)
+        inflight[head], keys[head] = nil, nil
+        head = head + 1
+    end
+    return (utils.gettime() - start) / tasks * 1e9
+end
+
+local function bench_sort(slavecount, tasks)
+    -- the table.sort per dispatch this balancer replaced
+    local slaves = {}
+    for i = 1, slavecount do
+        slaves[i] = {jobcount = 0, max_job_count = 8}
+    end
+    local function compare(a, b)
+        return a.max_job_count - a.jobcount > b.max_job_count - b.jobcount
+    end
+    local queue, head, tail = {}, 1, 0
+    local start = utils.gettime()
+    for i = 1, tasks do
+        table.sort(slaves, compare)
+        local slave = slaves[1]
+        slave.jobcount = slave.jobcount + 1
+        tail = tail + 1
+        queue[tail] = slave
+        if tail - head >= slavecount * 4 then
+            queue[head].jobcount = queue[head].jobcount - 1
+            queue[head] = nil
+            head = head + 1
+        end
+    end
+    return (utils.gettime() - start) / tasks * 1e9
+end
+
+for _, policy in ipairs({"least", "roundrobin", "p2c"}) do
+    suite:test(policy .. "_dispatch_flat_in_slave_count", function()
+        local small = bench(policy, 4, TASKS / 4)
+        local large = bench(policy, 64, TASKS)
+        print(string.format("%-10s 4 slaves: %6.0f ns/task   64 slaves: %6.0f ns/task", policy, small, large))
+        TestFramework.assert_true(large < small * 3,
+            string.format("%s dispatch grows with slave count: %.0f vs %.0f", policy, large, small))
+    end)
+end
+
+suite:test("table_sort_baseline", function()
+    print(string.format("table.sort 4 slaves: %6.0f ns/task   64 slaves: %6.0f ns/task",
+        bench_sort(4, TASKS / 20), bench_sort(64, TASKS / 20)))
+end)
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
@@ -0,0 +1,156 @@
+#!/usr/bin/env lua
+
+-- Test master:map() of fan.worker: results come back in list order, errors
+-- stay per call, and batching beats one message per call for tiny tasks.
+
+local TestFramework = require('test_framework')
+
+package.preload['config'] = function()
+    return {
+        worker_using_cjson = false,
+    }
+end
+
+local fan = require "fan"
+_G.fan = fan
+local utils = require "fan.utils"
+local worker = require "fan.worker"
+
+local suite = TestFramework.create_suite("fan.worker map Tests")
+
+local master_pid = fan.getpid()
+
+local worker_ok, commander = pcall(worker.new, {
+    add = function(a, b)
+        return a + b, fan.getpid()
+    end,
+    fail = function(x)
+        if x % 3 == 0 then
+            error("bad " .. x)
+        end
+        return x
+    end
+}, 2, 4)
+
+-- A slave gets here once its loop ends: os.exit only raises under
+-- run_all_lua_tests.lua, so end the process before it reaches the runner.
+if fan.getpid() ~= master_pid then
+    fan.kill(fan.getpid(), 9)
+end
+
+suite:set_teardown(function()
+    if worker_ok then
+        commander:terminate()
+    end
+end)
+
+-- Order is kept across batches that finish on different slaves.
+suite:test("results_in_list_order", TestFramework.async_test(function()
+    TestFramework.assert_true(worker_ok, "worker.new failed: " .. tostring(commander))
+    commander.wait_all_slaves()
+
+    local list = {}
+    for i = 1, 1000 do
+        list[i] = {i, i * 10}
+    end
+    local results = commander:map("add", list, {batch_size = 37})
+    TestFramework.assert_equal(#results, 1000, "result count")
+    local pids = {}
+    for i = 1, 1000 do
+        local r = results[i]
+        TestFramework.assert_true(r and r[1] == true and r[2] == i * 11, "result order " .. i)
+        pids[r[3]] = true
+    end
+    local slaves_used = 0
+    for _ in pairs(pids) do
+        slaves_used = slaves_used + 1
+    end
+    TestFramework.assert_equal(slaves_used, 2, "spread over slaves")
+end))
+
+-- An error fails only its own call.
+suite:test("call_errors_stay_per_call", TestFramework.async_test(function()
+    TestFramework.assert_true(worker_ok, "worker.new failed: " .. tostring(commander))
+    local results = commander:map("fail", {{1}, {3}, {4}})
+    TestFramework.assert_equal(results[1][1], true, "ok call")
+    TestFramework.assert_equal(results[1][2], 1)
+    TestFramework.assert_equal(results[2][1], false, "failed call")
+    TestFramework.assert_true(tostring(results[2][2]):find("bad 3", 1, true) ~= nil, tostring(results[2][2]))
+    TestFramework.assert_equal(results[3][1], true, "call after failure")
+    TestFramework.assert_equal(results[3][2], 4)
+
+    TestFramework.assert_equal(#commander:map("add", {}), 0, "empty list")
+    local ok, err = pcall(commander.map, commander, "missing", {{1}})
+    TestFramework.assert_false(ok, "unknown function")
+    TestFramework.assert_true(tostring(err):find("unknown worker function", 1, true) ~= nil, tostring(err))
+end))
+
+-- batch_size must be a whole number of calls.
+suite:test("bad_batch_size_raises", TestFramework.async_test(function()
+    TestFramework.assert_true(worker_ok, "worker.new failed: " .. tostring(commander))
+    for _, batch_size in ipairs({0, -1, 1.5, "2"}) do
+        local ok, err = pcall(commander.map, commander, "add", {{1, 2}}, {batch_size = batch_size})
+        TestFramework.assert_false(ok, "batch_size " .. tostring(batch_size))
+        TestFramework.assert_true(tostring(err):find("batch_size", 1, true) ~= nil, tostring(err))
+    end
+    TestFramework.assert_equal(commander:map("add", {{1, 2}, {3, 4}}, {batch_size = 1})[2][2], 7, "batch_size 1")
+end))
+
+-- A batch that cannot be sent (larger than the ring) fails every call in
+-- it; the other batches still complete and map returns.
+suite:test("batch_error_fails_its_range", TestFramework.async_test(function()
+    TestFramework.assert_true(worker_ok, "worker.new failed: " .. tostring(commander))
+    local huge = string.rep("x", 5 * 1024 * 1024)
+    local results = commander:map("add", {{1, 1}, {2, 2}, {huge, 3}, {4, 4}, {5, 5}, {6, 6}}, {batch_size = 2})
+    TestFramework.assert_equal(#results, 6, "result count")
+    TestFramework.assert_equal(results[1][2], 2)
+    TestFramework.assert_equal(results[2][2], 4)
+    for i = 3, 4 do
+        TestFramework.assert_equal(results[i][1], false, "call " .. i .. " in the failed batch")
+        TestFramework.assert_true(tostring(results[i][2]):find("exceeds ring capacity", 1, true) ~= nil,
+            tostring(results[i][2]))
+    end
+    TestFramework.assert_equal(results[5][2], 10)
+    TestFramework.assert_equal(results[6][2], 12)
+
+    -- The failed batch gave its slot back.
+    results = commander:map("add", {{7, 7}})
+    TestFramework.assert_equal(results[1][2], 14, "map after a failed batch")
+end))
+
+-- Tiny tasks: one call per message against the default batching.
+suite:test("map_beats_single_calls", TestFramework.async_test(function()
+    TestFramework.assert_true(worker_ok, "worker.new failed: " .. tostring(commander))
+    local N = 20000
+    local list = {}
+    for i = 1, N do
+        list[i] = {i, 1}
+    end
+    local start = utils.gettime()
+    local running = 0
+    for c = 1, 20 do
+        running = running + 1
+        coroutine.wrap(function()
+            for i = c, N, 20 do
+                commander:add(i, 1)
+            end
+            running = running - 1
+        end)()
+    end
+    while running > 0 do
+        fan.sleep(0.01)
+    end
+    local single = utils.gettime() - start
+
+    start = utils.gettime()
+    local results = commander:map("add", list)
+    local batched = utils.gettime() - start
+    TestFramework.assert_equal(#results, N, "batched results")
+    TestFramework.assert_equal(results[N][2], N + 1)
+    print(string.format("%d tiny calls: %.0f calls/s one by one, %.0f calls/s with map",
+        N, N / single, N / batched))
+    TestFramework.assert_true(batched < single, string.format("map is slower: %.3fs vs %.3fs", batched, single))
+end))
+
+local failures = TestFramework.run_suite(suite)
+os.exit(failures > 0 and 1 or 0)
@@ -0,0 +1,209 @@
+#!/usr/bin/env lua
+
+-- Test fan.shmring and the shared-memory transport of fan.worker
+-- Covers full/oversized sends, messages wrapping around a small ring between
+-- two processes, worker calls through the rings, oversized results, a dead
+-- consumer and slave death reporting.
+
+local TestFramework = require('test_framework')
+
+package.preload['config'] = function()
+    return {
+        worker_using_cjson = false,
+    }
+end
+
+local fan = require "fan"
+_G.fan = fan
+local utils = require "fan.utils"
+local shmring = require "fan.shmring"
+local worker = require "fan.worker"
+
+local suite = TestFramework.create_suite("fan.shmring transport Tests")
+
+local master_pid = fan.getpid()
+
+-- Forked children stop here. run_all_lua_tests.lua turns os.exit into an
+-- error, which would carry a child back into the runner's next test file.
+local function exit_child()
+    if fan.getpid() ~= master_pid then
+        fan.kill(fan.getpid(), 9)
+    end
+end
+
+-- Single process: capacity, full ring, oversized message.
+suite:test("ring_limits", function()
+    local ring = shmring.new(4096)
+    TestFramework.assert_equal(ring:capacity(), 4092, "capacity")
+    local sent = 0
+    while ring:send(string.rep("x", 1000)) do
+        sent = sent + 1
+    end
+    TestFramework.assert_equal(sent, 4, "full ring")
+    local ok, err = pcall(ring.send, ring, string.rep("x", 5000))
+    TestFramework.assert_false(ok, "oversized message")
+    TestFramework.assert_true(tostring(err):find("exceeds ring capacity", 1, true) ~= nil, tostring(err))
+    ring:close()
+    local r, e = ring:send("x")
+    TestFramework.assert_nil(r, "send after close")
+    TestFramework.assert_equal(e, "ring closed.")
+end)
+
+-- Fork the worker slaves and the echo peer before the event loop starts.
+local worker_ok, commander = pcall(worker.new, {
+    echo = function(...)
+        return ...
+    end,
+    slow = function()
+        fan.sleep(30)
+        return true
+    end,
+    big = function(n)
+        return string.rep("z", n)
+    end
+}, 2, 4)
+exit_child()
+
+local down, up = shmring.new(8192), shmring.new(8192)
+local pid = fan.fork()
+if pid == 0 then
+    fan.loop(function()
+        down:bind {
+            onread = function(msg)
+                while not up:send(msg:reverse()) do
+                    fan.sleep(0.001)
+                end
+            end,
+            ondisconnected = function()
+                fan.loopbreak()
+            end
+        }
+    end)
+    pcall(os.exit, 0)
+    exit_child()
+end
+
+-- 2000 messages of up to 3KB through 8KB rings: wraps and fills both ways.
+suite:test("messages_wrap_between_processes", TestFramework.async_test(function()
+    local got = {}
+    up:bind {
+        onread = function(msg)
+            got[#got + 1] = msg
+        end
+    }
+    local expected = {}
+    for i = 1, 2000 do
+        local msg = string.rep(string.char(65 + i % 26), (i * 37) % 3000) .. i
+        expected[i] = msg:reverse()
+        while not down:send(msg) do
+            fan.sleep(0.001)
+        end
+    end
+    for _ = 1, 500 do
+        if #got >= #expected then
+            break
+        end
+        fan.sleep(0.01)
+    end
+    down:close()
+
+    TestFramework.assert_equal(#got, #expected, "echo count")
+    -- Each message runs in its own coroutine on the peer, so replies that
+    -- waited for room may overtake each other.
+    table.sort(got)
+    table.sort(expected)
+    for i = 1, #expected do
+        TestFramework.assert_true(got[i] == expected[i], "echo content " .. i)
+    end
+end))
+
+-- Worker calls go through the rings.
+suite:test("worker_calls_through_rings", TestFramework.async_test(function()
+    TestFramework.assert_true(worker_ok, "worker.new failed: " .. tostring(commander))
+    commander.wait_all_slaves()
+    TestFramework.assert_equal(#commander.slaves, 2, "slaves attached")
+    local done, bad, running = 0, 0, 0
+    local start = utils.gettime()
+    for c = 1, 20 do
+        running = running + 1
+        coroutine.wrap(function()
+            for i = 1, 500 do
+                local st, a, b = commander:echo(c, string.rep("y", i % 64))
+                if st and a == c and b == string.rep("y", i % 64) then
+                    done = done + 1
+                else
+                    bad = bad + 1
+                end
+            end
+            running = running - 1
+        end)()
+    end
+    while running > 0 do
+        fan.sleep(0.01)
+    end
+    local elapsed = utils.gettime() - start
+    print(string.format("worker echo: %d calls in %.3fs (%.0f calls/s)", done, elapsed, done / elapsed))
+    TestFramework.assert_equal(done, 10000, "worker calls")
+    TestFramework.assert_equal(bad, 0, "failed worker calls")
+end))
+
+-- Results larger than the ring come back as an error and free the slot.
+suite:test("results_exceed_ring", TestFramework.async_test(function()
+    TestFramework.assert_true(worker_ok, "worker.new failed: " .. tostring(commander))
+    for _ = 1, 10 do
+        local st, err = commander:big(5 * 1024 * 1024)
+        TestFramework.assert_false(st, "oversized results")
+        TestFramework.assert_true(tostring(err):find("exceed ring capacity", 1, true) ~= nil, tostring(err))
+    end
+    local st, data = commander:big(1000)
+    TestFramework.assert_true(st, "call after oversized results")
+    TestFramework.assert_equal(data, string.rep("z", 1000))
+    for _, slave in ipairs(commander.slaves) do
+        TestFramework.assert_equal(slave.jobcount, 0, "slots freed")
+    end
+end))
+
+-- A send to a ring whose consumer has exited reports it instead of
+-- returning false forever.
+suite:test("send_to_dead_consumer", TestFramework.async_test(function()
+    local ring = shmring.new(4096)
+    local child = fan.fork()
+    if child == 0 then
+        fan.kill(fan.getpid(), 9)
+    end
+    fan.sleep(0.1)
+    local ok, err
+    for _ = 1, 10 do
+        ok, err = ring:send(string.rep("x", 1000))
+        if ok == nil then
+            break
+        end
+    end
+    TestFramework.assert_nil(ok, "send to dead consumer")
+    TestFramework.assert_equal(err, "peer closed.")
+    ring:close()
+end))
+
+-- A call in flight on a slave that dies reports the death.
+suite:test("slave_death_reported", TestFramework.async_test(function()
+    TestFramework.assert_true(worker_ok, "worker.new failed: " .. tostring(commander))
+    local result
+    coroutine.wrap(function()
+        result = {commander:slow()}
+    end)()
+    fan.sleep(0.2)
+    commander:terminate()
+    for _ = 1, 300 do
+        if result then
+            break
+        end
+        fan.sleep(0.01)
+    end
+    TestFramework.assert_not_nil(result, "in-flight call never returned")
+    TestFramework.assert_false(result[1])
+    TestFramework.assert_equal(result[2], "slave dead.")
+end))
+
+local failures = TestFramework.run_suite(suite)
+fan.kill(pid)
+os.exit(failures > 0 and 1 or 0)